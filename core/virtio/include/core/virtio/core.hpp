@@ -32,9 +32,11 @@ inline constexpr arch::scalar_register<uint32_t> PCI_DEVICE_FEATURE_SELECT(0);
 inline constexpr arch::scalar_register<uint32_t> PCI_DEVICE_FEATURE_WINDOW(4);
 inline constexpr arch::scalar_register<uint32_t> PCI_DRIVER_FEATURE_SELECT(8);
 inline constexpr arch::scalar_register<uint32_t> PCI_DRIVER_FEATURE_WINDOW(12);
+inline constexpr arch::scalar_register<uint16_t> PCI_CONFIG_MSIX_VECTOR(16);
 inline constexpr arch::scalar_register<uint8_t> PCI_DEVICE_STATUS(20);
 inline constexpr arch::scalar_register<uint16_t> PCI_QUEUE_SELECT(22);
 inline constexpr arch::scalar_register<uint16_t> PCI_QUEUE_SIZE(24);
+inline constexpr arch::scalar_register<uint16_t> PCI_QUEUE_MSIX_VECTOR(26);
 inline constexpr arch::scalar_register<uint16_t> PCI_QUEUE_ENABLE(28);
 inline constexpr arch::scalar_register<uint16_t> PCI_QUEUE_NOTIFY(30);
 inline constexpr arch::scalar_register<uint32_t> PCI_QUEUE_TABLE[] = {
@@ -53,6 +55,11 @@ enum {
 	PCI_L_DEVICE_SPECIFIC = 20
 };
 
+enum {
+	// Value of the MSI-X vector registers that disables the interrupt.
+	NO_VECTOR = 0xFFFF
+};
+
 // bits of the device status register
 enum {
 	ACKNOWLEDGE = 1,
@@ -62,10 +69,16 @@ enum {
 	DEVICE_NEEDS_RESET = 64
 };
 
+// device-independent feature bits
+enum {
+	VIRTIO_F_INDIRECT_DESC = 28
+};
+
 enum {
 	// Bits of the spec::Descriptor::flags field.
 	VIRTQ_DESC_F_NEXT = 1, // descriptor is part of a chain
 	VIRTQ_DESC_F_WRITE = 2, // buffer is written by device
+	VIRTQ_DESC_F_INDIRECT = 4, // buffer contains a table of descriptors
 
 	// Bits of the spec::UsedRing::flags field.
 	VIRTQ_USED_F_NO_NOTIFY = 1 // no need to notify the device
@@ -157,6 +170,10 @@ struct Transport {
 
 	virtual void claimQueues(unsigned int max_index) = 0;
 
+	// Returns the number of virtqs that can be serviced by individual interrupts.
+	// Drivers may use this as a hint to determine how many virtqs to set up.
+	virtual unsigned int numQueueInterrupts() = 0;
+
 	virtual Queue *setupQueue(unsigned int index) = 0;
 
 	virtual void runDevice() = 0;
@@ -227,11 +244,19 @@ struct Handle {
 
 	// setupBuffer() assumes that the buffer is contiguous in physical memory.
 	// Use scatterGather() for a more convenient API.
+	// If the view carries a physical address (i.e., it was allocated from a dma_pool),
+	// no syscall is necessary.
 	void setupBuffer(HostToDeviceType, arch::dma_buffer_view view);
 	void setupBuffer(DeviceToHostType, arch::dma_buffer_view view);
 
 	void setupLink(Handle other);
 
+	// Makes this descriptor refer to an indirect table of descriptors.
+	// The table must be contiguous in physical memory and its descriptors
+	// must be linked via their next fields (starting at index zero).
+	// Requires VIRTIO_F_INDIRECT_DESC.
+	void setupIndirect(arch::dma_buffer_view table);
+
 private:
 	Queue *_queue;
 	size_t _tableIndex;
@@ -272,6 +297,10 @@ private:
 	Handle _back;
 };
 
+// Splits a buffer into physically contiguous segments.
+// Requires at most one syscall (and none for memory from a dma_pool).
+std::vector<arch::dma_buffer_view> splitPhysical(arch::dma_buffer_view view);
+
 // Helper functions that obtain descriptor from a queue as needed.
 async::result<void> scatterGather(HostToDeviceType, Chain &chain, Queue *queue,
 		arch::dma_buffer_view view);
@@ -280,6 +309,10 @@ async::result<void> scatterGather(DeviceToHostType, Chain &chain, Queue *queue,
 
 struct Request {
 	void (*complete)(Request *);
+
+	// Number of bytes that the device wrote to the request's buffers.
+	// Set before complete() is called.
+	size_t bytesWritten = 0;
 };
 
 // Represents a single virtq.
@@ -93,6 +93,7 @@ struct LegacyPciTransport : Transport {
 	void finalizeFeatures() override;
 
 	void claimQueues(unsigned int max_index) override;
+	unsigned int numQueueInterrupts() override;
 	Queue *setupQueue(unsigned int index) override;
 
 	void runDevice() override;
@@ -159,6 +160,12 @@ void LegacyPciTransport::claimQueues(unsigned int max_index) {
 	_queues.resize(max_index);
 }
 
+unsigned int LegacyPciTransport::numQueueInterrupts() {
+	// We do not support MSI-X for the legacy transport
+	// (as it changes the layout of the legacy configuration space).
+	return 1;
+}
+
 Queue *LegacyPciTransport::setupQueue(unsigned int queue_index) {
 	assert(queue_index < _queues.size());
 	assert(!_queues[queue_index]);
@@ -274,7 +281,8 @@ struct StandardPciTransport : Transport {
 	StandardPciTransport(protocols::hw::Device hw_device,
 			Mapping common_mapping, Mapping notify_mapping,
 			Mapping isr_mapping, Mapping device_mapping,
-			unsigned int notify_multiplier, helix::UniqueDescriptor irq);
+			unsigned int notify_multiplier, helix::UniqueDescriptor irq,
+			std::vector<helix::UniqueDescriptor> msis);
 
 	protocols::hw::Device &hwDevice() override {
 		return _hwDevice;
@@ -289,6 +297,7 @@ struct StandardPciTransport : Transport {
 	void finalizeFeatures() override;
 
 	void claimQueues(unsigned int max_index) override;
+	unsigned int numQueueInterrupts() override;
 	Queue *setupQueue(unsigned int index) override;
 
 	void runDevice() override;
@@ -301,6 +310,15 @@ private:
 
 	async::detached _processIrqs();
 
+	// Services a single MSI-X vector.
+	// Vector zero is used for configuration changes, the others for virtqs.
+	async::detached _processMsi(unsigned int vector);
+
+	// Returns the MSI-X vector of a virtq.
+	unsigned int _queueVector(unsigned int queue_index) {
+		return 1 + queue_index % (_msis.size() - 1);
+	}
+
 	protocols::hw::Device _hwDevice;
 	Mapping _commonMapping;
 	Mapping _notifyMapping;
@@ -308,6 +326,8 @@ private:
 	Mapping _deviceMapping;
 	unsigned int _notifyMultiplier;
 	helix::UniqueDescriptor _irq;
+	// Either empty (use the INTx IRQ) or contains at least two MSI-X vectors.
+	std::vector<helix::UniqueDescriptor> _msis;
 
 	std::vector<std::unique_ptr<StandardPciQueue>> _queues;
 };
@@ -329,11 +349,14 @@ private:
 StandardPciTransport::StandardPciTransport(protocols::hw::Device hw_device,
 		Mapping common_mapping, Mapping notify_mapping,
 		Mapping isr_mapping, Mapping device_mapping,
-		unsigned int notify_multiplier, helix::UniqueDescriptor irq)
+		unsigned int notify_multiplier, helix::UniqueDescriptor irq,
+		std::vector<helix::UniqueDescriptor> msis)
 : _hwDevice{std::move(hw_device)},
 		_commonMapping{std::move(common_mapping)}, _notifyMapping{std::move(notify_mapping)},
 		_isrMapping{std::move(isr_mapping)}, _deviceMapping{std::move(device_mapping)},
-		_notifyMultiplier{notify_multiplier}, _irq{std::move(irq)} { }
+		_notifyMultiplier{notify_multiplier}, _irq{std::move(irq)}, _msis{std::move(msis)} {
+	assert(_msis.empty() || _msis.size() >= 2);
+}
 
 uint8_t StandardPciTransport::loadConfig8(size_t offset) {
 	return _deviceSpace().load(arch::scalar_register<uint8_t>(offset));
@@ -372,6 +395,12 @@ void StandardPciTransport::claimQueues(unsigned int max_index) {
 	_queues.resize(max_index);
 }
 
+unsigned int StandardPciTransport::numQueueInterrupts() {
+	if(_msis.empty())
+		return 1;
+	return _msis.size() - 1;
+}
+
 Queue *StandardPciTransport::setupQueue(unsigned int queue_index) {
 	assert(queue_index < _queues.size());
 	assert(!_queues[queue_index]);
@@ -381,6 +410,12 @@ Queue *StandardPciTransport::setupQueue(unsigned int queue_index) {
 	auto notify_index = _commonSpace().load(PCI_QUEUE_NOTIFY);
 	assert(queue_size);
 
+	if(!_msis.empty()) {
+		_commonSpace().store(PCI_QUEUE_MSIX_VECTOR, _queueVector(queue_index));
+		if(_commonSpace().load(PCI_QUEUE_MSIX_VECTOR) == NO_VECTOR)
+			throw std::runtime_error("Device failed to assign MSI-X vector to virtq");
+	}
+
 	// TODO: Ensure that the queue size is indeed a power of 2.
 
 	// Determine the queue size in bytes.
@@ -431,10 +466,21 @@ Queue *StandardPciTransport::setupQueue(unsigned int queue_index) {
 }
 
 void StandardPciTransport::runDevice() {
+	if(!_msis.empty()) {
+		_commonSpace().store(PCI_CONFIG_MSIX_VECTOR, 0);
+		if(_commonSpace().load(PCI_CONFIG_MSIX_VECTOR) == NO_VECTOR)
+			throw std::runtime_error("Device failed to assign MSI-X configuration vector");
+	}
+
 	// Finally set the DRIVER_OK bit to finish the configuration.
 	_commonSpace().store(PCI_DEVICE_STATUS, _commonSpace().load(PCI_DEVICE_STATUS) | DRIVER_OK);
 
-	_processIrqs();
+	if(_msis.empty()) {
+		_processIrqs();
+	}else{
+		for(unsigned int vector = 0; vector < _msis.size(); vector++)
+			_processMsi(vector);
+	}
 }
 
 async::detached StandardPciTransport::_processIrqs() {
@@ -514,6 +560,33 @@ async::detached StandardPciTransport::_processIrqs() {
 	}
 }
 
+async::detached StandardPciTransport::_processMsi(unsigned int vector) {
+	// MSI-X vectors are not shared; hence there is no need to read the ISR.
+	uint64_t sequence = 0;
+	while(true) {
+		helix::AwaitEvent await;
+		auto &&submit = helix::submitAwaitEvent(_msis[vector], &await, sequence,
+				helix::Dispatcher::global());
+		co_await submit.async_wait();
+		HEL_CHECK(await.error());
+		sequence = await.sequence();
+
+		if(!vector) {
+			std::cout << "core-virtio: Configuration change" << std::endl;
+			auto status = _commonSpace().load(PCI_DEVICE_STATUS);
+			assert(!(status & DEVICE_NEEDS_RESET));
+		}else{
+			for(auto &queue : _queues) {
+				if(!queue || _queueVector(queue->queueIndex()) != vector)
+					continue;
+				queue->processInterrupt();
+			}
+		}
+
+		HEL_CHECK(helAcknowledgeIrq(_msis[vector].getHandle(), kHelAckAcknowledge, sequence));
+	}
+}
+
 StandardPciQueue::StandardPciQueue(StandardPciTransport *transport,
 		unsigned int queue_index, size_t queue_size,
 		spec::Descriptor *table, spec::AvailableRing *available, spec::UsedRing *used,
@@ -531,6 +604,9 @@ void StandardPciQueue::notifyTransport() {
 // The discover() function.
 // --------------------------------------------------------
 
+// Upper bound on the number of MSI-X vectors that we allocate per device.
+static constexpr size_t maxMsiVectors = 17;
+
 async::result<std::unique_ptr<Transport>>
 discover(protocols::hw::Device hw_device, DiscoverMode mode) {
 	auto info = co_await hw_device.getPciInfo();
@@ -586,11 +662,35 @@ discover(protocols::hw::Device hw_device, DiscoverMode mode) {
 			common_space.store(PCI_DEVICE_STATUS,
 					common_space.load(PCI_DEVICE_STATUS) | DRIVER);
 
+			// Use MSI-X if the device supports at least one vector per virtq
+			// in addition to the configuration change vector.
+			std::vector<helix::UniqueDescriptor> msis;
+			for(size_t i = 0; i < info.caps.size(); i++) {
+				if(info.caps[i].type != 0x11)
+					continue;
+				auto control = co_await hw_device.loadPciCapability(i, 2, 2);
+				size_t num_vectors = std::min(size_t{(control & 0x7FF) + 1}, maxMsiVectors);
+				if(num_vectors < 2)
+					break;
+				for(size_t k = 0; k < num_vectors; k++) {
+					auto msi = co_await hw_device.accessMsi(k);
+					if(!msi) {
+						std::cout << "virtio: Failed to set up MSI-X vector " << k << std::endl;
+						msis.clear();
+						break;
+					}
+					msis.push_back(std::move(msi));
+				}
+				if(!msis.empty())
+					std::cout << "virtio: Using " << num_vectors << " MSI-X vectors" << std::endl;
+				break;
+			}
+
 			std::cout << "virtio: Using standard PCI transport" << std::endl;
 			co_return std::make_unique<StandardPciTransport>(std::move(hw_device),
 					std::move(*common_mapping), std::move(*notify_mapping),
 					std::move(*isr_mapping), std::move(*device_mapping),
-					notify_multiplier, std::move(irq));
+					notify_multiplier, std::move(irq), std::move(msis));
 		}
 	}
 
@@ -627,11 +727,22 @@ discover(protocols::hw::Device hw_device, DiscoverMode mode) {
 Handle::Handle(Queue *queue, size_t table_index)
 : _queue{queue}, _tableIndex{table_index} { }
 
+namespace {
+
+// Uses the physical address that the dma_pool recorded, if there is one.
+uintptr_t resolvePhysical(arch::dma_buffer_view view) {
+	auto physical = view.physical();
+	if(physical == arch::no_physical)
+		HEL_CHECK(helPointerPhysical(view.data(), &physical));
+	return physical;
+}
+
+} // anonymous namespace
+
 void Handle::setupBuffer(HostToDeviceType, arch::dma_buffer_view view) {
 	assert(view.size());
 
-	uintptr_t physical;
-	HEL_CHECK(helPointerPhysical(view.data(), &physical));
+	auto physical = resolvePhysical(view);
 	
 	auto descriptor = _queue->_table + _tableIndex;
 	descriptor->address.store(physical);
@@ -641,8 +752,7 @@ void Handle::setupBuffer(HostToDeviceType, arch::dma_buffer_view view) {
 void Handle::setupBuffer(DeviceToHostType, arch::dma_buffer_view view) {
 	assert(view.size());
 
-	uintptr_t physical;
-	HEL_CHECK(helPointerPhysical(view.data(), &physical));
+	auto physical = resolvePhysical(view);
 	
 	auto descriptor = _queue->_table + _tableIndex;
 	descriptor->address.store(physical);
@@ -650,35 +760,77 @@ void Handle::setupBuffer(DeviceToHostType, arch::dma_buffer_view view) {
 	descriptor->flags.store(descriptor->flags.load() | VIRTQ_DESC_F_WRITE);
 }
 
+void Handle::setupIndirect(arch::dma_buffer_view table) {
+	assert(table.size());
+	assert(!(table.size() % sizeof(spec::Descriptor)));
+
+	auto physical = resolvePhysical(table);
+
+	auto descriptor = _queue->_table + _tableIndex;
+	descriptor->address.store(physical);
+	descriptor->length.store(table.size());
+	descriptor->flags.store(VIRTQ_DESC_F_INDIRECT);
+}
+
 void Handle::setupLink(Handle other) {
 	auto descriptor = _queue->_table + _tableIndex;
 	descriptor->next.store(other._tableIndex);
 	descriptor->flags.store(descriptor->flags.load() | VIRTQ_DESC_F_NEXT);
 }
 
-async::result<void> scatterGather(HostToDeviceType, Chain &chain, Queue *queue,
-		arch::dma_buffer_view view) {
+std::vector<arch::dma_buffer_view> splitPhysical(arch::dma_buffer_view view) {
 	constexpr size_t page_size = 0x1000;
+	std::vector<arch::dma_buffer_view> segments;
+
+	// Memory from a dma_pool is physically contiguous.
+	if(view.physical() != arch::no_physical) {
+		segments.push_back(view);
+		return segments;
+	}
+
+	// Otherwise, resolve all pages using a single syscall.
+	auto address = reinterpret_cast<uintptr_t>(view.data());
+	auto num_pages = ((address & (page_size - 1)) + view.size() + (page_size - 1)) / page_size;
+	std::vector<uintptr_t> physicals(num_pages);
+	HEL_CHECK(helPointerPhysicalRange(view.data(), view.size(), physicals.data()));
+
 	size_t offset = 0;
-	while(offset < view.size()) {
-		auto address = reinterpret_cast<uintptr_t>(view.data()) + offset;
-		auto chunk = std::min(view.size() - offset, page_size - (address & (page_size - 1)));
-		chain.append(co_await queue->obtainDescriptor());
-		chain.setupBuffer(hostToDevice, view.subview(offset, chunk));
+	for(size_t i = 0; i < num_pages; i++) {
+		auto chunk = std::min(view.size() - offset,
+				page_size - ((address + offset) & (page_size - 1)));
+
+		// Merge pages that happen to be physically contiguous.
+		if(!segments.empty()) {
+			auto &last = segments.back();
+			if(last.physical() + last.size() == physicals[i]) {
+				last = arch::dma_buffer_view{nullptr, last.data(),
+						last.size() + chunk, last.physical()};
+				offset += chunk;
+				continue;
+			}
+		}
+
+		segments.push_back(arch::dma_buffer_view{nullptr, (char *)view.data() + offset,
+				chunk, physicals[i]});
 		offset += chunk;
 	}
+	assert(offset == view.size());
+	return segments;
+}
+
+async::result<void> scatterGather(HostToDeviceType, Chain &chain, Queue *queue,
+		arch::dma_buffer_view view) {
+	for(auto segment : splitPhysical(view)) {
+		chain.append(co_await queue->obtainDescriptor());
+		chain.setupBuffer(hostToDevice, segment);
+	}
 }
 
 async::result<void> scatterGather(DeviceToHostType, Chain &chain, Queue *queue,
 		arch::dma_buffer_view view) {
-	constexpr size_t page_size = 0x1000;
-	size_t offset = 0;
-	while(offset < view.size()) {
-		auto address = reinterpret_cast<uintptr_t>(view.data()) + offset;
-		auto chunk = std::min(view.size() - offset, page_size - (address & (page_size - 1)));
+	for(auto segment : splitPhysical(view)) {
 		chain.append(co_await queue->obtainDescriptor());
-		chain.setupBuffer(deviceToHost, view.subview(offset, chunk));
-		offset += chunk;
+		chain.setupBuffer(deviceToHost, segment);
 	}
 }
 
@@ -776,6 +928,7 @@ void Queue::processInterrupt() {
 		auto request = _activeRequests[table_index];
 		assert(request);
 		_activeRequests[table_index] = nullptr;
+		request->bytesWritten = _usedRing->elements[ring_index].written.load();
 
 		// Free all descriptors in the descriptor chain.
 		auto chain_index = table_index;
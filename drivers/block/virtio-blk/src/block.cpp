@@ -1,7 +1,11 @@
 
 #include <stdlib.h>
+#include <algorithm>
 #include <iostream>
 
+#include <hel.h>
+#include <hel-syscalls.h>
+
 #include "block.hpp"
 
 namespace block {
@@ -9,6 +13,9 @@ namespace virtio {
 
 static bool logInitiateRetire = false;
 
+// Run a sequential read benchmark before serving the device.
+static bool runBenchmark = false;
+
 // --------------------------------------------------------
 // UserRequest
 // --------------------------------------------------------
@@ -17,80 +24,39 @@ UserRequest::UserRequest(bool write_, uint64_t sector_, void *buffer_, size_t nu
 : write{write_}, sector{sector_}, buffer{buffer_}, numSectors{num_sectors_} { }
 
 // --------------------------------------------------------
-// Device
+// RequestQueue
 // --------------------------------------------------------
 
-Device::Device(std::unique_ptr<virtio_core::Transport> transport)
-: blockfs::BlockDevice{512}, _transport{std::move(transport)},
-		_requestQueue{nullptr} { }
-
-void Device::runDevice() {
-	_transport->finalizeFeatures();
-	_transport->claimQueues(1);
-	_requestQueue = _transport->setupQueue(0);
-
-	auto size = static_cast<uint64_t>(_transport->space().load(spec::regs::capacity[0]))
-			| (static_cast<uint64_t>(_transport->space().load(spec::regs::capacity[1])) << 32);
-	std::cout << "virtio: Disk size: " << size << " sectors" << std::endl;
-
-	_transport->runDevice();
-
-	// perform device specific setup
-	virtRequestBuffer = (VirtRequest *)malloc(_requestQueue->numDescriptors() * sizeof(VirtRequest));
-	statusBuffer = (uint8_t *)malloc(_requestQueue->numDescriptors());
-
-	// natural alignment makes sure that request headers do not cross page boundaries
-	assert((uintptr_t)virtRequestBuffer % sizeof(VirtRequest) == 0);
-	
-	// setup an interrupt for the device
-	_processRequests();
+RequestQueue::RequestQueue(Device *device, virtio_core::Queue *queue)
+: _device{device}, _queue{queue} {
+	// The pool records the physical addresses of these buffers, such that
+	// the descriptors can be written without asking the kernel.
+	_virtRequestBuffer = arch::dma_array<VirtRequest>{&_dmaPool, _queue->numDescriptors()};
+	_statusBuffer = arch::dma_array<uint8_t>{&_dmaPool, _queue->numDescriptors()};
 
-	blockfs::runDevice(this);
-}
-
-async::result<void> Device::readSectors(uint64_t sector,
-		void *buffer, size_t num_sectors) {
-	// Natural alignment makes sure a sector does not cross a page boundary.
-	assert(!((uintptr_t)buffer % 512));
-//	printf("readSectors(%lu, %lu)\n", sector, num_sectors);
-
-	// Limit to ensure that we don't monopolize the device.
-	auto max_sectors = _requestQueue->numDescriptors() / 4;
-	assert(max_sectors >= 1);
-
-	for(size_t progress = 0; progress < num_sectors; progress += max_sectors) {
-		auto request = new UserRequest(false, sector + progress,
-				(char *)buffer + 512 * progress,
-				std::min(num_sectors - progress, max_sectors));
-		_pendingQueue.push(request);
-		_pendingDoorbell.ring();
-		co_await request->promise.async_get();
-		delete request;
+	if(_device->_useIndirect) {
+		// Indirect tables need to be physically contiguous.
+		size_t tables_size = (_queue->numDescriptors() * indirectTableSize
+				* sizeof(virtio_core::spec::Descriptor) + 0xFFF) & ~size_t(0xFFF);
+		HelHandle memory;
+		void *window;
+		HEL_CHECK(helAllocateMemory(tables_size, kHelAllocContinuous, nullptr, &memory));
+		HEL_CHECK(helMapMemory(memory, kHelNullHandle, nullptr,
+				0, tables_size, kHelMapProtRead | kHelMapProtWrite, &window));
+		HEL_CHECK(helCloseDescriptor(memory));
+		_indirectTables = reinterpret_cast<virtio_core::spec::Descriptor *>(window);
+		HEL_CHECK(helPointerPhysical(_indirectTables, &_indirectTablesPhysical));
 	}
 }
 
-async::result<void> Device::writeSectors(uint64_t sector,
-		const void *buffer, size_t num_sectors) {
-	// Natural alignment makes sure a sector does not cross a page boundary.
-	assert(!((uintptr_t)buffer % 512));
-//	printf("writeSectors(%lu, %lu)\n", sector, num_sectors);
-
-	// Limit to ensure that we don't monopolize the device.
-	auto max_sectors = _requestQueue->numDescriptors() / 4;
-	assert(max_sectors >= 1);
-
-	for(size_t progress = 0; progress < num_sectors; progress += max_sectors) {
-		auto request = new UserRequest(true, sector + progress,
-				(char *)buffer + 512 * progress,
-				std::min(num_sectors - progress, max_sectors));
-		_pendingQueue.push(request);
-		_pendingDoorbell.ring();
-		co_await request->promise.async_get();
-		delete request;
-	}
+void RequestQueue::_computeSegments(UserRequest *request) {
+	// This resolves the physical addresses of the whole buffer in a single syscall.
+	_segments = virtio_core::splitPhysical(arch::dma_buffer_view{nullptr,
+			request->buffer, 512 * request->numSectors});
+	assert(_segments.size() <= _device->_maxSegments);
 }
 
-async::detached Device::_processRequests() {
+async::detached RequestQueue::processRequests() {
 	while(true) {
 		if(_pendingQueue.empty()) {
 			co_await _pendingDoorbell.async_wait();
@@ -99,14 +65,17 @@ async::detached Device::_processRequests() {
 
 		auto request = _pendingQueue.front();
 		_pendingQueue.pop();
-		assert(request->numSectors);
+		assert(request->flush || request->numSectors);
 
 		// Setup the descriptor for the request header.
 		virtio_core::Chain chain;
-		chain.append(co_await _requestQueue->obtainDescriptor());
+		chain.append(co_await _queue->obtainDescriptor());
 
-		VirtRequest *header = &virtRequestBuffer[chain.front().tableIndex()];
-		if(request->write) {
+		auto index = chain.front().tableIndex();
+		VirtRequest *header = &_virtRequestBuffer[index];
+		if(request->flush) {
+			header->type = VIRTIO_BLK_T_FLUSH;
+		}else if(request->write) {
 			header->type = VIRTIO_BLK_T_OUT;
 		}else{
 			header->type = VIRTIO_BLK_T_IN;
@@ -114,40 +83,202 @@ async::detached Device::_processRequests() {
 		header->reserved = 0;
 		header->sector = request->sector;
 
-		chain.setupBuffer(virtio_core::hostToDevice, arch::dma_buffer_view{nullptr,
-				header, sizeof(VirtRequest)});
-		
-		// Setup descriptors for the transfered data.
-		for(size_t i = 0; i < request->numSectors; i++) {
-			chain.append(co_await _requestQueue->obtainDescriptor());
-			if(request->write) {
-				chain.setupBuffer(virtio_core::hostToDevice, arch::dma_buffer_view{nullptr,
-						(char *)request->buffer + 512 * i, 512});
-			}else{
-				chain.setupBuffer(virtio_core::deviceToHost, arch::dma_buffer_view{nullptr,
-						(char *)request->buffer + 512 * i, 512});
-			}
+		auto header_view = _virtRequestBuffer.view_element(index);
+		auto status_view = _statusBuffer.view_element(index);
+
+		if(request->flush) {
+			_segments.clear();
+		}else{
+			_computeSegments(request);
 		}
 
 		if(logInitiateRetire)
-			std::cout << "Submitting " << request->numSectors
-					<< " data descriptors" << std::endl;
+			std::cout << "Submitting " << _segments.size()
+					<< " data segments to virtq " << _queue->queueIndex() << std::endl;
+
+		if(_device->_useIndirect) {
+			// Put all buffers into an indirect table.
+			// The request only consumes a single descriptor of the virtq.
+			auto table = &_indirectTables[index * indirectTableSize];
+			size_t n = 0;
+			auto append = [&] (uintptr_t physical, size_t length, uint16_t flags) {
+				assert(n < indirectTableSize);
+				table[n].address.store(physical);
+				table[n].length.store(length);
+				table[n].flags.store(flags);
+				table[n].next.store(n + 1);
+				n++;
+			};
+
+			append(header_view.physical(), sizeof(VirtRequest),
+					virtio_core::VIRTQ_DESC_F_NEXT);
+			for(auto &segment : _segments)
+				append(segment.physical(), segment.size(), virtio_core::VIRTQ_DESC_F_NEXT
+						| (request->write ? 0 : virtio_core::VIRTQ_DESC_F_WRITE));
+			append(status_view.physical(), 1, virtio_core::VIRTQ_DESC_F_WRITE);
+
+			chain.front().setupIndirect(arch::dma_buffer_view{nullptr,
+					table, n * sizeof(virtio_core::spec::Descriptor),
+					_indirectTablesPhysical + index * indirectTableSize
+						* sizeof(virtio_core::spec::Descriptor)});
+		}else{
+			chain.setupBuffer(virtio_core::hostToDevice, header_view);
+
+			// Setup descriptors for the transfered data.
+			for(auto &segment : _segments) {
+				chain.append(co_await _queue->obtainDescriptor());
+				if(request->write) {
+					chain.setupBuffer(virtio_core::hostToDevice, segment);
+				}else{
+					chain.setupBuffer(virtio_core::deviceToHost, segment);
+				}
+			}
 
-		// Setup a descriptor for the status byte.
-		chain.append(co_await _requestQueue->obtainDescriptor());
-		chain.setupBuffer(virtio_core::deviceToHost, arch::dma_buffer_view{nullptr,
-				&statusBuffer[chain.front().tableIndex()], 1});
+			// Setup a descriptor for the status byte.
+			chain.append(co_await _queue->obtainDescriptor());
+			chain.setupBuffer(virtio_core::deviceToHost, status_view);
+		}
 
 		// Submit the request to the device
-		_requestQueue->postDescriptor(chain.front(), request,
+		_queue->postDescriptor(chain.front(), request,
 				[] (virtio_core::Request *base_request) {
 			auto request = static_cast<UserRequest *>(base_request);
 			if(logInitiateRetire)
 				std::cout << "Retiring " << request->numSectors
-						<< " data descriptors" << std::endl;
+						<< " sectors" << std::endl;
 			request->promise.set_value();
 		});
-		_requestQueue->notify();
+		_queue->notify();
+	}
+}
+
+// --------------------------------------------------------
+// Device
+// --------------------------------------------------------
+
+Device::Device(std::unique_ptr<virtio_core::Transport> transport)
+: blockfs::BlockDevice{512}, _transport{std::move(transport)} { }
+
+void Device::runDevice() {
+	if(_transport->checkDeviceFeature(virtio_core::VIRTIO_F_INDIRECT_DESC)) {
+		_transport->acknowledgeDriverFeature(virtio_core::VIRTIO_F_INDIRECT_DESC);
+		_useIndirect = true;
+	}
+
+	if(_transport->checkDeviceFeature(VIRTIO_BLK_F_FLUSH)) {
+		_transport->acknowledgeDriverFeature(VIRTIO_BLK_F_FLUSH);
+		_useFlush = true;
+	}
+
+	// Only use as many virtqs as the transport can service by individual interrupts.
+	unsigned int num_queues = 1;
+	if(_transport->checkDeviceFeature(VIRTIO_BLK_F_MQ)) {
+		_transport->acknowledgeDriverFeature(VIRTIO_BLK_F_MQ);
+		num_queues = std::min({static_cast<unsigned int>(
+						_transport->space().load(spec::regs::numQueues)),
+				_transport->numQueueInterrupts(), maxRequestQueues});
+		if(!num_queues)
+			num_queues = 1;
+	}
+
+	_transport->finalizeFeatures();
+	_transport->claimQueues(num_queues);
+
+	_maxSegments = _useIndirect ? indirectTableSize - 2 : SIZE_MAX;
+	for(unsigned int i = 0; i < num_queues; i++) {
+		auto queue = _transport->setupQueue(i);
+
+		// Without indirect descriptors, limit the request size
+		// to ensure that we don't monopolize the device.
+		// Indirect tables must not be longer than the queue itself.
+		if(!_useIndirect)
+			_maxSegments = std::min(_maxSegments, queue->numDescriptors() / 4);
+		_maxSegments = std::min(_maxSegments, queue->numDescriptors() - 2);
+
+		_requestQueues.push_back(std::make_unique<RequestQueue>(this, queue));
+	}
+	assert(_maxSegments >= 2);
+
+	auto size = static_cast<uint64_t>(_transport->space().load(spec::regs::capacity[0]))
+			| (static_cast<uint64_t>(_transport->space().load(spec::regs::capacity[1])) << 32);
+	std::cout << "virtio: Disk size: " << size << " sectors" << std::endl;
+	if(_useIndirect)
+		std::cout << "virtio: Using indirect descriptors" << std::endl;
+	std::cout << "virtio: Using " << num_queues << " request virtqs" << std::endl;
+
+	_transport->runDevice();
+
+	for(auto &queue : _requestQueues)
+		queue->processRequests();
+
+	if(runBenchmark) {
+		// Do not read past the end of small disks. The benchmark size
+		// must be a multiple of its largest request size (1 MiB).
+		auto bench_size = std::min(uint64_t{64} << 20, size * 512) & ~uint64_t{0xFFFFF};
+		if(bench_size) {
+			[] (Device *self, size_t bench_size) -> async::detached {
+				co_await blockfs::benchmarkDevice(self, bench_size);
+				blockfs::runDevice(self);
+			}(this, bench_size);
+			return;
+		}
+		std::cout << "virtio: Disk is too small to benchmark" << std::endl;
+	}
+
+	blockfs::runDevice(this);
+}
+
+async::result<void> Device::readSectors(uint64_t sector,
+		void *buffer, size_t num_sectors) {
+	// Natural alignment makes sure a sector does not cross a page boundary.
+	assert(!((uintptr_t)buffer % 512));
+//	printf("readSectors(%lu, %lu)\n", sector, num_sectors);
+
+	co_await _transferSectors(false, sector, buffer, num_sectors);
+}
+
+async::result<void> Device::writeSectors(uint64_t sector,
+		const void *buffer, size_t num_sectors) {
+	// Natural alignment makes sure a sector does not cross a page boundary.
+	assert(!((uintptr_t)buffer % 512));
+//	printf("writeSectors(%lu, %lu)\n", sector, num_sectors);
+
+	co_await _transferSectors(true, sector, const_cast<void *>(buffer), num_sectors);
+}
+
+async::result<void> Device::flush() {
+	if(!_useFlush)
+		co_return;
+
+	// The device flushes all writes that completed before the flush was submitted.
+	UserRequest request{false, 0, nullptr, 0};
+	request.flush = true;
+	_requestQueues[_nextQueue]->submit(&request);
+	_nextQueue = (_nextQueue + 1) % _requestQueues.size();
+	co_await request.promise.async_get();
+}
+
+async::result<void> Device::_transferSectors(bool write, uint64_t sector,
+		void *buffer, size_t num_sectors) {
+	// Each chunk must fit into _maxSegments segments. As the buffer is not necessarily
+	// page aligned, one segment is lost to the misalignment.
+	auto max_sectors = (_maxSegments - 1) * (0x1000 / 512);
+
+	// Submit all chunks before waiting for any of them.
+	// This allows the device to process the chunks in parallel.
+	std::vector<UserRequest *> requests;
+	for(size_t progress = 0; progress < num_sectors; progress += max_sectors) {
+		auto request = new UserRequest(write, sector + progress,
+				(char *)buffer + 512 * progress,
+				std::min(num_sectors - progress, max_sectors));
+		_requestQueues[_nextQueue]->submit(request);
+		_nextQueue = (_nextQueue + 1) % _requestQueues.size();
+		requests.push_back(request);
+	}
+
+	for(auto request : requests) {
+		co_await request->promise.async_get();
+		delete request;
 	}
 }
 
@@ -1,6 +1,8 @@
 
 #include <queue>
+#include <vector>
 
+#include <arch/dma_pool.hpp>
 #include <blockfs.hpp>
 #include <core/virtio/core.hpp>
 
@@ -20,13 +22,27 @@ static_assert(sizeof(VirtRequest) == 16, "Bad sizeof(VirtRequest)");
 
 enum {
 	VIRTIO_BLK_T_IN = 0,
-	VIRTIO_BLK_T_OUT = 1
+	VIRTIO_BLK_T_OUT = 1,
+	VIRTIO_BLK_T_FLUSH = 4
 };
 
+enum {
+	VIRTIO_BLK_F_FLUSH = 9,
+	VIRTIO_BLK_F_MQ = 12
+};
+
+// Upper bound on the number of request virtqs that we use.
+inline constexpr unsigned int maxRequestQueues = 16;
+
+// Maximal number of descriptors in each indirect descriptor table.
+// Two descriptors are used for the request header and the status byte.
+inline constexpr size_t indirectTableSize = 128;
+
 namespace spec::regs {
 	inline constexpr arch::scalar_register<uint32_t> capacity[] = {
 			arch::scalar_register<uint32_t>{0},
 			arch::scalar_register<uint32_t>{4}};
+	inline constexpr arch::scalar_register<uint16_t> numQueues{34};
 }
 
 struct Device;
@@ -38,6 +54,8 @@ struct Device;
 struct UserRequest : virtio_core::Request {
 	UserRequest(bool write, uint64_t sector, void *buffer, size_t num_sectors);
 
+	// Flush requests have no data segments (and numSectors is zero).
+	bool flush = false;
 	bool write;
 	uint64_t sector;
 	void *buffer;
@@ -46,11 +64,65 @@ struct UserRequest : virtio_core::Request {
 	async::promise<void> promise;
 };
 
+// --------------------------------------------------------
+// RequestQueue
+// --------------------------------------------------------
+
+// Submission state of a single request virtq.
+struct RequestQueue {
+	RequestQueue(Device *device, virtio_core::Queue *queue);
+
+	RequestQueue(const RequestQueue &) = delete;
+
+	RequestQueue &operator= (const RequestQueue &) = delete;
+
+	size_t numDescriptors() {
+		return _queue->numDescriptors();
+	}
+
+	void submit(UserRequest *request) {
+		_pendingQueue.push(request);
+		_pendingDoorbell.ring();
+	}
+
+	// Submits requests from _pendingQueue to the device.
+	async::detached processRequests();
+
+private:
+	// Fills _segments with the physically contiguous parts of the request's buffer.
+	void _computeSegments(UserRequest *request);
+
+	Device *_device;
+
+	virtio_core::Queue *_queue;
+
+	// Stores UserRequest objects that have not been submitted yet.
+	std::queue<UserRequest *> _pendingQueue;
+	async::doorbell _pendingDoorbell;
+
+	arch::contiguous_pool _dmaPool;
+
+	// these two buffer store virtio-block request header and status bytes
+	// they are indexed by the index of the request's first descriptor
+	arch::dma_array<VirtRequest> _virtRequestBuffer;
+	arch::dma_array<uint8_t> _statusBuffer;
+
+	// Indirect descriptor tables (indirectTableSize entries each);
+	// indexed by the index of the request's first descriptor.
+	virtio_core::spec::Descriptor *_indirectTables = nullptr;
+	uintptr_t _indirectTablesPhysical = 0;
+
+	// Scratch space for _computeSegments().
+	std::vector<arch::dma_buffer_view> _segments;
+};
+
 // --------------------------------------------------------
 // Device
 // --------------------------------------------------------
 
 struct Device : blockfs::BlockDevice {
+	friend struct RequestQueue;
+
 	Device(std::unique_ptr<virtio_core::Transport> transport);
 
 	void runDevice();
@@ -61,23 +133,30 @@ struct Device : blockfs::BlockDevice {
 	async::result<void> writeSectors(uint64_t sector,
 			const void *buffer, size_t num_sectors) override;
 
+	async::result<void> flush() override;
+
 private:
-	// Submits requests from _pendingQueue to the device.
-	async::detached _processRequests();
-	
+	// Splits a transfer into chunks that are submitted to the device concurrently.
+	async::result<void> _transferSectors(bool write, uint64_t sector,
+			void *buffer, size_t num_sectors);
+
 	std::unique_ptr<virtio_core::Transport> _transport;
 
-	// The single virtq of this device.
-	virtio_core::Queue *_requestQueue;
+	// Request virtqs of this device (more than one if VIRTIO_BLK_F_MQ is negotiated).
+	std::vector<std::unique_ptr<RequestQueue>> _requestQueues;
 
-	// Stores UserRequest objects that have not been submitted yet.
-	std::queue<UserRequest *> _pendingQueue;
-	async::doorbell _pendingDoorbell;
+	// Chunks are distributed over all virtqs in a round-robin fashion.
+	size_t _nextQueue = 0;
 
-	// these two buffer store virtio-block request header and status bytes
-	// they are indexed by the index of the request's first descriptor
-	VirtRequest *virtRequestBuffer;
-	uint8_t *statusBuffer;
+	// Whether VIRTIO_F_INDIRECT_DESC was negotiated.
+	bool _useIndirect = false;
+
+	// Whether VIRTIO_BLK_F_FLUSH was negotiated. Otherwise, the device has
+	// no volatile write cache and completed writes are already durable.
+	bool _useFlush = false;
+
+	// Maximal number of data segments per request.
+	size_t _maxSegments;
 };
 
 } } // namespace block::virtio
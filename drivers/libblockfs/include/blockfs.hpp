@@ -19,11 +19,22 @@ struct BlockDevice {
 		throw std::runtime_error("BlockDevice does not support writeSectors()");
 	}
 
+	// Makes all completed writes durable. Devices without a volatile
+	// write cache do not need to override this.
+	virtual async::result<void> flush() {
+		co_return;
+	}
+
 	const size_t sectorSize;
 };
 
 async::detached runDevice(BlockDevice *device);
 
+// Measures sequential read throughput (MB/s) and IOPS of the device for different
+// request sizes and queue depths. Reads the first total_size bytes of the device;
+// total_size must be a multiple of 1 MiB and must not exceed the device capacity.
+async::result<void> benchmarkDevice(BlockDevice *device, size_t total_size = 64 << 20);
+
 } // namespace blockfs
 
 #endif // LIBFS_HPP
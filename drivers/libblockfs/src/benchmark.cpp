@@ -0,0 +1,139 @@
+#include <assert.h>
+#include <stdio.h>
+#include <random>
+#include <string>
+
+#include <async/result.hpp>
+#include <hel.h>
+#include <hel-syscalls.h>
+
+#include <blockfs.hpp>
+#include "ext2fs.hpp"
+
+namespace blockfs {
+
+namespace {
+
+struct BenchmarkState {
+	BlockDevice *device;
+	size_t requestSectors;
+	size_t numRequests;
+
+	size_t nextRequest = 0;
+	size_t activeWorkers = 0;
+	async::promise<void> done;
+};
+
+async::detached runWorker(BenchmarkState *state, void *buffer) {
+	while(state->nextRequest < state->numRequests) {
+		auto sector = state->nextRequest++ * state->requestSectors;
+		co_await state->device->readSectors(sector, buffer, state->requestSectors);
+	}
+
+	if(!--state->activeWorkers)
+		state->done.set_value();
+}
+
+} // anonymous namespace
+
+async::result<void> benchmarkDevice(BlockDevice *device, size_t total_size) {
+	constexpr size_t requestSizes[] = {0x1000, 0x10000, 0x100000};
+	constexpr size_t queueDepths[] = {1, 8};
+
+	for(auto request_size : requestSizes) {
+		for(auto depth : queueDepths) {
+			assert(!(request_size % device->sectorSize));
+			assert(!(total_size % request_size));
+
+			// Allocate page-aligned buffers; one per worker.
+			HelHandle memory;
+			void *window;
+			HEL_CHECK(helAllocateMemory(request_size * depth, 0, nullptr, &memory));
+			HEL_CHECK(helMapMemory(memory, kHelNullHandle, nullptr,
+					0, request_size * depth, kHelMapProtRead | kHelMapProtWrite, &window));
+			HEL_CHECK(helCloseDescriptor(memory));
+
+			BenchmarkState state;
+			state.device = device;
+			state.requestSectors = request_size / device->sectorSize;
+			state.numRequests = total_size / request_size;
+			state.activeWorkers = depth;
+
+			uint64_t start;
+			HEL_CHECK(helGetClock(&start));
+
+			for(size_t i = 0; i < depth; i++)
+				runWorker(&state, (char *)window + i * request_size);
+			co_await state.done.async_get();
+
+			uint64_t end;
+			HEL_CHECK(helGetClock(&end));
+
+			HEL_CHECK(helUnmapMemory(kHelNullHandle, window, request_size * depth));
+
+			auto nanos = end - start;
+			printf("blockfs: Benchmark: %lu KiB requests, depth %lu:"
+					" %lu MB/s, %lu IOPS\n",
+					request_size / 1024, depth,
+					total_size * 1000 / nanos,
+					state.numRequests * 1'000'000'000 / nanos);
+		}
+	}
+}
+
+namespace ext2fs {
+
+async::result<void> benchmarkLookups(FileSystem *fs) {
+	constexpr size_t directorySizes[] = {10'000, 100'000, 1'000'000};
+	constexpr size_t numLookups = 10'000;
+
+	auto root = fs->accessRoot();
+	auto bench_entry = co_await root->findEntry("lookup-bench");
+	if(!bench_entry || bench_entry->fileType != kTypeDirectory) {
+		printf("ext2fs: Lookup benchmark: /lookup-bench does not exist\n");
+		co_return;
+	}
+	auto bench_dir = fs->accessInode(bench_entry->inode);
+
+	std::mt19937 rng;
+	for(auto size : directorySizes) {
+		auto entry = co_await bench_dir->findEntry(std::to_string(size));
+		if(!entry || entry->fileType != kTypeDirectory) {
+			printf("ext2fs: Lookup benchmark: Skipping %lu entries\n", size);
+			continue;
+		}
+		auto dir = fs->accessInode(entry->inode);
+		co_await dir->readyJump.async_wait();
+
+		std::uniform_int_distribution<size_t> distribution{0, size - 1};
+		uint64_t hit_nanos = 0, miss_nanos = 0;
+		for(size_t i = 0; i < numLookups; i++) {
+			auto name = std::to_string(distribution(rng));
+
+			uint64_t start, end;
+			HEL_CHECK(helGetClock(&start));
+			auto hit = co_await dir->findEntry(name);
+			HEL_CHECK(helGetClock(&end));
+			assert(hit);
+			(void)hit;
+			hit_nanos += end - start;
+
+			// Misses are the worst case for linear directories.
+			name += "-missing";
+			HEL_CHECK(helGetClock(&start));
+			auto miss = co_await dir->findEntry(name);
+			HEL_CHECK(helGetClock(&end));
+			assert(!miss);
+			(void)miss;
+			miss_nanos += end - start;
+		}
+
+		printf("ext2fs: Lookup benchmark: %lu entries (%s): %lu ns per hit, %lu ns per miss\n",
+				size, dir->isIndexed() ? "hashed" : "linear",
+				hit_nanos / numLookups, miss_nanos / numLookups);
+	}
+}
+
+} // namespace ext2fs
+
+} // namespace blockfs
@@ -1,11 +1,14 @@
 
+#include <dirent.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <algorithm>
 #include <iostream>
+#include <mutex>
 
 #include <async/result.hpp>
+#include <hel-syscalls.h>
 #include <helix/ipc.hpp>
 #include <helix/memory.hpp>
 
@@ -16,11 +19,188 @@ namespace ext2fs {
 
 namespace {
 	constexpr bool logSuperblock = true;
+	constexpr bool logReadahead = false;
 
 	constexpr int pageShift = 12;
 	constexpr size_t pageSize = size_t{1} << pageShift;
 }
 
+// --------------------------------------------------------
+// Directory hashing
+// --------------------------------------------------------
+
+namespace {
+
+// The legacy hash of ext3's dir_index (dx_hack_hash() in Linux).
+template<typename Char>
+uint32_t legacyHash(const char *name, size_t length) {
+	uint32_t hash0 = 0x12A3FE2D;
+	uint32_t hash1 = 0x37ABE8F9;
+	for(size_t i = 0; i < length; i++) {
+		auto c = static_cast<uint32_t>(static_cast<int>(static_cast<Char>(name[i])));
+		uint32_t hash = hash1 + (hash0 ^ (c * 7152373));
+		if(hash & 0x80000000)
+			hash -= 0x7FFFFFFF;
+		hash1 = hash0;
+		hash0 = hash;
+	}
+	return hash0 << 1;
+}
+
+// Packs (a prefix of) the name into num words; the remainder is padded.
+template<typename Char>
+void nameToWords(const char *name, size_t length, uint32_t *words, int num) {
+	uint32_t pad = static_cast<uint32_t>(length) | (static_cast<uint32_t>(length) << 8);
+	pad |= pad << 16;
+
+	uint32_t value = pad;
+	if(length > size_t(num) * 4)
+		length = num * 4;
+	for(size_t i = 0; i < length; i++) {
+		value = static_cast<int>(static_cast<Char>(name[i])) + (value << 8);
+		if((i % 4) == 3) {
+			*words++ = value;
+			value = pad;
+			num--;
+		}
+	}
+	if(--num >= 0)
+		*words++ = value;
+	while(--num >= 0)
+		*words++ = pad;
+}
+
+uint32_t rotateLeft(uint32_t x, int s) {
+	return (x << s) | (x >> (32 - s));
+}
+
+// Cut-down MD4 transform as used by ext3's dir_index.
+void halfMd4Transform(uint32_t buf[4], const uint32_t in[8]) {
+	auto f = [] (uint32_t x, uint32_t y, uint32_t z) { return z ^ (x & (y ^ z)); };
+	auto g = [] (uint32_t x, uint32_t y, uint32_t z) { return (x & y) + ((x ^ y) & z); };
+	auto h = [] (uint32_t x, uint32_t y, uint32_t z) { return x ^ y ^ z; };
+	constexpr uint32_t k1 = 0;
+	constexpr uint32_t k2 = 013240474631;
+	constexpr uint32_t k3 = 015666365641;
+
+	uint32_t a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+	auto round = [] (auto fn, uint32_t &a, uint32_t b, uint32_t c, uint32_t d,
+			uint32_t x, int s) {
+		a = rotateLeft(a + fn(b, c, d) + x, s);
+	};
+
+	round(f, a, b, c, d, in[0] + k1, 3);
+	round(f, d, a, b, c, in[1] + k1, 7);
+	round(f, c, d, a, b, in[2] + k1, 11);
+	round(f, b, c, d, a, in[3] + k1, 19);
+	round(f, a, b, c, d, in[4] + k1, 3);
+	round(f, d, a, b, c, in[5] + k1, 7);
+	round(f, c, d, a, b, in[6] + k1, 11);
+	round(f, b, c, d, a, in[7] + k1, 19);
+
+	round(g, a, b, c, d, in[1] + k2, 3);
+	round(g, d, a, b, c, in[3] + k2, 5);
+	round(g, c, d, a, b, in[5] + k2, 9);
+	round(g, b, c, d, a, in[7] + k2, 13);
+	round(g, a, b, c, d, in[0] + k2, 3);
+	round(g, d, a, b, c, in[2] + k2, 5);
+	round(g, c, d, a, b, in[4] + k2, 9);
+	round(g, b, c, d, a, in[6] + k2, 13);
+
+	round(h, a, b, c, d, in[3] + k3, 3);
+	round(h, d, a, b, c, in[7] + k3, 9);
+	round(h, c, d, a, b, in[2] + k3, 11);
+	round(h, b, c, d, a, in[6] + k3, 15);
+	round(h, a, b, c, d, in[1] + k3, 3);
+	round(h, d, a, b, c, in[5] + k3, 9);
+	round(h, c, d, a, b, in[0] + k3, 11);
+	round(h, b, c, d, a, in[4] + k3, 15);
+
+	buf[0] += a;
+	buf[1] += b;
+	buf[2] += c;
+	buf[3] += d;
+}
+
+void teaTransform(uint32_t buf[4], const uint32_t in[4]) {
+	uint32_t sum = 0;
+	uint32_t b0 = buf[0], b1 = buf[1];
+	uint32_t a = in[0], b = in[1], c = in[2], d = in[3];
+
+	for(int n = 0; n < 16; n++) {
+		sum += 0x9E3779B9;
+		b0 += ((b1 << 4) + a) ^ (b1 + sum) ^ ((b1 >> 5) + b);
+		b1 += ((b0 << 4) + c) ^ (b0 + sum) ^ ((b0 >> 5) + d);
+	}
+
+	buf[0] += b0;
+	buf[1] += b1;
+}
+
+template<typename Char>
+uint32_t halfMd4Hash(uint32_t buf[4], const char *name, size_t length) {
+	uint32_t in[8];
+	for(size_t progress = 0; progress < length; progress += 32) {
+		nameToWords<Char>(name + progress, length - progress, in, 8);
+		halfMd4Transform(buf, in);
+	}
+	return buf[1];
+}
+
+template<typename Char>
+uint32_t teaHash(uint32_t buf[4], const char *name, size_t length) {
+	uint32_t in[4];
+	for(size_t progress = 0; progress < length; progress += 16) {
+		nameToWords<Char>(name + progress, length - progress, in, 4);
+		teaTransform(buf, in);
+	}
+	return buf[0];
+}
+
+} // anonymous namespace
+
+uint32_t hashEntryName(int version, const uint32_t seed[4], const char *name, size_t length) {
+	uint32_t buf[4] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476};
+	if(seed[0] || seed[1] || seed[2] || seed[3])
+		memcpy(buf, seed, sizeof(buf));
+
+	uint32_t hash;
+	switch(version) {
+	case EXT2_DX_HASH_LEGACY:
+		hash = legacyHash<signed char>(name, length); break;
+	case EXT2_DX_HASH_LEGACY_UNSIGNED:
+		hash = legacyHash<unsigned char>(name, length); break;
+	case EXT2_DX_HASH_HALF_MD4:
+		hash = halfMd4Hash<signed char>(buf, name, length); break;
+	case EXT2_DX_HASH_HALF_MD4_UNSIGNED:
+		hash = halfMd4Hash<unsigned char>(buf, name, length); break;
+	case EXT2_DX_HASH_TEA:
+		hash = teaHash<signed char>(buf, name, length); break;
+	case EXT2_DX_HASH_TEA_UNSIGNED:
+		hash = teaHash<unsigned char>(buf, name, length); break;
+	default:
+		throw std::runtime_error("ext2fs: Unexpected directory hash version");
+	}
+
+	// The lowest bit is reserved to mark hash collisions in the index.
+	// 0xFFFFFFFE is reserved as an end-of-directory marker.
+	hash &= ~uint32_t(1);
+	if(hash == (0x7FFFFFFFu << 1))
+		hash = (0x7FFFFFFFu - 1) << 1;
+	return hash;
+}
+
+// --------------------------------------------------------
+// MappingWindow
+// --------------------------------------------------------
+
+MappingWindow::~MappingWindow() {
+	// Writebacks that the kernel requests from now on include the pages of this window.
+	if(inode)
+		inode->writebackEpoch++;
+}
+
 // --------------------------------------------------------
 // Inode
 // --------------------------------------------------------
@@ -28,93 +208,433 @@ namespace {
 Inode::Inode(FileSystem &fs, uint32_t number)
 : fs(fs), number(number), isReady(false) { }
 
-async::result<std::optional<DirEntry>>
-Inode::findEntry(std::string name) {
-	assert(!name.empty() && name != "." && name != "..");
+Inode::~Inode() {
+	for(auto &entry : windows) {
+		auto window = entry.second.get();
+		assert(window->isCached);
+		fs.windowLru.erase(window->lruPosition);
+		window->isCached = false;
+		window->inode = nullptr;
+	}
+}
 
-	co_await readyJump.async_wait();
+async::result<std::shared_ptr<MappingWindow>> Inode::accessWindow(uint64_t offset) {
+	auto memory_size = (fileSize() + 0xFFF) & ~uint64_t(0xFFF);
+	assert(offset < memory_size);
+	auto index = offset / windowSize;
+	auto window_offset = index * windowSize;
+	auto length = std::min(uint64_t{windowSize}, memory_size - window_offset);
+
+	// Fast path: the window is already mapped. Windows that were created before
+	// the file grew might be too short; those are replaced.
+	auto it = windows.find(index);
+	if(it != windows.end() && it->second->contains(offset)) {
+		fs.touchWindow(it->second.get());
+		co_return it->second;
+	}
 
 	helix::LockMemoryView lock_memory;
-	auto map_size = (fileSize() + 0xFFF) & ~size_t(0xFFF);
 	auto &&submit = helix::submitLockMemoryView(helix::BorrowedDescriptor(frontalMemory),
-			&lock_memory,
-			0, map_size, helix::Dispatcher::global());
+			&lock_memory, window_offset, length, helix::Dispatcher::global());
 	co_await submit.async_wait();
 	HEL_CHECK(lock_memory.error());
 
 	// Map the page cache into the address space.
-	helix::Mapping file_map{helix::BorrowedDescriptor{frontalMemory},
-			0, map_size,
-			kHelMapProtRead | kHelMapDontRequireBacking};
+	auto window = std::make_shared<MappingWindow>(this, window_offset, length,
+			lock_memory.descriptor(),
+			helix::Mapping{helix::BorrowedDescriptor{frontalMemory},
+				static_cast<ptrdiff_t>(window_offset), length,
+				kHelMapProtRead | kHelMapProtWrite | kHelMapDontRequireBacking});
+
+	// Another request might have installed a window while we were waiting.
+	it = windows.find(index);
+	if(it != windows.end()) {
+		if(it->second->length >= length) {
+			fs.touchWindow(it->second.get());
+			co_return it->second;
+		}
+		fs.uncacheWindow(it->second.get());
+	}
 
-	// Read the directory structure.
-	uintptr_t offset = 0;
-	while(offset < fileSize()) {
-		assert(!(offset & 3));
-		assert(offset + sizeof(DiskDirEntry) <= fileSize());
-		auto disk_entry = reinterpret_cast<DiskDirEntry *>(
-				reinterpret_cast<char *>(file_map.get()) + offset);
+	fs.cacheWindow(window);
+	co_return window;
+}
 
-		if(disk_entry->inode
-				&& name.length() == disk_entry->nameLength
-				&& !memcmp(disk_entry->name, name.data(), name.length())) {
-			DirEntry entry;
-			entry.inode = disk_entry->inode;
+async::result<void> Inode::readCache(uint64_t offset, void *buffer, size_t length) {
+	size_t progress = 0;
+	while(progress < length) {
+		auto window = co_await accessWindow(offset + progress);
+		auto chunk = std::min(length - progress,
+				window->offset + window->length - (offset + progress));
+		memcpy(reinterpret_cast<char *>(buffer) + progress,
+				window->access(offset + progress), chunk);
+		progress += chunk;
+	}
+}
 
-			switch(disk_entry->fileType) {
-			case EXT2_FT_REG_FILE:
-				entry.fileType = kTypeRegular; break;
-			case EXT2_FT_DIR:
-				entry.fileType = kTypeDirectory; break;
-			case EXT2_FT_SYMLINK:
-				entry.fileType = kTypeSymlink; break;
-			default:
-				entry.fileType = kTypeNone;
-			}
+async::result<void> Inode::writeCache(uint64_t offset, const void *buffer, size_t length) {
+	size_t progress = 0;
+	while(progress < length) {
+		auto window = co_await accessWindow(offset + progress);
+		auto chunk = std::min(length - progress,
+				window->offset + window->length - (offset + progress));
+		memcpy(window->access(offset + progress),
+				reinterpret_cast<const char *>(buffer) + progress, chunk);
+		// Mark the chunk while we still hold the window. Once the window is unmapped,
+		// writebackEpoch is incremented and the range would never become clean.
+		markDirty(offset + progress, offset + progress + chunk);
+		progress += chunk;
+	}
+}
+
+void Inode::dropWindows(uint64_t size) {
+	auto memory_size = (size + 0xFFF) & ~uint64_t(0xFFF);
+	std::vector<MappingWindow *> victims;
+	for(auto &entry : windows)
+		if(entry.second->offset + entry.second->length > memory_size)
+			victims.push_back(entry.second.get());
+	for(auto window : victims)
+		fs.uncacheWindow(window);
+}
+
+std::optional<BlockExtent> Inode::cachedBlocks(uint64_t block) {
+	auto it = blockMap.upper_bound(block);
+	if(it == blockMap.begin())
+		return std::nullopt;
+	--it;
+
+	auto skip = block - it->first;
+	if(skip >= it->second.length)
+		return std::nullopt;
+	return BlockExtent{it->second.physical ? it->second.physical + skip : 0,
+			it->second.length - skip};
+}
 
-			co_return entry;
+void Inode::cacheBlocks(uint64_t block, BlockExtent extent) {
+	// For simplicity, we drop the whole block map once it becomes too large.
+	if(blockMap.size() >= maxCachedExtents)
+		blockMap.clear();
+
+	// Trim the extent such that it does not overlap the extents that are already cached.
+	auto it = blockMap.upper_bound(block);
+	if(it != blockMap.end())
+		extent.length = std::min(extent.length, it->first - block);
+	if(it != blockMap.begin()) {
+		auto previous = std::prev(it);
+		auto previous_end = previous->first + previous->second.length;
+		if(previous_end > block) {
+			auto skip = previous_end - block;
+			if(skip >= extent.length)
+				return;
+			block += skip;
+			extent.length -= skip;
+			if(extent.physical)
+				extent.physical += skip;
 		}
 
-		offset += disk_entry->recordLength;
+		// Merge the extent into its predecessor if they are contiguous.
+		auto &pe = previous->second;
+		if(previous_end == block && ((!pe.physical && !extent.physical)
+				|| (pe.physical && pe.physical + pe.length == extent.physical))) {
+			pe.length += extent.length;
+			return;
+		}
 	}
-	assert(offset == fileSize());
 
-	co_return std::nullopt;
+	if(!extent.length)
+		return;
+	blockMap.emplace(block, extent);
 }
 
-async::result<std::optional<DirEntry>>
-Inode::link(std::string name, int64_t ino, blockfs::FileType type) {
-	assert(!name.empty() && name != "." && name != "..");
-	assert(ino);
+void Inode::forgetBlocks(uint64_t begin, uint64_t end) {
+	auto it = blockMap.upper_bound(begin);
+	if(it != blockMap.begin()) {
+		auto previous = std::prev(it);
+		if(previous->first + previous->second.length > begin)
+			it = previous;
+	}
+	while(it != blockMap.end() && it->first < end)
+		it = blockMap.erase(it);
+}
 
-	co_await readyJump.async_wait();
+void Inode::markInodeDirty() {
+	// Hack: For now, we just remap the inode to make sure the dirty bit is checked.
+	auto inode_address = (number - 1) * fs.inodeSize;
+	diskMapping = helix::Mapping{fs.inodeTable,
+			inode_address, fs.inodeSize,
+			kHelMapProtWrite | kHelMapProtRead | kHelMapDontRequireBacking};
+	diskInodeDirty = true;
+}
 
-	helix::LockMemoryView lock_memory;
-	auto map_size = (fileSize() + 0xFFF) & ~size_t(0xFFF);
-	auto &&submit = helix::submitLockMemoryView(helix::BorrowedDescriptor(frontalMemory),
-			&lock_memory,
-			0, map_size, helix::Dispatcher::global());
-	co_await submit.async_wait();
-	HEL_CHECK(lock_memory.error());
+namespace {
 
-	// Map the page cache into the address space.
-	helix::Mapping file_map{helix::BorrowedDescriptor{frontalMemory},
-			0, map_size,
-			kHelMapProtRead | kHelMapProtWrite | kHelMapDontRequireBacking};
+// Makes sure that a range starts at the given offset (if it overlaps a range).
+void splitRange(std::map<uint64_t, DirtyRange> &ranges, uint64_t offset) {
+	auto it = ranges.upper_bound(offset);
+	if(it == ranges.begin())
+		return;
+	--it;
+	if(it->first == offset || it->second.end <= offset)
+		return;
+	ranges.emplace(offset, DirtyRange{it->second.end, it->second.epoch});
+	it->second.end = offset;
+}
+
+// Removes the parts of [begin, end) that were written before the given epoch.
+void cleanRanges(std::map<uint64_t, DirtyRange> &ranges,
+		uint64_t begin, uint64_t end, uint64_t epoch) {
+	splitRange(ranges, begin);
+	splitRange(ranges, end);
+	auto it = ranges.lower_bound(begin);
+	while(it != ranges.end() && it->first < end) {
+		if(it->second.epoch < epoch) {
+			it = ranges.erase(it);
+		}else{
+			++it;
+		}
+	}
+}
+
+} // anonymous namespace
+
+void Inode::markDirty(uint64_t begin, uint64_t end) {
+	begin &= ~uint64_t(0xFFF);
+	end = (end + 0xFFF) & ~uint64_t(0xFFF);
+	if(begin == end)
+		return;
+
+	if(dirtyRanges.empty()) {
+		HEL_CHECK(helGetClock(&dirtySince));
+		fs.dirtyInodes.insert(shared_from_this());
+	}
+
+	// Replace all ranges that overlap [begin, end).
+	splitRange(dirtyRanges, begin);
+	splitRange(dirtyRanges, end);
+	auto it = dirtyRanges.lower_bound(begin);
+	while(it != dirtyRanges.end() && it->first < end)
+		it = dirtyRanges.erase(it);
+	it = dirtyRanges.emplace(begin, DirtyRange{end, writebackEpoch}).first;
+
+	// Coalesce with adjacent ranges of the same epoch.
+	auto next = std::next(it);
+	if(next != dirtyRanges.end() && next->first == end
+			&& next->second.epoch == writebackEpoch) {
+		it->second.end = next->second.end;
+		dirtyRanges.erase(next);
+	}
+	if(it != dirtyRanges.begin()) {
+		auto previous = std::prev(it);
+		if(previous->second.end == begin && previous->second.epoch == writebackEpoch) {
+			previous->second.end = it->second.end;
+			dirtyRanges.erase(it);
+		}
+	}
+}
+
+void Inode::markClean(uint64_t begin, uint64_t end, uint64_t epoch) {
+	// Ranges that were written after the writeback was requested stay dirty.
+	cleanRanges(dirtyRanges, begin, end, epoch);
+	for(auto snapshot : syncSnapshots)
+		cleanRanges(*snapshot, begin, end, epoch);
+
+	writebackDoorbell.ring();
+	if(dirtyRanges.empty())
+		fs.dirtyInodes.erase(shared_from_this());
+}
+
+namespace {
+
+FileType fileTypeOfEntry(const DiskDirEntry *disk_entry) {
+	switch(disk_entry->fileType) {
+	case EXT2_FT_REG_FILE:
+		return kTypeRegular;
+	case EXT2_FT_DIR:
+		return kTypeDirectory;
+	case EXT2_FT_SYMLINK:
+		return kTypeSymlink;
+	default:
+		return kTypeNone;
+	}
+}
+
+// Size of a directory entry with a name of the given length.
+size_t entrySize(size_t name_length) {
+	return (sizeof(DiskDirEntry) + name_length + 3) & ~size_t(3);
+}
+
+} // anonymous namespace
+
+bool Inode::isIndexed() {
+	return fs.hasDirIndex && (diskInode()->flags & EXT2_INDEX_FL);
+}
+
+async::result<std::optional<IndexLookup>> Inode::lookupIndex(const std::string &name) {
+	auto window = co_await accessWindow(0);
+	auto info = reinterpret_cast<DiskDxRootInfo *>(window->access(24));
+	if(info->reservedZero || info->infoLength != sizeof(DiskDxRootInfo)
+			|| info->indirectLevels >= maxIndexLevels
+			|| info->hashVersion > EXT2_DX_HASH_TEA) {
+		std::cout << "\e[33m" "ext2fs: Ignoring unsupported htree of inode "
+				<< number << "\e[39m" << std::endl;
+		co_return std::nullopt;
+	}
+
+	IndexLookup lookup;
+	lookup.hashVersion = info->hashVersion;
+	if(fs.unsignedHash)
+		lookup.hashVersion += EXT2_DX_HASH_LEGACY_UNSIGNED;
+	lookup.hash = hashEntryName(lookup.hashVersion, fs.hashSeed, name.data(), name.size());
+	lookup.numFrames = info->indirectLevels + 1;
+
+	uint64_t block_offset = 0;
+	size_t entries_offset = 24 + info->infoLength;
+	for(int level = 0; level < lookup.numFrames; level++) {
+		if(!window->contains(block_offset))
+			window = co_await accessWindow(block_offset);
+		auto count_limit = reinterpret_cast<DiskDxCountLimit *>(
+				window->access(block_offset + entries_offset));
+		auto entries = reinterpret_cast<DiskDxEntry *>(count_limit);
+		if(!count_limit->count || count_limit->count > count_limit->limit) {
+			std::cout << "\e[33m" "ext2fs: Corrupted htree node in inode "
+					<< number << "\e[39m" << std::endl;
+			co_return std::nullopt;
+		}
+
+		// Find the last entry with hash <= lookup.hash. The first entry has an implicit
+		// hash of zero (its hash field is overlaid by the DiskDxCountLimit).
+		unsigned int low = 1, high = count_limit->count;
+		while(low < high) {
+			auto mid = (low + high) / 2;
+			if(entries[mid].hash > lookup.hash) {
+				high = mid;
+			}else{
+				low = mid + 1;
+			}
+		}
+
+		lookup.frames[level] = {block_offset, entries_offset, low - 1};
+		auto block = entries[low - 1].block & 0x0FFFFFFF;
+		if((uint64_t{block} << fs.blockShift) >= fileSize()) {
+			std::cout << "\e[33m" "ext2fs: htree of inode " << number
+					<< " points beyond the end of the directory\e[39m" << std::endl;
+			co_return std::nullopt;
+		}
+
+		lookup.leafBlock = block;
+		block_offset = uint64_t{block} << fs.blockShift;
+		entries_offset = sizeof(DiskDirEntry);
+	}
+
+	co_return lookup;
+}
+
+async::result<bool> Inode::nextLeaf(IndexLookup &lookup) {
+	// Find the lowest level that has a next entry.
+	int level = lookup.numFrames - 1;
+	std::shared_ptr<MappingWindow> window;
+	DiskDxEntry *entries;
+	while(true) {
+		auto &frame = lookup.frames[level];
+		window = co_await accessWindow(frame.blockOffset);
+		auto count_limit = reinterpret_cast<DiskDxCountLimit *>(
+				window->access(frame.blockOffset + frame.entriesOffset));
+		entries = reinterpret_cast<DiskDxEntry *>(count_limit);
+		if(frame.position + 1 < count_limit->count) {
+			frame.position++;
+			break;
+		}
+		if(!level)
+			co_return false;
+		level--;
+	}
 
-	// Space required for the new directory entry.
-	auto required = (sizeof(DiskDirEntry) + name.size() + 3) & ~size_t(3);
+	// The next block only continues our hash if the collision bit is set.
+	auto next_hash = entries[lookup.frames[level].position].hash;
+	if((next_hash & ~uint32_t(1)) != lookup.hash)
+		co_return false;
+
+	// Descend to the leftmost leaf below the new entry.
+	auto block = entries[lookup.frames[level].position].block & 0x0FFFFFFF;
+	for(level++; level < lookup.numFrames; level++) {
+		auto block_offset = uint64_t{block} << fs.blockShift;
+		lookup.frames[level] = {block_offset, sizeof(DiskDirEntry), 0};
+		window = co_await accessWindow(block_offset);
+		entries = reinterpret_cast<DiskDxEntry *>(
+				window->access(block_offset + sizeof(DiskDirEntry)));
+		block = entries[0].block & 0x0FFFFFFF;
+	}
+	lookup.leafBlock = block;
+	co_return true;
+}
 
-	// Walk the directory structure.
-	uintptr_t offset = 0;
-	while(offset < fileSize()) {
+async::result<std::optional<EntryLocation>> Inode::scanEntries(uint64_t begin, uint64_t end,
+		const std::string &name) {
+	std::shared_ptr<MappingWindow> window;
+	std::optional<uint64_t> previous;
+	uint64_t offset = begin;
+	while(offset < end) {
 		assert(!(offset & 3));
-		assert(offset + sizeof(DiskDirEntry) <= fileSize());
-		auto previous_entry = reinterpret_cast<DiskDirEntry *>(
-				reinterpret_cast<char *>(file_map.get()) + offset);
+		assert(offset + sizeof(DiskDirEntry) <= end);
+		if(!window || !window->contains(offset))
+			window = co_await accessWindow(offset);
+		auto disk_entry = reinterpret_cast<DiskDirEntry *>(window->access(offset));
+		assert(disk_entry->recordLength);
+
+		// Entries never cross block boundaries.
+		if(!(offset & (fs.blockSize - 1)))
+			previous = std::nullopt;
+
+		if(disk_entry->inode
+				&& name.length() == disk_entry->nameLength
+				&& !memcmp(disk_entry->name, name.data(), name.length()))
+			co_return EntryLocation{offset, previous};
 
-		// Calculate available space after we contract previous_entry.
-		auto contracted = (sizeof(DiskDirEntry) + previous_entry->nameLength + 3) & ~size_t(3);
+		previous = offset;
+		offset += disk_entry->recordLength;
+	}
+	assert(offset == end);
+
+	co_return std::nullopt;
+}
+
+async::result<std::optional<EntryLocation>> Inode::locateEntry(const std::string &name) {
+	if(isIndexed()) {
+		auto lookup = co_await lookupIndex(name);
+		if(lookup) {
+			while(true) {
+				auto leaf_offset = uint64_t{lookup->leafBlock} << fs.blockShift;
+				auto location = co_await scanEntries(leaf_offset,
+						leaf_offset + fs.blockSize, name);
+				if(location)
+					co_return location;
+				if(!(co_await nextLeaf(*lookup)))
+					co_return std::nullopt;
+			}
+		}
+	}
+
+	co_return co_await scanEntries(0, fileSize(), name);
+}
+
+async::result<bool> Inode::insertEntry(uint64_t begin, uint64_t end,
+		const std::string &name, uint32_t ino, FileType type) {
+	auto required = entrySize(name.size());
+
+	std::shared_ptr<MappingWindow> window;
+	uint64_t offset = begin;
+	while(offset < end) {
+		assert(!(offset & 3));
+		assert(offset + sizeof(DiskDirEntry) <= end);
+		if(!window || !window->contains(offset))
+			window = co_await accessWindow(offset);
+		auto previous_entry = reinterpret_cast<DiskDirEntry *>(window->access(offset));
+
+		// Unused entries can be taken over directly. Otherwise, calculate the available
+		// space after we contract previous_entry.
+		size_t contracted = 0;
+		if(previous_entry->inode)
+			contracted = entrySize(previous_entry->nameLength);
 		assert(previous_entry->recordLength >= contracted);
 		auto available = previous_entry->recordLength - contracted;
 
@@ -122,7 +642,7 @@ Inode::link(std::string name, int64_t ino, blockfs::FileType type) {
 		if(available >= required) {
 			// Create the new dentry.
 			auto disk_entry = reinterpret_cast<DiskDirEntry *>(
-					reinterpret_cast<char *>(file_map.get()) + offset + contracted);
+					window->access(offset + contracted));
 			memset(disk_entry, 0, sizeof(DiskDirEntry));
 			disk_entry->inode = ino;
 			disk_entry->recordLength = available;
@@ -140,75 +660,375 @@ Inode::link(std::string name, int64_t ino, blockfs::FileType type) {
 			memcpy(disk_entry->name, name.data(), name.length());
 
 			// Update the existing dentry.
-			previous_entry->recordLength = contracted;
-
-			// Update the inode.
-			auto target = fs.accessInode(ino);
-			co_await target->readyJump.async_wait();
-			target->diskInode()->linksCount++;
-
-			// Hack: For now, we just remap the inode to make sure the dirty bit is checked.
-			auto inode_address = (target->number - 1) * fs.inodeSize;
-			target->diskMapping = helix::Mapping{fs.inodeTable,
-					inode_address, fs.inodeSize,
-					kHelMapProtWrite | kHelMapProtRead | kHelMapDontRequireBacking};
-
-			DirEntry entry;
-			entry.inode = ino;
-			entry.fileType = type;
-			co_return entry;
+			if(contracted)
+				previous_entry->recordLength = contracted;
+			markDirty(offset, offset + contracted + available);
+			co_return true;
 		}
 
 		offset += previous_entry->recordLength;
 	}
-	assert(offset == fileSize());
+	assert(offset == end);
 
-	throw std::runtime_error("Not enough space for ext2fs directory entry");
+	co_return false;
 }
 
-async::result<void> Inode::unlink(std::string name) {
+async::result<IndexResult> Inode::splitLeaf(const IndexLookup &lookup,
+		const std::string &name, uint32_t ino, FileType type) {
+	auto &parent = lookup.frames[lookup.numFrames - 1];
+	{
+		auto window = co_await accessWindow(parent.blockOffset);
+		auto count_limit = reinterpret_cast<DiskDxCountLimit *>(
+				window->access(parent.blockOffset + parent.entriesOffset));
+		if(count_limit->count == count_limit->limit)
+			co_return IndexResult::noRoom;
+	}
+
+	// Collect the entries of the leaf, sorted by hash.
+	struct LiveEntry {
+		uint32_t hash;
+		std::vector<char> data;
+	};
+
+	auto leaf_offset = uint64_t{lookup.leafBlock} << fs.blockShift;
+	std::vector<LiveEntry> live;
+	{
+		auto window = co_await accessWindow(leaf_offset);
+		uint64_t offset = leaf_offset;
+		while(offset < leaf_offset + fs.blockSize) {
+			auto disk_entry = reinterpret_cast<DiskDirEntry *>(window->access(offset));
+			if(disk_entry->inode) {
+				auto length = entrySize(disk_entry->nameLength);
+				auto begin = reinterpret_cast<char *>(disk_entry);
+				live.push_back({hashEntryName(lookup.hashVersion, fs.hashSeed,
+						disk_entry->name, disk_entry->nameLength),
+						std::vector<char>(begin, begin + length)});
+			}
+			offset += disk_entry->recordLength;
+		}
+	}
+	std::stable_sort(live.begin(), live.end(), [] (const LiveEntry &a, const LiveEntry &b) {
+		return a.hash < b.hash;
+	});
+
+	// Like Linux, split at half of the used bytes (not of the entries), such that both
+	// blocks have about the same free space. Among the split points that leave room for
+	// the new entry in its half, take the one that is closest to the middle.
+	size_t total = 0;
+	for(auto &entry : live)
+		total += entry.data.size();
+	auto required = entrySize(name.size());
+
+	// Entries with the same hash must stay in consecutive blocks;
+	// the collision bit tells lookups to continue in the next block.
+	auto splitHash = [&] (size_t split) {
+		auto hash = live[split].hash;
+		if(live[split - 1].hash == hash)
+			hash |= 1;
+		return hash;
+	};
+
+	size_t split = 0;
+	size_t best_distance = SIZE_MAX;
+	size_t lower = 0;
+	for(size_t k = 1; k < live.size(); k++) {
+		lower += live[k - 1].data.size();
+		auto upper = total - lower;
+		auto target = (lookup.hash >= (splitHash(k) & ~uint32_t(1))) ? upper : lower;
+		if(fs.blockSize - target < required)
+			continue;
+		auto distance = (lower > upper) ? lower - upper : upper - lower;
+		if(distance < best_distance) {
+			split = k;
+			best_distance = distance;
+		}
+	}
+	if(!split)
+		co_return IndexResult::noSplit;
+	auto split_hash = splitHash(split);
+
+	auto appended = co_await appendBlock();
+	if(!appended)
+		co_return IndexResult::noSpace;
+	auto new_offset = *appended;
+	auto new_block = static_cast<uint32_t>(new_offset >> fs.blockShift);
+
+	// Write both halves back.
+	auto writeHalf = [this] (uint64_t block_offset, std::vector<LiveEntry>::iterator begin,
+			std::vector<LiveEntry>::iterator end) -> async::result<void> {
+		auto window = co_await accessWindow(block_offset);
+		auto block = window->access(block_offset);
+		memset(block, 0, fs.blockSize);
+
+		size_t offset = 0;
+		DiskDirEntry *last = nullptr;
+		for(auto it = begin; it != end; ++it) {
+			memcpy(block + offset, it->data.data(), it->data.size());
+			last = reinterpret_cast<DiskDirEntry *>(block + offset);
+			last->recordLength = it->data.size();
+			offset += it->data.size();
+		}
+		assert(last);
+		last->recordLength += fs.blockSize - offset;
+		markDirty(block_offset, block_offset + fs.blockSize);
+	};
+	co_await writeHalf(leaf_offset, live.begin(), live.begin() + split);
+	co_await writeHalf(new_offset, live.begin() + split, live.end());
+
+	// Insert the new block into the parent index block.
+	{
+		auto window = co_await accessWindow(parent.blockOffset);
+		auto count_limit = reinterpret_cast<DiskDxCountLimit *>(
+				window->access(parent.blockOffset + parent.entriesOffset));
+		auto entries = reinterpret_cast<DiskDxEntry *>(count_limit);
+		assert(count_limit->count < count_limit->limit);
+		memmove(&entries[parent.position + 2], &entries[parent.position + 1],
+				(count_limit->count - parent.position - 1) * sizeof(DiskDxEntry));
+		entries[parent.position + 1].hash = split_hash;
+		entries[parent.position + 1].block = new_block;
+		count_limit->count++;
+		markDirty(parent.blockOffset, parent.blockOffset + fs.blockSize);
+	}
+
+	auto target_offset = (lookup.hash >= (split_hash & ~uint32_t(1))) ? new_offset : leaf_offset;
+	if(!(co_await insertEntry(target_offset, target_offset + fs.blockSize,
+			name, ino, type)))
+		co_return IndexResult::noSplit;
+	co_return IndexResult::success;
+}
+
+async::result<IndexResult> Inode::growIndex(const IndexLookup &lookup) {
+	auto isFull = [this] (const IndexLookup::Frame &frame) -> async::result<bool> {
+		auto window = co_await accessWindow(frame.blockOffset);
+		auto count_limit = reinterpret_cast<DiskDxCountLimit *>(
+				window->access(frame.blockOffset + frame.entriesOffset));
+		co_return count_limit->count == count_limit->limit;
+	};
+
+	// Find the highest full index block such that its parent (if any) has room.
+	int level = lookup.numFrames - 1;
+	while(level && (co_await isFull(lookup.frames[level - 1])))
+		level--;
+
+	auto index_limit = static_cast<uint16_t>(
+			(fs.blockSize - sizeof(DiskDirEntry)) / sizeof(DiskDxEntry));
+
+	if(!level) {
+		// The root is full; move its entries into a new index block below the root.
+		if(lookup.numFrames >= fs.maxIndexDepth)
+			co_return IndexResult::noRoom;
+
+		auto appended = co_await appendBlock();
+		if(!appended)
+			co_return IndexResult::noSpace;
+		auto new_offset = *appended;
+		auto new_block = static_cast<uint32_t>(new_offset >> fs.blockShift);
+
+		auto window = co_await accessWindow(0);
+		auto info = reinterpret_cast<DiskDxRootInfo *>(window->access(24));
+		auto count_limit = reinterpret_cast<DiskDxCountLimit *>(
+				window->access(lookup.frames[0].entriesOffset));
+		auto entries = reinterpret_cast<DiskDxEntry *>(count_limit);
+
+		// appendBlock() already wrote the empty DiskDirEntry that spans the block.
+		auto new_window = co_await accessWindow(new_offset);
+		auto new_count_limit = reinterpret_cast<DiskDxCountLimit *>(
+				new_window->access(new_offset + sizeof(DiskDirEntry)));
+		auto new_entries = reinterpret_cast<DiskDxEntry *>(new_count_limit);
+		memcpy(new_entries, entries, count_limit->count * sizeof(DiskDxEntry));
+		new_count_limit->limit = index_limit;
+		markDirty(new_offset, new_offset + fs.blockSize);
+
+		count_limit->count = 1;
+		entries[0].block = new_block;
+		info->indirectLevels++;
+		markDirty(0, fs.blockSize);
+		co_return IndexResult::success;
+	}
+
+	// Move the upper half of the index block into a new block
+	// and insert that block into the parent.
+	auto &frame = lookup.frames[level];
+	auto &parent = lookup.frames[level - 1];
+
+	auto appended = co_await appendBlock();
+	if(!appended)
+		co_return IndexResult::noSpace;
+	auto new_offset = *appended;
+	auto new_block = static_cast<uint32_t>(new_offset >> fs.blockShift);
+
+	auto window = co_await accessWindow(frame.blockOffset);
+	auto count_limit = reinterpret_cast<DiskDxCountLimit *>(
+			window->access(frame.blockOffset + frame.entriesOffset));
+	auto entries = reinterpret_cast<DiskDxEntry *>(count_limit);
+	unsigned int count = count_limit->count;
+	unsigned int split = count / 2;
+	// The hash of the first entry of the new block is overlaid by its DiskDxCountLimit.
+	auto split_hash = entries[split].hash;
+
+	auto new_window = co_await accessWindow(new_offset);
+	auto new_count_limit = reinterpret_cast<DiskDxCountLimit *>(
+			new_window->access(new_offset + sizeof(DiskDirEntry)));
+	auto new_entries = reinterpret_cast<DiskDxEntry *>(new_count_limit);
+	memcpy(new_entries, &entries[split], (count - split) * sizeof(DiskDxEntry));
+	new_count_limit->limit = count_limit->limit;
+	new_count_limit->count = count - split;
+	count_limit->count = split;
+	markDirty(new_offset, new_offset + fs.blockSize);
+	markDirty(frame.blockOffset, frame.blockOffset + fs.blockSize);
+
+	auto parent_window = co_await accessWindow(parent.blockOffset);
+	auto parent_count_limit = reinterpret_cast<DiskDxCountLimit *>(
+			parent_window->access(parent.blockOffset + parent.entriesOffset));
+	auto parent_entries = reinterpret_cast<DiskDxEntry *>(parent_count_limit);
+	assert(parent_count_limit->count < parent_count_limit->limit);
+	memmove(&parent_entries[parent.position + 2], &parent_entries[parent.position + 1],
+			(parent_count_limit->count - parent.position - 1) * sizeof(DiskDxEntry));
+	parent_entries[parent.position + 1].hash = split_hash;
+	parent_entries[parent.position + 1].block = new_block;
+	parent_count_limit->count++;
+	markDirty(parent.blockOffset, parent.blockOffset + fs.blockSize);
+	co_return IndexResult::success;
+}
+
+async::result<std::optional<uint64_t>> Inode::appendBlock() {
+	auto offset = fileSize();
+	assert(!(offset & (fs.blockSize - 1)));
+	if(co_await fs.assignDataBlocks(this, offset >> fs.blockShift, 1)
+			!= protocols::fs::Error::none)
+		co_return std::nullopt;
+
+	HEL_CHECK(helResizeMemory(backingMemory,
+			(offset + fs.blockSize + 0xFFF) & ~size_t(0xFFF)));
+	setFileSize(offset + fs.blockSize);
+
+	markInodeDirty();
+
+	// Initialize the block with an unused entry that spans the whole block.
+	auto window = co_await accessWindow(offset);
+	memset(window->access(offset), 0, fs.blockSize);
+	auto disk_entry = reinterpret_cast<DiskDirEntry *>(window->access(offset));
+	disk_entry->recordLength = fs.blockSize;
+	markDirty(offset, offset + fs.blockSize);
+
+	co_return offset;
+}
+
+void Inode::dropIndex() {
+	std::cout << "\e[33m" "ext2fs: Turning inode " << number
+			<< " into a linear directory\e[39m" << std::endl;
+
+	// The index blocks look like empty directory blocks, hence we only clear the flag.
+	diskInode()->flags &= ~EXT2_INDEX_FL;
+
+	markInodeDirty();
+}
+
+async::result<std::optional<DirEntry>>
+Inode::findEntry(std::string name) {
 	assert(!name.empty() && name != "." && name != "..");
 
 	co_await readyJump.async_wait();
 
-	helix::LockMemoryView lock_memory;
-	auto map_size = (fileSize() + 0xFFF) & ~size_t(0xFFF);
-	auto &&submit = helix::submitLockMemoryView(helix::BorrowedDescriptor(frontalMemory),
-			&lock_memory,
-			0, map_size, helix::Dispatcher::global());
-	co_await submit.async_wait();
-	HEL_CHECK(lock_memory.error());
+	auto location = co_await locateEntry(name);
+	if(!location)
+		co_return std::nullopt;
 
-	// Map the page cache into the address space.
-	helix::Mapping file_map{helix::BorrowedDescriptor{frontalMemory},
-			0, map_size,
-			kHelMapProtRead | kHelMapProtWrite | kHelMapDontRequireBacking};
+	auto window = co_await accessWindow(location->offset);
+	auto disk_entry = reinterpret_cast<DiskDirEntry *>(window->access(location->offset));
 
-	// Read the directory structure.
-	DiskDirEntry *previous_entry = nullptr;
-	uintptr_t offset = 0;
-	while(offset < fileSize()) {
-		assert(!(offset & 3));
-		assert(offset + sizeof(DiskDirEntry) <= fileSize());
-		auto disk_entry = reinterpret_cast<DiskDirEntry *>(
-				reinterpret_cast<char *>(file_map.get()) + offset);
+	DirEntry entry;
+	entry.inode = disk_entry->inode;
+	entry.fileType = fileTypeOfEntry(disk_entry);
+	co_return entry;
+}
 
-		if(disk_entry->inode
-				&& name.length() == disk_entry->nameLength
-				&& !memcmp(disk_entry->name, name.data(), name.length())) {
-			// The directory should start with "." and "..". As those entries are never deleted,
-			// we can assume that a previous entry exists.
-			assert(previous_entry);
-			previous_entry->recordLength += disk_entry->recordLength;
-			co_return;
+async::result<std::optional<DirEntry>>
+Inode::link(std::string name, int64_t ino, blockfs::FileType type) {
+	assert(!name.empty() && name != "." && name != "..");
+	assert(ino);
+
+	co_await readyJump.async_wait();
+
+	bool inserted = false;
+	if(isIndexed()) {
+		// In hashed directories, the entry must be inserted into the leaf
+		// that corresponds to its hash. If the leaf is full, we split it;
+		// if its parent index block is full, we grow the index and retry.
+		while(true) {
+			auto lookup = co_await lookupIndex(name);
+			if(!lookup)
+				break;
+			auto leaf_offset = uint64_t{lookup->leafBlock} << fs.blockShift;
+			inserted = co_await insertEntry(leaf_offset, leaf_offset + fs.blockSize,
+					name, ino, type);
+			if(inserted)
+				break;
+			auto split = co_await splitLeaf(*lookup, name, ino, type);
+			if(split == IndexResult::success) {
+				inserted = true;
+				break;
+			}
+			if(split == IndexResult::noRoom)
+				split = co_await growIndex(*lookup);
+			if(split == IndexResult::noSpace)
+				co_return std::nullopt;
+			if(split != IndexResult::success)
+				break;
 		}
 
-		offset += disk_entry->recordLength;
-		previous_entry = disk_entry;
+		// Fall back to a linear directory if the index is corrupted,
+		// if it already has the maximal depth or if the leaf cannot be split.
+		if(!inserted)
+			dropIndex();
+	}
+
+	if(!inserted)
+		inserted = co_await insertEntry(0, fileSize(), name, ino, type);
+	if(!inserted) {
+		auto offset = co_await appendBlock();
+		if(!offset)
+			co_return std::nullopt;
+		inserted = co_await insertEntry(*offset, *offset + fs.blockSize, name, ino, type);
+		assert(inserted);
 	}
-	assert(offset == fileSize());
 
-	throw std::runtime_error("Given link does not exist");
+	// Update the inode.
+	auto target = fs.accessInode(ino);
+	co_await target->readyJump.async_wait();
+	target->diskInode()->linksCount++;
+
+	target->markInodeDirty();
+
+	DirEntry entry;
+	entry.inode = ino;
+	entry.fileType = type;
+	co_return entry;
+}
+
+async::result<void> Inode::unlink(std::string name) {
+	assert(!name.empty() && name != "." && name != "..");
+
+	co_await readyJump.async_wait();
+
+	auto location = co_await locateEntry(name);
+	if(!location)
+		throw std::runtime_error("Given link does not exist");
+
+	auto window = co_await accessWindow(location->offset);
+	auto disk_entry = reinterpret_cast<DiskDirEntry *>(window->access(location->offset));
+	if(location->previous) {
+		// Merge the entry into its predecessor. Both are in the same block, hence
+		// they are also in the same window.
+		auto previous_entry = reinterpret_cast<DiskDirEntry *>(
+				window->access(*location->previous));
+		previous_entry->recordLength += disk_entry->recordLength;
+		markDirty(*location->previous, location->offset + sizeof(DiskDirEntry));
+	}else{
+		// The entry starts a block; mark it as unused.
+		disk_entry->inode = 0;
+		markDirty(location->offset, location->offset + sizeof(DiskDirEntry));
+	}
 }
 
 async::result<std::optional<DirEntry>> Inode::mkdir(std::string name) {
@@ -216,23 +1036,14 @@ async::result<std::optional<DirEntry>> Inode::mkdir(std::string name) {
 
 	co_await readyJump.async_wait();
 
-	auto dir_node = co_await fs.createDirectory();
+	auto dir_node = co_await fs.createDirectory(number);
 	co_await dir_node->readyJump.async_wait();
 
-	co_await fs.assignDataBlocks(dir_node.get(), 0, 1);
-
-	helix::LockMemoryView lock_memory;
-	auto map_size = (dir_node->fileSize() + 0xFFF) & ~size_t(0xFFF);
-	auto &&submit = helix::submitLockMemoryView(helix::BorrowedDescriptor(dir_node->frontalMemory),
-			&lock_memory,
-			0, map_size, helix::Dispatcher::global());
-	co_await submit.async_wait();
-	HEL_CHECK(lock_memory.error());
+	// TODO: Free the inode if we run out of space.
+	if(co_await fs.assignDataBlocks(dir_node.get(), 0, 1) != protocols::fs::Error::none)
+		co_return std::nullopt;
 
-	// Map the page cache into the address space.
-	helix::Mapping file_map{helix::BorrowedDescriptor{dir_node->frontalMemory},
-			0, map_size,
-			kHelMapProtRead | kHelMapProtWrite | kHelMapDontRequireBacking};
+	auto window = co_await dir_node->accessWindow(0);
 
 	// XXX: this is a hack to make the directory accessible under
 	// OSes that respect the permissions, this means "drwxr-xr-x"
@@ -240,7 +1051,7 @@ async::result<std::optional<DirEntry>> Inode::mkdir(std::string name) {
 
 	size_t offset = 0;
 
-	auto dot_entry = reinterpret_cast<DiskDirEntry *>(file_map.get());
+	auto dot_entry = reinterpret_cast<DiskDirEntry *>(window->access(0));
 	offset += (sizeof(DiskDirEntry) + 1 + 3) & ~size_t(3);
 
 	dot_entry->inode = dir_node->number;
@@ -249,19 +1060,16 @@ async::result<std::optional<DirEntry>> Inode::mkdir(std::string name) {
 	dot_entry->fileType = EXT2_FT_DIR;
 	memcpy(dot_entry->name, ".", 1);
 
-	auto dot_dot_entry = reinterpret_cast<DiskDirEntry *>(
-			reinterpret_cast<char *>(file_map.get()) + offset);
+	auto dot_dot_entry = reinterpret_cast<DiskDirEntry *>(window->access(offset));
 
 	dot_dot_entry->inode = number;
 	dot_dot_entry->recordLength = dir_node->fileSize() - offset;
 	dot_dot_entry->nameLength = 2;
 	dot_dot_entry->fileType = EXT2_FT_DIR;
 	memcpy(dot_dot_entry->name, "..", 2);
+	dir_node->markDirty(0, dir_node->fileSize());
 
-	auto inode_address = (dir_node->number - 1) * fs.inodeSize;
-	dir_node->diskMapping = helix::Mapping{fs.inodeTable,
-			inode_address, fs.inodeSize,
-			kHelMapProtWrite | kHelMapProtRead | kHelMapDontRequireBacking};
+	dir_node->markInodeDirty();
 
 	co_return co_await link(name, dir_node->number, kTypeDirectory);
 }
@@ -275,11 +1083,12 @@ FileSystem::FileSystem(BlockDevice *device)
 }
 
 async::result<void> FileSystem::init() {
-	std::vector<uint8_t> buffer(1024);
-	co_await device->readSectors(2, buffer.data(), 2);
+	// We keep the superblock in memory to update its free block and inode counts.
+	superblockBuffer = malloc(1024);
+	co_await device->readSectors(2, superblockBuffer, 2);
 
 	DiskSuperblock sb;
-	memcpy(&sb, buffer.data(), sizeof(DiskSuperblock));
+	memcpy(&sb, superblockBuffer, sizeof(DiskSuperblock));
 	assert(sb.magic == 0xEF53);
 
 	inodeSize = sb.inodeSize;
@@ -289,7 +1098,16 @@ async::result<void> FileSystem::init() {
 	sectorsPerBlock = blockSize / 512;
 	blocksPerGroup = sb.blocksPerGroup;
 	inodesPerGroup = sb.inodesPerGroup;
-	numBlockGroups = (sb.blocksCount + (sb.blocksPerGroup - 1)) / sb.blocksPerGroup;
+	blocksCount = sb.blocksCount;
+	inodesCount = sb.inodesCount;
+	firstDataBlock = sb.firstDataBlock;
+	numBlockGroups = (sb.blocksCount - sb.firstDataBlock
+			+ (sb.blocksPerGroup - 1)) / sb.blocksPerGroup;
+
+	hasDirIndex = sb.featureCompat & EXT2_FEATURE_COMPAT_DIR_INDEX;
+	unsignedHash = sb.flags & EXT2_FLAGS_UNSIGNED_HASH;
+	maxIndexDepth = (sb.featureIncompat & EXT4_FEATURE_INCOMPAT_LARGEDIR) ? maxIndexLevels : 2;
+	memcpy(hashSeed, sb.hashSeed, sizeof(hashSeed));
 
 	if(logSuperblock) {
 		std::cout << "ext2fs: Revision is: " << sb.revLevel << std::endl;
@@ -311,7 +1129,8 @@ async::result<void> FileSystem::init() {
 	blockGroupDescriptorBuffer = malloc(bgdt_size);
 
 	auto bgdt_offset = (2048 + blockSize - 1) & ~size_t(blockSize - 1);
-	co_await device->readSectors((bgdt_offset >> blockShift) * sectorsPerBlock,
+	groupDescriptorSector = (bgdt_offset >> blockShift) * sectorsPerBlock;
+	co_await device->readSectors(groupDescriptorSector,
 			blockGroupDescriptorBuffer, bgdt_size / 512);
 
 	// Create memory bundles to manage the block and inode bitmaps.
@@ -337,6 +1156,8 @@ async::result<void> FileSystem::init() {
 
 	manageInodeTable(helix::UniqueDescriptor{inode_table_backing});
 
+	runWriteback();
+
 	co_return;
 }
 
@@ -472,8 +1293,8 @@ auto FileSystem::accessInode(uint32_t number) -> std::shared_ptr<Inode> {
 	return new_inode;
 }
 
-async::result<std::shared_ptr<Inode>> FileSystem::createRegular() {
-	auto ino = co_await allocateInode();
+async::result<std::shared_ptr<Inode>> FileSystem::createRegular(uint32_t parent) {
+	auto ino = co_await allocateInode(parent, false);
 	assert(ino);
 
 	// Lock and map the inode table.
@@ -500,8 +1321,8 @@ async::result<std::shared_ptr<Inode>> FileSystem::createRegular() {
 	co_return accessInode(ino);
 }
 
-async::result<std::shared_ptr<Inode>> FileSystem::createDirectory() {
-	auto ino = co_await allocateInode();
+async::result<std::shared_ptr<Inode>> FileSystem::createDirectory(uint32_t parent) {
+	auto ino = co_await allocateInode(parent, true);
 	assert(ino);
 
 	// Lock and map the inode table.
@@ -529,51 +1350,65 @@ async::result<std::shared_ptr<Inode>> FileSystem::createDirectory() {
 	co_return accessInode(ino);
 }
 
-async::result<void> FileSystem::write(Inode *inode, uint64_t offset,
+async::result<protocols::fs::Error> FileSystem::write(Inode *inode, uint64_t offset,
 		const void *buffer, size_t length) {
 	co_await inode->readyJump.async_wait();
 
 	// Make sure that data blocks are allocated.
 	auto block_offset = (offset & ~(blockSize - 1)) >> blockShift;
 	auto block_count = ((offset & (blockSize - 1)) + length + (blockSize - 1)) >> blockShift;
-	co_await assignDataBlocks(inode, block_offset, block_count);
+	auto error = co_await assignDataBlocks(inode, block_offset, block_count);
+	if(error != protocols::fs::Error::none)
+		co_return error;
 
 	// Resize the file if necessary.
 	if(offset + length > inode->fileSize()) {
 		HEL_CHECK(helResizeMemory(inode->backingMemory,
 				(offset + length + 0xFFF) & ~size_t(0xFFF)));
 		inode->setFileSize(offset + length);
+		markLargeFile(offset + length);
 
-		// Notify the kernel that the inode might have changed.
-		// Hack: For now, we just remap the inode to make sure the dirty bit is checked.
-		auto inode_address = (inode->number - 1) * inodeSize;
-
-		inode->diskMapping = helix::Mapping{inodeTable,
-				inode_address, inodeSize,
-				kHelMapProtWrite | kHelMapProtRead | kHelMapDontRequireBacking};
+		inode->markInodeDirty();
 	}
 
-	auto map_offset = offset & ~size_t(0xFFF);
-	auto map_size = ((offset & size_t(0xFFF)) + length + 0xFFF) & ~size_t(0xFFF);
+	co_await inode->writeCache(offset, buffer, length);
+	co_return protocols::fs::Error::none;
+}
 
-	helix::LockMemoryView lock_memory;
-	auto &&submit = helix::submitLockMemoryView(helix::BorrowedDescriptor(inode->frontalMemory),
-			&lock_memory, map_offset, map_size, helix::Dispatcher::global());
-	co_await submit.async_wait();
-	HEL_CHECK(lock_memory.error());
+void FileSystem::cacheWindow(std::shared_ptr<MappingWindow> window) {
+	assert(!window->isCached);
+	auto inode = window->inode;
+	auto index = window->offset / windowSize;
+	assert(inode->windows.find(index) == inode->windows.end());
 
-	// Map the page cache into the address space.
-	helix::Mapping file_map{helix::BorrowedDescriptor{inode->frontalMemory},
-			static_cast<ptrdiff_t>(map_offset), map_size,
-			kHelMapProtWrite | kHelMapDontRequireBacking};
+	windowLru.push_front(window.get());
+	window->lruPosition = windowLru.begin();
+	window->isCached = true;
+	inode->windows.emplace(index, std::move(window));
 
-	memcpy(reinterpret_cast<char *>(file_map.get()) + (offset - map_offset),
-			buffer, length);
+	while(windowLru.size() > maxCachedWindows)
+		uncacheWindow(windowLru.back());
 }
 
-async::detached FileSystem::initiateInode(std::shared_ptr<Inode> inode) {
-	// TODO: Use a shift instead of a division.
-	auto inode_address = (inode->number - 1) * inodeSize;
+void FileSystem::touchWindow(MappingWindow *window) {
+	assert(window->isCached);
+	windowLru.splice(windowLru.begin(), windowLru, window->lruPosition);
+}
+
+void FileSystem::uncacheWindow(MappingWindow *window) {
+	assert(window->isCached);
+	windowLru.erase(window->lruPosition);
+	window->isCached = false;
+
+	// This might destruct the window.
+	auto erased = window->inode->windows.erase(window->offset / windowSize);
+	assert(erased);
+	(void)erased;
+}
+
+async::detached FileSystem::initiateInode(std::shared_ptr<Inode> inode) {
+	// TODO: Use a shift instead of a division.
+	auto inode_address = (inode->number - 1) * inodeSize;
 
 	helix::LockMemoryView lock_inode;
 	auto &&submit = helix::submitLockMemoryView(inodeTable,
@@ -601,7 +1436,6 @@ async::detached FileSystem::initiateInode(std::shared_ptr<Inode> inode) {
 		abort();
 	}
 
-	// TODO: support large files
 	inode->fileData = disk_inode->data;
 
 	// filter out the file type from the mode
@@ -631,7 +1465,7 @@ async::detached FileSystem::initiateInode(std::shared_ptr<Inode> inode) {
 	HelHandle backingOrder1, backingOrder2;
 	HEL_CHECK(helCreateManagedMemory(3 << blockPagesShift,
 			kHelAllocBacked, &backingOrder1, &frontalOrder1));
-	HEL_CHECK(helCreateManagedMemory((blockSize / 4) << blockPagesShift,
+	HEL_CHECK(helCreateManagedMemory(2 * (blockSize / 4) << blockPagesShift,
 			kHelAllocBacked, &backingOrder2, &frontalOrder2));
 	inode->indirectOrder1 = helix::UniqueDescriptor{frontalOrder1};
 	inode->indirectOrder2 = helix::UniqueDescriptor{frontalOrder2};
@@ -651,6 +1485,9 @@ async::detached FileSystem::manageFileData(std::shared_ptr<Inode> inode) {
 		assert(manage.offset() + manage.length() <= ((inode->fileSize() + 0xFFF) & ~size_t(0xFFF)));
 
 		if(manage.type() == kHelManageInitialize) {
+			// Issue read-ahead first such that the kernel can queue it behind this request.
+			updateReadahead(inode, manage.offset(), manage.length());
+
 			helix::Mapping file_map{helix::BorrowedDescriptor{inode->backingMemory},
 					static_cast<ptrdiff_t>(manage.offset()), manage.length(), kHelMapProtWrite};
 
@@ -667,6 +1504,9 @@ async::detached FileSystem::manageFileData(std::shared_ptr<Inode> inode) {
 		}else{
 			assert(manage.type() == kHelManageWriteback);
 
+			// All windows that were unmapped until now are covered by this writeback.
+			auto epoch = inode->writebackEpoch;
+
 			helix::Mapping file_map{helix::BorrowedDescriptor{inode->backingMemory},
 					static_cast<ptrdiff_t>(manage.offset()), manage.length(), kHelMapProtRead};
 
@@ -680,10 +1520,196 @@ async::detached FileSystem::manageFileData(std::shared_ptr<Inode> inode) {
 
 			HEL_CHECK(helUpdateMemory(inode->backingMemory, kHelManageWriteback,
 					manage.offset(), manage.length()));
+			inode->markClean(manage.offset(), manage.offset() + manage.length(), epoch);
 		}
 	}
 }
 
+void FileSystem::updateReadahead(std::shared_ptr<Inode> inode,
+		uint64_t offset, size_t length) {
+	auto &state = inode->readahead;
+
+	// Requests for our own read-ahead windows do not tell us anything about the reader.
+	if(offset >= state.windowBegin && offset < state.windowEnd)
+		return;
+
+	auto window_pages = (state.windowEnd - state.windowBegin) >> pageShift;
+	if(offset != state.nextOffset) {
+		// Random access; forget about the stream.
+		readaheadStats.wastedPages += window_pages;
+		state.nextOffset = offset + length;
+		state.windowSize = 0;
+		state.windowBegin = 0;
+		state.windowEnd = 0;
+		return;
+	}
+
+	// The reader consumed the last window (or this is the first sequential access).
+	readaheadStats.hitPages += window_pages;
+	if(!state.windowSize) {
+		state.windowSize = initialReadahead;
+	}else{
+		state.windowSize = std::min(2 * state.windowSize, maxReadahead);
+	}
+
+	auto memory_size = (inode->fileSize() + 0xFFF) & ~uint64_t(0xFFF);
+	auto begin = std::min(offset + length, memory_size);
+	auto end = std::min(begin + state.windowSize, memory_size);
+	state.windowBegin = begin;
+	state.windowEnd = end;
+	state.nextOffset = end;
+	if(begin == end)
+		return;
+
+	readaheadStats.windows++;
+	readaheadStats.prefetchedPages += (end - begin) >> pageShift;
+	prefetchFileData(std::move(inode), begin, end - begin);
+}
+
+async::detached FileSystem::prefetchFileData(std::shared_ptr<Inode> inode,
+		uint64_t offset, size_t length) {
+	// Locking the frontal memory makes the kernel load all missing pages.
+	// Since the pages are queued at once, the kernel fuses them into large requests.
+	helix::LockMemoryView lock_memory;
+	auto &&submit = helix::submitLockMemoryView(helix::BorrowedDescriptor{inode->frontalMemory},
+			&lock_memory, offset, length, helix::Dispatcher::global());
+	co_await submit.async_wait();
+	HEL_CHECK(lock_memory.error());
+
+	// Dropping the lock leaves the pages in the page cache.
+}
+
+async::detached FileSystem::runWriteback() {
+	while(true) {
+		uint64_t tick;
+		HEL_CHECK(helGetClock(&tick));
+
+		helix::AwaitClock await_clock;
+		auto &&submit = helix::submitAwaitClock(&await_clock, tick + writebackInterval,
+				helix::Dispatcher::global());
+		co_await submit.async_wait();
+		HEL_CHECK(await_clock.error());
+
+		uint64_t now;
+		HEL_CHECK(helGetClock(&now));
+		for(auto &inode : dirtyInodes)
+			if(inode->dirtySince + writebackAge <= now)
+				startWriteback(inode.get());
+
+		// Report the read-ahead statistics, but only if read-ahead was active since the last report.
+		if(logReadahead && readaheadStats.windows != reportedReadaheadWindows
+				&& lastReadaheadReport + readaheadReportInterval <= now) {
+			std::cout << "ext2fs: Read-ahead issued " << readaheadStats.windows << " windows ("
+					<< readaheadStats.prefetchedPages << " pages), "
+					<< readaheadStats.hitPages << " pages hit, "
+					<< readaheadStats.wastedPages << " pages wasted" << std::endl;
+			reportedReadaheadWindows = readaheadStats.windows;
+			lastReadaheadReport = now;
+		}
+	}
+}
+
+void FileSystem::startWriteback(Inode *inode) {
+	std::vector<MappingWindow *> victims;
+	for(auto &entry : inode->windows) {
+		auto window = entry.second.get();
+
+		// Only unmap windows that overlap a dirty range.
+		auto it = inode->dirtyRanges.lower_bound(window->offset + window->length);
+		if(it == inode->dirtyRanges.begin())
+			continue;
+		if(std::prev(it)->second.end <= window->offset)
+			continue;
+		victims.push_back(window);
+	}
+
+	// The kernel queues writebacks in the order in which the pages are unmapped.
+	// Unmapping in ascending order lets it fuse adjacent pages into large requests.
+	std::sort(victims.begin(), victims.end(), [] (MappingWindow *a, MappingWindow *b) {
+		return a->offset < b->offset;
+	});
+	for(auto window : victims)
+		uncacheWindow(window);
+}
+
+async::result<protocols::fs::Error> FileSystem::sync(std::shared_ptr<Inode> inode,
+		protocols::fs::SyncMode mode) {
+	// Pages that clients dirtied through their own mappings of the page cache are
+	// only noticed (and written back) once the kernel unmaps or evicts them.
+	// We still write back everything that we know about.
+	if(mode != protocols::fs::SyncMode::fileSystem) {
+		co_await syncInode(std::move(inode), mode);
+	}else{
+		co_await syncAllInodes();
+	}
+
+	// The file might depend on blocks and inodes that were allocated by other files.
+	while(flushingBitmaps)
+		co_await bitmapsFlushed.async_wait();
+	while(flushingDescriptors)
+		co_await descriptorsFlushed.async_wait();
+
+	co_await device->flush();
+	co_return protocols::fs::Error::none;
+}
+
+async::result<void> FileSystem::syncAllInodes() {
+	// Collect the inodes first since syncInode() changes dirtyInodes.
+	std::vector<std::shared_ptr<Inode>> inodes;
+	for(auto &entry : activeInodes) {
+		auto active = entry.second.lock();
+		if(active && active->diskInodeDirty)
+			inodes.push_back(std::move(active));
+	}
+	for(auto &dirty : dirtyInodes)
+		if(!dirty->diskInodeDirty)
+			inodes.push_back(dirty);
+
+	// Start writeback of all inodes before waiting such that it can proceed in parallel.
+	for(auto &dirty : inodes)
+		startWriteback(dirty.get());
+	for(auto &dirty : inodes)
+		co_await syncInode(dirty, protocols::fs::SyncMode::file);
+}
+
+async::result<void> FileSystem::syncInode(std::shared_ptr<Inode> inode,
+		protocols::fs::SyncMode mode) {
+	co_await inode->readyJump.async_wait();
+
+	// Only wait for data that was written before the sync started.
+	// Otherwise, concurrent writers could delay us indefinitely.
+	auto snapshot = inode->dirtyRanges;
+	auto it = inode->syncSnapshots.insert(inode->syncSnapshots.end(), &snapshot);
+
+	startWriteback(inode.get());
+	while(!snapshot.empty()) {
+		// Windows that were in use during the last call might have been cached again.
+		co_await inode->writebackDoorbell.async_wait();
+		startWriteback(inode.get());
+	}
+	inode->syncSnapshots.erase(it);
+
+	// We do not track timestamps, hence the on-disk inode only changes if the size
+	// or the block mapping changes. fdatasync() has to write those changes, too.
+	(void)mode;
+	if(inode->diskInodeDirty)
+		co_await writeDiskInode(inode.get());
+}
+
+async::result<void> FileSystem::writeDiskInode(Inode *inode) {
+	auto bg_idx = groupOfInode(inode->number);
+	auto bgdt = reinterpret_cast<DiskGroupDesc *>(blockGroupDescriptorBuffer);
+	auto table_offset = uint64_t{(inode->number - 1) % inodesPerGroup} * inodeSize;
+
+	// The inode table is mapped in units of pages, hence the whole sector is mapped.
+	auto sector = uint64_t{bgdt[bg_idx].inodeTable} * sectorsPerBlock + table_offset / 512;
+	auto buffer = reinterpret_cast<char *>(inode->diskMapping.get()) - (table_offset & 511);
+
+	// Modifications that happen while we write set the flag again.
+	inode->diskInodeDirty = false;
+	co_await device->writeSectors(sector, buffer, 1);
+}
+
 async::detached FileSystem::manageIndirect(std::shared_ptr<Inode> inode,
 		int order, helix::UniqueDescriptor memory) {
 	while(true) {
@@ -753,8 +1779,141 @@ async::detached FileSystem::manageIndirect(std::shared_ptr<Inode> inode,
 	}
 }
 
-async::result<uint32_t> FileSystem::allocateBlock() {
-	int64_t bg_idx = 0;
+namespace {
+
+// Returns the first clear (or set) bit in [from, limit) or limit if there is none.
+// Bit i of the bitmap is bit (i % 64) of the little-endian word i / 64.
+template<bool Set>
+size_t findBit(const uint64_t *words, size_t from, size_t limit) {
+	while(from < limit) {
+		auto w = from / 64;
+		auto candidates = (Set ? words[w] : ~words[w]) & (~uint64_t{0} << (from % 64));
+		if(candidates)
+			return std::min(w * 64 + __builtin_ctzll(candidates), limit);
+		from = (w + 1) * 64;
+	}
+	return limit;
+}
+
+// Finds a run of at most count clear bits. The search starts at start and wraps around.
+// Returns the first bit and the length of the run (which is zero if all bits are set).
+std::pair<size_t, size_t> findClearRun(const uint64_t *words, size_t num_bits,
+		size_t start, size_t count) {
+	auto bit = findBit<false>(words, start, num_bits);
+	if(bit == num_bits) {
+		bit = findBit<false>(words, 0, start);
+		if(bit == start)
+			return {0, 0};
+	}
+	auto end = findBit<true>(words, bit, std::min(num_bits, bit + count));
+	return {bit, end - bit};
+}
+
+void setBits(uint64_t *words, size_t first, size_t count) {
+	while(count) {
+		auto w = first / 64;
+		auto shift = first % 64;
+		auto chunk = std::min(count, 64 - shift);
+		auto mask = (chunk == 64) ? ~uint64_t{0} : ((uint64_t{1} << chunk) - 1) << shift;
+		assert(!(words[w] & mask));
+		words[w] |= mask;
+		first += chunk;
+		count -= chunk;
+	}
+}
+
+void clearBits(uint64_t *words, size_t first, size_t count) {
+	while(count) {
+		auto w = first / 64;
+		auto shift = first % 64;
+		auto chunk = std::min(count, 64 - shift);
+		auto mask = (chunk == 64) ? ~uint64_t{0} : ((uint64_t{1} << chunk) - 1) << shift;
+		assert((words[w] & mask) == mask);
+		words[w] &= ~mask;
+		first += chunk;
+		count -= chunk;
+	}
+}
+
+} // anonymous namespace
+
+uint32_t FileSystem::groupOfInode(uint32_t ino) {
+	return (ino - 1) / inodesPerGroup;
+}
+
+uint32_t FileSystem::blocksInGroup(uint32_t bg_idx) {
+	if(bg_idx + 1 < numBlockGroups)
+		return blocksPerGroup;
+	return blocksCount - firstDataBlock - bg_idx * blocksPerGroup;
+}
+
+async::result<std::pair<uint32_t, size_t>>
+FileSystem::allocateBlocks(uint32_t goal, size_t count) {
+	assert(count);
+	if(goal < firstDataBlock || goal >= blocksCount)
+		goal = firstDataBlock;
+	auto goal_group = (goal - firstDataBlock) / blocksPerGroup;
+
+	auto bgdt = reinterpret_cast<DiskGroupDesc *>(blockGroupDescriptorBuffer);
+	for(uint32_t k = 0; k < numBlockGroups; k++) {
+		auto bg_idx = (goal_group + k) % numBlockGroups;
+		if(!bgdt[bg_idx].freeBlocksCount)
+			continue;
+
+		helix::LockMemoryView lock_bitmap;
+		auto &&submit_bitmap = helix::submitLockMemoryView(blockBitmap,
+				&lock_bitmap,
+				bg_idx << blockPagesShift, 1 << blockPagesShift,
+				helix::Dispatcher::global());
+		co_await submit_bitmap.async_wait();
+		HEL_CHECK(lock_bitmap.error());
+
+		helix::Mapping bitmap_map{blockBitmap,
+				bg_idx << blockPagesShift, size_t{1} << blockPagesShift,
+				kHelMapProtRead | kHelMapProtWrite | kHelMapDontRequireBacking};
+
+		// Only honor the goal within its own group; other groups are searched from the start.
+		size_t start = 0;
+		if(!k)
+			start = (goal - firstDataBlock) % blocksPerGroup;
+
+		// TODO: Make sure we never return reserved blocks.
+		auto words = reinterpret_cast<uint64_t *>(bitmap_map.get());
+		auto [bit, length] = findClearRun(words, blocksInGroup(bg_idx), start, count);
+		if(!length) {
+			std::cout << "\e[33m" "ext2fs: Block group " << bg_idx
+					<< " has no free blocks, but its descriptor disagrees\e[39m" << std::endl;
+			continue;
+		}
+		setBits(words, bit, length);
+		markBlockBitmapDirty(bg_idx);
+
+		assert(bgdt[bg_idx].freeBlocksCount >= length);
+		bgdt[bg_idx].freeBlocksCount -= length;
+		markGroupDescriptorDirty(bg_idx);
+
+		auto disk_sb = reinterpret_cast<DiskSuperblock *>(superblockBuffer);
+		disk_sb->freeBlocksCount -= std::min(uint32_t(length), disk_sb->freeBlocksCount);
+		markSuperblockDirty();
+
+		auto block = firstDataBlock + bg_idx * blocksPerGroup + bit;
+		assert(block != 0);
+		co_return std::pair<uint32_t, size_t>{block, length};
+	}
+
+	co_return std::pair<uint32_t, size_t>{0, 0};
+}
+
+async::result<uint32_t> FileSystem::allocateBlock(uint32_t goal) {
+	auto [block, length] = co_await allocateBlocks(goal, 1);
+	(void)length;
+	co_return block;
+}
+
+async::result<void> FileSystem::freeBlocks(uint32_t block, size_t count) {
+	auto bg_idx = (block - firstDataBlock) / blocksPerGroup;
+	auto bit = (block - firstDataBlock) % blocksPerGroup;
+	assert(bit + count <= blocksInGroup(bg_idx));
 
 	helix::LockMemoryView lock_bitmap;
 	auto &&submit_bitmap = helix::submitLockMemoryView(blockBitmap,
@@ -768,32 +1927,48 @@ async::result<uint32_t> FileSystem::allocateBlock() {
 			bg_idx << blockPagesShift, size_t{1} << blockPagesShift,
 			kHelMapProtRead | kHelMapProtWrite | kHelMapDontRequireBacking};
 
-	// TODO: Update the block group descriptor table.
+	clearBits(reinterpret_cast<uint64_t *>(bitmap_map.get()), bit, count);
+	markBlockBitmapDirty(bg_idx);
 
-	auto words = reinterpret_cast<uint32_t *>(bitmap_map.get());
-	for(int i = 0; i < (blocksPerGroup + 31) / 32; i++) {
-		if(words[i] == 0xFFFFFFFF)
-			continue;
-		for(int j = 0; j < 32; j++) {
-			if(words[i] & (static_cast<uint32_t>(1) << j))
+	auto bgdt = reinterpret_cast<DiskGroupDesc *>(blockGroupDescriptorBuffer);
+	bgdt[bg_idx].freeBlocksCount += count;
+	markGroupDescriptorDirty(bg_idx);
+
+	auto disk_sb = reinterpret_cast<DiskSuperblock *>(superblockBuffer);
+	disk_sb->freeBlocksCount += count;
+	markSuperblockDirty();
+}
+
+async::result<uint32_t> FileSystem::allocateInode(uint32_t parent, bool directory) {
+	auto bgdt = reinterpret_cast<DiskGroupDesc *>(blockGroupDescriptorBuffer);
+
+	// Regular files are placed in the group of their parent directory.
+	// Directories are spread out: we prefer the group with the most free blocks among
+	// the groups that have an above-average number of free inodes.
+	auto goal_group = groupOfInode(parent);
+	if(directory) {
+		uint64_t total_free_inodes = 0;
+		for(uint32_t bg_idx = 0; bg_idx < numBlockGroups; bg_idx++)
+			total_free_inodes += bgdt[bg_idx].freeInodesCount;
+		auto average_free_inodes = total_free_inodes / numBlockGroups;
+
+		int best_free_blocks = -1;
+		for(uint32_t bg_idx = 0; bg_idx < numBlockGroups; bg_idx++) {
+			if(!bgdt[bg_idx].freeInodesCount
+					|| bgdt[bg_idx].freeInodesCount < average_free_inodes)
 				continue;
-			// TODO: Make sure we never return reserved blocks.
-			// TODO: Make sure we never return blocks higher than the max. block in the SB.
-			auto block = bg_idx * blocksPerGroup + i * 32 + j;
-			assert(block != 0);
-			assert(block < blocksPerGroup);
-			words[i] |= static_cast<uint32_t>(1) << j;
-			co_return block;
+			if(bgdt[bg_idx].freeBlocksCount > best_free_blocks) {
+				best_free_blocks = bgdt[bg_idx].freeBlocksCount;
+				goal_group = bg_idx;
+			}
 		}
-		assert(!"Failed to find zero-bit");
 	}
 
-	co_return 0;
-}
+	for(uint32_t k = 0; k < numBlockGroups; k++) {
+		auto bg_idx = (goal_group + k) % numBlockGroups;
+		if(!bgdt[bg_idx].freeInodesCount)
+			continue;
 
-async::result<uint32_t> FileSystem::allocateInode() {
-	// TODO: Do not start at block group zero.
-	for(uint32_t bg_idx = 0; bg_idx < numBlockGroups; bg_idx++) {
 		helix::LockMemoryView lock_bitmap;
 		auto &&submit_bitmap = helix::submitLockMemoryView(inodeBitmap,
 				&lock_bitmap,
@@ -806,301 +1981,870 @@ async::result<uint32_t> FileSystem::allocateInode() {
 				bg_idx << blockPagesShift, size_t{1} << blockPagesShift,
 				kHelMapProtRead | kHelMapProtWrite | kHelMapDontRequireBacking};
 
-		// TODO: Update the block group descriptor table.
-
-		auto words = reinterpret_cast<uint32_t *>(bitmap_map.get());
-		for(int i = 0; i < (inodesPerGroup + 31) / 32; i++) {
-			if(words[i] == 0xFFFFFFFF)
-				continue;
-			for(int j = 0; j < 32; j++) {
-				if(words[i] & (static_cast<uint32_t>(1) << j))
-					continue;
-				// TODO: Make sure we never return reserved inodes.
-				// TODO: Make sure we never return inodes higher than the max. inode in the SB.
-				auto ino = bg_idx * inodesPerGroup + i * 32 + j + 1;
-				assert(ino != 0);
-				assert(ino < inodesPerGroup);
-				words[i] |= static_cast<uint32_t>(1) << j;
-				co_return ino;
-			}
-			assert(!"Failed to find zero-bit");
+		// TODO: Make sure we never return reserved inodes.
+		auto words = reinterpret_cast<uint64_t *>(bitmap_map.get());
+		auto [bit, length] = findClearRun(words, inodesPerGroup, 0, 1);
+		if(!length) {
+			std::cout << "\e[33m" "ext2fs: Block group " << bg_idx
+					<< " has no free inodes, but its descriptor disagrees\e[39m" << std::endl;
+			continue;
 		}
+		setBits(words, bit, 1);
+		markInodeBitmapDirty(bg_idx);
+
+		bgdt[bg_idx].freeInodesCount--;
+		if(directory)
+			bgdt[bg_idx].usedDirsCount++;
+		markGroupDescriptorDirty(bg_idx);
+
+		auto disk_sb = reinterpret_cast<DiskSuperblock *>(superblockBuffer);
+		if(disk_sb->freeInodesCount)
+			disk_sb->freeInodesCount--;
+		markSuperblockDirty();
+
+		auto ino = bg_idx * inodesPerGroup + bit + 1;
+		assert(ino <= inodesCount);
+		co_return ino;
 	}
 
 	co_return 0;
 }
 
-async::result<void> FileSystem::assignDataBlocks(Inode *inode,
+void FileSystem::markGroupDescriptorDirty(uint32_t bg_idx) {
+	dirtyDescriptorSectors.insert(bg_idx * sizeof(DiskGroupDesc) / 512);
+	if(!flushingDescriptors) {
+		flushingDescriptors = true;
+		flushGroupDescriptors();
+	}
+}
+
+void FileSystem::markLargeFile(uint64_t size) {
+	if(size <= 0x7FFFFFFF)
+		return;
+
+	auto disk_sb = reinterpret_cast<DiskSuperblock *>(superblockBuffer);
+	if(disk_sb->featureRoCompat & EXT2_FEATURE_RO_COMPAT_LARGE_FILE)
+		return;
+
+	// Revision 0 has no feature fields; upgrade it like Linux does.
+	if(!disk_sb->revLevel) {
+		disk_sb->revLevel = 1;
+		disk_sb->firstIno = 11;
+		disk_sb->inodeSize = 128;
+	}
+	disk_sb->featureRoCompat |= EXT2_FEATURE_RO_COMPAT_LARGE_FILE;
+	markSuperblockDirty();
+}
+
+void FileSystem::markSuperblockDirty() {
+	superblockDirty = true;
+	if(!flushingDescriptors) {
+		flushingDescriptors = true;
+		flushGroupDescriptors();
+	}
+}
+
+async::detached FileSystem::flushGroupDescriptors() {
+	// Allocations that happen while we write are picked up by the next iteration.
+	while(superblockDirty || !dirtyDescriptorSectors.empty()) {
+		if(superblockDirty) {
+			superblockDirty = false;
+			co_await device->writeSectors(2, superblockBuffer, 2);
+			continue;
+		}
+
+		auto sector = *dirtyDescriptorSectors.begin();
+		dirtyDescriptorSectors.erase(dirtyDescriptorSectors.begin());
+		co_await device->writeSectors(groupDescriptorSector + sector,
+				reinterpret_cast<char *>(blockGroupDescriptorBuffer) + sector * 512, 1);
+	}
+	flushingDescriptors = false;
+	descriptorsFlushed.ring();
+}
+
+void FileSystem::markBlockBitmapDirty(uint32_t bg_idx) {
+	dirtyBlockBitmaps.insert(bg_idx);
+	if(!flushingBitmaps) {
+		flushingBitmaps = true;
+		flushBitmaps();
+	}
+}
+
+void FileSystem::markInodeBitmapDirty(uint32_t bg_idx) {
+	dirtyInodeBitmaps.insert(bg_idx);
+	if(!flushingBitmaps) {
+		flushingBitmaps = true;
+		flushBitmaps();
+	}
+}
+
+async::detached FileSystem::flushBitmaps() {
+	// The kernel only writes the bitmaps back when they are evicted.
+	// Allocations that happen while we write are picked up by the next iteration.
+	auto bgdt = reinterpret_cast<DiskGroupDesc *>(blockGroupDescriptorBuffer);
+	while(!dirtyBlockBitmaps.empty() || !dirtyInodeBitmaps.empty()) {
+		if(!dirtyBlockBitmaps.empty()) {
+			auto bg_idx = *dirtyBlockBitmaps.begin();
+			dirtyBlockBitmaps.erase(dirtyBlockBitmaps.begin());
+			co_await writeBitmap(blockBitmap, bg_idx, bgdt[bg_idx].blockBitmap);
+		}else{
+			auto bg_idx = *dirtyInodeBitmaps.begin();
+			dirtyInodeBitmaps.erase(dirtyInodeBitmaps.begin());
+			co_await writeBitmap(inodeBitmap, bg_idx, bgdt[bg_idx].inodeBitmap);
+		}
+	}
+	flushingBitmaps = false;
+	bitmapsFlushed.ring();
+}
+
+async::result<void> FileSystem::writeBitmap(helix::BorrowedDescriptor memory,
+		uint32_t bg_idx, uint32_t block) {
+	helix::LockMemoryView lock_bitmap;
+	auto &&submit_bitmap = helix::submitLockMemoryView(memory,
+			&lock_bitmap,
+			bg_idx << blockPagesShift, 1 << blockPagesShift,
+			helix::Dispatcher::global());
+	co_await submit_bitmap.async_wait();
+	HEL_CHECK(lock_bitmap.error());
+
+	helix::Mapping bitmap_map{memory,
+			bg_idx << blockPagesShift, size_t{1} << blockPagesShift,
+			kHelMapProtRead | kHelMapDontRequireBacking};
+	co_await device->writeSectors(uint64_t{block} * sectorsPerBlock,
+			bitmap_map.get(), sectorsPerBlock);
+}
+
+async::result<protocols::fs::Error> FileSystem::assignDataBlocks(Inode *inode,
 		uint64_t block_offset, size_t num_blocks) {
-	size_t per_indirect = blockSize / 4;
-	size_t per_single = per_indirect;
-	size_t per_double = per_indirect * per_indirect;
+	int per_shift = blockShift - 2;
+	uint64_t per_indirect = uint64_t{1} << per_shift;
+	uint64_t index_mask = per_indirect - 1;
 
 	// Number of blocks that can be accessed by:
-	size_t i_range = 12; // Direct blocks only.
-	size_t s_range = i_range + per_single; // Plus the first single indirect block.
-	size_t d_range = s_range + per_double; // Plus the first double indirect block.
+	uint64_t i_range = 12; // Direct blocks only.
+	uint64_t s_range = i_range + per_indirect; // Plus the single indirect block.
+	uint64_t d_range = s_range + (per_indirect << per_shift); // Plus the double indirect block.
+	uint64_t t_range = d_range + (per_indirect << (2 * per_shift)); // Plus the triple indirect block.
+
+	if(inode->usesExtents()) {
+		// ext4 uses 32-bit logical block numbers.
+		if(block_offset + num_blocks > (uint64_t{1} << 32))
+			co_return protocols::fs::Error::fileTooBig;
+
+		// Place new blocks after the preceding block of the file or in the inode's group.
+		uint32_t goal = firstDataBlock + groupOfInode(inode->number) * blocksPerGroup;
+		if(block_offset) {
+			auto previous = co_await mapBlocks(inode, block_offset - 1, 1);
+			if(previous.physical)
+				goal = previous.physical + 1;
+		}
+
+		size_t prg = 0;
+		while(prg < num_blocks) {
+			// Blocks that are already mapped do not require us to walk the tree.
+			auto extent = co_await mapBlocks(inode, block_offset + prg, num_blocks - prg);
+			if(extent.physical) {
+				goal = extent.physical + extent.length;
+				prg += extent.length;
+				continue;
+			}
+
+			co_await inode->extentMutex.async_lock();
+			std::unique_lock<async::mutex> extent_lock{inode->extentMutex, std::adopt_lock};
+			auto n = co_await assignExtentBlocks(inode, block_offset + prg,
+					std::min(extent.length, uint64_t{num_blocks - prg}), goal);
+			if(!n)
+				co_return protocols::fs::Error::noSpaceLeft;
+			inode->forgetBlocks(block_offset + prg, block_offset + prg + n);
+			prg += n;
+		}
+		co_return protocols::fs::Error::none;
+	}
+
+	if(block_offset + num_blocks > t_range)
+		co_return protocols::fs::Error::fileTooBig;
 
 	auto disk_inode = inode->diskInode();
 
+	// Maps the frame-th block of an indirectOrderN memory object.
+	// Blocks that were just allocated are cleared.
+	auto mapIndirect = [&] (helix::BorrowedDescriptor memory, uint64_t frame,
+			bool clear) -> async::result<helix::Mapping> {
+		helix::LockMemoryView lock_indirect;
+		auto &&submit = helix::submitLockMemoryView(memory, &lock_indirect,
+				frame << blockPagesShift, 1 << blockPagesShift,
+				helix::Dispatcher::global());
+		co_await submit.async_wait();
+		HEL_CHECK(lock_indirect.error());
+
+		helix::Mapping indirect_map{memory,
+				static_cast<ptrdiff_t>(frame << blockPagesShift), size_t{1} << blockPagesShift,
+				kHelMapProtRead | kHelMapProtWrite | kHelMapDontRequireBacking};
+		if(clear)
+			memset(indirect_map.get(), 0, size_t{1} << blockPagesShift);
+		co_return indirect_map;
+	};
+
+	// The kernel only writes indirect blocks back when they are evicted.
+	auto writeIndirect = [&] (uint32_t block, const void *window) -> async::result<void> {
+		co_await device->writeSectors(uint64_t{block} * sectorsPerBlock,
+				window, sectorsPerBlock);
+	};
+
+	// Place new blocks after the preceding block of the file or in the inode's group.
+	uint32_t goal = firstDataBlock + groupOfInode(inode->number) * blocksPerGroup;
+	if(block_offset && block_offset <= i_range
+			&& disk_inode->data.blocks.direct[block_offset - 1])
+		goal = disk_inode->data.blocks.direct[block_offset - 1] + 1;
+
 	size_t prg = 0;
-	while(prg < num_blocks) {
+
+	// Allocates the data blocks that are referenced by an indirect block.
+	// The indirect block covers the logical blocks starting at base.
+	// Returns false if the disk is full.
+	auto fillIndirect = [&] (uint32_t *window, uint64_t base) -> async::result<bool> {
+		while(prg < num_blocks
+				&& block_offset + prg < base + per_indirect) {
+			auto idx = block_offset + prg - base;
+			if(window[idx]) {
+				goal = window[idx] + 1;
+				prg++;
+				continue;
+			}
+
+			// Allocate all consecutive unassigned blocks at once.
+			size_t run = 1;
+			while(prg + run < num_blocks && idx + run < per_indirect && !window[idx + run])
+				run++;
+			auto [block, length] = co_await allocateBlocks(goal, run);
+			if(!block)
+				co_return false;
+			for(size_t i = 0; i < length; i++)
+				window[idx + i] = block + i;
+			goal = block + length;
+			prg += length;
+		}
+		co_return true;
+	};
+
+	// Makes sure that an entry of an indirect block (or of the inode) references a block.
+	// Returns false if the disk is full. Sets allocated if a new block was allocated.
+	auto assignIndirect = [&] (uint32_t &entry, bool &allocated) -> async::result<bool> {
+		allocated = false;
+		if(entry)
+			co_return true;
+		auto block = co_await allocateBlock(goal);
+		if(!block)
+			co_return false;
+		entry = block;
+		goal = block + 1;
+		allocated = true;
+		co_return true;
+	};
+
+	auto error = protocols::fs::Error::none;
+	while(prg < num_blocks && error == protocols::fs::Error::none) {
 		if(block_offset + prg < i_range) {
+			auto direct = disk_inode->data.blocks.direct;
 			while(prg < num_blocks
 					&& block_offset + prg < i_range) {
 				auto idx = block_offset + prg;
-				if(disk_inode->data.blocks.direct[idx]) {
+				if(direct[idx]) {
+					goal = direct[idx] + 1;
 					prg++;
 					continue;
 				}
-				auto block = co_await allocateBlock();
-				assert(block && "Out of disk space"); // TODO: Fix this.
-				disk_inode->data.blocks.direct[idx] = block;
-				prg++;
+
+				// Allocate all consecutive unassigned blocks at once.
+				size_t run = 1;
+				while(prg + run < num_blocks && idx + run < i_range && !direct[idx + run])
+					run++;
+				auto [block, length] = co_await allocateBlocks(goal, run);
+				if(!block) {
+					error = protocols::fs::Error::noSpaceLeft;
+					break;
+				}
+				for(size_t i = 0; i < length; i++)
+					direct[idx + i] = block + i;
+				goal = block + length;
+				prg += length;
 			}
 		}else if(block_offset + prg < s_range) {
-			bool needsReset = false;
-
-			// Allocate the single-indirect block itself.
-			if(!disk_inode->data.blocks.singleIndirect) {
-				auto block = co_await allocateBlock();
-				assert(block && "Out of disk space"); // TODO: Fix this.
-				disk_inode->data.blocks.singleIndirect = block;
-				needsReset = true;
+			bool new_single;
+			if(!(co_await assignIndirect(disk_inode->data.blocks.singleIndirect, new_single))) {
+				error = protocols::fs::Error::noSpaceLeft;
+				break;
 			}
 
-			helix::LockMemoryView lock_indirect;
-			auto &&submit = helix::submitLockMemoryView(inode->indirectOrder1,
-					&lock_indirect, 0, 1 << blockPagesShift,
-					helix::Dispatcher::global());
-			co_await submit.async_wait();
-			HEL_CHECK(lock_indirect.error());
-
-			helix::Mapping indirect_map{inode->indirectOrder1,
-					0, size_t{1} << blockPagesShift,
-					kHelMapProtRead | kHelMapProtWrite | kHelMapDontRequireBacking};
-			auto window = reinterpret_cast<uint32_t *>(indirect_map.get());
+			auto single_map = co_await mapIndirect(inode->indirectOrder1, 0, new_single);
+			auto single = reinterpret_cast<uint32_t *>(single_map.get());
+			if(!(co_await fillIndirect(single, i_range)))
+				error = protocols::fs::Error::noSpaceLeft;
+			co_await writeIndirect(disk_inode->data.blocks.singleIndirect, single);
+		}else if(block_offset + prg < d_range) {
+			auto rel = block_offset + prg - s_range;
+			auto outer = rel >> per_shift;
 
-			if(needsReset)
-				memset(window, 0, size_t{1} << blockPagesShift);
+			bool new_double;
+			if(!(co_await assignIndirect(disk_inode->data.blocks.doubleIndirect, new_double))) {
+				error = protocols::fs::Error::noSpaceLeft;
+				break;
+			}
 
-			while(prg < num_blocks
-					&& block_offset + prg < s_range) {
-				auto idx = block_offset + prg - i_range;
-				if(window[idx]) {
-					prg++;
-					continue;
-				}
-				auto block = co_await allocateBlock();
-				assert(block && "Out of disk space"); // TODO: Fix this.
-				window[idx] = block;
-				prg++;
+			auto double_map = co_await mapIndirect(inode->indirectOrder1, 1, new_double);
+			auto double_window = reinterpret_cast<uint32_t *>(double_map.get());
+			bool new_leaf;
+			bool assigned = co_await assignIndirect(double_window[outer], new_leaf);
+			if(new_double || new_leaf)
+				co_await writeIndirect(disk_inode->data.blocks.doubleIndirect, double_window);
+			if(!assigned) {
+				error = protocols::fs::Error::noSpaceLeft;
+				break;
 			}
-		}else if(block_offset + prg < d_range) {
-			assert(!"TODO: Implement allocation in double indirect blocks");
+
+			auto leaf_map = co_await mapIndirect(inode->indirectOrder2, outer, new_leaf);
+			auto leaf = reinterpret_cast<uint32_t *>(leaf_map.get());
+			if(!(co_await fillIndirect(leaf, s_range + (rel & ~index_mask))))
+				error = protocols::fs::Error::noSpaceLeft;
+			co_await writeIndirect(double_window[outer], leaf);
 		}else{
-			assert(!"TODO: Implement allocation in triple indirect blocks");
+			auto rel = block_offset + prg - d_range;
+			auto outer = rel >> (2 * per_shift);
+			auto middle = (rel >> per_shift) & index_mask;
+
+			bool new_triple;
+			if(!(co_await assignIndirect(disk_inode->data.blocks.tripleIndirect, new_triple))) {
+				error = protocols::fs::Error::noSpaceLeft;
+				break;
+			}
+
+			auto triple_map = co_await mapIndirect(inode->indirectOrder1, 2, new_triple);
+			auto triple_window = reinterpret_cast<uint32_t *>(triple_map.get());
+			bool new_middle;
+			bool assigned = co_await assignIndirect(triple_window[outer], new_middle);
+			if(new_triple || new_middle)
+				co_await writeIndirect(disk_inode->data.blocks.tripleIndirect, triple_window);
+			if(!assigned) {
+				error = protocols::fs::Error::noSpaceLeft;
+				break;
+			}
+
+			auto middle_map = co_await mapIndirect(inode->indirectOrder2,
+					per_indirect + outer, new_middle);
+			auto middle_window = reinterpret_cast<uint32_t *>(middle_map.get());
+			bool new_leaf;
+			assigned = co_await assignIndirect(middle_window[middle], new_leaf);
+			if(new_middle || new_leaf)
+				co_await writeIndirect(triple_window[outer], middle_window);
+			if(!assigned) {
+				error = protocols::fs::Error::noSpaceLeft;
+				break;
+			}
+
+			// The last level is not cached (see resolveIndirect()); update it on the disk.
+			std::vector<uint32_t> leaf(per_indirect);
+			if(!new_leaf)
+				co_await device->readSectors(uint64_t{middle_window[middle]} * sectorsPerBlock,
+						leaf.data(), sectorsPerBlock);
+			if(!(co_await fillIndirect(leaf.data(), d_range + (rel & ~index_mask))))
+				error = protocols::fs::Error::noSpaceLeft;
+			co_await writeIndirect(middle_window[middle], leaf.data());
 		}
 	}
 
-	// Notify the kernel that the inode might have changed.
-	// Hack: For now, we just remap the inode to make sure the dirty bit is checked.
-	auto inode_address = (inode->number - 1) * inodeSize;
+	// The block map might contain holes that are now filled.
+	inode->forgetBlocks(block_offset, block_offset + num_blocks);
 
-	inode->diskMapping = helix::Mapping{inodeTable,
-			inode_address, inodeSize,
-			kHelMapProtWrite | kHelMapProtRead | kHelMapDontRequireBacking};
+	inode->markInodeDirty();
+	co_return error;
 }
 
-async::result<void> FileSystem::readDataBlocks(std::shared_ptr<Inode> inode,
-		uint64_t offset, size_t num_blocks, void *buffer) {
-	// We perform "block-fusion" here i.e. we try to read/write multiple
-	// consecutive blocks in a single read/writeSectors() operation.
-	auto fuse = [] (size_t index, size_t remaining, uint32_t *list, size_t limit) {
-		size_t n = 1;
-		while(n < remaining && index + n < limit) {
-			if(list[index + n] != list[index] + n)
-				break;
+namespace {
+
+// Returns the extent that starts at list[index], i.e., the run of either
+// consecutive block numbers or zeros (= holes) in list[index] to list[limit - 1].
+BlockExtent fuseBlocks(const uint32_t *list, size_t index, size_t limit) {
+	size_t n = 1;
+	if(list[index]) {
+		while(index + n < limit && list[index + n] == list[index] + n)
 			n++;
+	}else{
+		while(index + n < limit && !list[index + n])
+			n++;
+	}
+	return BlockExtent{list[index], n};
+}
+
+} // anonymous namespace
+
+async::result<BlockExtent> FileSystem::mapBlocks(Inode *inode,
+		uint64_t block, uint64_t count) {
+	assert(count);
+	auto extent = inode->cachedBlocks(block);
+	if(!extent) {
+		if(inode->usesExtents()) {
+			extent = co_await resolveExtent(inode, block);
+		}else{
+			extent = co_await resolveIndirect(inode, block);
 		}
-		return std::pair<size_t, size_t>{list[index], n};
-	};
+		inode->cacheBlocks(block, *extent);
+	}
+
+	extent->length = std::min(extent->length, count);
+	co_return *extent;
+}
 
-	size_t per_indirect = blockSize / 4;
-	size_t per_single = per_indirect;
-	size_t per_double = per_indirect * per_indirect;
+async::result<BlockExtent> FileSystem::resolveIndirect(Inode *inode, uint64_t block) {
+	int per_shift = blockShift - 2;
+	uint64_t per_indirect = uint64_t{1} << per_shift;
+	uint64_t index_mask = per_indirect - 1;
 
 	// Number of blocks that can be accessed by:
-	size_t i_range = 12; // Direct blocks only.
-	size_t s_range = i_range + per_single; // Plus the first single indirect block.
-	size_t d_range = s_range + per_double; // Plus the first double indirect block.
+	uint64_t i_range = 12; // Direct blocks only.
+	uint64_t s_range = i_range + per_indirect; // Plus the single indirect block.
+	uint64_t d_range = s_range + (per_indirect << per_shift); // Plus the double indirect block.
+	uint64_t t_range = d_range + (per_indirect << (2 * per_shift)); // Plus the triple indirect block.
 
-	co_await inode->readyJump.async_wait();
-	// TODO: Assert that we do not read past the EOF.
+	auto disk_inode = inode->diskInode();
+	if(block < i_range)
+		co_return fuseBlocks(disk_inode->data.blocks.direct, block, i_range);
+
+	// Reads the index-th entry of the frame-th block of an indirectOrderN memory object.
+	auto readEntry = [&] (helix::BorrowedDescriptor memory, uint64_t frame,
+			uint64_t index) -> async::result<uint32_t> {
+		helix::LockMemoryView lock_indirect;
+		auto &&submit = helix::submitLockMemoryView(memory, &lock_indirect,
+				frame << blockPagesShift, 1 << blockPagesShift,
+				helix::Dispatcher::global());
+		co_await submit.async_wait();
+		HEL_CHECK(lock_indirect.error());
 
-	size_t progress = 0;
-	while(progress < num_blocks) {
-		// Block number and block count of the readSectors() command that we will issue here.
-		std::pair<size_t, size_t> issue;
+		helix::Mapping indirect_map{memory,
+				static_cast<ptrdiff_t>(frame << blockPagesShift), size_t{1} << blockPagesShift,
+				kHelMapProtRead | kHelMapDontRequireBacking};
+		co_return reinterpret_cast<uint32_t *>(indirect_map.get())[index];
+	};
 
-		auto index = offset + progress;
-//		std::cout << "Reading " << index << "-th block from inode " << inode->number
-//				<< " (" << progress << "/" << num_blocks << " in request)" << std::endl;
+	// Find the indirect block that contains the entry. Missing indirect blocks are holes.
+	helix::BorrowedDescriptor memory;
+	uint64_t frame;
+	uint64_t index;
+	if(block < s_range) {
+		if(!disk_inode->data.blocks.singleIndirect)
+			co_return BlockExtent{0, s_range - block};
+		memory = inode->indirectOrder1;
+		frame = 0;
+		index = block - i_range;
+	}else if(block < d_range) {
+		if(!disk_inode->data.blocks.doubleIndirect)
+			co_return BlockExtent{0, d_range - block};
+		auto rel = block - s_range;
+		if(!(co_await readEntry(inode->indirectOrder1, 1, rel >> per_shift)))
+			co_return BlockExtent{0, per_indirect - (rel & index_mask)};
+		memory = inode->indirectOrder2;
+		frame = rel >> per_shift;
+		index = rel & index_mask;
+	}else{
+		assert(block < t_range);
+		if(!disk_inode->data.blocks.tripleIndirect)
+			co_return BlockExtent{0, t_range - block};
+		auto rel = block - d_range;
+		auto outer = rel >> (2 * per_shift);
+		auto middle = (rel >> per_shift) & index_mask;
+		if(!(co_await readEntry(inode->indirectOrder1, 2, outer)))
+			co_return BlockExtent{0, (per_indirect << per_shift)
+					- (rel & ((per_indirect << per_shift) - 1))};
+		auto leaf_block = co_await readEntry(inode->indirectOrder2,
+				per_indirect + outer, middle);
+		if(!leaf_block)
+			co_return BlockExtent{0, per_indirect - (rel & index_mask)};
+
+		// The last level is read directly; its extents end up in the block map anyway.
+		std::vector<uint32_t> leaf(per_indirect);
+		co_await device->readSectors(leaf_block * sectorsPerBlock,
+				leaf.data(), sectorsPerBlock);
+		co_return fuseBlocks(leaf.data(), rel & index_mask, per_indirect);
+	}
 
-		assert(index < d_range);
-		if(index >= d_range) {
-			assert(!"Fix triple indirect blocks");
-		}else if(index >= s_range) { // Use the double indirect block.
-			// TODO: Use shift/and instead of div/mod.
-			int64_t indirect_frame = (index - s_range) >> (blockShift - 2);
-			int64_t indirect_index = (index - s_range) & ((1 << (blockShift - 2)) - 1);
+	helix::LockMemoryView lock_indirect;
+	auto &&submit = helix::submitLockMemoryView(memory, &lock_indirect,
+			frame << blockPagesShift, 1 << blockPagesShift,
+			helix::Dispatcher::global());
+	co_await submit.async_wait();
+	HEL_CHECK(lock_indirect.error());
 
-			helix::LockMemoryView lock_indirect;
-			auto &&submit = helix::submitLockMemoryView(inode->indirectOrder2, &lock_indirect,
-					indirect_frame << blockPagesShift, 1 << blockPagesShift,
-					helix::Dispatcher::global());
-			co_await submit.async_wait();
-			HEL_CHECK(lock_indirect.error());
+	helix::Mapping indirect_map{memory,
+			static_cast<ptrdiff_t>(frame << blockPagesShift), size_t{1} << blockPagesShift,
+			kHelMapProtRead | kHelMapDontRequireBacking};
+	co_return fuseBlocks(reinterpret_cast<uint32_t *>(indirect_map.get()),
+			index, per_indirect);
+}
 
-			helix::Mapping indirect_map{inode->indirectOrder2,
-					indirect_frame << blockPagesShift, size_t{1} << blockPagesShift,
-					kHelMapProtRead | kHelMapDontRequireBacking};
+async::result<BlockExtent> FileSystem::resolveExtent(Inode *inode, uint64_t block) {
+	// ext4 uses 32-bit logical block numbers.
+	uint64_t end = uint64_t{1} << 32;
+	assert(block < end);
 
-			issue = fuse(indirect_index, num_blocks - progress,
-					reinterpret_cast<uint32_t *>(indirect_map.get()), per_indirect);
-		}else if(index >= i_range) { // Use the single indirect block.
-			helix::LockMemoryView lock_indirect;
-			auto &&submit = helix::submitLockMemoryView(inode->indirectOrder1,
-					&lock_indirect, 0, 1 << blockPagesShift,
-					helix::Dispatcher::global());
-			co_await submit.async_wait();
-			HEL_CHECK(lock_indirect.error());
+	// Start at the root node in the inode; other nodes are read from the disk.
+	std::vector<char> node(sizeof(FileData));
+	memcpy(node.data(), &inode->diskInode()->data, sizeof(FileData));
+	while(true) {
+		auto header = reinterpret_cast<DiskExtentHeader *>(node.data());
+		if(header->magic != extentMagic
+				|| sizeof(DiskExtentHeader) + header->entries * sizeof(DiskExtent) > node.size()) {
+			std::cerr << "ext2fs: Corrupted extent tree in inode " << inode->number << std::endl;
+			abort();
+		}
 
-			helix::Mapping indirect_map{inode->indirectOrder1,
-					0, size_t{1} << blockPagesShift,
-					kHelMapProtRead | kHelMapDontRequireBacking};
-			issue = fuse(index - i_range, num_blocks - progress,
-					reinterpret_cast<uint32_t *>(indirect_map.get()), per_indirect);
-		}else{
-			auto disk_inode = inode->diskInode();
+		if(!header->depth) {
+			auto extents = reinterpret_cast<DiskExtent *>(header + 1);
+
+			// Cache all extents of the leaf as they are likely to be accessed soon.
+			std::optional<BlockExtent> result;
+			for(unsigned int i = 0; i < header->entries; i++) {
+				uint64_t physical = extents[i].startLo | (uint64_t{extents[i].startHi} << 32);
+				uint64_t length = extents[i].length;
+				if(length > maxInitializedExtent) {
+					length -= maxInitializedExtent;
+					physical = 0;
+				}
+				inode->cacheBlocks(extents[i].block, BlockExtent{physical, length});
 
-			issue = fuse(index, num_blocks - progress,
-					disk_inode->data.blocks.direct, 12);
+				if(block >= extents[i].block + length)
+					continue;
+				if(!result) {
+					if(block >= extents[i].block) {
+						auto skip = block - extents[i].block;
+						result = BlockExtent{physical ? physical + skip : 0, length - skip};
+					}else{
+						result = BlockExtent{0, extents[i].block - block};
+					}
+				}
+			}
+			if(!result)
+				result = BlockExtent{0, end - block};
+			co_return *result;
 		}
 
-//		std::cout << "Issuing read of " << issue.second
-//				<< " blocks, starting at " << issue.first << std::endl;
-
-		assert(issue.first);
-		co_await device->readSectors(issue.first * sectorsPerBlock,
-				(uint8_t *)buffer + progress * blockSize,
-				issue.second * sectorsPerBlock);
-		progress += issue.second;
+		// Follow the last index entry that starts at or before the block.
+		auto indices = reinterpret_cast<DiskExtentIndex *>(header + 1);
+		unsigned int k = 0;
+		while(k < header->entries && indices[k].block <= block)
+			k++;
+		if(k < header->entries)
+			end = indices[k].block;
+		if(!k)
+			co_return BlockExtent{0, end - block};
+
+		uint64_t child = indices[k - 1].leafLo | (uint64_t{indices[k - 1].leafHi} << 32);
+		node.resize(blockSize);
+		co_await device->readSectors(child * sectorsPerBlock, node.data(), sectorsPerBlock);
 	}
 }
 
-// TODO: There is a lot of overlap between this method and readDataBlocks.
-//       Refactor common code into a another method.
-async::result<void> FileSystem::writeDataBlocks(std::shared_ptr<Inode> inode,
-		uint64_t offset, size_t num_blocks, const void *buffer) {
-	// We perform "block-fusion" here i.e. we try to read/write multiple
-	// consecutive blocks in a single read/writeSectors() operation.
-	auto fuse = [] (size_t index, size_t remaining, uint32_t *list, size_t limit) {
-		size_t n = 1;
-		while(n < remaining && index + n < limit) {
-			if(list[index + n] != list[index] + n)
-				break;
-			n++;
+async::result<std::vector<ExtentNode>> FileSystem::loadExtentPath(Inode *inode,
+		uint64_t block) {
+	std::vector<ExtentNode> path;
+	uint64_t physical = 0;
+	uint64_t end = uint64_t{1} << 32;
+
+	std::vector<char> buffer(sizeof(FileData));
+	memcpy(buffer.data(), &inode->diskInode()->data, sizeof(FileData));
+	while(true) {
+		auto header = reinterpret_cast<DiskExtentHeader *>(buffer.data());
+		if(header->magic != extentMagic || header->entries > header->max
+				|| sizeof(DiskExtentHeader) + header->max * sizeof(DiskExtentEntry) > buffer.size()
+				|| (header->depth && !header->entries)) {
+			std::cerr << "ext2fs: Corrupted extent tree in inode " << inode->number << std::endl;
+			abort();
 		}
-		return std::pair<size_t, size_t>{list[index], n};
-	};
 
-	size_t per_indirect = blockSize / 4;
-	size_t per_single = per_indirect;
-	size_t per_double = per_indirect * per_indirect;
+		ExtentNode node;
+		node.physical = physical;
+		node.depth = header->depth;
+		node.max = header->max;
+		node.entries.resize(header->entries);
+		memcpy(node.entries.data(), header + 1, header->entries * sizeof(DiskExtentEntry));
+
+		size_t k = 0;
+		while(k < node.entries.size() && node.entries[k].extent.block <= block)
+			k++;
+
+		if(!node.depth) {
+			node.position = k;
+			node.end = end;
+			path.push_back(std::move(node));
+			co_return path;
+		}
 
-	// Number of blocks that can be accessed by:
-	size_t i_range = 12; // Direct blocks only.
-	size_t s_range = i_range + per_single; // Plus the first single indirect block.
-	size_t d_range = s_range + per_double; // Plus the first double indirect block.
+		// Follow the last index entry that starts at or before the block (or the first one).
+		node.position = k ? k - 1 : 0;
+		if(node.position + 1 < node.entries.size())
+			end = node.entries[node.position + 1].index.block;
+		node.end = end;
 
-	co_await inode->readyJump.async_wait();
-	// TODO: Assert that we do not write past the EOF.
+		auto &index = node.entries[node.position].index;
+		physical = index.leafLo | (uint64_t{index.leafHi} << 32);
+		path.push_back(std::move(node));
 
-	size_t progress = 0;
-	while(progress < num_blocks) {
-		// Block number and block count of the writeSectors() command that we will issue here.
-		std::pair<size_t, size_t> issue;
+		buffer.resize(blockSize);
+		co_await device->readSectors(physical * sectorsPerBlock, buffer.data(), sectorsPerBlock);
+	}
+}
 
-		auto index = offset + progress;
-//		std::cout << "Write " << index << "-th block to inode " << inode->number
-//				<< " (" << progress << "/" << num_blocks << " in request)" << std::endl;
+async::result<void> FileSystem::writeExtentNode(Inode *inode, const ExtentNode &node) {
+	assert(node.entries.size() <= node.max);
+	DiskExtentHeader header{};
+	header.magic = extentMagic;
+	header.entries = node.entries.size();
+	header.max = node.max;
+	header.depth = node.depth;
+
+	// The root node is part of the on-disk inode.
+	if(!node.physical) {
+		auto root = reinterpret_cast<char *>(&inode->diskInode()->data);
+		memcpy(root, &header, sizeof(DiskExtentHeader));
+		memcpy(root + sizeof(DiskExtentHeader), node.entries.data(),
+				node.entries.size() * sizeof(DiskExtentEntry));
+		inode->markInodeDirty();
+		co_return;
+	}
 
-		assert(index < d_range);
-		if(index >= d_range) {
-			assert(!"Fix triple indirect blocks");
-		}else if(index >= s_range) { // Use the double indirect block.
-			// TODO: Use shift/and instead of div/mod.
-			int64_t indirect_frame = (index - s_range) >> (blockShift - 2);
-			int64_t indirect_index = (index - s_range) & ((1 << (blockShift - 2)) - 1);
+	std::vector<char> buffer(blockSize);
+	memcpy(buffer.data(), &header, sizeof(DiskExtentHeader));
+	memcpy(buffer.data() + sizeof(DiskExtentHeader), node.entries.data(),
+			node.entries.size() * sizeof(DiskExtentEntry));
+	co_await device->writeSectors(node.physical * sectorsPerBlock,
+			buffer.data(), sectorsPerBlock);
+}
 
-			helix::LockMemoryView lock_indirect;
-			auto &&submit = helix::submitLockMemoryView(inode->indirectOrder2, &lock_indirect,
-					indirect_frame << blockPagesShift, 1 << blockPagesShift,
-					helix::Dispatcher::global());
-			co_await submit.async_wait();
-			HEL_CHECK(lock_indirect.error());
+async::result<bool> FileSystem::storeExtentPath(Inode *inode, std::vector<ExtentNode> &path) {
+	uint16_t block_max = (blockSize - sizeof(DiskExtentHeader)) / sizeof(DiskExtentEntry);
+
+	// Allocate the blocks for all splits up front, such that we never write
+	// a partially updated tree if the disk is full.
+	size_t num_splits = 0;
+	bool overflow = false;
+	for(size_t level = path.size() - 1; level; level--) {
+		overflow = path[level].entries.size() + overflow > path[level].max;
+		if(overflow)
+			num_splits++;
+	}
+	if(path.front().entries.size() + overflow > path.front().max)
+		num_splits++;
+
+	uint32_t goal = path.back().physical ? path.back().physical + 1
+			: firstDataBlock + groupOfInode(inode->number) * blocksPerGroup;
+	std::vector<uint32_t> reserved;
+	while(reserved.size() < num_splits) {
+		auto block = co_await allocateBlock(goal);
+		if(!block) {
+			for(auto unused : reserved)
+				co_await freeBlocks(unused, 1);
+			co_return false;
+		}
+		reserved.push_back(block);
+		goal = block + 1;
+	}
+	auto takeReserved = [&] {
+		assert(!reserved.empty());
+		auto block = reserved.back();
+		reserved.pop_back();
+		return block;
+	};
 
-			helix::Mapping indirect_map{inode->indirectOrder2,
-					indirect_frame << blockPagesShift, size_t{1} << blockPagesShift,
-					kHelMapProtRead | kHelMapDontRequireBacking};
+	// Walk from the leaf to the root; splitting a node inserts an entry into its parent.
+	for(size_t level = path.size() - 1; level; level--) {
+		auto &node = path[level];
+		auto &parent = path[level - 1];
+
+		// Index entries must not start after the first entry of their child.
+		auto &key = parent.entries[parent.position].index.block;
+		if(!node.entries.empty() && node.entries.front().extent.block < key)
+			key = node.entries.front().extent.block;
+
+		if(node.entries.size() > node.max) {
+			// Move the upper half of the entries to a new sibling.
+			auto physical = takeReserved();
+
+			auto half = node.entries.size() / 2;
+			ExtentNode sibling;
+			sibling.physical = physical;
+			sibling.depth = node.depth;
+			sibling.max = block_max;
+			sibling.entries.assign(node.entries.begin() + half, node.entries.end());
+			node.entries.resize(half);
+			co_await writeExtentNode(inode, sibling);
+
+			DiskExtentEntry entry{};
+			entry.index.block = sibling.entries.front().extent.block;
+			entry.index.leafLo = physical;
+			entry.index.leafHi = 0;
+			parent.entries.insert(parent.entries.begin() + parent.position + 1, entry);
+		}
+		co_await writeExtentNode(inode, node);
+	}
 
-			issue = fuse(indirect_index, num_blocks - progress,
-					reinterpret_cast<uint32_t *>(indirect_map.get()), per_indirect);
-		}else if(index >= i_range) { // Use the triple indirect block.
-			helix::LockMemoryView lock_indirect;
-			auto &&submit = helix::submitLockMemoryView(inode->indirectOrder1,
-					&lock_indirect, 0, 1 << blockPagesShift,
-					helix::Dispatcher::global());
-			co_await submit.async_wait();
-			HEL_CHECK(lock_indirect.error());
+	auto &root = path.front();
+	if(root.entries.size() > root.max) {
+		// Move the contents of the root to a new block and add a level to the tree.
+		auto physical = takeReserved();
+
+		ExtentNode child;
+		child.physical = physical;
+		child.depth = root.depth;
+		child.max = block_max;
+		child.entries = std::move(root.entries);
+		co_await writeExtentNode(inode, child);
+
+		DiskExtentEntry entry{};
+		entry.index.block = child.entries.front().extent.block;
+		entry.index.leafLo = physical;
+		entry.index.leafHi = 0;
+		root.depth++;
+		root.entries.assign(1, entry);
+	}
+	co_await writeExtentNode(inode, root);
+	assert(reserved.empty());
+	co_return true;
+}
 
-			helix::Mapping indirect_map{inode->indirectOrder1,
-					0, size_t{1} << blockPagesShift,
-					kHelMapProtRead | kHelMapDontRequireBacking};
-			issue = fuse(index - i_range, num_blocks - progress,
-					reinterpret_cast<uint32_t *>(indirect_map.get()), per_indirect);
-		}else{
-			auto disk_inode = inode->diskInode();
+async::result<size_t> FileSystem::assignExtentBlocks(Inode *inode,
+		uint64_t block, size_t count, uint32_t &goal) {
+	auto path = co_await loadExtentPath(inode, block);
+	auto &leaf = path.back();
+	auto &entries = leaf.entries;
+	auto k = leaf.position;
+
+	auto makeExtent = [] (uint64_t first, uint64_t length, uint64_t physical,
+			bool initialized) {
+		DiskExtentEntry entry{};
+		entry.extent.block = first;
+		entry.extent.length = initialized ? length : length + maxInitializedExtent;
+		entry.extent.startLo = physical;
+		entry.extent.startHi = physical >> 32;
+		return entry;
+	};
 
-			issue = fuse(index, num_blocks - progress,
-					disk_inode->data.blocks.direct, 12);
+	if(k) {
+		auto &extent = entries[k - 1].extent;
+		uint64_t physical = extent.startLo | (uint64_t{extent.startHi} << 32);
+		uint64_t length = extent.length;
+		bool initialized = length <= maxInitializedExtent;
+		if(!initialized)
+			length -= maxInitializedExtent;
+
+		if(block < extent.block + length) {
+			auto n = std::min(uint64_t{count}, extent.block + length - block);
+			if(initialized)
+				co_return n;
+
+			// Writing to an uninitialized extent: split it such that
+			// the written part becomes initialized.
+			uint64_t first = extent.block;
+			std::vector<DiskExtentEntry> pieces;
+			if(block > first)
+				pieces.push_back(makeExtent(first, block - first, physical, false));
+			pieces.push_back(makeExtent(block, n, physical + (block - first), true));
+			if(block + n < first + length)
+				pieces.push_back(makeExtent(block + n, first + length - (block + n),
+						physical + (block + n - first), false));
+
+			entries.erase(entries.begin() + (k - 1));
+			entries.insert(entries.begin() + (k - 1), pieces.begin(), pieces.end());
+			if(!(co_await storeExtentPath(inode, path)))
+				co_return 0;
+			goal = physical + (block + n - first);
+			co_return n;
 		}
+	}
 
-//		std::cout << "Issuing write of " << issue.second
-//				<< " blocks, starting at " << issue.first << std::endl;
+	// The block is in a hole that extends to the next extent (or the end of the leaf).
+	auto hole_end = (k < entries.size()) ? uint64_t{entries[k].extent.block} : leaf.end;
+	auto wanted = std::min({uint64_t{count}, hole_end - block,
+			uint64_t{maxInitializedExtent}});
+	auto [physical, length] = co_await allocateBlocks(goal, wanted);
+	if(!physical)
+		co_return 0;
+
+	// Extend the preceding extent if the new blocks are contiguous to it.
+	bool merged = false;
+	if(k) {
+		auto &previous = entries[k - 1].extent;
+		uint64_t previous_physical = previous.startLo | (uint64_t{previous.startHi} << 32);
+		if(previous.length + length <= maxInitializedExtent
+				&& previous.block + previous.length == block
+				&& previous_physical + previous.length == physical) {
+			previous.length += length;
+			merged = true;
+		}
+	}
+	if(!merged)
+		entries.insert(entries.begin() + k, makeExtent(block, length, physical, true));
 
-		assert(issue.first);
-		co_await device->writeSectors(issue.first * sectorsPerBlock,
-				(const uint8_t *)buffer + progress * blockSize,
-				issue.second * sectorsPerBlock);
-		progress += issue.second;
+	if(!(co_await storeExtentPath(inode, path))) {
+		co_await freeBlocks(physical, length);
+		co_return 0;
 	}
+	goal = physical + length;
+	co_return length;
 }
 
+async::result<void> FileSystem::readDataBlocks(std::shared_ptr<Inode> inode,
+		uint64_t offset, size_t num_blocks, void *buffer) {
+	co_await inode->readyJump.async_wait();
+	// TODO: Assert that we do not read past the EOF.
+
+	// We perform "block-fusion" here i.e. we try to read/write multiple
+	// consecutive blocks in a single read/writeSectors() operation.
+	size_t progress = 0;
+	while(progress < num_blocks) {
+		auto extent = co_await mapBlocks(inode.get(), offset + progress,
+				num_blocks - progress);
+
+		auto chunk = reinterpret_cast<uint8_t *>(buffer) + progress * blockSize;
+		if(extent.physical) {
+			co_await device->readSectors(extent.physical * sectorsPerBlock,
+					chunk, extent.length * sectorsPerBlock);
+		}else{
+			// Holes and uninitialized extents read as zeros.
+			memset(chunk, 0, extent.length * blockSize);
+		}
+		progress += extent.length;
+	}
+}
+
+async::result<void> FileSystem::writeDataBlocks(std::shared_ptr<Inode> inode,
+		uint64_t offset, size_t num_blocks, const void *buffer) {
+	co_await inode->readyJump.async_wait();
+	// TODO: Assert that we do not write past the EOF.
+
+	size_t progress = 0;
+	while(progress < num_blocks) {
+		auto extent = co_await mapBlocks(inode.get(), offset + progress,
+				num_blocks - progress);
+
+		// assignDataBlocks() allocates all blocks before they are written.
+		assert(extent.physical && "Write to unassigned block");
+		co_await device->writeSectors(extent.physical * sectorsPerBlock,
+				reinterpret_cast<const uint8_t *>(buffer) + progress * blockSize,
+				extent.length * sectorsPerBlock);
+		progress += extent.length;
+	}
+}
 
 async::result<void> FileSystem::truncate(Inode *inode, size_t size) {
+	// Windows must not keep pages beyond the new end of the file locked.
+	inode->dropWindows(size);
 	HEL_CHECK(helResizeMemory(inode->backingMemory,
 			(size + 0xFFF) & ~size_t(0xFFF)));
 	inode->setFileSize(size);
+	markLargeFile(size);
+	inode->forgetBlocks((size + blockSize - 1) >> blockShift, UINT64_MAX);
+	// Pages beyond the end of the file were discarded and will never be written back.
+	inode->markClean((size + 0xFFF) & ~uint64_t(0xFFF), UINT64_MAX, UINT64_MAX);
 
-	// Notify the kernel that the inode might have changed.
-	// Hack: For now, we just remap the inode to make sure the dirty bit is checked.
-	auto inode_address = (inode->number - 1) * inodeSize;
-
-	inode->diskMapping = helix::Mapping{inodeTable,
-			inode_address, inodeSize,
-			kHelMapProtWrite | kHelMapProtRead | kHelMapDontRequireBacking};
+	inode->markInodeDirty();
 	co_return;
 }
 
@@ -1120,26 +2864,15 @@ OpenFile::readEntries() {
 		co_return std::nullopt; // FIXME: this does not indicate an error
 	}
 
-	auto map_size = (inode->fileSize() + 0xFFF) & ~size_t(0xFFF);
-
-	helix::LockMemoryView lock_memory;
-	auto &&submit = helix::submitLockMemoryView(helix::BorrowedDescriptor(inode->frontalMemory),
-			&lock_memory, 0, map_size, helix::Dispatcher::global());
-	co_await submit.async_wait();
-	HEL_CHECK(lock_memory.error());
-
-	// Map the page cache into the address space.
-	helix::Mapping file_map{helix::BorrowedDescriptor{inode->frontalMemory},
-			0, map_size,
-			kHelMapProtRead | kHelMapDontRequireBacking};
-
 	// Read the directory structure.
+	std::shared_ptr<MappingWindow> window;
 	assert(offset <= inode->fileSize());
 	while(offset < inode->fileSize()) {
 		assert(!(offset & 3));
 		assert(offset + sizeof(DiskDirEntry) <= inode->fileSize());
-		auto disk_entry = reinterpret_cast<DiskDirEntry *>(
-				reinterpret_cast<char *>(file_map.get()) + offset);
+		if(!window || !window->contains(offset))
+			window = co_await inode->accessWindow(offset);
+		auto disk_entry = reinterpret_cast<DiskDirEntry *>(window->access(offset));
 		assert(offset + disk_entry->recordLength <= inode->fileSize());
 
 		offset += disk_entry->recordLength;
@@ -1155,5 +2888,48 @@ OpenFile::readEntries() {
 	co_return std::nullopt;
 }
 
+async::result<void>
+OpenFile::readEntryBatch(protocols::fs::EntryBatch *batch) {
+	co_await inode->readyJump.async_wait();
+
+	if (inode->fileType != kTypeDirectory) {
+		std::cout << "\e[33m" "ext2fs: readEntryBatch called on something that's not a directory\e[39m" << std::endl;
+		co_return;
+	}
+
+	std::shared_ptr<MappingWindow> window;
+	assert(offset <= inode->fileSize());
+	while(offset < inode->fileSize()) {
+		assert(!(offset & 3));
+		assert(offset + sizeof(DiskDirEntry) <= inode->fileSize());
+		if(!window || !window->contains(offset))
+			window = co_await inode->accessWindow(offset);
+		auto disk_entry = reinterpret_cast<DiskDirEntry *>(window->access(offset));
+		assert(offset + disk_entry->recordLength <= inode->fileSize());
+
+		if(disk_entry->inode) {
+			uint8_t type;
+			switch(disk_entry->fileType) {
+			case EXT2_FT_REG_FILE:
+				type = DT_REG; break;
+			case EXT2_FT_DIR:
+				type = DT_DIR; break;
+			case EXT2_FT_SYMLINK:
+				type = DT_LNK; break;
+			default:
+				type = DT_UNKNOWN;
+			}
+
+			// Only advance the offset if the entry fits into the batch.
+			if(!batch->append(disk_entry->inode, type,
+					disk_entry->name, disk_entry->nameLength))
+				co_return;
+		}
+
+		offset += disk_entry->recordLength;
+	}
+	assert(offset == inode->fileSize());
+}
+
 } } // namespace blockfs::ext2fs
 
@@ -1,16 +1,22 @@
 
 #include <string.h>
 #include <time.h>
+#include <list>
+#include <map>
 #include <optional>
 #include <memory>
 #include <optional>
+#include <set>
 #include <unordered_map>
 #include <vector>
+#include <protocols/fs/common.hpp>
 #include <protocols/fs/file-locks.hpp>
 
 #include <async/jump.hpp>
 #include <async/doorbell.hpp>
+#include <async/mutex.hpp>
 #include <hel.h>
+#include <helix/memory.hpp>
 
 #include <blockfs.hpp>
 #include "common.hpp"
@@ -92,7 +98,16 @@ struct DiskSuperblock {
 	//-- Other options --
 	uint32_t defaultMountOptions;
 	uint32_t firstMetaBg;
-	uint8_t unused[760];
+	uint32_t mkfsTime;
+	uint32_t journalBlocks[17];
+	//-- 64bit Support --
+	uint32_t blocksCountHi;
+	uint32_t rBlocksCountHi;
+	uint32_t freeBlocksCountHi;
+	uint16_t minExtraIsize;
+	uint16_t wantExtraIsize;
+	uint32_t flags;
+	uint8_t unused[668];
 };
 static_assert(sizeof(DiskSuperblock) == 1024, "Bad DiskSuperblock struct size");
 
@@ -124,7 +139,7 @@ struct DiskInode {
 	FileData data;
 	uint32_t generation;
 	uint32_t fileAcl;
-	uint32_t dirAcl;
+	uint32_t sizeHigh; // Called dirAcl in revision 0.
 	uint32_t faddr;
 	uint8_t osd2[12];
 };
@@ -134,6 +149,31 @@ enum {
 	EXT2_ROOT_INO = 2
 };
 
+enum {
+	EXT2_FEATURE_COMPAT_DIR_INDEX = 0x0020
+};
+
+enum {
+	EXT2_FEATURE_RO_COMPAT_LARGE_FILE = 0x0002
+};
+
+enum {
+	EXT4_FEATURE_INCOMPAT_EXTENTS = 0x0040,
+	EXT4_FEATURE_INCOMPAT_LARGEDIR = 0x4000
+};
+
+// Superblock flags.
+enum {
+	EXT2_FLAGS_SIGNED_HASH = 0x0001,
+	EXT2_FLAGS_UNSIGNED_HASH = 0x0002
+};
+
+// Inode flags.
+enum {
+	EXT2_INDEX_FL = 0x00001000,
+	EXT4_EXTENTS_FL = 0x00080000
+};
+
 enum {
 	EXT2_S_IFMT = 0xF000,
 	EXT2_S_IFLNK = 0xA000,
@@ -155,6 +195,83 @@ enum {
 	EXT2_FT_SYMLINK = 7
 };
 
+// Structures of hashed directories (htree). The index is stored in directory blocks
+// that look like empty directory blocks to implementations that do not understand it.
+// The root block starts with the "." and ".." entries, followed by a DiskDxRootInfo.
+// Other index blocks start with an empty DiskDirEntry that spans the whole block.
+// In both cases, a DiskDxCountLimit follows; it overlays the hash of the first DiskDxEntry.
+struct DiskDxRootInfo {
+	uint32_t reservedZero;
+	uint8_t hashVersion;
+	uint8_t infoLength;
+	uint8_t indirectLevels;
+	uint8_t unusedFlags;
+};
+static_assert(sizeof(DiskDxRootInfo) == 8, "Bad DiskDxRootInfo struct size");
+
+struct DiskDxCountLimit {
+	uint16_t limit;
+	uint16_t count;
+};
+
+struct DiskDxEntry {
+	uint32_t hash;
+	uint32_t block;
+};
+
+enum {
+	EXT2_DX_HASH_LEGACY = 0,
+	EXT2_DX_HASH_HALF_MD4 = 1,
+	EXT2_DX_HASH_TEA = 2,
+	EXT2_DX_HASH_LEGACY_UNSIGNED = 3,
+	EXT2_DX_HASH_HALF_MD4_UNSIGNED = 4,
+	EXT2_DX_HASH_TEA_UNSIGNED = 5
+};
+
+// Structures of extent-mapped files (ext4). Each node of the extent tree starts with
+// a DiskExtentHeader. Inner nodes contain DiskExtentIndex entries, leaves contain
+// DiskExtent entries; both are sorted by their first logical block.
+// The root node is stored in the inode's FileData.
+struct DiskExtentHeader {
+	uint16_t magic;
+	uint16_t entries;
+	uint16_t max;
+	uint16_t depth;
+	uint32_t generation;
+};
+static_assert(sizeof(DiskExtentHeader) == 12, "Bad DiskExtentHeader struct size");
+
+struct DiskExtentIndex {
+	uint32_t block;
+	uint32_t leafLo;
+	uint16_t leafHi;
+	uint16_t unused;
+};
+static_assert(sizeof(DiskExtentIndex) == 12, "Bad DiskExtentIndex struct size");
+
+struct DiskExtent {
+	uint32_t block;
+	uint16_t length;
+	uint16_t startHi;
+	uint32_t startLo;
+};
+static_assert(sizeof(DiskExtent) == 12, "Bad DiskExtent struct size");
+
+// Entry of an extent tree node. Both kinds of entries start with their first logical block.
+union DiskExtentEntry {
+	DiskExtent extent;
+	DiskExtentIndex index;
+};
+static_assert(sizeof(DiskExtentEntry) == 12, "Bad DiskExtentEntry struct size");
+
+inline constexpr uint16_t extentMagic = 0xF30A;
+
+// Extents that are longer than this are uninitialized (i.e., they read as zeros).
+inline constexpr uint16_t maxInitializedExtent = 32768;
+
+// Computes the (major) hash of a directory entry name.
+uint32_t hashEntryName(int version, const uint32_t seed[4], const char *name, size_t length);
+
 // --------------------------------------------------------
 // DirEntry
 // --------------------------------------------------------
@@ -164,27 +281,211 @@ struct DirEntry {
 	FileType fileType;
 };
 
+// Location of an on-disk directory entry (as byte offsets into the directory).
+struct EntryLocation {
+	uint64_t offset;
+	// Offset of the preceding entry in the same block (if any).
+	std::optional<uint64_t> previous;
+};
+
+// Maximal depth of the htree (ext4's largedir allows three levels).
+inline constexpr int maxIndexLevels = 3;
+
+// Path from the root of the htree to a leaf block.
+struct IndexLookup {
+	struct Frame {
+		// Offset of the index block within the directory.
+		uint64_t blockOffset;
+		// Offset of the DiskDxCountLimit within the index block.
+		size_t entriesOffset;
+		// Index of the DiskDxEntry that was followed.
+		unsigned int position;
+	};
+
+	int hashVersion;
+	uint32_t hash;
+	int numFrames;
+	Frame frames[maxIndexLevels];
+	uint32_t leafBlock;
+};
+
+// Result of the functions that modify the htree.
+enum class IndexResult {
+	success,
+	// There is no room in the index (see the individual functions).
+	noRoom,
+	// The leaf cannot be split such that the new entry fits into its half.
+	noSplit,
+	// A block could not be allocated because the disk is full.
+	noSpace
+};
+
 // --------------------------------------------------------
-// Inode
+// BlockExtent
+// --------------------------------------------------------
+
+// Run of logical blocks that are stored in consecutive physical blocks.
+// A physical block of zero denotes a hole.
+struct BlockExtent {
+	uint64_t physical;
+	uint64_t length;
+};
+
+// Maximal number of extents that each inode keeps in its block map.
+inline constexpr size_t maxCachedExtents = 1024;
+
+// In-memory copy of a node of an extent tree that is being modified.
+struct ExtentNode {
+	// Physical block of the node (zero for the root node in the inode).
+	uint64_t physical;
+	uint16_t depth;
+	uint16_t max;
+	// DiskExtent entries in leaves, DiskExtentIndex entries in inner nodes.
+	std::vector<DiskExtentEntry> entries;
+	// Inner nodes: index of the entry that was followed.
+	// Leaves: number of entries that start at or before the block that was looked up.
+	size_t position;
+	// End of the logical range that is covered by the node.
+	uint64_t end;
+};
+
+// --------------------------------------------------------
+// Read-ahead
+// --------------------------------------------------------
+
+// Size of the first read-ahead window of a sequential reader.
+// Each window that is consumed completely doubles the size of the next one.
+inline constexpr size_t initialReadahead = 128 * 1024;
+inline constexpr size_t maxReadahead = 2 * 1024 * 1024;
+
+// Tracks the access pattern of an inode's page cache.
+// We only observe faults on pages that are not present; a sequential reader
+// thus faults once at the end of each read-ahead window.
+struct ReadaheadState {
+	// Offset at which we expect the next fault of a sequential reader.
+	uint64_t nextOffset = 0;
+	// Size of the next read-ahead window (zero if no stream was detected).
+	size_t windowSize = 0;
+	// Range of the last read-ahead window.
+	uint64_t windowBegin = 0;
+	uint64_t windowEnd = 0;
+};
+
+struct ReadaheadStats {
+	uint64_t windows = 0;
+	uint64_t prefetchedPages = 0;
+	// Pages of windows that were consumed up to their end.
+	uint64_t hitPages = 0;
+	// Pages of windows that were abandoned because the stream ended.
+	// This is an upper bound: the reader might have used some of them.
+	uint64_t wastedPages = 0;
+};
+
+// Minimal interval (in nanoseconds) between two reports of the read-ahead statistics.
+inline constexpr uint64_t readaheadReportInterval = 60'000'000'000;
+
+// --------------------------------------------------------
+// Writeback
+// --------------------------------------------------------
+
+// The kernel only notices that a page of the page cache is dirty once the page is unmapped.
+// Data that we write through windows is thus tracked as dirty until the kernel has
+// requested (and we have completed) a writeback that started after the window was unmapped.
+struct DirtyRange {
+	uint64_t end;
+	// Value of Inode::writebackEpoch at the time of the write.
+	uint64_t epoch;
+};
+
+// Interval (in nanoseconds) at which we look for inodes that need to be written back.
+inline constexpr uint64_t writebackInterval = 1'000'000'000;
+
+// Default age (in nanoseconds) after which dirty data is written back.
+inline constexpr uint64_t defaultWritebackAge = 5'000'000'000;
+
+// --------------------------------------------------------
+// MappingWindow
 // --------------------------------------------------------
 
 struct FileSystem;
+struct Inode;
+
+// Size (and alignment) of the windows that map an inode's page cache.
+// This is a multiple of all possible ext2 block sizes, hence directory entries
+// never cross windows.
+inline constexpr size_t windowSize = 64 * 1024;
+
+// Maximal number of windows that each FileSystem keeps mapped.
+inline constexpr size_t maxCachedWindows = 256;
+
+// Long-lived locked mapping of a part of an inode's page cache.
+// Windows are cached in the inode and evicted in LRU order by the FileSystem.
+// Users hold a std::shared_ptr such that the mapping survives eviction.
+struct MappingWindow {
+	MappingWindow(Inode *inode, uint64_t offset, size_t length,
+			helix::UniqueDescriptor lock, helix::Mapping mapping)
+	: inode{inode}, offset{offset}, length{length},
+			lock{std::move(lock)}, mapping{std::move(mapping)} { }
+
+	MappingWindow(const MappingWindow &) = delete;
+
+	~MappingWindow();
+
+	MappingWindow &operator= (const MappingWindow &) = delete;
+
+	bool contains(uint64_t address) {
+		return address >= offset && address - offset < length;
+	}
+
+	// Returns a pointer to the byte at the given file offset.
+	char *access(uint64_t address) {
+		assert(contains(address));
+		return reinterpret_cast<char *>(mapping.get()) + (address - offset);
+	}
+
+	Inode *inode;
+	uint64_t offset;
+	size_t length;
+	helix::UniqueDescriptor lock;
+	helix::Mapping mapping;
+
+	// Position in FileSystem::windowLru (only valid while the window is cached).
+	bool isCached = false;
+	std::list<MappingWindow *>::iterator lruPosition;
+};
+
+// --------------------------------------------------------
+// Inode
+// --------------------------------------------------------
 
 struct Inode : std::enable_shared_from_this<Inode> {
 	Inode(FileSystem &fs, uint32_t number);
 
+	Inode(const Inode &) = delete;
+
+	~Inode();
+
+	Inode &operator= (const Inode &) = delete;
+
 	DiskInode *diskInode() {
 		return reinterpret_cast<DiskInode *>(diskMapping.get());
 	}
 
 	// Returns the size of the file in bytes.
 	uint64_t fileSize() {
-		return diskInode()->size;
+		auto disk_inode = diskInode();
+		return disk_inode->size | (uint64_t{disk_inode->sizeHigh} << 32);
 	}
 
 	void setFileSize(uint64_t size) {
-		assert(!(size & ~uint64_t(0xFFFFFFFF)));
-		diskInode()->size = size;
+		auto disk_inode = diskInode();
+		disk_inode->size = size;
+		disk_inode->sizeHigh = size >> 32;
+	}
+
+	// Returns true if the blocks of this file are mapped by an extent tree.
+	bool usesExtents() {
+		return diskInode()->flags & EXT4_EXTENTS_FL;
 	}
 
 	async::result<std::optional<DirEntry>> findEntry(std::string name);
@@ -192,6 +493,68 @@ struct Inode : std::enable_shared_from_this<Inode> {
 	async::result<void> unlink(std::string name);
 	async::result<std::optional<DirEntry>> mkdir(std::string name);
 
+	// Returns true if this is a directory with an htree index.
+	bool isIndexed();
+
+	// Returns a window that maps the page cache at the given offset.
+	// The offset must be within the file.
+	async::result<std::shared_ptr<MappingWindow>> accessWindow(uint64_t offset);
+
+	// Copies data from/to the page cache through the cached windows.
+	// writeCache() marks the written range as dirty.
+	async::result<void> readCache(uint64_t offset, void *buffer, size_t length);
+	async::result<void> writeCache(uint64_t offset, const void *buffer, size_t length);
+
+	// Drops all cached windows that extend beyond the given file size.
+	void dropWindows(uint64_t size);
+
+	// Returns the cached extent that contains the given logical block
+	// (trimmed such that it starts at that block).
+	std::optional<BlockExtent> cachedBlocks(uint64_t block);
+	// Adds an extent that starts at the given logical block to the block map.
+	void cacheBlocks(uint64_t block, BlockExtent extent);
+	// Removes all cached extents that overlap [begin, end) from the block map.
+	void forgetBlocks(uint64_t begin, uint64_t end);
+
+	// Notifies the kernel that the on-disk inode changed.
+	void markInodeDirty();
+	// Records that [begin, end) of the page cache was written.
+	void markDirty(uint64_t begin, uint64_t end);
+	// Called when a writeback of [begin, end) that was requested at the given epoch completes.
+	void markClean(uint64_t begin, uint64_t end, uint64_t epoch);
+
+private:
+	// Walks the htree to the leaf block that contains the given name.
+	// Returns std::nullopt if the index is corrupted.
+	async::result<std::optional<IndexLookup>> lookupIndex(const std::string &name);
+	// Advances the lookup to the next leaf block if that block can contain
+	// entries with the same hash (i.e., on hash collisions across blocks).
+	async::result<bool> nextLeaf(IndexLookup &lookup);
+	// Searches [begin, end) for the entry with the given name.
+	async::result<std::optional<EntryLocation>> scanEntries(uint64_t begin, uint64_t end,
+			const std::string &name);
+	// Searches the whole directory (via the index, if available).
+	async::result<std::optional<EntryLocation>> locateEntry(const std::string &name);
+	// Inserts an entry into the first gap in [begin, end) that is large enough.
+	async::result<bool> insertEntry(uint64_t begin, uint64_t end,
+			const std::string &name, uint32_t ino, FileType type);
+	// Splits the leaf block of the lookup at half of its used bytes and inserts the entry
+	// into one of the halves. Returns noRoom if the parent index block is full.
+	async::result<IndexResult> splitLeaf(const IndexLookup &lookup,
+			const std::string &name, uint32_t ino, FileType type);
+	// Makes room in the parent index block of the lookup's leaf, either by splitting
+	// an index block or by adding a level to the htree. Only one level is changed per call;
+	// the caller has to repeat the lookup. Returns noRoom if the htree cannot grow further.
+	async::result<IndexResult> growIndex(const IndexLookup &lookup);
+
+	// Appends an empty block to the directory and returns its offset.
+	// Returns std::nullopt if the disk is full.
+	async::result<std::optional<uint64_t>> appendBlock();
+	// Turns the directory into a linear directory.
+	void dropIndex();
+
+public:
+
 	FileSystem &fs;
 
 	// ext2fs on-disk inode number
@@ -216,12 +579,18 @@ struct Inode : std::enable_shared_from_this<Inode> {
 	// - Indirection level 1/3 for triple indirect blocks.
 	helix::UniqueDescriptor indirectOrder1;
 	// Caches indirection blocks reachable from order 1 blocks.
-	// - Indirection level 2/2 for double indirect blocks.
-	// - Indirection level 2/3 for triple indirect blocks.
+	// - Indirection level 2/2 for double indirect blocks (the first blockSize / 4 blocks).
+	// - Indirection level 2/3 for triple indirect blocks (the next blockSize / 4 blocks).
 	helix::UniqueDescriptor indirectOrder2;
-	// Caches indirection blocks reachable from order 2 blocks.
-	// - Indirection level 3/3 for triple indirect blocks.
-	helix::UniqueDescriptor indirectOrder3;
+	// Indirection level 3/3 is not cached here; those blocks are read on demand
+	// and only their contents end up in the block map.
+
+	// Logical to physical block mappings that were already resolved,
+	// indexed by the first logical block of each extent. Extents do not overlap.
+	std::map<uint64_t, BlockExtent> blockMap;
+
+	// Serializes modifications of the extent tree.
+	async::mutex extentMutex;
 
 	// NOTE: The following fields are only meaningful if the isReady is true
 
@@ -235,6 +604,24 @@ struct Inode : std::enable_shared_from_this<Inode> {
 	struct timespec dataModifyTime;
 	struct timespec anyChangeTime;
 	FlockManager flockManager;
+
+	// Cached mapping windows, indexed by offset / windowSize.
+	std::unordered_map<uint64_t, std::shared_ptr<MappingWindow>> windows;
+
+	ReadaheadState readahead;
+
+	// Dirty ranges of the page cache, indexed by their first byte. Page-aligned.
+	std::map<uint64_t, DirtyRange> dirtyRanges;
+	// Incremented whenever a window of this inode is unmapped.
+	uint64_t writebackEpoch = 0;
+	// Time (as returned by helGetClock()) at which the page cache became dirty.
+	uint64_t dirtySince = 0;
+	// Rung whenever a writeback of the page cache completes.
+	async::doorbell writebackDoorbell;
+	// Copies of dirtyRanges that pending syncs wait for. markClean() cleans them, too.
+	std::list<std::map<uint64_t, DirtyRange> *> syncSnapshots;
+	// True if the on-disk inode was changed since it was last synced.
+	bool diskInodeDirty = false;
 };
 
 // --------------------------------------------------------
@@ -252,23 +639,89 @@ struct FileSystem {
 
 	std::shared_ptr<Inode> accessRoot();
 	std::shared_ptr<Inode> accessInode(uint32_t number);
-	async::result<std::shared_ptr<Inode>> createRegular();
-	async::result<std::shared_ptr<Inode>> createDirectory();
+	// The parent directory is only used to select a block group.
+	async::result<std::shared_ptr<Inode>> createRegular(uint32_t parent);
+	async::result<std::shared_ptr<Inode>> createDirectory(uint32_t parent);
 
-	async::result<void> write(Inode *inode, uint64_t offset,
+	async::result<protocols::fs::Error> write(Inode *inode, uint64_t offset,
 			const void *buffer, size_t length);
 
 	async::detached initiateInode(std::shared_ptr<Inode> inode);
 	async::detached manageFileData(std::shared_ptr<Inode> inode);
+	// Updates the read-ahead state on a fault and issues read-ahead if the access is sequential.
+	void updateReadahead(std::shared_ptr<Inode> inode, uint64_t offset, size_t length);
+	// Loads a range of the page cache without blocking the caller.
+	async::detached prefetchFileData(std::shared_ptr<Inode> inode,
+			uint64_t offset, size_t length);
+
+	// Periodically starts writeback of inodes that have been dirty for writebackAge
+	// and (if enabled) reports the read-ahead statistics.
+	async::detached runWriteback();
+	// Unmaps the windows of an inode, such that the kernel notices all dirty pages.
+	void startWriteback(Inode *inode);
+	// Waits until the file (or all files for SyncMode::fileSystem) are on the disk.
+	// Fails for files that are mapped into memory, as we cannot observe writes to them.
+	async::result<protocols::fs::Error> sync(std::shared_ptr<Inode> inode,
+			protocols::fs::SyncMode mode);
+	async::result<void> syncInode(std::shared_ptr<Inode> inode, protocols::fs::SyncMode mode);
+	async::result<void> syncAllInodes();
+	// Writes the sector that contains the on-disk inode.
+	async::result<void> writeDiskInode(Inode *inode);
 	async::detached manageIndirect(std::shared_ptr<Inode> inode, int order,
 			helix::UniqueDescriptor memory);
 
-	async::result<uint32_t> allocateBlock();
-	async::result<uint32_t> allocateInode();
-
-	async::result<void> assignDataBlocks(Inode *inode,
+	uint32_t groupOfInode(uint32_t ino);
+	uint32_t blocksInGroup(uint32_t bg_idx);
+
+	// Allocates up to count contiguous blocks, preferably starting at goal.
+	// Returns the first block and the number of blocks ({0, 0} if the disk is full).
+	async::result<std::pair<uint32_t, size_t>> allocateBlocks(uint32_t goal, size_t count);
+	async::result<uint32_t> allocateBlock(uint32_t goal = 0);
+	// Frees blocks that were allocated by allocateBlocks(). The blocks must be in the same group.
+	async::result<void> freeBlocks(uint32_t block, size_t count);
+	// Allocates an inode close to its parent directory (for directories: in a group
+	// with many free blocks and inodes). Returns zero if there are no free inodes.
+	async::result<uint32_t> allocateInode(uint32_t parent, bool directory);
+
+	// Schedules a write-back of the group descriptor.
+	void markGroupDescriptorDirty(uint32_t bg_idx);
+	// Sets the LARGE_FILE feature once a file grows beyond 2 GiB.
+	void markLargeFile(uint64_t size);
+	// Schedules a write-back of the superblock (together with the group descriptors).
+	void markSuperblockDirty();
+	async::detached flushGroupDescriptors();
+
+	// Schedules a write-back of the block (or inode) bitmap of a block group.
+	void markBlockBitmapDirty(uint32_t bg_idx);
+	void markInodeBitmapDirty(uint32_t bg_idx);
+	async::detached flushBitmaps();
+	async::result<void> writeBitmap(helix::BorrowedDescriptor memory,
+			uint32_t bg_idx, uint32_t block);
+
+	// Allocates the blocks [block_offset, block_offset + num_blocks) of the file if necessary.
+	// Returns noSpaceLeft if the disk is full and fileTooBig if the blocks cannot be mapped.
+	async::result<protocols::fs::Error> assignDataBlocks(Inode *inode,
 			uint64_t block_offset, size_t num_blocks);
 
+	// Returns the physical location of up to count blocks starting at the given logical block.
+	async::result<BlockExtent> mapBlocks(Inode *inode, uint64_t block, uint64_t count);
+	// Resolve the extent that starts at the given logical block. The result does not
+	// extend beyond a single indirect block (or leaf of the extent tree).
+	async::result<BlockExtent> resolveIndirect(Inode *inode, uint64_t block);
+	async::result<BlockExtent> resolveExtent(Inode *inode, uint64_t block);
+
+	// Returns the path from the root of the extent tree to the leaf that covers the block.
+	async::result<std::vector<ExtentNode>> loadExtentPath(Inode *inode, uint64_t block);
+	// Writes a modified path back, splitting nodes that overflow.
+	// Returns false (without writing anything) if the disk is full.
+	async::result<bool> storeExtentPath(Inode *inode, std::vector<ExtentNode> &path);
+	async::result<void> writeExtentNode(Inode *inode, const ExtentNode &node);
+	// Allocates (or initializes) blocks of an extent-mapped file, starting at the given block.
+	// Returns the number of blocks that were processed (zero if the disk is full);
+	// goal is advanced past new blocks.
+	async::result<size_t> assignExtentBlocks(Inode *inode, uint64_t block, size_t count,
+			uint32_t &goal);
+
 	async::result<void> readDataBlocks(std::shared_ptr<Inode> inode, uint64_t block_offset,
 			size_t num_blocks, void *buffer);
 	async::result<void> writeDataBlocks(std::shared_ptr<Inode> inode, uint64_t block_offset,
@@ -285,13 +738,63 @@ struct FileSystem {
 	uint32_t numBlockGroups;
 	uint32_t blocksPerGroup;
 	uint32_t inodesPerGroup;
+	uint32_t blocksCount;
+	uint32_t inodesCount;
+	uint32_t firstDataBlock;
 	void *blockGroupDescriptorBuffer;
+	uint64_t groupDescriptorSector;
+	// The 1024 bytes of the on-disk superblock.
+	void *superblockBuffer;
+	bool superblockDirty = false;
+
+	// Sectors of the group descriptor table (relative to groupDescriptorSector)
+	// that have been modified but not written back yet.
+	std::set<uint64_t> dirtyDescriptorSectors;
+	bool flushingDescriptors = false;
+	// Rung whenever flushGroupDescriptors() finishes.
+	async::doorbell descriptorsFlushed;
+
+	// Block groups whose block (or inode) bitmap has been modified
+	// but not written back yet.
+	std::set<uint32_t> dirtyBlockBitmaps;
+	std::set<uint32_t> dirtyInodeBitmaps;
+	bool flushingBitmaps = false;
+	// Rung whenever flushBitmaps() finishes.
+	async::doorbell bitmapsFlushed;
+
+	// Parameters of hashed directories.
+	bool hasDirIndex;
+	bool unsignedHash;
+	// Maximal depth of htrees that we create (largedir allows more than two levels).
+	int maxIndexDepth;
+	uint32_t hashSeed[4];
 
 	helix::UniqueDescriptor blockBitmap;
 	helix::UniqueDescriptor inodeBitmap;
 	helix::UniqueDescriptor inodeTable;
 
 	std::unordered_map<uint32_t, std::weak_ptr<Inode>> activeInodes;
+
+	// Adds a window to the cache, evicting the least recently used window if necessary.
+	void cacheWindow(std::shared_ptr<MappingWindow> window);
+	// Marks a window as most recently used.
+	void touchWindow(MappingWindow *window);
+	// Removes a window from the cache; it is unmapped once its last user releases it.
+	void uncacheWindow(MappingWindow *window);
+
+	// Cached windows of all inodes; the most recently used window is at the front.
+	std::list<MappingWindow *> windowLru;
+
+	ReadaheadStats readaheadStats;
+	// Value of readaheadStats.windows and time of the last report.
+	uint64_t reportedReadaheadWindows = 0;
+	uint64_t lastReadaheadReport = 0;
+
+	// Inodes that have dirty ranges. Keeps the inodes alive until they are clean.
+	std::set<std::shared_ptr<Inode>> dirtyInodes;
+	// Age (in nanoseconds) after which dirty data is written back.
+	// Set by the blockfs.writeback_age option (in milliseconds).
+	uint64_t writebackAge = defaultWritebackAge;
 };
 
 // --------------------------------------------------------
@@ -302,11 +805,17 @@ struct OpenFile {
 	OpenFile(std::shared_ptr<Inode> inode);
 
 	async::result<std::optional<std::string>> readEntries();
+	async::result<void> readEntryBatch(protocols::fs::EntryBatch *batch);
 
 	std::shared_ptr<Inode> inode;
 	uint64_t offset;
 	Flock flock;
 };
 
+// Measures the latency of Inode::findEntry() for hits and misses in the directories
+// /lookup-bench/10000, /lookup-bench/100000 and /lookup-bench/1000000 (if they exist).
+// These directories are expected to contain the entries "0" to "N - 1".
+async::result<void> benchmarkLookups(FileSystem *fs);
+
 } } // namespace blockfs::ext2fs
 
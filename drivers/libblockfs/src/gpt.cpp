@@ -84,5 +84,9 @@ async::result<void> Partition::writeSectors(uint64_t sector, const void *buffer,
 			buffer, count);
 }
 
+async::result<void> Partition::flush() {
+	return _table.getDevice()->flush();
+}
+
 } } // namespace blockfs::gpt
 
@@ -1,9 +1,12 @@
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <iostream>
 #include <algorithm>
+#include <optional>
 
+#include <async/jump.hpp>
 #include <helix/ipc.hpp>
 #include <protocols/fs/server.hpp>
 #include <protocols/mbus/client.hpp>
@@ -12,9 +15,14 @@
 #include "gpt.hpp"
 #include "ext2fs.hpp"
 #include "fs.pb.h"
+#include "kerncfg.pb.h"
 
 namespace blockfs {
 
+namespace {
+	constexpr bool runLookupBenchmark = false;
+}
+
 // TODO: Support more than one table.
 gpt::Table *table;
 ext2fs::FileSystem *fs;
@@ -65,33 +73,52 @@ async::result<protocols::fs::ReadResult> read(void *object, const char *,
 		co_return 0; // TODO: Return an explicit end-of-file error?
 
 	auto chunk_offset = self->offset;
-	auto map_offset = chunk_offset & ~size_t(0xFFF);
-	auto map_size = (((chunk_offset & size_t(0xFFF)) + chunk_size + 0xFFF) & ~size_t(0xFFF));
 	self->offset += chunk_size;
 
-	helix::LockMemoryView lock_memory;
-	auto &&submit = helix::submitLockMemoryView(helix::BorrowedDescriptor(self->inode->frontalMemory),
-			&lock_memory, map_offset, map_size, helix::Dispatcher::global());
-	co_await submit.async_wait();
-	HEL_CHECK(lock_memory.error());
+	// Copy out of the inode's cached mapping windows.
+	co_await self->inode->readCache(chunk_offset, buffer, chunk_size);
+	co_return chunk_size;
+}
 
-	// Map the page cache into the address space.
-	helix::Mapping file_map{helix::BorrowedDescriptor{self->inode->frontalMemory},
-			static_cast<ptrdiff_t>(map_offset), map_size,
-			kHelMapProtRead | kHelMapDontRequireBacking};
+async::result<protocols::fs::Error> write(void *object, const char *,
+		const void *buffer, size_t length) {
+	assert(length);
 
-	memcpy(buffer, reinterpret_cast<char *>(file_map.get()) + (chunk_offset - map_offset),
-			chunk_size);
+	auto self = static_cast<ext2fs::OpenFile *>(object);
+	auto error = co_await self->inode->fs.write(self->inode.get(), self->offset,
+			buffer, length);
+	if(error != protocols::fs::Error::none)
+		co_return error;
+	self->offset += length;
+	co_return protocols::fs::Error::none;
+}
+
+async::result<protocols::fs::ReadResult> pread(void *object, int64_t offset, const char *,
+		void *buffer, size_t length) {
+	assert(length);
+
+	auto self = static_cast<ext2fs::OpenFile *>(object);
+	co_await self->inode->readyJump.async_wait();
+
+	if(offset < 0)
+		co_return protocols::fs::Error::illegalArguments;
+	if(static_cast<uint64_t>(offset) >= self->inode->fileSize())
+		co_return 0;
+	auto chunk_size = std::min(length, self->inode->fileSize() - offset);
+
+	co_await self->inode->readCache(offset, buffer, chunk_size);
 	co_return chunk_size;
 }
 
-async::result<void> write(void *object, const char *,
+async::result<protocols::fs::Error> pwrite(void *object, int64_t offset, const char *,
 		const void *buffer, size_t length) {
 	assert(length);
 
+	if(offset < 0)
+		co_return protocols::fs::Error::illegalArguments;
+
 	auto self = static_cast<ext2fs::OpenFile *>(object);
-	co_await self->inode->fs.write(self->inode.get(), self->offset, buffer, length);
-	self->offset += length;
+	co_return co_await self->inode->fs.write(self->inode.get(), offset, buffer, length);
 }
 
 async::result<helix::BorrowedDescriptor>
@@ -107,22 +134,39 @@ readEntries(void *object) {
 	co_return co_await self->readEntries();
 }
 
+async::result<bool>
+readEntryBatch(void *object, protocols::fs::EntryBatch *batch) {
+	auto self = static_cast<ext2fs::OpenFile *>(object);
+	co_await self->readEntryBatch(batch);
+	co_return true;
+}
+
 async::result<void>
 truncate(void *object, size_t size) {
 	auto self = static_cast<ext2fs::OpenFile *>(object);
 	co_return co_await self->inode->fs.truncate(self->inode.get(), size);
 }
 
+async::result<protocols::fs::Error>
+sync(void *object, protocols::fs::SyncMode mode) {
+	auto self = static_cast<ext2fs::OpenFile *>(object);
+	co_return co_await self->inode->fs.sync(self->inode, mode);
+}
+
 constexpr protocols::fs::FileOperations fileOperations {
 	.seekAbs      = &seekAbs,
 	.seekRel      = &seekRel,
 	.seekEof      = &seekEof,
 	.read         = &read,
 	.write        = &write,
+	.pread        = &pread,
+	.pwrite       = &pwrite,
 	.flock        = &flock,
 	.readEntries  = &readEntries,
+	.readEntryBatch = &readEntryBatch,
 	.accessMemory = &accessMemory,
-	.truncate     = &truncate
+	.truncate     = &truncate,
+	.sync         = &sync
 };
 
 async::result<protocols::fs::GetLinkResult> getLink(std::shared_ptr<void> object,
@@ -307,7 +351,12 @@ async::detached servePartition(helix::UniqueLane lane) {
 			helix::SendBuffer send_resp;
 			helix::PushDescriptor push_node;
 
-			auto inode = co_await fs->createRegular();
+			// The inode is placed close to its parent directory. Fall back to the root
+			// directory for clients that do not send a (valid) parent.
+			uint32_t parent = ext2fs::EXT2_ROOT_INO;
+			if(req.parent_id() && req.parent_id() <= fs->inodesCount)
+				parent = req.parent_id();
+			auto inode = co_await fs->createRegular(parent);
 
 			helix::UniqueLane local_lane, remote_lane;
 			std::tie(local_lane, remote_lane) = helix::createStream();
@@ -332,7 +381,89 @@ async::detached servePartition(helix::UniqueLane lane) {
 	}
 }
 
+namespace {
+
+bool linkedKerncfg = false;
+helix::UniqueLane kerncfgLane;
+async::jump foundKerncfg;
+
+async::result<std::string> fetchCmdline() {
+	// There might be multiple devices, but we only need to find kerncfg once.
+	if(!linkedKerncfg) {
+		linkedKerncfg = true;
+
+		auto root = co_await mbus::Instance::global().getRoot();
+
+		auto filter = mbus::Conjunction({
+			mbus::EqualsFilter("class", "kerncfg")
+		});
+
+		auto handler = mbus::ObserverHandler{}
+		.withAttach([] (mbus::Entity entity, mbus::Properties properties) -> async::detached {
+			kerncfgLane = helix::UniqueLane(co_await entity.bind());
+			foundKerncfg.trigger();
+		});
+
+		co_await root.linkObserver(std::move(filter), std::move(handler));
+	}
+	co_await foundKerncfg.async_wait();
+
+	helix::Offer offer;
+	helix::SendBuffer send_req;
+	helix::RecvInline recv_resp;
+	helix::RecvInline recv_cmdline;
+
+	managarm::kerncfg::CntRequest req;
+	req.set_req_type(managarm::kerncfg::CntReqType::GET_CMDLINE);
+
+	auto ser = req.SerializeAsString();
+	auto &&transmit = helix::submitAsync(kerncfgLane, helix::Dispatcher::global(),
+			helix::action(&offer, kHelItemAncillary),
+			helix::action(&send_req, ser.data(), ser.size(), kHelItemChain),
+			helix::action(&recv_resp, kHelItemChain),
+			helix::action(&recv_cmdline));
+	co_await transmit.async_wait();
+	HEL_CHECK(offer.error());
+	HEL_CHECK(send_req.error());
+	HEL_CHECK(recv_resp.error());
+	HEL_CHECK(recv_cmdline.error());
+
+	managarm::kerncfg::SvrResponse resp;
+	resp.ParseFromArray(recv_resp.data(), recv_resp.length());
+	assert(resp.error() == managarm::kerncfg::Error::SUCCESS);
+	co_return std::string{(const char *)recv_cmdline.data(), recv_cmdline.length()};
+}
+
+// Returns the value of a "name=value" option on the kernel command line.
+std::optional<uint64_t> getNumericOption(const std::string &cmdline, const std::string &name) {
+	size_t pos = 0;
+	while(pos < cmdline.size()) {
+		auto end = cmdline.find(' ', pos);
+		if(end == std::string::npos)
+			end = cmdline.size();
+		auto option = cmdline.substr(pos, end - pos);
+		pos = end + 1;
+
+		if(option.size() <= name.size() || option.compare(0, name.size(), name)
+				|| option[name.size()] != '=')
+			continue;
+
+		char *tail;
+		auto value = strtoull(option.c_str() + name.size() + 1, &tail, 10);
+		if(tail == option.c_str() + name.size() + 1 || *tail) {
+			printf("blockfs: Ignoring malformed option %s\n", option.c_str());
+			return std::nullopt;
+		}
+		return value;
+	}
+	return std::nullopt;
+}
+
+} // anonymous namespace
+
 async::detached runDevice(BlockDevice *device) {
+	auto cmdline = co_await fetchCmdline();
+
 	table = new gpt::Table(device);
 	co_await table->parse();
 
@@ -347,9 +478,16 @@ async::detached runDevice(BlockDevice *device) {
 		printf("It's a Windows data partition!\n");
 
 		fs = new ext2fs::FileSystem(&table->getPartition(i));
+		if(auto age = getNumericOption(cmdline, "blockfs.writeback_age"); age) {
+			printf("ext2fs: Writing back dirty data after %lu ms\n", *age);
+			fs->writebackAge = *age * 1'000'000;
+		}
 		co_await fs->init();
 		printf("ext2fs is ready!\n");
 
+		if(runLookupBenchmark)
+			co_await ext2fs::benchmarkLookups(fs);
+
 		// Create an mbus object for the partition.
 		auto root = co_await mbus::Instance::global().getRoot();
 
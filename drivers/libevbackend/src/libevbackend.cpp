@@ -135,7 +135,7 @@ File::read(void *object, const char *, void *buffer, size_t max_size) {
 	}
 }
 
-async::result<void> File::write(void *, const char *, const void *, size_t) {
+async::result<protocols::fs::Error> File::write(void *, const char *, const void *, size_t) {
 	throw std::runtime_error("write not yet implemented");
 }
 
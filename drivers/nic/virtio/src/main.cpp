@@ -68,8 +68,8 @@ async::result<protocols::fs::ReadResult> noopRead(void *, const char *, void *bu
 	co_return length;
 }
 
-async::result<void> noopWrite(void*, const char*, const void *, size_t) {
-	co_return;
+async::result<protocols::fs::Error> noopWrite(void*, const char*, const void *, size_t) {
+	co_return protocols::fs::Error::none;
 }
 }
 
@@ -1,11 +1,18 @@
 #include <stdlib.h>
+#include <algorithm>
 #include <iostream>
 
+#include <hel.h>
+#include <hel-syscalls.h>
+
 #include "net.hpp"
 
 namespace nic {
 namespace virtio {
 
+static bool logDroppedPackets = false;
+static bool logPacketRates = false;
+
 static uint8_t deviceMac[6];
 
 static async::result<void> testNetworking(Device *device);
@@ -19,6 +26,16 @@ static void recvUdpPacket(Device *device,
 static std::deque<std::vector<std::byte>> dhcpInPackets;
 static async::doorbell dhcpInDoorbell;
 
+// --------------------------------------------------------
+// ReceiveBuffer / TransmitBuffer
+// --------------------------------------------------------
+
+ReceiveBuffer::ReceiveBuffer(Device *device_, arch::dma_pool *pool)
+: device{device_}, header{pool}, packet{pool, maxFrameSize} { }
+
+TransmitBuffer::TransmitBuffer(arch::dma_pool *pool, size_t size)
+: header{pool}, packet{pool, size} { }
+
 // --------------------------------------------------------
 // Device
 // --------------------------------------------------------
@@ -47,53 +64,109 @@ void Device::runDevice() {
 
 	_transport->runDevice();
 
+	// Make sure that posting receive buffers never blocks on descriptors.
+	auto num_buffers = std::min(numReceiveBuffers, _receiveVq->numDescriptors() / 2);
+	for(size_t i = 0; i < num_buffers; i++)
+		_receiveBuffers.push_back(std::make_unique<ReceiveBuffer>(this, &_dmaPool));
+
 	_processReceive();
 
 	async::detach(testNetworking(this));
 }
 
 async::result<void> Device::sendPacket(const std::vector<std::byte> &payload) {
-	if(payload.size() > 1514)
+	if(payload.size() > maxFrameSize)
 		throw std::runtime_error("Packet exceeds maximum ethernet size");
 
-	arch::dma_object<VirtHeader> header{&_dmaPool};
-	arch::dma_buffer packet{&_dmaPool, payload.size()};
-
-	memset(header.data(), 0, sizeof(VirtHeader));
-	memcpy(packet.data(), payload.data(), payload.size());
+	auto buffer = new TransmitBuffer{&_dmaPool, payload.size()};
+	memset(buffer->header.data(), 0, sizeof(VirtHeader));
+	memcpy(buffer->packet.data(), payload.data(), payload.size());
 
+	// obtainDescriptor() blocks if the transmit virtq is full.
+	// This limits the number of transmits that are in flight.
 	virtio_core::Chain chain;
 	chain.append(co_await _transmitVq->obtainDescriptor());
 	chain.setupBuffer(virtio_core::hostToDevice,
-			header.view_buffer().subview(0, legacyHeaderSize));
+			buffer->header.view_buffer().subview(0, legacyHeaderSize));
 	chain.append(co_await _transmitVq->obtainDescriptor());
-	chain.setupBuffer(virtio_core::hostToDevice, packet);
+	chain.setupBuffer(virtio_core::hostToDevice, buffer->packet);
+
+	_transmitVq->postDescriptor(chain.front(), buffer,
+			[] (virtio_core::Request *base_request) {
+		auto buffer = static_cast<TransmitBuffer *>(base_request);
+		delete buffer;
+	});
+	_transmitVq->notify();
 
-	std::cout << "nic-virtio: Preparing to send" << std::endl;
-	co_await _transmitVq->submitDescriptor(chain.front());
-	std::cout << "nic-virtio: Sent packet" << std::endl;
+	_numTransmitted++;
+	_updateRates();
+}
+
+async::result<void> Device::_postReceive(ReceiveBuffer *buffer) {
+	virtio_core::Chain chain;
+	chain.append(co_await _receiveVq->obtainDescriptor());
+	chain.setupBuffer(virtio_core::deviceToHost,
+			buffer->header.view_buffer().subview(0, legacyHeaderSize));
+	chain.append(co_await _receiveVq->obtainDescriptor());
+	chain.setupBuffer(virtio_core::deviceToHost, buffer->packet);
+
+	_receiveVq->postDescriptor(chain.front(), buffer,
+			[] (virtio_core::Request *base_request) {
+		auto buffer = static_cast<ReceiveBuffer *>(base_request);
+		buffer->device->_completedReceives.push(buffer);
+		buffer->device->_receiveDoorbell.ring();
+	});
 }
 
 async::detached Device::_processReceive() {
+	// Fill the receive virtq.
+	for(auto &buffer : _receiveBuffers)
+		co_await _postReceive(buffer.get());
+	_receiveVq->notify();
+
 	while(true) {
-		arch::dma_object<VirtHeader> header{&_dmaPool};
-		arch::dma_buffer packet{&_dmaPool, 1514};
+		if(_completedReceives.empty()) {
+			co_await _receiveDoorbell.async_wait();
+			continue;
+		}
 
-		virtio_core::Chain chain;
-		chain.append(co_await _receiveVq->obtainDescriptor());
-		chain.setupBuffer(virtio_core::deviceToHost,
-				header.view_buffer().subview(0, legacyHeaderSize));
-		chain.append(co_await _receiveVq->obtainDescriptor());
-		chain.setupBuffer(virtio_core::deviceToHost, packet);
+		// Handle all packets that completed so far before notifying the device.
+		while(!_completedReceives.empty()) {
+			auto buffer = _completedReceives.front();
+			_completedReceives.pop();
 
-		std::cout << "nic-virtio: Preparing to receive" << std::endl;
-		co_await _receiveVq->submitDescriptor(chain.front());
-		std::cout << "nic-virtio: Received packet" << std::endl;
+			if(buffer->bytesWritten > legacyHeaderSize) {
+				auto length = std::min(buffer->bytesWritten - legacyHeaderSize, maxFrameSize);
+				recvEthernetPacket(this, arch::dma_buffer_view{buffer->packet}.subview(0, length));
+				_numReceived++;
+			}
 
-		recvEthernetPacket(this, packet);
+			co_await _postReceive(buffer);
+		}
+		_receiveVq->notify();
+
+		_updateRates();
 	}
 }
 
+void Device::_updateRates() {
+	if(!logPacketRates)
+		return;
+
+	uint64_t now;
+	HEL_CHECK(helGetClock(&now));
+	if(now - _rateEpoch < 1'000'000'000)
+		return;
+
+	auto nanos = now - _rateEpoch;
+	std::cout << "nic-virtio: " << (_numReceived - _epochReceived) * 1'000'000'000 / nanos
+			<< " RX packets/s, " << (_numTransmitted - _epochTransmitted) * 1'000'000'000 / nanos
+			<< " TX packets/s" << std::endl;
+	_rateEpoch = now;
+	_epochReceived = _numReceived;
+	_epochTransmitted = _numTransmitted;
+}
+
 // --------------------------------------------------------
 
 template<typename T>
@@ -296,7 +369,8 @@ static async::result<void> sendEthernetPacket(Device *device,
 static void recvEthernetPacket(Device *device,
 		arch::dma_buffer_view buffer) {
 	if(buffer.size() < sizeof(EthernetHeader)) {
-		std::cout << "nic-virtio: Ethernet packet without header" << std::endl;
+		if(logDroppedPackets)
+			std::cout << "nic-virtio: Ethernet packet without header" << std::endl;
 		return;
 	}
 
@@ -310,7 +384,8 @@ static void recvEthernetPacket(Device *device,
 static void recvIp4Packet(Device *device,
 		arch::dma_buffer_view buffer) {
 	if(buffer.size() < sizeof(Ip4Header)) {
-		std::cout << "nic-virtio: IP4 packet without header" << std::endl;
+		if(logDroppedPackets)
+			std::cout << "nic-virtio: IP4 packet without header" << std::endl;
 		return;
 	}
 
@@ -319,20 +394,22 @@ static void recvIp4Packet(Device *device,
 
 	size_t header_length = (header.version_headerLength & 0xF) * 4;
 	if(buffer.size() < sizeof(Ip4Header)) {
-		std::cout << "nic-virtio: IP4 packet smaller than length of header" << std::endl;
+		if(logDroppedPackets)
+			std::cout << "nic-virtio: IP4 packet smaller than length of header" << std::endl;
 		return;
 	}
 
 	// TODO: Support fragment reassembly.
 	auto fo = netToHost<uint16_t>(header.flags_offset);
 	if((fo & kFragmentOffsetMask) || (fo & kFlagMF)) {
-		std::cout << "nic-virtio: Dropping fragmented IP4 packet" << std::endl;
+		if(logDroppedPackets)
+			std::cout << "nic-virtio: Dropping fragmented IP4 packet" << std::endl;
 		return;
 	}
 
 	if(header.protocol == kUdpProtocol) {
 		recvUdpPacket(device, buffer.subview(header_length));
-	}else{
+	}else if(logDroppedPackets) {
 		std::cout << "nic-virtio: Dropping unexpected IP4 protocol "
 				<< (int)header.protocol << std::endl;
 	}
@@ -340,10 +417,9 @@ static void recvIp4Packet(Device *device,
 
 static void recvUdpPacket(Device *device,
 		arch::dma_buffer_view buffer) {
-	std::cout << "nic-virtio: Got UDP packet" << std::endl;
-
 	if(buffer.size() < sizeof(UdpHeader)) {
-		std::cout << "nic-virtio: UDP packet without header" << std::endl;
+		if(logDroppedPackets)
+			std::cout << "nic-virtio: UDP packet without header" << std::endl;
 		return;
 	}
 
@@ -351,7 +427,8 @@ static void recvUdpPacket(Device *device,
 	memcpy(&header, buffer.data(), sizeof(UdpHeader));
 
 	if(buffer.size() < sizeof(UdpHeader) + netToHost<uint16_t>(header.length)) {
-		std::cout << "nic-virtio: UDP packet is smaller than advertised" << std::endl;
+		if(logDroppedPackets)
+			std::cout << "nic-virtio: UDP packet is smaller than advertised" << std::endl;
 		return;
 	}
 
@@ -363,8 +440,8 @@ static void recvUdpPacket(Device *device,
 
 		dhcpInPackets.push_back(std::move(payload));
 		dhcpInDoorbell.ring();
-	}else{
-		std::cout << "nic-virtio: Dropping unexpected IP4 protocol "
+	}else if(logDroppedPackets) {
+		std::cout << "nic-virtio: Dropping UDP packet to unexpected port "
 				<< port << std::endl;
 	}
 }
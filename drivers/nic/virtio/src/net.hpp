@@ -45,21 +45,59 @@ static constexpr size_t legacyHeaderSize = 10;
 static constexpr size_t multiBuffersHeaderSize = 12;
 static_assert(sizeof(VirtHeader) == multiBuffersHeaderSize);
 
+// Maximal size of an ethernet frame (without FCS).
+static constexpr size_t maxFrameSize = 1514;
+
+// Number of receive buffers that we keep posted to the device.
+// Each buffer consumes two descriptors of the receive virtq.
+static constexpr size_t numReceiveBuffers = 64;
+
+struct Device;
+
+// --------------------------------------------------------
+// ReceiveBuffer / TransmitBuffer
+// --------------------------------------------------------
+
+// Receive buffers are allocated once and recycled after each packet.
+struct ReceiveBuffer : virtio_core::Request {
+	ReceiveBuffer(Device *device, arch::dma_pool *pool);
+
+	Device *device;
+	arch::dma_object<VirtHeader> header;
+	arch::dma_buffer packet;
+};
+
+struct TransmitBuffer : virtio_core::Request {
+	TransmitBuffer(arch::dma_pool *pool, size_t size);
+
+	arch::dma_object<VirtHeader> header;
+	arch::dma_buffer packet;
+};
+
 // --------------------------------------------------------
 // Device
 // --------------------------------------------------------
 
 struct Device {
+	friend struct ReceiveBuffer;
+
 	Device(std::unique_ptr<virtio_core::Transport> transport);
 
 	void runDevice();
 
+	// Posts the packet to the device. Completes once the packet is posted;
+	// it does not wait until the device has transmitted the packet.
 	async::result<void> sendPacket(const std::vector<std::byte> &payload);
 
 private:
+	// Posts a receive buffer to the receive virtq (without notifying the device).
+	async::result<void> _postReceive(ReceiveBuffer *buffer);
+
+	// Handles completed receive buffers and reposts them in batches.
 	async::detached _processReceive();
-	// Submits requests from _pendingQueue to the device.
-	async::detached _processTransmit();
+
+	// Reports packet rates if logPacketRates is set.
+	void _updateRates();
 
 	std::unique_ptr<virtio_core::Transport> _transport;
 	arch::contiguous_pool _dmaPool;
@@ -67,6 +105,19 @@ private:
 	// The receive/transmit queues of this device.
 	virtio_core::Queue *_receiveVq;
 	virtio_core::Queue *_transmitVq;
+
+	std::vector<std::unique_ptr<ReceiveBuffer>> _receiveBuffers;
+
+	// Receive buffers that were completed by the device but not handled yet.
+	std::queue<ReceiveBuffer *> _completedReceives;
+	async::doorbell _receiveDoorbell;
+
+	// Packet counters (used to compute packet rates).
+	uint64_t _numReceived = 0;
+	uint64_t _numTransmitted = 0;
+	uint64_t _rateEpoch = 0;
+	uint64_t _epochReceived = 0;
+	uint64_t _epochTransmitted = 0;
 };
 
 } } // namespace nic::virtio
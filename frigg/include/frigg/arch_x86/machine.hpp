@@ -25,6 +25,7 @@ enum {
 	// Extendend features, EDX register
 	kCpuFlagSyscall = 0x800,
 	kCpuFlagNx = 0x100000,
+	kCpuFlag1GPages = 0x4000000,
 	kCpuFlagLongMode = 0x20000000
 };
 
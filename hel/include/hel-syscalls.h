@@ -201,6 +201,12 @@ extern inline __attribute__ (( always_inline )) HelError helPointerPhysical(void
 	return error;
 };
 
+extern inline __attribute__ (( always_inline )) HelError helPointerPhysicalRange(void *pointer,
+		size_t size, uintptr_t *physicals) {
+	return helSyscall3(kHelCallPointerPhysicalRange, (HelWord)pointer, (HelWord)size,
+			(HelWord)physicals);
+};
+
 extern inline __attribute__ (( always_inline )) HelError helLoadForeign(HelHandle handle,
 		uintptr_t address, size_t length, void *buffer) {
 	return helSyscall4(kHelCallLoadForeign, (HelWord)handle, (HelWord)address,
@@ -345,6 +351,32 @@ extern inline __attribute__ (( always_inline )) HelError helFutexWake(int *point
 	return helSyscall1(kHelCallFutexWake, (HelWord)pointer);
 };
 
+extern inline __attribute__ (( always_inline )) HelError helFutexWaitDeadline(int *pointer,
+		int expected, int64_t deadline, uint32_t flags) {
+	return helSyscall4(kHelCallFutexWaitDeadline, (HelWord)pointer, (HelWord)expected,
+			(HelWord)deadline, (HelWord)flags);
+};
+
+extern inline __attribute__ (( always_inline )) HelError helFutexWakeCount(int *pointer,
+		int count, uint32_t flags, int *woken) {
+	HelWord out_woken;
+	HelError error = helSyscall3_1(kHelCallFutexWakeCount, (HelWord)pointer, (HelWord)count,
+			(HelWord)flags, &out_woken);
+	*woken = (int)out_woken;
+	return error;
+};
+
+extern inline __attribute__ (( always_inline )) HelError helFutexRequeue(int *pointer,
+		int *target, int expected, int wake_count, int requeue_count, uint32_t flags,
+		int *woken) {
+	HelWord out_woken;
+	HelError error = helSyscall6_1(kHelCallFutexRequeue, (HelWord)pointer, (HelWord)target,
+			(HelWord)expected, (HelWord)wake_count, (HelWord)requeue_count, (HelWord)flags,
+			&out_woken);
+	*woken = (int)out_woken;
+	return error;
+};
+
 extern inline __attribute__ (( always_inline )) HelError helCreateOneshotEvent(HelHandle *handle) {
 	HelWord handle_word;
 	HelError error = helSyscall0_1(kHelCallCreateOneshotEvent, &handle_word);
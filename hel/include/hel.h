@@ -45,6 +45,7 @@ enum {
 	kHelCallSubmitProtectMemory = 99,
 	kHelCallUnmapMemory = 36,
 	kHelCallPointerPhysical = 43,
+	kHelCallPointerPhysicalRange = 53,
 	kHelCallLoadForeign = 77,
 	kHelCallStoreForeign = 78,
 	kHelCallMemoryInfo = 26,
@@ -76,6 +77,9 @@ enum {
 
 	kHelCallFutexWait = 70,
 	kHelCallFutexWake = 71,
+	kHelCallFutexWaitDeadline = 72,
+	kHelCallFutexWakeCount = 73,
+	kHelCallFutexRequeue = 69,
 
 	kHelCallCreateOneshotEvent = 96,
 	kHelCallCreateBitsetEvent = 97,
@@ -115,6 +119,7 @@ enum {
 	kHelErrFault = 10,
 	kHelErrNoHardwareSupport = 16,
 	kHelErrNoMemory = 17,
+	kHelErrTimeout = 20,
 };
 
 struct HelX86SegmentRegister {
@@ -180,6 +185,12 @@ enum {
 	kHelWaitInfinite = -1
 };
 
+enum {
+	// Key the futex by the underlying memory object instead of the virtual address.
+	// Required for futexes in memory that is shared between address spaces.
+	kHelFutexShared = 1
+};
+
 enum {
 	kHelAbiSystemV = 1
 };
@@ -232,7 +243,9 @@ struct HelDescriptorInfo {
 enum HelAllocFlags {
 	kHelAllocContinuous = 4,
 	kHelAllocOnDemand = 1,
-	kHelAllocBacked = 2
+	kHelAllocBacked = 2,
+	// Back the memory by 2 MiB pages where possible.
+	kHelAllocHugePages = 8
 };
 
 struct HelAllocRestrictions {
@@ -474,6 +487,16 @@ HEL_C_LINKAGE HelError helSubmitProtectMemory(HelHandle space,
 		HelHandle queue, uintptr_t context);
 HEL_C_LINKAGE HelError helUnmapMemory(HelHandle space, void *pointer, size_t size);
 HEL_C_LINKAGE HelError helPointerPhysical(void *pointer, uintptr_t *physical);
+//! Resolves the physical addresses of all pages of a range of virtual memory.
+//! @param[in] pointer
+//!     Start of the range; does not need to be page aligned.
+//! @param[in] size
+//!     Size of the range in bytes.
+//! @param[out] physicals
+//!     Array that receives one physical address per page that the range touches.
+//!     The first entry includes the offset of @p pointer within its page.
+HEL_C_LINKAGE HelError helPointerPhysicalRange(void *pointer, size_t size,
+		uintptr_t *physicals);
 HEL_C_LINKAGE HelError helLoadForeign(HelHandle handle, uintptr_t address,
 		size_t length, void *buffer);
 HEL_C_LINKAGE HelError helStoreForeign(HelHandle handle, uintptr_t address,
@@ -514,6 +537,18 @@ HEL_C_LINKAGE HelError helShutdownLane(HelHandle handle);
 
 HEL_C_LINKAGE HelError helFutexWait(int *pointer, int expected);
 HEL_C_LINKAGE HelError helFutexWake(int *pointer);
+//! Waits until the futex is woken or the deadline (as returned by helGetClock())
+//! passes; returns kHelErrTimeout in the latter case.
+//! @param deadline kHelWaitInfinite to wait without timeout.
+HEL_C_LINKAGE HelError helFutexWaitDeadline(int *pointer, int expected, int64_t deadline,
+		uint32_t flags);
+//! Wakes up to @p count waiters (all waiters if @p count is negative).
+HEL_C_LINKAGE HelError helFutexWakeCount(int *pointer, int count, uint32_t flags, int *woken);
+//! If @p pointer still contains @p expected, wakes up to @p wake_count waiters
+//! and moves up to @p requeue_count further waiters to @p target.
+//! Returns kHelErrIllegalState if the value does not match.
+HEL_C_LINKAGE HelError helFutexRequeue(int *pointer, int *target, int expected,
+		int wake_count, int requeue_count, uint32_t flags, int *woken);
 
 HEL_C_LINKAGE HelError helCreateOneshotEvent(HelHandle *handle);
 HEL_C_LINKAGE HelError helCreateBitsetEvent(HelHandle *handle);
@@ -558,6 +593,8 @@ extern inline __attribute__ (( always_inline )) const char *_helErrorString(HelE
 		return "Missing hardware support for this feature";
 	case kHelErrNoMemory:
 		return "Out of memory";
+	case kHelErrTimeout:
+		return "Timeout";
 	default:
 		return 0;
 	}
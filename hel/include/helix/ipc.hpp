@@ -7,6 +7,7 @@
 #include <initializer_list>
 #include <list>
 #include <stdexcept>
+#include <vector>
 
 #include <async/result.hpp>
 #include <hel.h>
@@ -890,6 +891,57 @@ private:
 	ElementHandle _element;
 };
 
+// Type-erased Item<R>, used when the number of actions is only known at runtime.
+struct AnyItem {
+	template<typename R>
+	AnyItem(Item<R> item)
+	: operation{item.operation}, action{item.action} { }
+
+	Operation *operation;
+	HelAction action;
+};
+
+// Like Transmission but the actions are passed as a vector.
+struct DynamicTransmission : private Context {
+	DynamicTransmission(BorrowedDescriptor descriptor, const std::vector<AnyItem> &items,
+			Dispatcher &dispatcher) {
+		std::vector<HelAction> actions;
+		actions.reserve(items.size());
+		_results.reserve(items.size());
+		for(auto &item : items) {
+			actions.push_back(item.action);
+			_results.push_back(item.operation);
+		}
+
+		auto context = static_cast<Context *>(this);
+		HEL_CHECK(helSubmitAsync(descriptor.getHandle(), actions.data(), actions.size(),
+				dispatcher.acquire(),
+				reinterpret_cast<uintptr_t>(context), 0));
+	}
+
+	DynamicTransmission(const DynamicTransmission &) = delete;
+
+	DynamicTransmission &operator= (DynamicTransmission &other) = delete;
+
+	async::result<void> async_wait() {
+		return _pledge.async_get();
+	}
+
+private:
+	void complete(ElementHandle element) override {
+		_element = std::move(element);
+
+		auto ptr = _element.data();
+		for(auto result : _results)
+			result->parse(ptr);
+		_pledge.set_value();
+	}
+
+	std::vector<Operation *> _results;
+	async::promise<void> _pledge;
+	ElementHandle _element;
+};
+
 inline Submission submitAwaitClock(AwaitClock *operation, uint64_t counter,
 		Dispatcher &dispatcher) {
 	return {operation, counter, dispatcher};
@@ -924,6 +976,11 @@ inline Transmission<I...> submitAsync(BorrowedDescriptor descriptor, Dispatcher
 	return {descriptor, actions, results, dispatcher};
 }
 
+inline DynamicTransmission submitAsync(BorrowedDescriptor descriptor, Dispatcher &dispatcher,
+		const std::vector<AnyItem> &items) {
+	return {descriptor, items, dispatcher};
+}
+
 inline Submission submitAwaitEvent(BorrowedDescriptor descriptor, AwaitEvent *operation,
 		uint64_t sequence, Dispatcher &dispatcher) {
 	return {descriptor, operation, sequence, dispatcher};
@@ -203,9 +203,18 @@ enum PageFlags {
 	kPagePwt = 0x8,
 	kPagePat = 0x80,
 	kPageGlobal = 0x100,
-	kPageXd = 0x8000000000000000
+	kPageXd = 0x8000000000000000,
+
+	// Set in PDPTEs and PDEs that map 1 GiB and 2 MiB pages.
+	kPageHuge = 0x80
 };
 
+static constexpr uint64_t kHugePageSize = 0x200000;
+static constexpr uint64_t kGiantPageSize = 0x40000000;
+
+// Set if the CPU supports 1 GiB pages.
+bool haveGiantPages = false;
+
 uintptr_t bootReserve(size_t length, size_t alignment) {
 	assert(length <= kPageSize);
 	assert(alignment <= kPageSize);
@@ -341,7 +350,9 @@ void mapSingle4kPage(uint64_t address, uint64_t physical, uint32_t flags,
 			((uint64_t*)pd)[i] = 0;
 		((uint64_t*)pdpt)[pdpt_index] = pd | kPagePresent | kPageWrite;
 	}
+	assert(!(((uint64_t*)pdpt)[pdpt_index] & kPageHuge));
 	uint64_t pd_entry = ((uint64_t*)pd)[pd_index];
+	assert(!(pd_entry & kPageHuge));
 	
 	// find the pt entry; create pt if necessary
 	uintptr_t pt = (uintptr_t)(pd_entry & 0xFFFFF000);
@@ -373,8 +384,116 @@ void mapSingle4kPage(uint64_t address, uint64_t physical, uint32_t flags,
 	((uint64_t*)pt)[pt_index] = new_entry;
 }
 
+void mapSingle2mPage(uint64_t address, uint64_t physical, uint32_t flags) {
+	assert(address % kHugePageSize == 0);
+	assert(physical % kHugePageSize == 0);
+
+	int pml4_index = (int)((address >> 39) & 0x1FF);
+	int pdpt_index = (int)((address >> 30) & 0x1FF);
+	int pd_index = (int)((address >> 21) & 0x1FF);
+
+	// find the pml4_entry. the pml4 is always present
+	uintptr_t pml4 = eirPml4Pointer;
+	uint64_t pml4_entry = ((uint64_t*)pml4)[pml4_index];
+
+	// find the pdpt entry; create pdpt if necessary
+	uintptr_t pdpt = (uintptr_t)(pml4_entry & 0xFFFFF000);
+	if(!(pml4_entry & kPagePresent)) {
+		pdpt = allocPage();
+		for(int i = 0; i < 512; i++)
+			((uint64_t*)pdpt)[i] = 0;
+		((uint64_t*)pml4)[pml4_index] = pdpt | kPagePresent | kPageWrite;
+	}
+	uint64_t pdpt_entry = ((uint64_t*)pdpt)[pdpt_index];
+
+	// find the pd entry; create pd if necessary
+	uintptr_t pd = (uintptr_t)(pdpt_entry & 0xFFFFF000);
+	if(!(pdpt_entry & kPagePresent)) {
+		pd = allocPage();
+		for(int i = 0; i < 512; i++)
+			((uint64_t*)pd)[i] = 0;
+		((uint64_t*)pdpt)[pdpt_index] = pd | kPagePresent | kPageWrite;
+	}
+	assert(!(((uint64_t*)pdpt)[pdpt_index] & kPageHuge));
+	uint64_t pd_entry = ((uint64_t*)pd)[pd_index];
+
+	// setup the new pd entry
+	if(pd_entry & kPagePresent)
+		frigg::infoLogger() << "eir: Trying to map 0x" << frigg::logHex(address)
+				<< " twice!" << frigg::endLog;
+	assert(!(pd_entry & kPagePresent));
+	uint64_t new_entry = physical | kPagePresent | kPageHuge;
+	if(flags & kAccessWrite)
+		new_entry |= kPageWrite;
+	if(!(flags & kAccessExecute))
+		new_entry |= kPageXd;
+	if(!(flags & kAccessGlobal))
+		new_entry |= kPageGlobal;
+	((uint64_t*)pd)[pd_index] = new_entry;
+}
+
+void mapSingle1gPage(uint64_t address, uint64_t physical, uint32_t flags) {
+	assert(haveGiantPages);
+	assert(address % kGiantPageSize == 0);
+	assert(physical % kGiantPageSize == 0);
+
+	int pml4_index = (int)((address >> 39) & 0x1FF);
+	int pdpt_index = (int)((address >> 30) & 0x1FF);
+
+	// find the pml4_entry. the pml4 is always present
+	uintptr_t pml4 = eirPml4Pointer;
+	uint64_t pml4_entry = ((uint64_t*)pml4)[pml4_index];
+
+	// find the pdpt entry; create pdpt if necessary
+	uintptr_t pdpt = (uintptr_t)(pml4_entry & 0xFFFFF000);
+	if(!(pml4_entry & kPagePresent)) {
+		pdpt = allocPage();
+		for(int i = 0; i < 512; i++)
+			((uint64_t*)pdpt)[i] = 0;
+		((uint64_t*)pml4)[pml4_index] = pdpt | kPagePresent | kPageWrite;
+	}
+	uint64_t pdpt_entry = ((uint64_t*)pdpt)[pdpt_index];
+
+	// setup the new pdpt entry
+	if(pdpt_entry & kPagePresent)
+		frigg::infoLogger() << "eir: Trying to map 0x" << frigg::logHex(address)
+				<< " twice!" << frigg::endLog;
+	assert(!(pdpt_entry & kPagePresent));
+	uint64_t new_entry = physical | kPagePresent | kPageHuge;
+	if(flags & kAccessWrite)
+		new_entry |= kPageWrite;
+	if(!(flags & kAccessExecute))
+		new_entry |= kPageXd;
+	if(!(flags & kAccessGlobal))
+		new_entry |= kPageGlobal;
+	((uint64_t*)pdpt)[pdpt_index] = new_entry;
+}
+
 // ----------------------------------------------------------------------------
 
+// Maps physical memory into the direct map, using the largest pages that fit.
+// We never map memory outside of the range, as it might not be RAM.
+void mapDirectRange(address_t physical, address_t size) {
+	address_t progress = 0;
+	while(progress < size) {
+		auto address = physical + progress;
+		if(haveGiantPages && !(address % kGiantPageSize)
+				&& size - progress >= kGiantPageSize) {
+			mapSingle1gPage(0xFFFF'8000'0000'0000 + address, address,
+					kAccessWrite | kAccessGlobal);
+			progress += kGiantPageSize;
+		}else if(!(address % kHugePageSize) && size - progress >= kHugePageSize) {
+			mapSingle2mPage(0xFFFF'8000'0000'0000 + address, address,
+					kAccessWrite | kAccessGlobal);
+			progress += kHugePageSize;
+		}else{
+			mapSingle4kPage(0xFFFF'8000'0000'0000 + address, address,
+					kAccessWrite | kAccessGlobal);
+			progress += kPageSize;
+		}
+	}
+}
+
 void mapRegionsAndStructs() {
 	// This region should be available RAM on every PC.
 	for(size_t page = 0x8000; page < 0x80000; page += kPageSize)
@@ -387,9 +506,7 @@ void mapRegionsAndStructs() {
 			continue;
 
 		// Map the region itself.
-		for(address_t page = 0; page < regions[i].size; page += kPageSize)
-			mapSingle4kPage(0xFFFF'8000'0000'0000 + regions[i].address + page,
-					regions[i].address + page, kAccessWrite | kAccessGlobal);
+		mapDirectRange(regions[i].address, regions[i].size);
 
 		// Map the buddy tree.
 		regions[i].buddyMap = tree_mapping;
@@ -500,6 +617,11 @@ void initProcessorEarly(){
 		frigg::panicLogger() << "Long mode is not supported on this CPU" << frigg::endLog;
 	if((extended[3] & arch::kCpuFlagNx) == 0)
 		frigg::panicLogger() << "NX bit is not supported on this CPU" << frigg::endLog;
+	if(extended[3] & arch::kCpuFlag1GPages) {
+		haveGiantPages = true;
+	}else{
+		frigg::infoLogger() << "eir: CPU does not support 1 GiB pages" << frigg::endLog;
+	}
 
 	frigg::Array<uint32_t, 4> normal = arch::cpuid(arch::kCpuIndexFeatures);
 	if((normal[3] & arch::kCpuFlagPat) == 0)
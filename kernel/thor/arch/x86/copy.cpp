@@ -0,0 +1,153 @@
+#include <frigg/arch_x86/machine.hpp>
+
+#include "generic/kernel.hpp"
+#include "copy.hpp"
+
+namespace thor {
+
+namespace {
+	// Size of the buffers that benchmarkCopyRoutines() uses.
+	constexpr size_t benchmarkSize = 0x100000;
+	constexpr int benchmarkRounds = 16;
+
+	bool haveErms = false;
+
+	// Pages are copied with rep movsq by default. This is fast on all x86_64 CPUs.
+	void copyPageMovsq(void *dest, const void *src) {
+		size_t count = kPageSize / 8;
+		asm volatile ("rep movsq" : "+D"(dest), "+S"(src), "+c"(count) : : "memory");
+	}
+
+	void zeroPageStosq(void *dest) {
+		size_t count = kPageSize / 8;
+		asm volatile ("rep stosq" : "+D"(dest), "+c"(count) : "a"(uint64_t{0}) : "memory");
+	}
+
+	// On CPUs with ERMS (enhanced rep movsb/stosb), the microcode chooses the optimal width.
+	void copyPageMovsb(void *dest, const void *src) {
+		size_t count = kPageSize;
+		asm volatile ("rep movsb" : "+D"(dest), "+S"(src), "+c"(count) : : "memory");
+	}
+
+	void zeroPageStosb(void *dest) {
+		size_t count = kPageSize;
+		asm volatile ("rep stosb" : "+D"(dest), "+c"(count) : "a"(0) : "memory");
+	}
+
+	// movnti only uses general purpose registers, hence we do not need to save
+	// the SSE state. The sfence orders the stores before later (ordinary) stores.
+	void copyPageMovnti(void *dest, const void *src) {
+		auto d = reinterpret_cast<uint64_t *>(dest);
+		auto s = reinterpret_cast<const uint64_t *>(src);
+		for(size_t i = 0; i < kPageSize / 8; i += 4) {
+			uint64_t a = s[i], b = s[i + 1], c = s[i + 2], e = s[i + 3];
+			asm volatile ("movnti %1, 0(%0)\n"
+					"\tmovnti %2, 8(%0)\n"
+					"\tmovnti %3, 16(%0)\n"
+					"\tmovnti %4, 24(%0)"
+					: : "r"(d + i), "r"(a), "r"(b), "r"(c), "r"(e) : "memory");
+		}
+		asm volatile ("sfence" : : : "memory");
+	}
+
+	void zeroPageMovnti(void *dest) {
+		auto d = reinterpret_cast<uint64_t *>(dest);
+		for(size_t i = 0; i < kPageSize / 8; i += 4)
+			asm volatile ("movnti %1, 0(%0)\n"
+					"\tmovnti %1, 8(%0)\n"
+					"\tmovnti %1, 16(%0)\n"
+					"\tmovnti %1, 24(%0)"
+					: : "r"(d + i), "r"(uint64_t{0}) : "memory");
+		asm volatile ("sfence" : : : "memory");
+	}
+
+	void (*copyPageRoutine)(void *, const void *) = &copyPageMovsq;
+	void (*zeroPageRoutine)(void *) = &zeroPageStosq;
+
+	template<typename F>
+	void measureThroughput(const char *name, F f) {
+		auto start = systemClockSource()->currentNanos();
+		for(int r = 0; r < benchmarkRounds; r++)
+			f();
+		auto elapsed = systemClockSource()->currentNanos() - start;
+
+		// Bytes per nanosecond equals GB/s.
+		auto centis = uint64_t{benchmarkSize} * benchmarkRounds * 100
+				/ frigg::max(elapsed, uint64_t{1});
+		frigg::infoLogger() << "thor: " << name << ": " << (centis / 100)
+				<< "." << ((centis / 10) % 10) << (centis % 10) << " GB/s" << frigg::endLog;
+	}
+}
+
+void copyMemory(void *dest, const void *src, size_t size) {
+	if(!haveErms) {
+		memcpy(dest, src, size);
+		return;
+	}
+	asm volatile ("rep movsb" : "+D"(dest), "+S"(src), "+c"(size) : : "memory");
+}
+
+void copyPage(void *dest, const void *src) {
+	copyPageRoutine(dest, src);
+}
+
+void zeroPage(void *dest) {
+	zeroPageRoutine(dest);
+}
+
+void zeroPageNonTemporal(void *dest) {
+	zeroPageMovnti(dest);
+}
+
+void selectCopyRoutines() {
+	if(frigg::arch_x86::cpuid(0x07)[1] & (uint32_t(1) << 9)) {
+		frigg::infoLogger() << "\e[37mthor: CPU supports ERMS\e[39m" << frigg::endLog;
+		copyPageRoutine = &copyPageMovsb;
+		zeroPageRoutine = &zeroPageStosb;
+		haveErms = true;
+	}else{
+		frigg::infoLogger() << "\e[37mthor: CPU does not support ERMS!\e[39m" << frigg::endLog;
+	}
+}
+
+void benchmarkCopyRoutines() {
+	auto src_physical = physicalAllocator->allocate(benchmarkSize);
+	auto dest_physical = physicalAllocator->allocate(benchmarkSize);
+	assert(src_physical != PhysicalAddr(-1) && dest_physical != PhysicalAddr(-1));
+	auto src = reinterpret_cast<char *>(SkeletalRegion::global().access(src_physical));
+	auto dest = reinterpret_cast<char *>(SkeletalRegion::global().access(dest_physical));
+	memset(src, 0x5A, benchmarkSize);
+
+	auto pageWise = [&] (void (*copy)(void *, const void *)) {
+		return [=] {
+			for(size_t off = 0; off < benchmarkSize; off += kPageSize)
+				copy(dest + off, src + off);
+		};
+	};
+	auto pageWiseZero = [&] (void (*zero)(void *)) {
+		return [=] {
+			for(size_t off = 0; off < benchmarkSize; off += kPageSize)
+				zero(dest + off);
+		};
+	};
+
+	measureThroughput("Page copy (rep movsq)", pageWise(&copyPageMovsq));
+	measureThroughput("Page copy (rep movsb)", pageWise(&copyPageMovsb));
+	measureThroughput("Page copy (movnti)", pageWise(&copyPageMovnti));
+	measureThroughput("Page zero (rep stosq)", pageWiseZero(&zeroPageStosq));
+	measureThroughput("Page zero (rep stosb)", pageWiseZero(&zeroPageStosb));
+	measureThroughput("Page zero (movnti)", pageWiseZero(&zeroPageMovnti));
+
+	// Misaligned copies of arbitrary size, e.g., from user space.
+	measureThroughput("Unaligned memcpy()", [&] {
+		memcpy(dest + 1, src, benchmarkSize - 1);
+	});
+	measureThroughput("Unaligned copyMemory()", [&] {
+		copyMemory(dest + 1, src, benchmarkSize - 1);
+	});
+
+	physicalAllocator->free(src_physical, benchmarkSize);
+	physicalAllocator->free(dest_physical, benchmarkSize);
+}
+
+} // namespace thor
@@ -0,0 +1,28 @@
+#ifndef THOR_ARCH_X86_COPY_HPP
+#define THOR_ARCH_X86_COPY_HPP
+
+#include <stddef.h>
+
+namespace thor {
+
+// Copies memory using the fastest method that the CPU supports.
+// In contrast to memcpy(), this uses rep movsb on CPUs with ERMS.
+void copyMemory(void *dest, const void *src, size_t size);
+
+// Copies or zeros a single page. Both pointers must be page-aligned.
+void copyPage(void *dest, const void *src);
+void zeroPage(void *dest);
+
+// Like zeroPage() but bypasses the cache.
+// Use this for pages that are not accessed in the near future.
+void zeroPageNonTemporal(void *dest);
+
+// Chooses the copy routines based on CPUID. Called once on the boot processor.
+void selectCopyRoutines();
+
+// Measures the throughput of all available copy routines and logs the results.
+void benchmarkCopyRoutines();
+
+} // namespace thor
+
+#endif // THOR_ARCH_X86_COPY_HPP
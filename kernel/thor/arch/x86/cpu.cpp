@@ -559,7 +559,7 @@ FiberContext::FiberContext(UniqueKernelStack stack)
 // --------------------------------------------------------
 
 PlatformCpuData::PlatformCpuData()
-: haveSmap{false}, havePcids{false} {
+: cpuIndex{-1}, haveSmap{false}, havePcids{false} {
 	for(int i = 0; i < maxPcidCount; i++)
 		pcidBindings[i].setupPcid(i);
 
@@ -664,6 +664,7 @@ void initializeThisProcessor() {
 	auto cpu_data = getCpuData();
 	
 	// TODO: If we want to make bootSecondary() parallel, we have to lock here.
+	cpu_data->cpuIndex = allCpuContexts->size();
 	allCpuContexts->push(cpu_data);
 
 	// Allocate per-CPU areas.
@@ -850,8 +851,8 @@ void initializeThisProcessor() {
 	// set user mode rpl bits to work around a qemu bug
 	frigg::arch_x86::wrmsr(frigg::arch_x86::kMsrStar, (uint64_t(kSelClientUserCompat) << 48)
 			| (uint64_t(kSelExecutorSyscallCode) << 32));
-	// mask interrupt and trap flag
-	frigg::arch_x86::wrmsr(frigg::arch_x86::kMsrFmask, 0x300);
+	// mask interrupt, trap and direction flag
+	frigg::arch_x86::wrmsr(frigg::arch_x86::kMsrFmask, 0x700);
 
 	initLocalApicPerCpu();
 }
@@ -563,6 +563,8 @@ struct AssemblyCpuData {
 struct PlatformCpuData : public AssemblyCpuData {
 	PlatformCpuData();
 
+	// Index of this CPU in the list of all CPUs (see getCpuData(size_t)).
+	int cpuIndex;
 	int localApicId;
 
 	uint32_t gdt[14 * 2];
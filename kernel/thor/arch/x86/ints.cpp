@@ -430,6 +430,10 @@ extern "C" void onPlatformShootdown(IrqImageAccessor image) {
 	assert(!irqMutex().nesting());
 	disableUserAccess();
 
+	// Clear the flag before processing the queues;
+	// requests that are submitted afterwards will trigger another IPI.
+	getCpuData()->pageContext.shootdownPending.store(false, std::memory_order_release);
+
 	for(int i = 0; i < maxPcidCount; i++)
 		getCpuData()->pcidBindings[i].shootdown();
 
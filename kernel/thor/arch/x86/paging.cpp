@@ -74,19 +74,139 @@ enum {
 	kPageUser = 0x4,
 	kPagePwt = 0x8,
 	kPagePcd = 0x10,
+	kPageAccessed = 0x20,
 	kPageDirty = 0x40,
 	kPagePat = 0x80,
 	kPageGlobal = 0x100,
 	kPageXd = 0x8000000000000000,
-	kPageAddress = 0x000FFFFFFFFFF000
+	kPageAddress = 0x000FFFFFFFFFF000,
+
+	// Bits that are specific to 2 MiB pages (i.e., PDEs) and 1 GiB pages (i.e., PDPTEs).
+	kPageHuge = 0x80,
+	kPageHugePat = 0x1000,
+	kPageHugeAddress = 0x000FFFFFFFE00000,
+	kPageGiantAddress = 0x000FFFFFC0000000
 };
 
 namespace thor {
 
+namespace {
+	// Shootdowns of ranges larger than this invalidate the whole PCID
+	// instead of issuing one invlpg per page.
+	constexpr size_t shootdownFlushThreshold = 32 * kPageSize;
+
+	// Invalidates the whole TLB context of a binding.
+	void invalidateBinding(int pcid) {
+		if(!getCpuData()->havePcids) {
+			assert(!pcid);
+			invalidateFullTlb();
+		}else{
+			invalidatePcid(pcid);
+		}
+		getCpuData()->pageContext.shootdownStats.fullFlushes.fetch_add(1,
+				std::memory_order_relaxed);
+	}
+
+	// Invalidates a range of a binding; large ranges flush the entire binding.
+	void invalidateBindingRange(int pcid, VirtualAddr address, size_t size) {
+		if(size > shootdownFlushThreshold) {
+			invalidateBinding(pcid);
+			return;
+		}
+
+		if(!getCpuData()->havePcids) {
+			assert(!pcid);
+			for(size_t pg = 0; pg < size; pg += kPageSize)
+				invalidatePage(reinterpret_cast<void *>(address + pg));
+		}else{
+			for(size_t pg = 0; pg < size; pg += kPageSize)
+				invalidatePage(pcid, reinterpret_cast<void *>(address + pg));
+		}
+	}
+
+	// Amount of user memory that is mapped by 2 MiB pages.
+	std::atomic<size_t> hugeMappedBytes{0};
+
+	// Replaces a 2 MiB PDE by a PT that maps the same memory using 4 KiB pages.
+	// Must be called with the lock of the page space held.
+	void splitHugePage(arch::scalar_variable<uint64_t> *pde) {
+		auto entry = pde->load();
+		assert((entry & kPagePresent) && (entry & kPageHuge));
+
+		auto tbl_address = physicalAllocator->allocate(kPageSize);
+		assert(tbl_address != PhysicalAddr(-1) && "OOM");
+		PageAccessor accessor{tbl_address};
+		auto tbl = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor.get());
+
+		// The PTEs inherit all attributes of the PDE; the PAT bit moves from bit 12 to bit 7.
+		// The CPU might still set the dirty bit of the PDE until we replace it.
+		// Hence, we conservatively consider all pages of a writable 2 MiB page to be dirty.
+		uint64_t attributes = entry & ~(kPageHugeAddress | kPageHuge | kPageHugePat);
+		if(entry & kPageHugePat)
+			attributes |= kPagePat;
+		if(entry & kPageWrite)
+			attributes |= kPageDirty;
+		for(int i = 0; i < 512; i++)
+			tbl[i].store(((entry & kPageHugeAddress) + (uint64_t(i) << kPageShift)) | attributes);
+
+		// Stale TLB entries of the 2 MiB page map the same memory with the same attributes.
+		// They are flushed by the shootdown that follows the unmap that caused the split.
+		uint64_t new_entry = tbl_address | kPagePresent | kPageWrite;
+		if(entry & kPageUser)
+			new_entry |= kPageUser;
+		pde->store(new_entry);
+		hugeMappedBytes.fetch_sub(kHugePageSize, std::memory_order_relaxed);
+	}
+
+	// The kernel's direct map is built from 1 GiB and 2 MiB pages by eir (if possible).
+	// Mapping or unmapping single pages within these large pages requires splitting them.
+	// Both functions must be called with the lock of the kernel page space held.
+
+	// Replaces a 1 GiB PDPTE by a PD that maps the same memory using 2 MiB pages.
+	void splitKernelGiantPage(uint64_t *pdpte) {
+		auto entry = *pdpte;
+		assert((entry & kPagePresent) && (entry & kPageHuge));
+
+		PhysicalAddr pd_page = physicalAllocator->allocate(kPageSize);
+		assert(pd_page != static_cast<PhysicalAddr>(-1) && "OOM");
+		auto pd_pointer = (uint64_t *)SkeletalRegion::global().access(pd_page);
+
+		// 1 GiB and 2 MiB pages use the same layout (including the PAT bit).
+		uint64_t attributes = entry & ~uint64_t(kPageGiantAddress);
+		for(int i = 0; i < 512; i++)
+			pd_pointer[i] = ((entry & kPageGiantAddress) + (uint64_t(i) << 21)) | attributes;
+
+		*pdpte = pd_page | kPagePresent | kPageWrite;
+	}
+
+	// Replaces a 2 MiB PDE by a PT that maps the same memory using 4 KiB pages.
+	void splitKernelHugePage(uint64_t *pde) {
+		auto entry = *pde;
+		assert((entry & kPagePresent) && (entry & kPageHuge));
+
+		PhysicalAddr pt_page = physicalAllocator->allocate(kPageSize);
+		assert(pt_page != static_cast<PhysicalAddr>(-1) && "OOM");
+		auto pt_pointer = (uint64_t *)SkeletalRegion::global().access(pt_page);
+
+		// The PAT bit moves from bit 12 to bit 7.
+		uint64_t attributes = entry & ~(kPageHugeAddress | kPageHuge | kPageHugePat);
+		if(entry & kPageHugePat)
+			attributes |= kPagePat;
+		for(int i = 0; i < 512; i++)
+			pt_pointer[i] = ((entry & kPageHugeAddress) + (uint64_t(i) << kPageShift)) | attributes;
+
+		*pde = pt_page | kPagePresent | kPageWrite;
+	}
+}
+
+size_t hugeMappedMemory() {
+	return hugeMappedBytes.load(std::memory_order_relaxed);
+}
+
 // --------------------------------------------------------
 
 PageContext::PageContext()
-: _nextStamp{1}, _primaryBinding{nullptr} { }
+: shootdownPending{false}, _nextStamp{1}, _primaryBinding{nullptr} { }
 
 PageBinding::PageBinding()
 : _pcid{0}, _boundSpace{nullptr},
@@ -131,6 +251,7 @@ void PageBinding::rebind(smarter::shared_ptr<PageSpace> space) {
 
 		target_seq = space->_shootSequence;
 		space->_numBindings++;
+		space->_addBindingCpu(getCpuData()->cpuIndex);
 	}
 
 	_boundSpace = space;
@@ -177,6 +298,7 @@ void PageBinding::rebind(smarter::shared_ptr<PageSpace> space) {
 		}
 
 		unbound_space->_numBindings--;
+		unbound_space->_removeBindingCpu(getCpuData()->cpuIndex);
 		if(!unbound_space->_numBindings && unbound_space->_retireNode) {
 			WorkQueue::post(unbound_space->_retireNode->_worklet);
 			unbound_space->_retireNode = nullptr;
@@ -240,6 +362,7 @@ void PageBinding::unbind() {
 		}
 
 		_boundSpace->_numBindings--;
+		_boundSpace->_removeBindingCpu(getCpuData()->cpuIndex);
 		if(!_boundSpace->_numBindings && _boundSpace->_retireNode) {
 			WorkQueue::post(_boundSpace->_retireNode->_worklet);
 			_boundSpace->_retireNode = nullptr;
@@ -281,20 +404,32 @@ void PageBinding::shootdown() {
 		auto lock = frigg::guard(&_boundSpace->_mutex);
 
 		if(!_boundSpace->_shootQueue.empty()) {
+			// Determine the total size of all pending requests.
+			// If it is too large, we flush the whole PCID once instead of each range.
+			size_t pending_size = 0;
 			auto current = _boundSpace->_shootQueue.back();
+			while(current->_sequence > _alreadyShotSequence) {
+				if(current->_initiatorCpu != getCpuData())
+					pending_size += current->size;
+
+				auto predecessor = current->_queueNode.previous;
+				if(!predecessor)
+					break;
+				current = predecessor;
+			}
+
+			bool flush_all = pending_size > shootdownFlushThreshold;
+			if(flush_all)
+				invalidateBinding(_pcid);
+
+			current = _boundSpace->_shootQueue.back();
 			while(current->_sequence > _alreadyShotSequence) {
 				auto predecessor = current->_queueNode.previous;
 
 				if(current->_initiatorCpu != getCpuData()) {
 					// Perform the actual shootdown.
-					if(!getCpuData()->havePcids) {
-						assert(!_pcid);
-						for(size_t pg = 0; pg < current->size; pg += kPageSize)
-							invalidatePage(reinterpret_cast<void *>(current->address + pg));
-					}else{
-						for(size_t pg = 0; pg < current->size; pg += kPageSize)
-							invalidatePage(_pcid, reinterpret_cast<void *>(current->address + pg));
-					}
+					if(!flush_all)
+						invalidateBindingRange(_pcid, current->address, current->size);
 
 					// Signal completion of the shootdown.
 					if(current->_bindingsToShoot.fetch_sub(1, std::memory_order_acq_rel) == 1) {
@@ -351,7 +486,8 @@ void PageSpace::activate(smarter::shared_ptr<PageSpace> space) {
 
 
 PageSpace::PageSpace(PhysicalAddr root_table)
-: _rootTable{root_table}, _numBindings{0}, _shootSequence{0} { }
+: _rootTable{root_table}, _numBindings{0}, _cpuMask{0}, _numUnmaskedBindings{0},
+		_shootSequence{0} { }
 
 PageSpace::~PageSpace() {
 	assert(!_numBindings);
@@ -359,21 +495,28 @@ PageSpace::~PageSpace() {
 
 void PageSpace::retire(RetireNode *node) {
 	bool any_bindings;
+	uint64_t cpu_mask;
+	bool broadcast;
 	{
 		auto irq_lock = frigg::guard(&irqMutex());
 		auto lock = frigg::guard(&_mutex);
 
 		any_bindings = _numBindings;
+		cpu_mask = _cpuMask;
+		broadcast = _numUnmaskedBindings;
 		if(any_bindings) {
 			_retireNode = node;
 			_wantToRetire.store(true, std::memory_order_release);
 		}
 	}
 
-	if(!any_bindings)
+	if(!any_bindings) {
 		WorkQueue::post(node->_worklet);
+		return;
+	}
 
-	sendShootdownIpi();
+	auto irq_lock = frigg::guard(&irqMutex());
+	_sendShootdownIpis(cpu_mask, broadcast);
 }
 
 bool PageSpace::submitShootdown(ShootNode *node) {
@@ -392,8 +535,7 @@ bool PageSpace::submitShootdown(ShootNode *node) {
 			if(bindings[0].boundSpace().get() == this) {
 				assert(unshot_bindings);
 
-				for(size_t pg = 0; pg < node->size; pg += kPageSize)
-					invalidatePage(reinterpret_cast<void *>(node->address + pg));
+				invalidateBindingRange(0, node->address, node->size);
 				unshot_bindings--;
 			}
 		}else{
@@ -402,9 +544,7 @@ bool PageSpace::submitShootdown(ShootNode *node) {
 					continue;
 				assert(unshot_bindings);
 
-				for(size_t pg = 0; pg < node->size; pg += kPageSize)
-					invalidatePage(bindings[i].getPcid(),
-							reinterpret_cast<void *>(node->address + pg));
+				invalidateBindingRange(bindings[i].getPcid(), node->address, node->size);
 				unshot_bindings--;
 			}
 		}
@@ -416,12 +556,63 @@ bool PageSpace::submitShootdown(ShootNode *node) {
 		node->_sequence = ++_shootSequence;
 		node->_bindingsToShoot = unshot_bindings;
 		_shootQueue.push_back(node);
+
+		// Send the IPIs while holding the lock, so that _cpuMask is consistent
+		// with the set of bindings that still have to process the request.
+		_sendShootdownIpis(_cpuMask, _numUnmaskedBindings);
 	}
 
-	sendShootdownIpi();
 	return false;
 }
 
+void PageSpace::_addBindingCpu(int cpuIndex) {
+	if(cpuIndex >= 0 && cpuIndex < maxMaskedCpus) {
+		assert(!(_cpuMask & (uint64_t(1) << cpuIndex)));
+		_cpuMask |= uint64_t(1) << cpuIndex;
+	}else{
+		_numUnmaskedBindings++;
+	}
+}
+
+void PageSpace::_removeBindingCpu(int cpuIndex) {
+	if(cpuIndex >= 0 && cpuIndex < maxMaskedCpus) {
+		assert(_cpuMask & (uint64_t(1) << cpuIndex));
+		_cpuMask &= ~(uint64_t(1) << cpuIndex);
+	}else{
+		assert(_numUnmaskedBindings);
+		_numUnmaskedBindings--;
+	}
+}
+
+void PageSpace::_sendShootdownIpis(uint64_t cpu_mask, bool broadcast) {
+	assert(!intsAreEnabled());
+	auto self = getCpuData();
+	auto stats = &self->pageContext.shootdownStats;
+
+	if(broadcast) {
+		sendShootdownIpi();
+		stats->broadcastIpis.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	for(int i = 0; i < getCpuCount() && i < maxMaskedCpus; i++) {
+		if(!(cpu_mask & (uint64_t(1) << i)))
+			continue;
+		auto other = getCpuData(i);
+		if(other == self)
+			continue;
+
+		// If the target did not process its last IPI yet, it will also see our request.
+		// This coalesces all requests that are submitted in a burst into one IPI.
+		if(other->pageContext.shootdownPending.exchange(true, std::memory_order_acq_rel)) {
+			stats->coalescedIpis.fetch_add(1, std::memory_order_relaxed);
+			continue;
+		}
+		sendShootdownIpi(other->localApicId);
+		stats->targetedIpis.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
 // --------------------------------------------------------
 // Kernel paging management.
 // --------------------------------------------------------
@@ -476,6 +667,8 @@ void KernelPageSpace::mapSingle4k(VirtualAddr pointer, PhysicalAddr physical,
 	assert(!(pml4_pointer[pml4_index] & kPageUser));
 
 	// make sure there is a pd
+	if((pdpt_pointer[pdpt_index] & kPagePresent) && (pdpt_pointer[pdpt_index] & kPageHuge))
+		splitKernelGiantPage(&pdpt_pointer[pdpt_index]);
 	uint64_t pdpt_initial_entry = pdpt_pointer[pdpt_index];
 	uint64_t *pd_pointer;
 	if((pdpt_initial_entry & kPagePresent) != 0) {
@@ -494,6 +687,8 @@ void KernelPageSpace::mapSingle4k(VirtualAddr pointer, PhysicalAddr physical,
 	assert(!(pdpt_pointer[pdpt_index] & kPageUser));
 
 	// make sure there is a pt
+	if((pd_pointer[pd_index] & kPagePresent) && (pd_pointer[pd_index] & kPageHuge))
+		splitKernelHugePage(&pd_pointer[pd_index]);
 	uint64_t pd_initial_entry = pd_pointer[pd_index];
 	uint64_t *pt_pointer;
 	if((pd_initial_entry & kPagePresent) != 0) {
@@ -548,11 +743,15 @@ PhysicalAddr KernelPageSpace::unmapSingle4k(VirtualAddr pointer) {
 	// find the pdpt entry
 	assert((pml4_entry & kPagePresent) != 0);
 	uint64_t *pdpt_pointer = (uint64_t *)region.access(pml4_entry & 0x000FFFFFFFFFF000);
+	if((pdpt_pointer[pdpt_index] & kPagePresent) && (pdpt_pointer[pdpt_index] & kPageHuge))
+		splitKernelGiantPage(&pdpt_pointer[pdpt_index]);
 	uint64_t pdpt_entry = pdpt_pointer[pdpt_index];
 
 	// find the pd entry
 	assert((pdpt_entry & kPagePresent) != 0);
 	uint64_t *pd_pointer = (uint64_t *)region.access(pdpt_entry & 0x000FFFFFFFFFF000);
+	if((pd_pointer[pd_index] & kPagePresent) && (pd_pointer[pd_index] & kPageHuge))
+		splitKernelHugePage(&pd_pointer[pd_index]);
 	uint64_t pd_entry = pd_pointer[pd_index];
 
 	// find the pt entry
@@ -596,8 +795,14 @@ ClientPageSpace::~ClientPageSpace() {
 		PageAccessor accessor{ps};
 		auto tbl = reinterpret_cast<uint64_t *>(accessor.get());
 		for(int i = 0; i < 512; i++) {
-			if(tbl[i] & kPagePresent)
-				physicalAllocator->free(tbl[i] & kPageAddress, kPageSize);
+			if(!(tbl[i] & kPagePresent))
+				continue;
+			// 2 MiB pages do not have a PT; their memory is owned by the MemoryView.
+			if(tbl[i] & kPageHuge) {
+				hugeMappedBytes.fetch_sub(kHugePageSize, std::memory_order_relaxed);
+				continue;
+			}
+			physicalAllocator->free(tbl[i] & kPageAddress, kPageSize);
 		}
 	};
 
@@ -690,6 +895,7 @@ void ClientPageSpace::mapSingle4k(VirtualAddr pointer, PhysicalAddr physical,
 	// Make sure there is a PT.
 	tbl2 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor2.get());
 	if(tbl2[index2].load() & kPagePresent) {
+		assert(!(tbl2[index2].load() & kPageHuge) && "2 MiB page must be split first");
 		accessor1 = PageAccessor{tbl2[index2].load() & 0x000FFFFFFFFFF000};
 	}else{
 		auto tbl_address = physicalAllocator->allocate(kPageSize);
@@ -725,6 +931,90 @@ void ClientPageSpace::mapSingle4k(VirtualAddr pointer, PhysicalAddr physical,
 	tbl1[index1].store(new_entry);
 }
 
+bool ClientPageSpace::mapSingle2m(VirtualAddr pointer, PhysicalAddr physical,
+		bool user_page, uint32_t flags, CachingMode caching_mode) {
+	assert(!(pointer & (kHugePageSize - 1)));
+	assert(!(physical & (kHugePageSize - 1)));
+
+	auto irq_lock = frigg::guard(&irqMutex());
+	auto lock = frigg::guard(&_mutex);
+
+	PageAccessor accessor4;
+	PageAccessor accessor3;
+	PageAccessor accessor2;
+
+	arch::scalar_variable<uint64_t> *tbl4;
+	arch::scalar_variable<uint64_t> *tbl3;
+	arch::scalar_variable<uint64_t> *tbl2;
+
+	auto index4 = (int)((pointer >> 39) & 0x1FF);
+	auto index3 = (int)((pointer >> 30) & 0x1FF);
+	auto index2 = (int)((pointer >> 21) & 0x1FF);
+
+	// The PML4 does always exist.
+	accessor4 = PageAccessor{rootTable()};
+
+	// Make sure there is a PDPT.
+	tbl4 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor4.get());
+	if(tbl4[index4].load() & kPagePresent) {
+		accessor3 = PageAccessor{tbl4[index4].load() & 0x000FFFFFFFFFF000};
+	}else{
+		auto tbl_address = physicalAllocator->allocate(kPageSize);
+		assert(tbl_address != PhysicalAddr(-1) && "OOM");
+		accessor3 = PageAccessor{tbl_address};
+		memset(accessor3.get(), 0, kPageSize);
+
+		uint64_t new_entry = tbl_address | kPagePresent | kPageWrite;
+		if(user_page)
+			new_entry |= kPageUser;
+		tbl4[index4].store(new_entry);
+	}
+	assert(user_page ? ((tbl4[index4].load() & kPageUser) != 0)
+			: ((tbl4[index4].load() & kPageUser) == 0));
+
+	// Make sure there is a PD.
+	tbl3 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor3.get());
+	if(tbl3[index3].load() & kPagePresent) {
+		accessor2 = PageAccessor{tbl3[index3].load() & 0x000FFFFFFFFFF000};
+	}else{
+		auto tbl_address = physicalAllocator->allocate(kPageSize);
+		assert(tbl_address != PhysicalAddr(-1) && "OOM");
+		accessor2 = PageAccessor{tbl_address};
+		memset(accessor2.get(), 0, kPageSize);
+
+		uint64_t new_entry = tbl_address | kPagePresent | kPageWrite;
+		if(user_page)
+			new_entry |= kPageUser;
+		tbl3[index3].store(new_entry);
+	}
+	assert(user_page ? ((tbl3[index3].load() & kPageUser) != 0)
+			: ((tbl3[index3].load() & kPageUser) == 0));
+
+	// We do not replace existing PTs: the paging-structure caches might still refer to them.
+	tbl2 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor2.get());
+	if(tbl2[index2].load() & kPagePresent)
+		return false;
+
+	// Setup the new PDE.
+	uint64_t new_entry = physical | kPagePresent | kPageHuge;
+	if(user_page)
+		new_entry |= kPageUser;
+	if(flags & page_access::write)
+		new_entry |= kPageWrite;
+	if(!(flags & page_access::execute))
+		new_entry |= kPageXd;
+	if(caching_mode == CachingMode::writeThrough) {
+		new_entry |= kPagePwt;
+	}else if(caching_mode == CachingMode::writeCombine) {
+		new_entry |= kPageHugePat | kPagePwt;
+	}else{
+		assert(caching_mode == CachingMode::null || caching_mode == CachingMode::writeBack);
+	}
+	tbl2[index2].store(new_entry);
+	hugeMappedBytes.fetch_add(kHugePageSize, std::memory_order_relaxed);
+	return true;
+}
+
 PageStatus ClientPageSpace::unmapSingle4k(VirtualAddr pointer) {
 	assert(!(pointer & (kPageSize - 1)));
 
@@ -763,6 +1053,8 @@ PageStatus ClientPageSpace::unmapSingle4k(VirtualAddr pointer) {
 	if(!(tbl2[index2].load() & kPagePresent))
 		return 0;
 	assert(tbl2[index2].load() & kPagePresent);
+	if(tbl2[index2].load() & kPageHuge)
+		splitHugePage(&tbl2[index2]);
 	accessor1 = PageAccessor{tbl2[index2].load() & 0x000FFFFFFFFFF000};
 	auto tbl1 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor1.get());
 
@@ -822,6 +1114,17 @@ void ClientPageSpace::unmapRange(VirtualAddr pointer, size_t size, PageMode mode
 		if(mode == PageMode::remap && !(tbl2[index2].load() & kPagePresent))
 			continue;
 		assert(tbl2[index2].load() & kPagePresent);
+		if(tbl2[index2].load() & kPageHuge) {
+			// Drop 2 MiB pages that are completely covered by the range; split all others.
+			if(!((pointer + progress) & (kHugePageSize - 1))
+					&& progress + kHugePageSize <= size) {
+				tbl2[index2].store(0);
+				hugeMappedBytes.fetch_sub(kHugePageSize, std::memory_order_relaxed);
+				progress += kHugePageSize - kPageSize;
+				continue;
+			}
+			splitHugePage(&tbl2[index2]);
+		}
 		accessor1 = PageAccessor{tbl2[index2].load() & 0x000FFFFFFFFFF000};
 		tbl1 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor1.get());
 
@@ -872,12 +1175,70 @@ bool ClientPageSpace::isMapped(VirtualAddr pointer) {
 	// Find the PT.
 	if(!(tbl2[index2].load() & kPagePresent))
 		return false;
+	if(tbl2[index2].load() & kPageHuge)
+		return true;
 	accessor1 = PageAccessor{tbl2[index2].load() & 0x000FFFFFFFFFF000};
 	tbl1 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor1.get());
 
 	return tbl1[index1].load() & kPagePresent;
 }
 
+bool ClientPageSpace::testAndClearAccessed(VirtualAddr pointer) {
+	assert(!(pointer & (kPageSize - 1)));
+
+	auto irq_lock = frigg::guard(&irqMutex());
+	auto lock = frigg::guard(&_mutex);
+
+	PageAccessor accessor4;
+	PageAccessor accessor3;
+	PageAccessor accessor2;
+	PageAccessor accessor1;
+
+	auto index4 = (int)((pointer >> 39) & 0x1FF);
+	auto index3 = (int)((pointer >> 30) & 0x1FF);
+	auto index2 = (int)((pointer >> 21) & 0x1FF);
+	auto index1 = (int)((pointer >> 12) & 0x1FF);
+
+	// The PML4 is always present.
+	accessor4 = PageAccessor{rootTable()};
+	auto tbl4 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor4.get());
+
+	// Find the PDPT.
+	if(!(tbl4[index4].load() & kPagePresent))
+		return false;
+	accessor3 = PageAccessor{tbl4[index4].load() & 0x000FFFFFFFFFF000};
+	auto tbl3 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor3.get());
+
+	// Find the PD.
+	if(!(tbl3[index3].load() & kPagePresent))
+		return false;
+	accessor2 = PageAccessor{tbl3[index3].load() & 0x000FFFFFFFFFF000};
+	auto tbl2 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor2.get());
+
+	// Find the PT.
+	if(!(tbl2[index2].load() & kPagePresent))
+		return false;
+
+	// For 2 MiB pages, the accessed bit of the PDE is shared by all 4 KiB pages.
+	arch::scalar_variable<uint64_t> *entry;
+	if(tbl2[index2].load() & kPageHuge) {
+		entry = &tbl2[index2];
+	}else{
+		accessor1 = PageAccessor{tbl2[index2].load() & 0x000FFFFFFFFFF000};
+		auto tbl1 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(accessor1.get());
+		entry = &tbl1[index1];
+	}
+
+	if(!(entry->load() & kPageAccessed))
+		return false;
+
+	// The CPU sets the accessed bit atomically; clear it without losing a concurrent dirty bit.
+	// We do not flush the TLB here: a stale TLB entry only delays the next accessed bit
+	// until the entry is evicted, which is acceptable for reclaim heuristics.
+	auto bits = entry->atomic_fetch_and(~static_cast<uint64_t>(kPageAccessed));
+	return (bits & kPagePresent) && (bits & kPageAccessed);
+}
+
 ClientPageSpace::Walk::Walk(ClientPageSpace *space)
 : _space{space} {
 	irqMutex().lock();
@@ -897,14 +1258,11 @@ void ClientPageSpace::Walk::walkTo(uintptr_t address) {
 	_accessor3 = PageAccessor{};
 	_accessor2 = PageAccessor{};
 	_accessor1 = PageAccessor{};
+	_huge = false;
 }
 
 PageFlags ClientPageSpace::Walk::peekFlags() {
-	_update();
-	assert(_accessor1);
-
-	auto tbl = reinterpret_cast<arch::scalar_variable<uint64_t> *>(_accessor1.get());
-	auto ent = tbl[(_address >> 12) & 0x1FF].load();
+	auto ent = _leafEntry();
 	assert(ent & kPagePresent);
 
 	PageFlags flags = 0;
@@ -916,13 +1274,26 @@ PageFlags ClientPageSpace::Walk::peekFlags() {
 }
 
 PhysicalAddr ClientPageSpace::Walk::peekPhysical() {
+	auto ent = _leafEntry();
+	assert(ent & kPagePresent);
+	if(_huge)
+		return (ent & kPageHugeAddress) + (_address & (kHugePageSize - 1) & ~(kPageSize - 1));
+	return ent & 0x000FFFFFFFFFF000;
+}
+
+uint64_t ClientPageSpace::Walk::_leafEntry() {
 	_update();
-	assert(_accessor1);
 
+	// 2 MiB pages are mapped directly by the PD.
+	if(_huge) {
+		assert(_accessor2);
+		auto tbl = reinterpret_cast<arch::scalar_variable<uint64_t> *>(_accessor2.get());
+		return tbl[(_address >> 21) & 0x1FF].load();
+	}
+
+	assert(_accessor1);
 	auto tbl = reinterpret_cast<arch::scalar_variable<uint64_t> *>(_accessor1.get());
-	auto ent = tbl[(_address >> 12) & 0x1FF].load();
-	assert(ent & kPagePresent);
-	return ent & 0x000FFFFFFFFFF000;
+	return tbl[(_address >> 12) & 0x1FF].load();
 }
 
 void ClientPageSpace::Walk::_update() {
@@ -949,6 +1320,10 @@ void ClientPageSpace::Walk::_update() {
 	auto tbl2 = reinterpret_cast<arch::scalar_variable<uint64_t> *>(_accessor2.get());
 	if(!(tbl2[index2].load() & kPagePresent))
 		return;
+	if(tbl2[index2].load() & kPageHuge) {
+		_huge = true;
+		return;
+	}
 	_accessor1 = PageAccessor{tbl2[index2].load() & 0x000FFFFFFFFFF000};
 }
 
@@ -15,7 +15,9 @@ void initializePhysicalAccess();
 
 enum {
 	kPageSize = 0x1000,
-	kPageShift = 12
+	kPageShift = 12,
+	kHugePageSize = 0x200000,
+	kHugePageShift = 21
 };
 
 struct PageAccessor {
@@ -108,6 +110,22 @@ struct PageBinding;
 
 static constexpr int maxPcidCount = 8;
 
+// PageSpaces track the CPUs that have bindings in a bit mask.
+// Bindings on CPUs beyond this limit fall back to broadcast IPIs.
+static constexpr int maxMaskedCpus = 64;
+
+// Per-CPU TLB shootdown statistics.
+struct ShootdownStats {
+	// IPIs sent to a single CPU that has a binding of the affected space.
+	std::atomic<uint64_t> targetedIpis{0};
+	// IPIs that were not sent because the target already had one pending.
+	std::atomic<uint64_t> coalescedIpis{0};
+	// IPIs broadcast to all other CPUs.
+	std::atomic<uint64_t> broadcastIpis{0};
+	// Shootdowns that invalidated a whole PCID instead of individual pages.
+	std::atomic<uint64_t> fullFlushes{0};
+};
+
 // Per-CPU context for paging.
 struct PageContext {
 	friend struct PageBinding;
@@ -118,6 +136,12 @@ struct PageContext {
 	
 	PageContext &operator= (const PageContext &) = delete;
 
+	// Set by remote CPUs when they send a shootdown IPI to this CPU.
+	// Cleared by this CPU before it processes the shootdown queues.
+	std::atomic<bool> shootdownPending;
+
+	ShootdownStats shootdownStats;
+
 private:
 	// Timestamp for the LRU mechansim of PCIDs.
 	uint64_t _nextStamp;
@@ -191,6 +215,13 @@ struct PageSpace {
 	bool submitShootdown(ShootNode *node);
 
 private:
+	// Both functions must be called with _mutex held.
+	void _addBindingCpu(int cpuIndex);
+	void _removeBindingCpu(int cpuIndex);
+
+	// Sends shootdown IPIs to all other CPUs that have bindings of this space.
+	static void _sendShootdownIpis(uint64_t cpu_mask, bool broadcast);
+
 	PhysicalAddr _rootTable;
 
 	std::atomic<bool> _wantToRetire = false;
@@ -201,6 +232,12 @@ private:
 	
 	unsigned int _numBindings;
 
+	// Bit i is set if CPU i has a binding of this space.
+	uint64_t _cpuMask;
+
+	// Number of bindings on CPUs that cannot be represented in _cpuMask.
+	unsigned int _numUnmaskedBindings;
+
 	uint64_t _shootSequence;
 
 	frg::intrusive_list<
@@ -287,8 +324,14 @@ public:
 
 		void _update();
 
+		// Returns the PTE (or the PDE of a 2 MiB page) that maps the current address.
+		uint64_t _leafEntry();
+
 		uintptr_t _address = 0;
 
+		// True if the current address is mapped by a 2 MiB page.
+		bool _huge = false;
+
 		// Accessors for all levels of PTs.
 		PageAccessor _accessor4; // Coarsest level (PML4).
 		PageAccessor _accessor3;
@@ -306,14 +349,24 @@ public:
 
 	void mapSingle4k(VirtualAddr pointer, PhysicalAddr physical, bool user_access,
 			uint32_t flags, CachingMode caching_mode);
+	// Maps a 2 MiB page. Fails if a page table already exists for the range;
+	// in this case, the caller has to fall back to 4 KiB pages.
+	bool mapSingle2m(VirtualAddr pointer, PhysicalAddr physical, bool user_access,
+			uint32_t flags, CachingMode caching_mode);
+	// Unmapping parts of a 2 MiB page splits it into 4 KiB pages.
 	PageStatus unmapSingle4k(VirtualAddr pointer);
 	void unmapRange(VirtualAddr pointer, size_t size, PageMode mode);
 	bool isMapped(VirtualAddr pointer);
+	// Returns whether the page was accessed since the last call and clears the accessed bit.
+	bool testAndClearAccessed(VirtualAddr pointer);
 
 private:
 	frigg::TicketLock _mutex;
 };
 
+// Returns the amount of user memory (in bytes) that is mapped by 2 MiB pages.
+size_t hugeMappedMemory();
+
 void invalidatePage(const void *address);
 
 void invalidateFullTlb();
@@ -321,6 +321,15 @@ void sendShootdownIpi() {
 	}
 }
 
+void sendShootdownIpi(uint32_t apic) {
+	picBase.store(lApicIcrHigh, apicIcrHighDestField(apic));
+	picBase.store(lApicIcrLow, apicIcrLowVector(0xF0) | apicIcrLowDelivMode(0)
+			| apicIcrLowLevel(true) | apicIcrLowShorthand(0));
+	while(picBase.load(lApicIcrLow) & apicIcrLowDelivStatus) {
+		// Wait for IPI delivery.
+	}
+}
+
 void sendPingIpi(uint32_t apic) {
 //	frigg::infoLogger() << "thor [CPU" << getLocalApicId() << "]: Sending ping" << frigg::endLog;
 	picBase.store(lApicIcrHigh, apicIcrHighDestField(apic));
@@ -357,6 +366,21 @@ IrqPin *getGlobalSystemIrq(size_t n) {
 // TODO: Replace this by proper IRQ allocation.
 extern frigg::LazyInitializer<IrqSlot> globalIrqSlots[64];
 
+// Links a free IRQ slot to the pin. Returns the vector of the slot.
+static int allocateIrqVector(IrqPin *pin) {
+	for(int i = 0; i < 64; i++) {
+		if(!globalIrqSlots[i]->isAvailable())
+			continue;
+		frigg::infoLogger() << "thor: Allocating IRQ slot " << i
+				<< " to " << pin->name() << frigg::endLog;
+		globalIrqSlots[i]->link(pin);
+		return 64 + i;
+	}
+	frigg::panicLogger() << "thor: Could not allocate interrupt vector for "
+			<< pin->name() << frigg::endLog;
+	__builtin_unreachable();
+}
+
 constexpr arch::scalar_register<uint32_t> apicIndex(0x00);
 constexpr arch::scalar_register<uint32_t> apicData(0x10);
 
@@ -456,18 +480,7 @@ namespace {
 
 		// Allocate an IRQ vector for the I/O APIC pin.
 		if(_vector == -1)
-			for(int i = 0; i < 64; i++) {
-				if(!globalIrqSlots[i]->isAvailable())
-					continue;
-				frigg::infoLogger() << "thor: Allocating IRQ slot " << i
-						<< " to " << name() << frigg::endLog;
-				globalIrqSlots[i]->link(this);
-				_vector = 64 + i;
-				break;
-			}
-		if(_vector == -1)
-			frigg::panicLogger() << "thor: Could not allocate interrupt vector for "
-					<< name() << frigg::endLog;
+			_vector = allocateIrqVector(this);
 
 		_chip->_storeRegister(kIoApicInts + _index * 2 + 1,
 				static_cast<uint32_t>(pin_word2::destination(0)));
@@ -552,6 +565,36 @@ void setupIoApic(int apic_id, int gsi_base, PhysicalAddr address) {
 	}));
 }
 
+// --------------------------------------------------------
+// MSI management
+// --------------------------------------------------------
+
+MsiPin::MsiPin(frigg::String<KernelAlloc> name)
+: IrqPin{std::move(name)} {
+	// The vector is part of the message; hence it is allocated eagerly.
+	_vector = allocateIrqVector(this);
+}
+
+uint64_t MsiPin::getMessageAddress() {
+	// Like the I/O APIC pins, deliver all MSIs to the local APIC with ID zero.
+	return 0xFEE0'0000;
+}
+
+uint32_t MsiPin::getMessageData() {
+	// Fixed delivery mode, edge triggered.
+	return _vector;
+}
+
+IrqStrategy MsiPin::program(TriggerMode mode, Polarity polarity) {
+	assert(mode == TriggerMode::edge);
+	assert(polarity == Polarity::high);
+	return IrqStrategy::justEoi;
+}
+
+void MsiPin::sendEoi() {
+	acknowledgeIrq(0);
+}
+
 // --------------------------------------------------------
 // Legacy PIC management
 // --------------------------------------------------------
@@ -73,6 +73,7 @@ void raiseInitDeassertIpi(uint32_t dest_apic_id);
 void raiseStartupIpi(uint32_t dest_apic_id, uint32_t page);
 
 void sendShootdownIpi();
+void sendShootdownIpi(uint32_t apic);
 void sendPingIpi(uint32_t apic);
 void sendGlobalNmi();
 
@@ -82,6 +83,28 @@ void sendGlobalNmi();
 
 void setupIoApic(int apic_id, int gsi_base, PhysicalAddr address);
 
+// --------------------------------------------------------
+// MSI management
+// --------------------------------------------------------
+
+// Represents an IRQ that is triggered by a message signaled interrupt.
+// Subclasses are responsible for programming the message into the device
+// and for masking it.
+struct MsiPin : IrqPin {
+	MsiPin(frigg::String<KernelAlloc> name);
+
+	// Address and data of the message that the device needs to write.
+	uint64_t getMessageAddress();
+	uint32_t getMessageData();
+
+protected:
+	IrqStrategy program(TriggerMode mode, Polarity polarity) override;
+	void sendEoi() override;
+
+private:
+	int _vector;
+};
+
 // --------------------------------------------------------
 // Legacy PIC management
 // --------------------------------------------------------
@@ -104,7 +104,7 @@ struct KernelAccessor {
 		return _length;
 	}
 
-	Error write(size_t offset, void *source, size_t size) {
+	Error write(size_t offset, const void *source, size_t size) {
 		// TODO: detect overflows here.
 		assert(offset + size <= _length);
 		memcpy((char *)_pointer + offset, source, size);
@@ -136,7 +136,7 @@ public:
 		});
 	}
 
-	Error write(size_t offset, void *source, size_t size) {
+	Error write(size_t offset, const void *source, size_t size) {
 		return _variant.apply([&] (auto &accessor) -> Error {
 			return accessor.write(offset, source, size);
 		});
@@ -1,5 +1,6 @@
 
 #include <type_traits>
+#include "../arch/x86/copy.hpp"
 #include "execution/coroutine.hpp"
 #include "kernel.hpp"
 #include "fiber.hpp"
@@ -21,6 +22,9 @@ namespace {
 
 	constexpr bool disableCow = false;
 
+	// Fault-around window (in pages) that is used unless the command line overrides it.
+	constexpr size_t defaultFaultAroundPages = 16;
+
 	void logRss(VirtualSpace *space) {
 		if(!logUsage)
 			return;
@@ -98,6 +102,9 @@ bool HoleAggregator::check_invariant(HoleTree &tree, Hole *hole) {
 // Mapping
 // --------------------------------------------------------
 
+std::atomic<size_t> faultAroundPages{defaultFaultAroundPages};
+FaultAroundStats faultAroundStats;
+
 Mapping::Mapping(size_t length, MappingFlags flags,
 		frigg::SharedPtr<MemorySlice> slice, uintptr_t view_offset)
 : _length{length}, _flags{flags},
@@ -188,6 +195,65 @@ bool Mapping::touchVirtualPage(TouchVirtualNode *continuation) {
 		if(self->flags() & MappingFlags::dontRequireBacking)
 			fetchFlags |= FetchNode::disallowBacking;
 
+		// Try to map the whole 2 MiB page that surrounds the faulting page.
+		// This requires that the 2 MiB page is part of the mapping and that the view
+		// returns physically contiguous, suitably aligned memory for it.
+		auto pageAddress = (self->address() + continuation->_offset) & ~(kPageSize - 1);
+		auto hugeAddress = pageAddress & ~(kHugePageSize - 1);
+		auto hugeOffset = hugeAddress - self->address();
+		if(self->_view->canMapHugePages()
+				&& hugeAddress >= self->address()
+				&& hugeAddress + kHugePageSize <= self->address() + self->length()
+				&& !((self->_viewOffset + hugeOffset) & (kHugePageSize - 1))) {
+			if(auto e = co_await self->_view->asyncLockRange(self->_viewOffset + hugeOffset,
+					kHugePageSize); e)
+				assert(!"asyncLockRange() failed");
+
+			// Fetch the faulting page (and not the start of the 2 MiB page) such that
+			// views that fall back to 4 KiB pages do not commit an unrelated page.
+			auto disp = pageAddress - hugeAddress;
+			auto [error, range, flags] = co_await self->_view->fetchRange(self->_viewOffset
+					+ hugeOffset + disp);
+
+			// mapSingle2m() fails if parts of the 2 MiB page are already mapped.
+			bool mappedHuge = false;
+			bool alreadyMapped = false;
+			if(range.get<1>() >= kHugePageSize - disp
+					&& !((range.get<0>() - disp) & (kHugePageSize - 1))) {
+				// Synchronize with observeEviction() and fault-around.
+				auto irqLock = frigg::guard(&irqMutex());
+				auto lock = frigg::guard(&self->_evictMutex);
+
+				mappedHuge = self->owner()->_ops->mapSingle2m(hugeAddress,
+						range.get<0>() - disp, self->compilePageFlags(), range.get<2>());
+				if(mappedHuge) {
+					self->owner()->_residuentSize += kHugePageSize;
+				}else if(self->owner()->_ops->isMapped(pageAddress)) {
+					// Another fault mapped the page concurrently, possibly as part of
+					// a 2 MiB page. Falling back to unmapSingle4k() would split that page.
+					alreadyMapped = true;
+				}
+			}
+
+			if(mappedHuge) {
+				logRss(self->owner());
+
+				self->_view->unlockRange(self->_viewOffset + hugeOffset, kHugePageSize);
+				continuation->setResult(kErrSuccess, range.get<0>(),
+						kHugePageSize - disp, range.get<2>());
+				WorkQueue::post(continuation->_worklet);
+				co_return;
+			}else if(alreadyMapped) {
+				self->_view->unlockRange(self->_viewOffset + hugeOffset, kHugePageSize);
+				continuation->setResult(kErrSuccess, range.get<0>(),
+						kPageSize, range.get<2>());
+				WorkQueue::post(continuation->_worklet);
+				co_return;
+			}
+
+			self->_view->unlockRange(self->_viewOffset + hugeOffset, kHugePageSize);
+		}
+
 		if(auto e = co_await self->_view->asyncLockRange((self->_viewOffset + continuation->_offset)
 				& ~(kPageSize - 1), kPageSize); e)
 			assert(!"asyncLockRange() failed");
@@ -195,23 +261,69 @@ bool Mapping::touchVirtualPage(TouchVirtualNode *continuation) {
 		auto [error, range, flags] = co_await self->_view->fetchRange(self->_viewOffset
 				+ continuation->_offset);
 
-		// TODO: Update RSS, handle dirty pages, etc.
-		auto pageOffset = self->address() + continuation->_offset;
-		self->owner()->_ops->unmapSingle4k(pageOffset & ~(kPageSize - 1));
-		self->owner()->_ops->mapSingle4k(pageOffset & ~(kPageSize - 1),
-				range.get<0>() & ~(kPageSize - 1),
-				self->compilePageFlags(), range.get<2>());
-		self->owner()->_residuentSize += kPageSize;
+		{
+			// Synchronize with observeEviction() and fault-around.
+			auto irqLock = frigg::guard(&irqMutex());
+			auto lock = frigg::guard(&self->_evictMutex);
+
+			// TODO: Handle dirty pages, etc.
+			auto status = self->owner()->_ops->unmapSingle4k(pageAddress);
+			self->owner()->_ops->mapSingle4k(pageAddress,
+					range.get<0>() & ~(kPageSize - 1),
+					self->compilePageFlags(), range.get<2>());
+			if(!(status & page_status::present))
+				self->owner()->_residuentSize += kPageSize;
+
+			// Avoid further faults on surrounding pages that are already resident.
+			self->_faultAround(pageAddress - self->address(), self->compilePageFlags());
+		}
 		logRss(self->owner());
 
 		self->_view->unlockRange((self->_viewOffset + continuation->_offset)
 				& ~(kPageSize - 1), kPageSize);
-		continuation->setResult(kErrSuccess, range);
+
+		// Only report the page that we actually mapped; populateVirtualRange() relies on this.
+		auto disp = (self->_viewOffset + continuation->_offset) & (kPageSize - 1);
+		continuation->setResult(kErrSuccess, range.get<0>(),
+				frg::min(range.get<1>(), kPageSize - disp), range.get<2>());
 		WorkQueue::post(continuation->_worklet);
 	}(this, continuation));
 	return false;
 }
 
+void Mapping::_faultAround(uintptr_t offset, uint32_t pageFlags) {
+	auto window = faultAroundPages.load(std::memory_order_relaxed);
+	if(window <= 1)
+		return;
+
+	// Align the window such that sequential faults cover disjoint windows.
+	auto windowSize = window * kPageSize;
+	auto begin = offset - (offset % windowSize);
+	auto end = frg::min(begin + windowSize, length());
+
+	size_t mapped = 0;
+	for(size_t progress = begin; progress < end; progress += kPageSize) {
+		if(progress == offset)
+			continue;
+
+		// peekRange() does not fetch pages; hence, this only maps pages that are resident.
+		VirtualAddr vaddr = address() + progress;
+		if(owner()->_ops->isMapped(vaddr))
+			continue;
+		auto physicalRange = _view->peekRange(_viewOffset + progress);
+		if(physicalRange.get<0>() == PhysicalAddr(-1))
+			continue;
+
+		owner()->_ops->mapSingle4k(vaddr, physicalRange.get<0>(),
+				pageFlags, physicalRange.get<1>());
+		owner()->_residuentSize += kPageSize;
+		mapped++;
+	}
+
+	faultAroundStats.faults.fetch_add(1, std::memory_order_relaxed);
+	faultAroundStats.mappedPages.fetch_add(mapped, std::memory_order_relaxed);
+}
+
 void Mapping::install() {
 	assert(_state == MappingState::null);
 	_state = MappingState::active;
@@ -361,6 +473,27 @@ bool Mapping::observeEviction(uintptr_t evict_offset, size_t evict_length,
 	return true;
 }
 
+bool Mapping::observeAccess(uintptr_t access_offset, size_t access_length) {
+	if(_state != MappingState::active)
+		return false;
+
+	if(access_offset + access_length <= _viewOffset
+			|| access_offset >= _viewOffset + length())
+		return false;
+
+	auto test_begin = frg::max(access_offset, _viewOffset);
+	auto test_end = frg::min(access_offset + access_length, _viewOffset + length());
+	assert(!((test_begin - _viewOffset) & (kPageSize - 1)));
+
+	// Test all pages; this clears all accessed bits even if we already found one.
+	bool accessed = false;
+	for(auto offset = test_begin; offset < test_end; offset += kPageSize) {
+		if(owner()->_ops->testAndClearAccessed(address() + (offset - _viewOffset)))
+			accessed = true;
+	}
+	return accessed;
+}
+
 // --------------------------------------------------------
 // CowMapping
 // --------------------------------------------------------
@@ -934,7 +1067,7 @@ void AddressSpaceLockHandle::load(size_t offset, void *pointer, size_t size) {
 		assert(page != PhysicalAddr(-1));
 
 		PageAccessor accessor{page};
-		memcpy((char *)pointer + progress, (char *)accessor.get() + misalign, chunk);
+		copyMemory((char *)pointer + progress, (char *)accessor.get() + misalign, chunk);
 		progress += chunk;
 	}
 }
@@ -953,7 +1086,7 @@ Error AddressSpaceLockHandle::write(size_t offset, const void *pointer, size_t s
 		assert(page != PhysicalAddr(-1));
 
 		PageAccessor accessor{page};
-		memcpy((char *)accessor.get() + misalign, (char *)pointer + progress, chunk);
+		copyMemory((char *)accessor.get() + misalign, (char *)pointer + progress, chunk);
 		progress += chunk;
 	}
 
@@ -15,8 +15,14 @@ struct VirtualOperations {
 
 	virtual void mapSingle4k(VirtualAddr pointer, PhysicalAddr physical,
 			uint32_t flags, CachingMode cachingMode) = 0;
+	// Maps a 2 MiB page. Returns false if huge pages cannot be used for the range.
+	virtual bool mapSingle2m(VirtualAddr pointer, PhysicalAddr physical,
+			uint32_t flags, CachingMode cachingMode) {
+		return false;
+	}
 	virtual PageStatus unmapSingle4k(VirtualAddr pointer) = 0;
 	virtual bool isMapped(VirtualAddr pointer) = 0;
+	virtual bool testAndClearAccessed(VirtualAddr pointer) = 0;
 };
 
 struct Hole {
@@ -127,6 +133,22 @@ struct PopulateVirtualNode {
 	Worklet *_prepared;
 };
 
+// Number of pages around a faulting page that are mapped if they are already resident.
+// Fault-around is disabled if this is at most one. Set by the thor.fault_around option.
+extern std::atomic<size_t> faultAroundPages;
+
+// Upper bound for thor.fault_around. Faults walk the whole window with IRQs disabled.
+constexpr size_t maxFaultAroundPages = 512;
+
+struct FaultAroundStats {
+	// Page faults that attempted to map surrounding pages.
+	std::atomic<uint64_t> faults{0};
+	// Surrounding pages that were mapped. Each of them saves a fault once it is accessed.
+	std::atomic<uint64_t> mappedPages{0};
+};
+
+extern FaultAroundStats faultAroundStats;
+
 enum class MappingState {
 	null,
 	active,
@@ -160,6 +182,15 @@ struct Mapping : MemoryObserver {
 		return _flags;
 	}
 
+	// Memory object and offset (of the mapping's first page) that back this mapping.
+	MemoryView *view() {
+		return _view.get();
+	}
+
+	uintptr_t viewOffset() const {
+		return _viewOffset;
+	}
+
 	void tie(smarter::shared_ptr<VirtualSpace> owner, VirtualAddr address);
 
 	void protect(MappingFlags flags);
@@ -185,6 +216,7 @@ struct Mapping : MemoryObserver {
 	void retire();
 
 	bool observeEviction(uintptr_t offset, size_t length, EvictNode *node) override;
+	bool observeAccess(uintptr_t offset, size_t length) override;
 
 	// ----------------------------------------------------------------------------------
 	// Sender boilerplate for lockVirtualRange()
@@ -357,6 +389,9 @@ protected:
 	uint32_t compilePageFlags();
 
 private:
+	// Maps resident pages around offset. Requires _evictMutex.
+	void _faultAround(uintptr_t offset, uint32_t pageFlags);
+
 	smarter::shared_ptr<VirtualSpace> _owner;
 	VirtualAddr _address;
 	size_t _length;
@@ -615,6 +650,11 @@ struct AddressSpace : VirtualSpace, smarter::crtp_counter<AddressSpace, Bindable
 			space_->pageSpace_.mapSingle4k(pointer, physical, true, flags, cachingMode);
 		}
 
+		bool mapSingle2m(VirtualAddr pointer, PhysicalAddr physical,
+				uint32_t flags, CachingMode cachingMode) override {
+			return space_->pageSpace_.mapSingle2m(pointer, physical, true, flags, cachingMode);
+		}
+
 		PageStatus unmapSingle4k(VirtualAddr pointer) override {
 			return space_->pageSpace_.unmapSingle4k(pointer);
 		}
@@ -623,6 +663,10 @@ struct AddressSpace : VirtualSpace, smarter::crtp_counter<AddressSpace, Bindable
 			return space_->pageSpace_.isMapped(pointer);
 		}
 
+		bool testAndClearAccessed(VirtualAddr pointer) override {
+			return space_->pageSpace_.testAndClearAccessed(pointer);
+		}
+
 	private:
 		AddressSpace *space_;
 	};
@@ -800,6 +844,24 @@ private:
 	MemoryViewLockHandle _handle;
 };
 
+struct ReclaimStats {
+	// Number of pages on the active and inactive LRU lists.
+	size_t activePages;
+	size_t inactivePages;
+	// Free page thresholds that start and stop reclaim.
+	size_t lowWatermark;
+	size_t highWatermark;
+
+	// Number of times that the reclaimer was woken up by the low watermark.
+	uint64_t pressureWakeups;
+	uint64_t scannedPages;
+	uint64_t activatedPages;
+	uint64_t deactivatedPages;
+	uint64_t evictedPages;
+};
+
 void initializeReclaim();
 
+ReclaimStats getReclaimStats();
+
 } // namespace thor
@@ -7,6 +7,7 @@
 #include <frigg/variant.hpp>
 #include "error.hpp"
 #include "../arch/x86/cpu.hpp"
+#include "physical.hpp"
 #include "schedule.hpp"
 
 namespace thor {
@@ -72,6 +73,7 @@ struct CpuData : public PlatformCpuData {
 
 	IrqMutex irqMutex;
 	Scheduler scheduler;
+	PhysicalPageCache pageCache;
 	bool haveVirtualization;
 
 	ExecutorContext *executorContext;
@@ -0,0 +1,88 @@
+#include "futex.hpp"
+
+namespace thor {
+
+frigg::LazyInitializer<Futex> globalFutexSpace;
+
+void initializeFutexes() {
+	globalFutexSpace.initialize();
+}
+
+bool Futex::cancelWait(FutexNode *node) {
+	auto irq_lock = frigg::guard(&irqMutex());
+
+	// requeue() might move the node to another bucket before we manage to lock it.
+	while(true) {
+		auto bucket = static_cast<Bucket *>(node->_bucket.load(std::memory_order_acquire));
+		if(!bucket)
+			return false;
+
+		auto lock = frigg::guard(&bucket->mutex);
+		if(node->_bucket.load(std::memory_order_relaxed) != bucket)
+			continue;
+
+		bucket->queue.erase(bucket->queue.iterator_to(node));
+		node->_bucket.store(nullptr, std::memory_order_relaxed);
+		return true;
+	}
+}
+
+size_t Futex::wake(FutexIdentity identity, size_t count) {
+	auto bucket = _getBucket(identity);
+
+	WaitQueue wakeQueue;
+	{
+		auto irq_lock = frigg::guard(&irqMutex());
+		auto lock = frigg::guard(&bucket->mutex);
+
+		_collect(bucket, identity, count, wakeQueue);
+	}
+
+	return _post(wakeQueue);
+}
+
+void Futex::_lockPair(Bucket *a, Bucket *b) {
+	if(a == b) {
+		a->mutex.lock();
+	}else if(a < b) {
+		a->mutex.lock();
+		b->mutex.lock();
+	}else{
+		b->mutex.lock();
+		a->mutex.lock();
+	}
+}
+
+void Futex::_unlockPair(Bucket *a, Bucket *b) {
+	a->mutex.unlock();
+	if(a != b)
+		b->mutex.unlock();
+}
+
+void Futex::_collect(Bucket *bucket, FutexIdentity identity, size_t count,
+		WaitQueue &wakeQueue) {
+	size_t n = 0;
+	auto it = bucket->queue.begin();
+	while(n < count && it != bucket->queue.end()) {
+		auto node = *it;
+		++it;
+		if(!(node->_identity == identity))
+			continue;
+		bucket->queue.erase(bucket->queue.iterator_to(node));
+		node->_bucket.store(nullptr, std::memory_order_relaxed);
+		wakeQueue.push_back(node);
+		n++;
+	}
+}
+
+size_t Futex::_post(WaitQueue &wakeQueue) {
+	size_t n = 0;
+	while(!wakeQueue.empty()) {
+		auto node = wakeQueue.pop_front();
+		WorkQueue::post(node->_woken);
+		n++;
+	}
+	return n;
+}
+
+} // namespace thor
@@ -1,9 +1,11 @@
 #ifndef THOR_GENERIC_FUTEX_HPP
 #define THOR_GENERIC_FUTEX_HPP
 
-#include <frg/hash_map.hpp>
+#include <atomic>
+
 #include <frg/list.hpp>
 #include <frigg/atomic.hpp>
+#include <frigg/initializer.hpp>
 #include <frigg/linked.hpp>
 #include "cancel.hpp"
 #include "kernel_heap.hpp"
@@ -12,6 +14,18 @@
 
 namespace thor {
 
+// Identifies a futex within a Futex table.
+// Private futexes are identified by (0, virtual address) in the futex table of their
+// address space; shared futexes are identified by (MemoryView::id(), offset) in globalFutexSpace.
+struct FutexIdentity {
+	uintptr_t object;
+	uintptr_t offset;
+
+	bool operator== (const FutexIdentity &other) const {
+		return object == other.object && offset == other.offset;
+	}
+};
+
 struct FutexNode {
 	friend struct Futex;
 
@@ -21,104 +35,159 @@ struct FutexNode {
 
 private:
 	Worklet *_woken;
+	FutexIdentity _identity;
+
+	// Bucket that the node is currently queued on (or null).
+	// Only changes while the lock of that bucket is held.
+	std::atomic<void *> _bucket{nullptr};
+
 	frg::default_list_hook<FutexNode> _queueNode;
 };
 
+// Futex table that is split into buckets with individual locks.
+// Waiters of all futexes that hash to the same bucket are kept on a single list.
 struct Futex {
 	using Address = uintptr_t;
 
-	Futex()
-	: _slots{frg::hash<Address>{}, *kernelAlloc} { }
+	static constexpr size_t numBuckets = 64;
+
+	Futex() = default;
+
+	Futex(const Futex &) = delete;
+
+	Futex &operator= (const Futex &) = delete;
 
-	bool empty() {
-		return _slots.empty();
-	}
-	
 	template<typename C>
 	bool checkSubmitWait(Address address, C condition, FutexNode *node) {
+		return checkSubmitWait(FutexIdentity{0, address}, std::move(condition), node);
+	}
+
+	template<typename C>
+	bool checkSubmitWait(FutexIdentity identity, C condition, FutexNode *node) {
+		auto bucket = _getBucket(identity);
 		auto irq_lock = frigg::guard(&irqMutex());
-		auto lock = frigg::guard(&_mutex);
+		auto lock = frigg::guard(&bucket->mutex);
 
 		if(!condition())
 			return false;
 
-		auto it = _slots.get(address);
-		if(!it) {
-			_slots.insert(address, Slot());
-			it = _slots.get(address);
-		}
-
 		assert(!node->_queueNode.in_list);
-		it->queue.push_back(node);
+		node->_identity = identity;
+		node->_bucket.store(bucket, std::memory_order_relaxed);
+		bucket->queue.push_back(node);
 		return true;
 	}
 
 	template<typename C>
 	void submitWait(Address address, C condition, FutexNode *node) {
-		if(!checkSubmitWait(address, std::move(condition), node))
+		submitWait(FutexIdentity{0, address}, std::move(condition), node);
+	}
+
+	template<typename C>
+	void submitWait(FutexIdentity identity, C condition, FutexNode *node) {
+		if(!checkSubmitWait(identity, std::move(condition), node))
 			WorkQueue::post(node->_woken);
 	}
 
-	void wake(Address address) {
-		auto irq_lock = frigg::guard(&irqMutex());
-		auto lock = frigg::guard(&_mutex);
+	// Removes a node that is still waiting. The node's worklet is *not* posted.
+	// Returns false if the node was already woken (or was never queued).
+	bool cancelWait(FutexNode *node);
 
-		auto it = _slots.get(address);
-		if(!it)
-			return;
-		
-		// Invariant: If the slot exists then its queue is not empty.
-		assert(!it->queue.empty());
+	// Wakes up to count waiters. Returns the number of woken waiters.
+	size_t wake(Address address, size_t count = SIZE_MAX) {
+		return wake(FutexIdentity{0, address}, count);
+	}
 
-		frg::intrusive_list<
-			FutexNode,
-			frg::locate_member<
-				FutexNode,
-				frg::default_list_hook<FutexNode>,
-				&FutexNode::_queueNode
-			>
-		> wake_queue;
-
-		// TODO: Enable users to only wake a certain number of waiters.
-		wake_queue.splice(wake_queue.end(), it->queue);
-		
-		_slots.remove(address);
-
-		lock.unlock();
-		irq_lock.unlock();
-
-		while(!wake_queue.empty()) {
-			auto node = wake_queue.pop_front();
-			WorkQueue::post(node->_woken);
+	size_t wake(FutexIdentity identity, size_t count = SIZE_MAX);
+
+	// Wakes up to wakeCount waiters of from and moves up to requeueCount of the remaining
+	// waiters to the futex to. This operation is only performed if condition() holds
+	// (which is checked while all involved locks are held).
+	// Returns false if condition() fails.
+	template<typename C>
+	bool requeue(FutexIdentity from, FutexIdentity to, size_t wakeCount, size_t requeueCount,
+			C condition, size_t *woken) {
+		auto fromBucket = _getBucket(from);
+		auto toBucket = _getBucket(to);
+
+		WaitQueue wakeQueue;
+		{
+			auto irq_lock = frigg::guard(&irqMutex());
+			_lockPair(fromBucket, toBucket);
+
+			if(!condition()) {
+				_unlockPair(fromBucket, toBucket);
+				return false;
+			}
+
+			_collect(fromBucket, from, wakeCount, wakeQueue);
+
+			// Move the remaining waiters.
+			size_t n = 0;
+			auto it = fromBucket->queue.begin();
+			while(!(from == to) && n < requeueCount && it != fromBucket->queue.end()) {
+				auto node = *it;
+				++it;
+				if(!(node->_identity == from))
+					continue;
+				fromBucket->queue.erase(fromBucket->queue.iterator_to(node));
+				node->_identity = to;
+				node->_bucket.store(toBucket, std::memory_order_relaxed);
+				toBucket->queue.push_back(node);
+				n++;
+			}
+
+			_unlockPair(fromBucket, toBucket);
 		}
+
+		*woken = _post(wakeQueue);
+		return true;
 	}
 
-private:	
+private:
 	using Mutex = frigg::TicketLock;
 
-	struct Slot {
-		frg::intrusive_list<
+	using WaitQueue = frg::intrusive_list<
+		FutexNode,
+		frg::locate_member<
 			FutexNode,
-			frg::locate_member<
-				FutexNode,
-				frg::default_list_hook<FutexNode>,
-				&FutexNode::_queueNode
-			>
-		> queue;
+			frg::default_list_hook<FutexNode>,
+			&FutexNode::_queueNode
+		>
+	>;
+
+	struct Bucket {
+		Mutex mutex;
+		WaitQueue queue;
 	};
 
-	// TODO: use a scalable hash table with fine-grained locks to
-	// improve the scalability of the futex algorithm.
-	Mutex _mutex;
+	Bucket *_getBucket(FutexIdentity identity) {
+		// Futex words are 4-byte aligned; mix in the view ID for shared futexes.
+		auto h = (identity.offset >> 2) ^ (identity.object << 20);
+		h ^= h >> 17;
+		h *= 0x9E3779B97F4A7C15;
+		return &_buckets[(h >> 32) % numBuckets];
+	}
+
+	// Locks two buckets in a consistent order. IRQs must be disabled.
+	static void _lockPair(Bucket *a, Bucket *b);
+	static void _unlockPair(Bucket *a, Bucket *b);
 
-	frg::hash_map<
-		Address,
-		Slot,
-		frg::hash<Address>,
-		KernelAlloc
-	> _slots;
+	// Moves up to count waiters of a futex to a local queue. Requires the bucket lock.
+	static void _collect(Bucket *bucket, FutexIdentity identity, size_t count,
+			WaitQueue &wakeQueue);
+
+	// Posts the worklets of all nodes. Must be called without holding bucket locks.
+	static size_t _post(WaitQueue &wakeQueue);
+
+	Bucket _buckets[numBuckets];
 };
 
+// Futex table for shared futexes, i.e., futexes that are keyed by memory object.
+extern frigg::LazyInitializer<Futex> globalFutexSpace;
+
+void initializeFutexes();
+
 } // namespace thor
 
 #endif // THOR_GENERIC_FUTEX_HPP
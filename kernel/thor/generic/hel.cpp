@@ -6,6 +6,7 @@
 #include "ipc-queue.hpp"
 #include "irq.hpp"
 #include "kernlet.hpp"
+#include "../arch/x86/copy.hpp"
 #include "../arch/x86/debug.hpp"
 #include <arch/x86/ept.hpp>
 #include <arch/x86/vmx.hpp>
@@ -13,15 +14,21 @@
 
 using namespace thor;
 
+namespace {
+	// Allocations of at least this size are backed by 2 MiB pages even if
+	// the caller does not pass kHelAllocHugePages.
+	constexpr size_t hugeAllocationThreshold = size_t{32} << 20;
+}
+
 void readUserMemory(void *kern_ptr, const void *user_ptr, size_t size) {
 	enableUserAccess();
-	memcpy(kern_ptr, user_ptr, size);
+	copyMemory(kern_ptr, user_ptr, size);
 	disableUserAccess();
 }
 
 void writeUserMemory(void *user_ptr, const void *kern_ptr, size_t size) {
 	enableUserAccess();
-	memcpy(user_ptr, kern_ptr, size);
+	copyMemory(user_ptr, kern_ptr, size);
 	disableUserAccess();
 }
 
@@ -352,6 +359,11 @@ HelError helAllocateMemory(size_t size, uint32_t flags,
 	if(flags & kHelAllocContinuous) {
 		memory = frigg::makeShared<AllocatedMemory>(*kernelAlloc, size, effective.addressBits,
 				size, kPageSize);
+	}else if((flags & kHelAllocHugePages) || size >= hugeAllocationThreshold) {
+		// Back aligned 2 MiB regions by 2 MiB pages, such that they can be mapped by huge pages.
+		// A single fault commits the whole region; hence we only do this for large objects.
+		memory = frigg::makeShared<AllocatedMemory>(*kernelAlloc, size, effective.addressBits,
+				kPageSize, kPageSize, true);
 	}else if(flags & kHelAllocOnDemand) {
 		memory = frigg::makeShared<AllocatedMemory>(*kernelAlloc, size, effective.addressBits);
 	}else{
@@ -930,6 +942,45 @@ HelError helPointerPhysical(void *pointer, uintptr_t *physical) {
 	return kHelErrNone;
 }
 
+HelError helPointerPhysicalRange(void *pointer, size_t size, uintptr_t *physicals) {
+	if(!size)
+		return kHelErrIllegalArgs;
+
+	auto this_thread = getCurrentThread();
+
+	auto space = this_thread->getAddressSpace().lock();
+
+	auto disp = (reinterpret_cast<uintptr_t>(pointer) & (kPageSize - 1));
+	auto length = (disp + size + (kPageSize - 1)) & ~(kPageSize - 1);
+	auto accessor = AddressSpaceLockHandle{std::move(space),
+			reinterpret_cast<char *>(pointer) - disp, length};
+
+	// FIXME: See helPointerPhysical() for the lifetime of the physical pages.
+	struct Closure {
+		ThreadBlocker blocker;
+		Worklet worklet;
+		AcquireNode acquire;
+	} closure;
+
+	closure.worklet.setup([] (Worklet *base) {
+		auto closure = frg::container_of(base, &Closure::worklet);
+		Thread::unblockOther(&closure->blocker);
+	});
+	closure.acquire.setup(&closure.worklet);
+	closure.blocker.setup();
+	if(!accessor.acquire(&closure.acquire))
+		Thread::blockCurrent(&closure.blocker);
+
+	for(size_t offset = 0; offset < length; offset += kPageSize) {
+		auto page_physical = accessor.getPhysical(offset);
+		if(!offset)
+			page_physical += disp;
+		writeUserObject<uintptr_t>(physicals + offset / kPageSize, page_physical);
+	}
+
+	return kHelErrNone;
+}
+
 HelError helLoadForeign(HelHandle handle, uintptr_t address,
 		size_t length, void *buffer) {
 	auto this_thread = getCurrentThread();
@@ -2040,11 +2091,16 @@ HelError helSubmitAsync(HelHandle handle, const HelAction *actions, size_t count
 			closure->items[i].transmit.setup(kTagExtractCredentials, &closure->packet);
 		} break;
 		case kHelActionSendFromBuffer: {
-			frigg::UniqueMemory<KernelAlloc> buffer(*kernelAlloc, action.length);
-			readUserMemory(buffer.data(), action.buffer, action.length);
-
 			closure->items[i].transmit.setup(kTagSendFromBuffer, &closure->packet);
-			closure->items[i].transmit._inBuffer = std::move(buffer);
+			if(action.length) {
+				// The stream copies from user space directly if the receiver is already waiting.
+				// Otherwise, it copies the buffer to the kernel heap before it queues the item.
+				closure->items[i].transmit._inUserBuffer = action.buffer;
+				closure->items[i].transmit._inUserLength = action.length;
+			}else{
+				closure->items[i].transmit._inBuffer
+						= frigg::UniqueMemory<KernelAlloc>(*kernelAlloc, 0);
+			}
 		} break;
 		case kHelActionSendFromBufferSg: {
 			size_t length = 0;
@@ -2164,57 +2220,152 @@ HelError helShutdownLane(HelHandle handle) {
 	return kHelErrNone;
 }
 
+namespace {
+	// Determines the futex table and the identity of the futex at pointer.
+	HelError resolveFutex(int *pointer, uint32_t flags, Futex **futex, FutexIdentity *identity) {
+		auto this_thread = getCurrentThread();
+		auto space = this_thread->getAddressSpace();
+
+		auto address = reinterpret_cast<VirtualAddr>(pointer);
+		if(address & (sizeof(int) - 1))
+			return kHelErrIllegalArgs;
+
+		if(!(flags & kHelFutexShared)) {
+			*futex = &space->futexSpace;
+			*identity = FutexIdentity{0, address};
+			return kHelErrNone;
+		}
+
+		// Shared futexes are keyed by the memory object that backs the mapping.
+		// This way, all address spaces that map the same memory see the same futex.
+		auto mapping = space->getMapping(address);
+		if(!mapping)
+			return kHelErrFault;
+		*futex = &(*globalFutexSpace);
+		*identity = FutexIdentity{mapping->view()->id(),
+				mapping->viewOffset() + (address - mapping->address())};
+		return kHelErrNone;
+	}
+}
+
 HelError helFutexWait(int *pointer, int expected) {
-	auto this_thread = getCurrentThread();
-	auto space = this_thread->getAddressSpace();
+	return helFutexWaitDeadline(pointer, expected, kHelWaitInfinite, 0);
+}
+
+HelError helFutexWake(int *pointer) {
+	int woken;
+	return helFutexWakeCount(pointer, -1, 0, &woken);
+}
+
+HelError helFutexWaitDeadline(int *pointer, int expected, int64_t deadline, uint32_t flags) {
+	if(flags & ~uint32_t(kHelFutexShared))
+		return kHelErrIllegalArgs;
+
+	Futex *futex;
+	FutexIdentity identity;
+	if(auto error = resolveFutex(pointer, flags, &futex, &identity); error)
+		return error;
 
 	struct Closure final {
 		ThreadBlocker blocker;
-		Worklet worklet;
+		Worklet futexWorklet;
+		Worklet timerWorklet;
 		FutexNode futex;
+		PrecisionTimerNode timer;
+		Futex *futexSpace;
+		bool haveTimer;
+		bool timedOut = false;
+		std::atomic<int> pending;
 	} closure;
 
-	// TODO: Support physical (i.e. non-private) futexes.
-	closure.worklet.setup([] (Worklet *base) {
-		auto closure = frg::container_of(base, &Closure::worklet);
-		Thread::unblockOther(&closure->blocker);
+	// Both worklets run on this thread's work queue, i.e., only inside of blockCurrent().
+	// Each of them drops one reference; the last one unblocks the thread.
+	closure.futexWorklet.setup([] (Worklet *base) {
+		auto closure = frg::container_of(base, &Closure::futexWorklet);
+		if(closure->haveTimer)
+			closure->timer.cancelTimer();
+		if(closure->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			Thread::unblockOther(&closure->blocker);
 	});
-	closure.futex.setup(&closure.worklet);
+	closure.timerWorklet.setup([] (Worklet *base) {
+		auto closure = frg::container_of(base, &Closure::timerWorklet);
+		if(!closure->timer.wasCancelled() && closure->futexSpace->cancelWait(&closure->futex)) {
+			// cancelWait() does not post the node's worklet; do that here.
+			closure->timedOut = true;
+			WorkQueue::post(&closure->futexWorklet);
+		}
+		if(closure->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			Thread::unblockOther(&closure->blocker);
+	});
+	closure.futex.setup(&closure.futexWorklet);
 	closure.blocker.setup();
-	space->futexSpace.submitWait(VirtualAddr(pointer), [&] () -> bool {
+	closure.futexSpace = futex;
+	closure.haveTimer = deadline >= 0;
+	closure.pending.store(closure.haveTimer ? 2 : 1, std::memory_order_relaxed);
+
+	futex->submitWait(identity, [&] () -> bool {
 		enableUserAccess();
 		auto v = __atomic_load_n(pointer, __ATOMIC_RELAXED);
 		disableUserAccess();
 		return expected == v;
 	}, &closure.futex);
 
-/*
-	frigg::infoLogger() << "thor: "
-			<< " " << this_thread->credentials()[0] << " " << this_thread->credentials()[1]
-			<< " " << this_thread->credentials()[2] << " " << this_thread->credentials()[3]
-			<< " " << this_thread->credentials()[4] << " " << this_thread->credentials()[5]
-			<< " " << this_thread->credentials()[6] << " " << this_thread->credentials()[7]
-			<< " " << this_thread->credentials()[8] << " " << this_thread->credentials()[9]
-			<< " " << this_thread->credentials()[10] << " " << this_thread->credentials()[11]
-			<< " " << this_thread->credentials()[12] << " " << this_thread->credentials()[13]
-			<< " " << this_thread->credentials()[14] << " " << this_thread->credentials()[15]
-			<< " Thread blocked on futex" << frigg::endLog;
-*/
+	// The worklets cannot run before blockCurrent(), hence it is safe to install the
+	// timer only after the node is queued.
+	if(closure.haveTimer) {
+		closure.timer.setup(deadline, &closure.timerWorklet);
+		generalTimerEngine()->installTimer(&closure.timer);
+	}
 
 	Thread::blockCurrent(&closure.blocker);
 
+	if(closure.timedOut)
+		return kHelErrTimeout;
 	return kHelErrNone;
 }
 
-HelError helFutexWake(int *pointer) {
-	auto this_thread = getCurrentThread();
-	auto space = this_thread->getAddressSpace();
+HelError helFutexWakeCount(int *pointer, int count, uint32_t flags, int *woken) {
+	if(flags & ~uint32_t(kHelFutexShared))
+		return kHelErrIllegalArgs;
 
-	{
-		// TODO: Support physical (i.e. non-private) futexes.
-		space->futexSpace.wake(VirtualAddr(pointer));
-	}
+	Futex *futex;
+	FutexIdentity identity;
+	if(auto error = resolveFutex(pointer, flags, &futex, &identity); error)
+		return error;
+
+	size_t n = futex->wake(identity, count < 0 ? SIZE_MAX : static_cast<size_t>(count));
+	*woken = n;
+	return kHelErrNone;
+}
+
+HelError helFutexRequeue(int *pointer, int *target, int expected,
+		int wake_count, int requeue_count, uint32_t flags, int *woken) {
+	if(flags & ~uint32_t(kHelFutexShared))
+		return kHelErrIllegalArgs;
+	if(wake_count < 0 || requeue_count < 0)
+		return kHelErrIllegalArgs;
+
+	Futex *futex;
+	FutexIdentity fromIdentity;
+	if(auto error = resolveFutex(pointer, flags, &futex, &fromIdentity); error)
+		return error;
+
+	Futex *targetFutex;
+	FutexIdentity toIdentity;
+	if(auto error = resolveFutex(target, flags, &targetFutex, &toIdentity); error)
+		return error;
+	assert(futex == targetFutex);
+
+	size_t n;
+	if(!futex->requeue(fromIdentity, toIdentity, wake_count, requeue_count, [&] () -> bool {
+		enableUserAccess();
+		auto v = __atomic_load_n(pointer, __ATOMIC_RELAXED);
+		disableUserAccess();
+		return expected == v;
+	}, &n))
+		return kHelErrIllegalState;
 
+	*woken = n;
 	return kHelErrNone;
 }
 
@@ -16,6 +16,83 @@ extern frigg::LazyInitializer<frg::string<KernelAlloc>> kernelCommandLine;
 
 namespace {
 
+void addCounter(managarm::kerncfg::CounterList<KernelAlloc> &list,
+		const char *name, int64_t cpu, uint64_t value) {
+	managarm::kerncfg::Counter<KernelAlloc> counter(*kernelAlloc);
+	counter.set_name(frg::string<KernelAlloc>(*kernelAlloc, name));
+	counter.set_cpu(cpu);
+	counter.set_value(value);
+	list.add_counters(std::move(counter));
+}
+
+void collectCounters(managarm::kerncfg::CounterList<KernelAlloc> &list) {
+	auto &physical = physicalAllocator->stats();
+	addCounter(list, "physical.lock-acquisitions", -1,
+			physical.lockAcquisitions.load(std::memory_order_relaxed));
+	addCounter(list, "physical.lock-contentions", -1,
+			physical.lockContentions.load(std::memory_order_relaxed));
+	addCounter(list, "physical.used-pages", -1, physicalAllocator->numUsedPages());
+	addCounter(list, "physical.free-pages", -1, physicalAllocator->numFreePages());
+
+	auto reclaim = getReclaimStats();
+	addCounter(list, "reclaim.active-pages", -1, reclaim.activePages);
+	addCounter(list, "reclaim.inactive-pages", -1, reclaim.inactivePages);
+	addCounter(list, "reclaim.low-watermark", -1, reclaim.lowWatermark);
+	addCounter(list, "reclaim.high-watermark", -1, reclaim.highWatermark);
+	addCounter(list, "reclaim.pressure-wakeups", -1, reclaim.pressureWakeups);
+	addCounter(list, "reclaim.scanned-pages", -1, reclaim.scannedPages);
+	addCounter(list, "reclaim.activated-pages", -1, reclaim.activatedPages);
+	addCounter(list, "reclaim.deactivated-pages", -1, reclaim.deactivatedPages);
+	addCounter(list, "reclaim.evicted-pages", -1, reclaim.evictedPages);
+
+	addCounter(list, "paging.huge-mapped-bytes", -1, hugeMappedMemory());
+	addCounter(list, "paging.fault-around-faults", -1,
+			faultAroundStats.faults.load(std::memory_order_relaxed));
+	addCounter(list, "paging.fault-around-pages", -1,
+			faultAroundStats.mappedPages.load(std::memory_order_relaxed));
+
+	auto &zeroPool = zeroedPagePool->stats();
+	addCounter(list, "zero-pool.pages", -1, zeroedPagePool->numPages());
+	addCounter(list, "zero-pool.hits", -1, zeroPool.hits.load(std::memory_order_relaxed));
+	addCounter(list, "zero-pool.misses", -1, zeroPool.misses.load(std::memory_order_relaxed));
+	addCounter(list, "zero-pool.hit-nanos", -1,
+			zeroPool.hitNanos.load(std::memory_order_relaxed));
+	addCounter(list, "zero-pool.miss-nanos", -1,
+			zeroPool.missNanos.load(std::memory_order_relaxed));
+	addCounter(list, "zero-pool.zeroed-pages", -1,
+			zeroPool.zeroedPages.load(std::memory_order_relaxed));
+
+	for(int i = 0; i < getCpuCount(); i++) {
+		auto &sched = getCpuData(i)->scheduler.stats();
+		addCounter(list, "sched.idle-steals", i,
+				sched.idleSteals.load(std::memory_order_relaxed));
+		addCounter(list, "sched.balance-steals", i,
+				sched.balanceSteals.load(std::memory_order_relaxed));
+		addCounter(list, "sched.migrated-away", i,
+				sched.migratedAway.load(std::memory_order_relaxed));
+		addCounter(list, "sched.pinned-rejects", i,
+				sched.pinnedRejects.load(std::memory_order_relaxed));
+		addCounter(list, "sched.idle-kicks", i,
+				sched.idleKicks.load(std::memory_order_relaxed));
+
+		auto &shootdown = getCpuData(i)->pageContext.shootdownStats;
+		addCounter(list, "tlb.targeted-ipis", i,
+				shootdown.targetedIpis.load(std::memory_order_relaxed));
+		addCounter(list, "tlb.coalesced-ipis", i,
+				shootdown.coalescedIpis.load(std::memory_order_relaxed));
+		addCounter(list, "tlb.broadcast-ipis", i,
+				shootdown.broadcastIpis.load(std::memory_order_relaxed));
+		addCounter(list, "tlb.full-flushes", i,
+				shootdown.fullFlushes.load(std::memory_order_relaxed));
+
+		auto &pageCache = getCpuData(i)->pageCache;
+		addCounter(list, "physical.cache-hits", i,
+				pageCache.hits.load(std::memory_order_relaxed));
+		addCounter(list, "physical.cache-misses", i,
+				pageCache.misses.load(std::memory_order_relaxed));
+	}
+}
+
 coroutine<Error> handleReq(LaneHandle boundLane) {
 	auto [acceptError, lane] = co_await AcceptSender{boundLane};
 	if(acceptError)
@@ -41,6 +118,27 @@ coroutine<Error> handleReq(LaneHandle boundLane) {
 		memcpy(cmdlineBuffer.data(), kernelCommandLine->data(), kernelCommandLine->size());
 		auto cmdlineError = co_await SendBufferSender{lane, std::move(cmdlineBuffer)};
 		assert(!cmdlineError && "Unexpected mbus transaction");
+	}else if(req.req_type() == managarm::kerncfg::CntReqType::GET_COUNTERS) {
+		managarm::kerncfg::CounterList<KernelAlloc> list(*kernelAlloc);
+		collectCounters(list);
+
+		frg::string<KernelAlloc> listSer(*kernelAlloc);
+		list.SerializeToString(&listSer);
+
+		managarm::kerncfg::SvrResponse<KernelAlloc> resp(*kernelAlloc);
+		resp.set_error(managarm::kerncfg::Error::SUCCESS);
+		resp.set_size(listSer.size());
+
+		frg::string<KernelAlloc> ser(*kernelAlloc);
+		resp.SerializeToString(&ser);
+		frigg::UniqueMemory<KernelAlloc> respBuffer{*kernelAlloc, ser.size()};
+		memcpy(respBuffer.data(), ser.data(), ser.size());
+		auto respError = co_await SendBufferSender{lane, std::move(respBuffer)};
+		assert(!respError && "Unexpected mbus transaction");
+		frigg::UniqueMemory<KernelAlloc> listBuffer{*kernelAlloc, listSer.size()};
+		memcpy(listBuffer.data(), listSer.data(), listSer.size());
+		auto listError = co_await SendBufferSender{lane, std::move(listBuffer)};
+		assert(!listError && "Unexpected mbus transaction");
 	}else{
 		managarm::kerncfg::SvrResponse<KernelAlloc> resp(*kernelAlloc);
 		resp.set_error(managarm::kerncfg::Error::ILLEGAL_REQUEST);
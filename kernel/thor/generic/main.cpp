@@ -15,10 +15,12 @@
 #include "../system/pci/pci.hpp"
 #include "../system/fb.hpp"
 #include <arch/x86/ept.hpp>
+#include "../arch/x86/copy.hpp"
 
 namespace thor {
 
 static constexpr bool logInitialization = false;
+static constexpr bool runCopyBenchmark = false;
 static constexpr bool logEveryPageFault = false;
 static constexpr bool logEveryIrq = false;
 static constexpr bool logPreemptionIrq = false;
@@ -43,6 +45,40 @@ extern "C" void frg_panic(const char *cstring) {
 
 frigg::LazyInitializer<frigg::Vector<KernelFiber *, KernelAlloc>> earlyFibers;
 
+// Looks up a numeric option of the form name=value on the kernel command line.
+static bool getNumericOption(const char *name, size_t *value) {
+	auto str = kernelCommandLine->data();
+	auto length = kernelCommandLine->size();
+	auto nameLength = strlen(name);
+
+	size_t i = 0;
+	while(i < length) {
+		// Find the next space-separated word.
+		while(i < length && str[i] == ' ')
+			i++;
+		auto start = i;
+		while(i < length && str[i] != ' ')
+			i++;
+
+		if(i - start <= nameLength + 1 || memcmp(str + start, name, nameLength)
+				|| str[start + nameLength] != '=')
+			continue;
+
+		size_t result = 0;
+		for(auto j = start + nameLength + 1; j < i; j++) {
+			if(str[j] < '0' || str[j] > '9') {
+				frigg::infoLogger() << "\e[31m" "thor: Ignoring malformed option "
+						<< name << "\e[39m" << frigg::endLog;
+				return false;
+			}
+			result = result * 10 + (str[j] - '0');
+		}
+		*value = result;
+		return true;
+	}
+	return false;
+}
+
 extern "C" void thorMain(PhysicalAddr info_paddr) {
 	earlyInitializeBootProcessor();
 
@@ -61,6 +97,7 @@ extern "C" void thorMain(PhysicalAddr info_paddr) {
 	frigg::infoLogger() << "Starting Thor" << frigg::endLog;
 	
 	initializeProcessorEarly();
+	selectCopyRoutines();
 
 	if(info->signature == eirSignatureValue) {
 		frigg::infoLogger() << "\e[37mthor: Bootstrap information signature matches\e[39m"
@@ -95,6 +132,16 @@ extern "C" void thorMain(PhysicalAddr info_paddr) {
 	kernelCommandLine.initialize(*kernelAlloc, reinterpret_cast<const char *>(info->commandLine));
 	earlyFibers.initialize(*kernelAlloc);
 
+	if(size_t pages; getNumericOption("thor.fault_around", &pages)) {
+		if(pages > maxFaultAroundPages) {
+			frigg::infoLogger() << "thor: Limiting thor.fault_around=" << pages
+					<< " to " << maxFaultAroundPages << frigg::endLog;
+			pages = maxFaultAroundPages;
+		}
+		frigg::infoLogger() << "thor: Fault-around window is " << pages << " pages" << frigg::endLog;
+		faultAroundPages.store(pages, std::memory_order_relaxed);
+	}
+
 	for(int i = 0; i < 64; i++)
 		globalIrqSlots[i].initialize();
 
@@ -103,6 +150,8 @@ extern "C" void thorMain(PhysicalAddr info_paddr) {
 	initializeThisProcessor();
 
 	initializeReclaim();
+	initializeZeroedPagePool();
+	initializeFutexes();
 
 	if(logInitialization)
 		frigg::infoLogger() << "thor: Bootstrap processor initialized successfully."
@@ -118,6 +167,9 @@ extern "C" void thorMain(PhysicalAddr info_paddr) {
 		// Complete the system initialization.
 		initializeExtendedSystem();
 
+		if(runCopyBenchmark)
+			benchmarkCopyRoutines();
+
 		transitionBootFb();
 
 		pci::runAllDevices();
@@ -650,6 +702,10 @@ void handleSyscall(SyscallImageAccessor image) {
 		*image.error() = helPointerPhysical((void *)arg0, &physical);
 		*image.out0() = physical;
 	} break;
+	case kHelCallPointerPhysicalRange: {
+		*image.error() = helPointerPhysicalRange((void *)arg0, (size_t)arg1,
+				(uintptr_t *)arg2);
+	} break;
 	case kHelCallLoadForeign: {
 		*image.error() = helLoadForeign((HelHandle)arg0, (uintptr_t)arg1,
 				(size_t)arg2, (void *)arg3);
@@ -766,6 +822,21 @@ void handleSyscall(SyscallImageAccessor image) {
 	case kHelCallFutexWake: {
 		*image.error() = helFutexWake((int *)arg0);
 	} break;
+	case kHelCallFutexWaitDeadline: {
+		*image.error() = helFutexWaitDeadline((int *)arg0, (int)arg1,
+				(int64_t)arg2, (uint32_t)arg3);
+	} break;
+	case kHelCallFutexWakeCount: {
+		int woken;
+		*image.error() = helFutexWakeCount((int *)arg0, (int)arg1, (uint32_t)arg2, &woken);
+		*image.out0() = woken;
+	} break;
+	case kHelCallFutexRequeue: {
+		int woken;
+		*image.error() = helFutexRequeue((int *)arg0, (int *)arg1, (int)arg2,
+				(int)arg3, (int)arg4, (uint32_t)arg5, &woken);
+		*image.out0() = woken;
+	} break;
 
 	case kHelCallCreateOneshotEvent: {
 		HelHandle handle;
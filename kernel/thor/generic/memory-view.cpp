@@ -1,8 +1,10 @@
+#include "../arch/x86/copy.hpp"
 #include "execution/coroutine.hpp"
 #include "fiber.hpp"
 #include "memory-view.hpp"
 #include "physical.hpp"
 #include "service_helpers.hpp"
+#include "timer.hpp"
 
 namespace thor {
 
@@ -12,6 +14,11 @@ namespace {
 
 	// The following flags are debugging options to debug the correctness of various components.
 	constexpr bool disableUncaching = false;
+
+	// Number of pages that the reclaimer scans (and evicts) at once.
+	constexpr size_t reclaimBatchSize = 16;
+	// Time that the reclaimer waits if it cannot make progress while memory is low.
+	constexpr uint64_t reclaimBackoff = 100'000'000;
 }
 
 // --------------------------------------------------------
@@ -20,7 +27,31 @@ namespace {
 
 extern frigg::LazyInitializer<frigg::Vector<KernelFiber *, KernelAlloc>> earlyFibers;
 
+// Pages are kept on two LRU lists. New pages enter the inactive list.
+// Pages that are referenced while they are on the inactive list are promoted to the
+// active list; pages on the active list that are not referenced anymore are demoted again.
+// Only pages from the inactive list are evicted. References are either reported by
+// bumpPage() or sampled from the accessed bits of the page tables that map the page.
+// Reclaim is driven by the number of free physical pages: the reclaimer sleeps until
+// free memory drops below the low watermark and then evicts until it is above the high one.
 struct MemoryReclaimer {
+	using PageList = frg::intrusive_list<
+		CachePage,
+		frg::locate_member<
+			CachePage,
+			frg::default_list_hook<CachePage>,
+			&CachePage::listHook
+		>
+	>;
+
+	MemoryReclaimer() {
+		auto totalPages = physicalAllocator->numUsedPages() + physicalAllocator->numFreePages();
+		_lowWatermark = totalPages / 64;
+		if(_lowWatermark < 256)
+			_lowWatermark = 256;
+		_highWatermark = 2 * _lowWatermark;
+	}
+
 	void addPage(CachePage *page) {
 		// TODO: Do we need the IRQ lock here?
 		auto irq_lock = frigg::guard(&irqMutex());
@@ -31,8 +62,9 @@ struct MemoryReclaimer {
 		page->refcount.fetch_add(1, std::memory_order_acq_rel);
 
 		assert(!(page->flags & CachePage::reclaimStateMask));
-		_lruList.push_back(page);
+		page->flags &= ~CachePage::reclaimReferenced;
 		page->flags |= CachePage::reclaimCached;
+		_linkPage(page, false);
 		_cachedSize += kPageSize;
 	}
 
@@ -41,17 +73,44 @@ struct MemoryReclaimer {
 		auto irq_lock = frigg::guard(&irqMutex());
 		auto lock = frigg::guard(&_mutex);
 
-		if((page->flags & CachePage::reclaimStateMask) == CachePage::reclaimCached) {
-			auto it = _lruList.iterator_to(page);
-			_lruList.erase(it);
-		}else {
-			assert((page->flags & CachePage::reclaimStateMask) == CachePage::reclaimUncaching);
-			page->flags &= ~CachePage::reclaimStateMask;
+		auto state = page->flags & CachePage::reclaimStateMask;
+		if(state == CachePage::reclaimCached) {
+			if(!(page->flags & CachePage::reclaimActive)
+					&& (page->flags & CachePage::reclaimReferenced)) {
+				// Second reference while on the inactive list: promote the page.
+				_unlinkPage(page);
+				page->flags &= ~CachePage::reclaimReferenced;
+				_linkPage(page, true);
+				_stats.activatedPages++;
+			}else{
+				page->flags |= CachePage::reclaimReferenced;
+			}
+		}else if(state == CachePage::reclaimIsolated) {
+			// The reclaimer takes this into account when it puts the page back.
+			page->flags |= CachePage::reclaimReferenced;
+		}else{
+			assert(state == CachePage::reclaimUncaching);
+			// The page is still needed; put it back onto the active list.
+			page->flags &= ~(CachePage::reclaimStateMask | CachePage::reclaimReferenced);
 			page->flags |= CachePage::reclaimCached;
+			_linkPage(page, true);
 			_cachedSize += kPageSize;
 		}
+	}
+
+	// Called by CacheBundle::uncachePage() if the page cannot be evicted after all.
+	// Unless removePage() was called in the meantime, the page is still owned by
+	// the reclaimer; put it back onto the active list.
+	void restorePage(CachePage *page) {
+		auto irq_lock = frigg::guard(&irqMutex());
+		auto lock = frigg::guard(&_mutex);
 
-		_lruList.push_back(page);
+		if((page->flags & CachePage::reclaimStateMask) != CachePage::reclaimUncaching)
+			return;
+		page->flags &= ~(CachePage::reclaimStateMask | CachePage::reclaimReferenced);
+		page->flags |= CachePage::reclaimCached;
+		_linkPage(page, true);
+		_cachedSize += kPageSize;
 	}
 
 	void removePage(CachePage *page) {
@@ -59,52 +118,40 @@ struct MemoryReclaimer {
 		auto irq_lock = frigg::guard(&irqMutex());
 		auto lock = frigg::guard(&_mutex);
 
-		if((page->flags & CachePage::reclaimStateMask) == CachePage::reclaimCached) {
-			auto it = _lruList.iterator_to(page);
-			_lruList.erase(it);
+		auto state = page->flags & CachePage::reclaimStateMask;
+		if(state == CachePage::reclaimCached) {
+			_unlinkPage(page);
+			_cachedSize -= kPageSize;
+		}else if(state == CachePage::reclaimIsolated) {
+			// The reclaimer notices this when it puts the page back.
 			_cachedSize -= kPageSize;
 		}else{
-			assert((page->flags & CachePage::reclaimStateMask) == CachePage::reclaimUncaching);
+			assert(state == CachePage::reclaimUncaching);
 		}
-		page->flags &= ~CachePage::reclaimStateMask;
+		page->flags &= ~(CachePage::reclaimStateMask | CachePage::reclaimActive
+				| CachePage::reclaimReferenced);
 
 		if(page->refcount.fetch_sub(1, std::memory_order_acq_rel) == 1)
 			page->bundle->retirePage(page);
 	}
 
-	KernelFiber *createReclaimFiber() {
-		auto checkReclaim = [this] () -> bool {
-			if(disableUncaching)
-				return false;
-
-			// Take a single page out of the LRU list.
-			// TODO: We have to acquire a refcount here.
-			CachePage *page;
-			{
-				auto irq_lock = frigg::guard(&irqMutex());
-				auto lock = frigg::guard(&_mutex);
-
-				if(_cachedSize <= (1 << 20))
-					return false;
-				if(_lruList.empty())
-					return false;
-
-				page = _lruList.pop_front();
-
-				// Take another reference while we do the uncaching. (removePage() could be
-				// called concurrently and release the reclaimer's reference).
-				page->refcount.fetch_add(1, std::memory_order_acq_rel);
+	ReclaimStats stats() {
+		auto irq_lock = frigg::guard(&irqMutex());
+		auto lock = frigg::guard(&_mutex);
 
-				page->flags &= ~CachePage::reclaimStateMask;
-				page->flags |= CachePage::reclaimUncaching;
-				_cachedSize -= kPageSize;
-			}
+		auto stats = _stats;
+		stats.activePages = _numActive;
+		stats.inactivePages = _numInactive;
+		stats.lowWatermark = _lowWatermark;
+		stats.highWatermark = _highWatermark;
+		return stats;
+	}
 
-			// Evict the page and wait until it is evicted.
+	KernelFiber *createReclaimFiber() {
+		return KernelFiber::post([=] {
 			struct Closure {
 				FiberBlocker blocker;
 				Worklet worklet;
-				ReclaimNode node;
 			} closure;
 
 			closure.worklet.setup([] (Worklet *base) {
@@ -112,46 +159,232 @@ struct MemoryReclaimer {
 				KernelFiber::unblockOther(&closure->blocker);
 			});
 
-			closure.blocker.setup();
-			closure.node.setup(&closure.worklet);
-			if(!page->bundle->uncachePage(page, &closure.node))
+			while(true) {
+				// Wait until the physical allocator runs low on memory.
+				closure.blocker.setup();
+				physicalAllocator->notifyOnPressure(&closure.worklet, _lowWatermark);
 				KernelFiber::blockCurrent(&closure.blocker);
 
-			if(page->refcount.fetch_sub(1, std::memory_order_acq_rel) == 1)
-				page->bundle->retirePage(page);
-
-			return true;
-		};
-
-		return KernelFiber::post([=] {
-			while(true) {
-				if(logUncaching) {
+				// Scan each page at most twice per wakeup. This is enough to demote
+				// and evict all pages that are not referenced anymore.
+				size_t budget;
+				{
 					auto irq_lock = frigg::guard(&irqMutex());
 					auto lock = frigg::guard(&_mutex);
-					frigg::infoLogger() << "thor: " << (_cachedSize / 1024)
-							<< " KiB of cached pages" << frigg::endLog;
+
+					_stats.pressureWakeups++;
+					budget = 2 * (_numActive + _numInactive);
+
+					if(logUncaching)
+						frigg::infoLogger() << "thor: " << (_cachedSize / 1024)
+								<< " KiB of cached pages, " << physicalAllocator->numFreePages()
+								<< " free pages" << frigg::endLog;
+				}
+
+				while(budget && physicalAllocator->numFreePages() < _highWatermark) {
+					auto scanned = _reclaimBatch();
+					if(!scanned)
+						break;
+					budget -= (scanned < budget) ? scanned : budget;
 				}
 
-				while(checkReclaim())
-					;
-				fiberSleep(1'000'000'000);
+				// Avoid spinning if there is nothing left that we could evict.
+				if(physicalAllocator->numFreePages() < _lowWatermark)
+					fiberSleep(reclaimBackoff);
 			}
 		});
 	}
 
 private:
+	// Scans one batch of pages and evicts the pages that were not referenced.
+	// Returns the number of scanned pages.
+	size_t _reclaimBatch() {
+		if(disableUncaching)
+			return 0;
+
+		// Keep the inactive list at least as large as the active list, such that
+		// pages have a chance to be referenced again before they are evicted.
+		bool fromActive;
+		{
+			auto irq_lock = frigg::guard(&irqMutex());
+			auto lock = frigg::guard(&_mutex);
+
+			fromActive = _numActive > _numInactive;
+		}
+
+		CachePage *pages[reclaimBatchSize];
+		bool accessed[reclaimBatchSize];
+		CachePage *victims[reclaimBatchSize];
+		size_t numPages;
+		size_t numVictims = 0;
+
+		{
+			auto irq_lock = frigg::guard(&irqMutex());
+			auto lock = frigg::guard(&_mutex);
+
+			numPages = _isolatePages(fromActive, pages);
+		}
+		if(!numPages)
+			return 0;
+
+		// Sample the accessed bits outside of our lock (this takes the page table locks).
+		for(size_t i = 0; i < numPages; i++)
+			accessed[i] = pages[i]->bundle->testAndClearAccessed(pages[i]);
+
+		{
+			auto irq_lock = frigg::guard(&irqMutex());
+			auto lock = frigg::guard(&_mutex);
+
+			for(size_t i = 0; i < numPages; i++) {
+				auto page = pages[i];
+
+				// removePage() was called while the page was isolated.
+				if((page->flags & CachePage::reclaimStateMask) != CachePage::reclaimIsolated)
+					continue;
+
+				bool referenced = accessed[i] || (page->flags & CachePage::reclaimReferenced);
+				page->flags &= ~(CachePage::reclaimStateMask | CachePage::reclaimReferenced);
+
+				if(referenced) {
+					// Rotate (or promote) referenced pages to the tail of the active list.
+					page->flags |= CachePage::reclaimCached;
+					_linkPage(page, true);
+					if(!fromActive)
+						_stats.activatedPages++;
+				}else if(fromActive) {
+					page->flags |= CachePage::reclaimCached;
+					_linkPage(page, false);
+					_stats.deactivatedPages++;
+				}else{
+					// Keep our reference while we do the uncaching. (removePage() could be
+					// called concurrently and release the reclaimer's reference).
+					page->flags |= CachePage::reclaimUncaching;
+					_cachedSize -= kPageSize;
+					victims[numVictims++] = page;
+					pages[i] = nullptr;
+				}
+			}
+		}
+
+		for(size_t i = 0; i < numPages; i++) {
+			auto page = pages[i];
+			if(!page)
+				continue;
+			if(page->refcount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				page->bundle->retirePage(page);
+		}
+
+		if(numVictims)
+			_evictPages(victims, numVictims);
+		return numPages;
+	}
+
+	// Starts uncaching all pages and waits until they are evicted.
+	// Drops the references that were taken by _isolatePages().
+	void _evictPages(CachePage **pages, size_t numPages) {
+		struct Closure;
+
+		struct Slot {
+			Closure *closure;
+			Worklet worklet;
+			ReclaimNode node;
+		};
+
+		struct Closure {
+			FiberBlocker blocker;
+			size_t pending;
+			Slot slots[reclaimBatchSize];
+		} closure;
+
+		// The worklets run on this fiber, hence pending does not need to be atomic.
+		closure.blocker.setup();
+		closure.pending = numPages;
+		for(size_t i = 0; i < numPages; i++) {
+			auto slot = &closure.slots[i];
+			slot->closure = &closure;
+			slot->worklet.setup([] (Worklet *base) {
+				auto slot = frg::container_of(base, &Slot::worklet);
+				assert(slot->closure->pending);
+				if(!--slot->closure->pending)
+					KernelFiber::unblockOther(&slot->closure->blocker);
+			});
+			slot->node.setup(&slot->worklet);
+			if(pages[i]->bundle->uncachePage(pages[i], &slot->node))
+				closure.pending--;
+		}
+		if(closure.pending)
+			KernelFiber::blockCurrent(&closure.blocker);
+
+		for(size_t i = 0; i < numPages; i++) {
+			if(pages[i]->refcount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				pages[i]->bundle->retirePage(pages[i]);
+		}
+
+		auto irq_lock = frigg::guard(&irqMutex());
+		auto lock = frigg::guard(&_mutex);
+		_stats.evictedPages += numPages;
+	}
+
+	// Takes up to reclaimBatchSize pages from the head of an LRU list.
+	// Each isolated page holds an additional reference. Requires _mutex.
+	size_t _isolatePages(bool fromActive, CachePage **pages) {
+		auto list = fromActive ? &_activeList : &_inactiveList;
+		size_t n = 0;
+		while(n < reclaimBatchSize && !list->empty()) {
+			auto page = list->pop_front();
+			if(fromActive) {
+				_numActive--;
+			}else{
+				_numInactive--;
+			}
+
+			page->refcount.fetch_add(1, std::memory_order_acq_rel);
+			assert((page->flags & CachePage::reclaimStateMask) == CachePage::reclaimCached);
+			page->flags &= ~(CachePage::reclaimStateMask | CachePage::reclaimActive);
+			page->flags |= CachePage::reclaimIsolated;
+			pages[n++] = page;
+		}
+		_stats.scannedPages += n;
+		return n;
+	}
+
+	// Requires _mutex.
+	void _linkPage(CachePage *page, bool active) {
+		if(active) {
+			page->flags |= CachePage::reclaimActive;
+			_activeList.push_back(page);
+			_numActive++;
+		}else{
+			page->flags &= ~CachePage::reclaimActive;
+			_inactiveList.push_back(page);
+			_numInactive++;
+		}
+	}
+
+	// Requires _mutex.
+	void _unlinkPage(CachePage *page) {
+		if(page->flags & CachePage::reclaimActive) {
+			_activeList.erase(_activeList.iterator_to(page));
+			_numActive--;
+		}else{
+			_inactiveList.erase(_inactiveList.iterator_to(page));
+			_numInactive--;
+		}
+	}
+
 	frigg::TicketLock _mutex;
 
-	frg::intrusive_list<
-		CachePage,
-		frg::locate_member<
-			CachePage,
-			frg::default_list_hook<CachePage>,
-			&CachePage::listHook
-		>
-	> _lruList;
+	PageList _activeList;
+	PageList _inactiveList;
+	size_t _numActive = 0;
+	size_t _numInactive = 0;
 
 	size_t _cachedSize = 0;
+
+	size_t _lowWatermark;
+	size_t _highWatermark;
+
+	ReclaimStats _stats{};
 };
 
 frigg::LazyInitializer<MemoryReclaimer> globalReclaimer;
@@ -161,6 +394,10 @@ void initializeReclaim() {
 	earlyFibers->push(globalReclaimer->createReclaimFiber());
 }
 
+ReclaimStats getReclaimStats() {
+	return globalReclaimer->stats();
+}
+
 // --------------------------------------------------------
 // MemoryView.
 // --------------------------------------------------------
@@ -186,6 +423,8 @@ void MemoryView::asyncLockRange(uintptr_t offset, size_t size,
 	receiver.set_done(lockRange(offset, size));
 }
 
+std::atomic<uint64_t> MemoryView::_nextId{1};
+
 Error MemoryView::updateRange(ManageRequest type, size_t offset, size_t length) {
 	return kErrIllegalObject;
 }
@@ -267,7 +506,7 @@ bool transferBetweenViews(TransferNode *node) {
 
 			PageAccessor dest_accessor{dest_page};
 			PageAccessor src_accessor{src_page};
-			memcpy((uint8_t *)dest_accessor.get() + dest_misalign,
+			copyMemory((uint8_t *)dest_accessor.get() + dest_misalign,
 					(uint8_t *)src_accessor.get() + src_misalign, chunk);
 
 			node->_progress += chunk;
@@ -319,7 +558,7 @@ bool copyToBundle(MemoryView *view, ptrdiff_t offset, const void *pointer, size_
 		assert(page != PhysicalAddr(-1));
 
 		PageAccessor accessor{page};
-		memcpy((uint8_t *)accessor.get() + misalign, pointer, prefix);
+		copyMemory((uint8_t *)accessor.get() + misalign, pointer, prefix);
 		progress += prefix;
 	}
 
@@ -336,7 +575,7 @@ bool copyToBundle(MemoryView *view, ptrdiff_t offset, const void *pointer, size_
 		assert(page != PhysicalAddr(-1));
 
 		PageAccessor accessor{page};
-		memcpy(accessor.get(), (uint8_t *)pointer + progress, kPageSize);
+		copyMemory(accessor.get(), (uint8_t *)pointer + progress, kPageSize);
 		progress += kPageSize;
 	}
 
@@ -353,7 +592,7 @@ bool copyToBundle(MemoryView *view, ptrdiff_t offset, const void *pointer, size_
 		assert(page != PhysicalAddr(-1));
 
 		PageAccessor accessor{page};
-		memcpy(accessor.get(), (uint8_t *)pointer + progress, size - progress);
+		copyMemory(accessor.get(), (uint8_t *)pointer + progress, size - progress);
 	}
 
 	view->unlockRange(offset, size);
@@ -404,7 +643,7 @@ bool copyFromBundle(MemoryView *view, ptrdiff_t offset, void *buffer, size_t siz
 			auto physical = node->_fetch.range().get<0>();
 			assert(physical != PhysicalAddr(-1));
 			PageAccessor accessor{physical};
-			memcpy(reinterpret_cast<uint8_t *>(node->_buffer) + node->_progress,
+			copyMemory(reinterpret_cast<uint8_t *>(node->_buffer) + node->_progress,
 					reinterpret_cast<uint8_t *>(accessor.get()) + misalign, chunk);
 			node->_progress += chunk;
 		}
@@ -470,6 +709,10 @@ void HardwareMemory::markDirty(uintptr_t, size_t) {
 	// We never evict memory, there is no need to track dirty pages.
 }
 
+bool HardwareMemory::canMapHugePages() {
+	return _length >= kHugePageSize;
+}
+
 size_t HardwareMemory::getLength() {
 	return _length;
 }
@@ -479,9 +722,10 @@ size_t HardwareMemory::getLength() {
 // --------------------------------------------------------
 
 AllocatedMemory::AllocatedMemory(size_t desiredLngth,
-		int addressBits, size_t desiredChunkSize, size_t chunkAlign)
+		int addressBits, size_t desiredChunkSize, size_t chunkAlign, bool hugePages)
 : _physicalChunks{*kernelAlloc},
-		_addressBits{addressBits}, _chunkAlign{chunkAlign} {
+		_addressBits{addressBits}, _chunkAlign{chunkAlign},
+		_hugePages{hugePages}, _hugeRegions{*kernelAlloc} {
 	static_assert(sizeof(unsigned long) == sizeof(uint64_t), "Fix use of __builtin_clzl");
 	_chunkSize = size_t(1) << (64 - __builtin_clzl(desiredChunkSize - 1));
 	if(_chunkSize != desiredChunkSize)
@@ -497,7 +741,10 @@ AllocatedMemory::AllocatedMemory(size_t desiredLngth,
 	assert(_chunkSize % kPageSize == 0);
 	assert(_chunkAlign % kPageSize == 0);
 	assert(_chunkSize % _chunkAlign == 0);
+	assert(!_hugePages || _chunkSize == kPageSize);
 	_physicalChunks.resize(length / _chunkSize, PhysicalAddr(-1));
+	if(_hugePages)
+		_hugeRegions.resize((length + (kHugePageSize - 1)) / kHugePageSize, false);
 }
 
 AllocatedMemory::~AllocatedMemory() {
@@ -506,7 +753,14 @@ AllocatedMemory::~AllocatedMemory() {
 	if(logUsage)
 		frigg::infoLogger() << "thor: Releasing AllocatedMemory ("
 				<< (physicalAllocator->numUsedPages() * 4) << " KiB in use)" << frigg::endLog;
+	size_t pagesPerHuge = kHugePageSize / kPageSize;
 	for(size_t i = 0; i < _physicalChunks.size(); ++i) {
+		if(_hugePages && _hugeRegions[i / pagesPerHuge]) {
+			assert(!(i % pagesPerHuge));
+			physicalAllocator->free(_physicalChunks[i], kHugePageSize);
+			i += pagesPerHuge - 1;
+			continue;
+		}
 		if(_physicalChunks[i] != PhysicalAddr(-1))
 			physicalAllocator->free(_physicalChunks[i], _chunkSize);
 	}
@@ -519,10 +773,13 @@ void AllocatedMemory::resize(size_t newLength) {
 	auto irq_lock = frigg::guard(&irqMutex());
 	auto lock = frigg::guard(&_mutex);
 
-	assert(!(newLength % _chunkSize));
-	size_t num_chunks = newLength / _chunkSize;
+	// Like the constructor, round up to the chunk size.
+	size_t num_chunks = (newLength + (_chunkSize - 1)) / _chunkSize;
 	assert(num_chunks >= _physicalChunks.size());
 	_physicalChunks.resize(num_chunks, PhysicalAddr(-1));
+	if(_hugePages)
+		_hugeRegions.resize((num_chunks * _chunkSize + (kHugePageSize - 1)) / kHugePageSize,
+				false);
 }
 
 void AllocatedMemory::copyKernelToThisSync(ptrdiff_t offset, void *pointer, size_t size) {
@@ -542,13 +799,13 @@ void AllocatedMemory::copyKernelToThisSync(ptrdiff_t offset, void *pointer, size
 
 		for(size_t pg_progress = 0; pg_progress < _chunkSize; pg_progress += kPageSize) {
 			PageAccessor accessor{physical + pg_progress};
-			memset(accessor.get(), 0, kPageSize);
+			zeroPage(accessor.get());
 		}
 		_physicalChunks[index] = physical;
 	}
 
 	PageAccessor accessor{_physicalChunks[index]
-			+ ((offset % _chunkSize) / kPageSize)};
+			+ ((offset % _chunkSize) & ~(kPageSize - 1))};
 	memcpy((uint8_t *)accessor.get() + (offset % kPageSize), pointer, size);
 }
 
@@ -585,7 +842,62 @@ frg::tuple<PhysicalAddr, CachingMode> AllocatedMemory::peekRange(uintptr_t offse
 			CachingMode::null};
 }
 
+void AllocatedMemory::_populateHugeRegion(uintptr_t offset) {
+	size_t pagesPerHuge = kHugePageSize / kPageSize;
+	auto region = offset / kHugePageSize;
+	auto first = region * pagesPerHuge;
+
+	// Only regions that are completely unpopulated can be backed by a 2 MiB page.
+	auto isUnpopulated = [&] {
+		if(_hugeRegions[region] || first + pagesPerHuge > _physicalChunks.size())
+			return false;
+		for(size_t i = 0; i < pagesPerHuge; i++)
+			if(_physicalChunks[first + i] != PhysicalAddr(-1))
+				return false;
+		return true;
+	};
+
+	{
+		auto irq_lock = frigg::guard(&irqMutex());
+		auto lock = frigg::guard(&_mutex);
+
+		if(!isUnpopulated())
+			return;
+	}
+
+	// If no 2 MiB page is available (e.g. due to fragmentation), fetchRange()
+	// falls back to 4 KiB pages.
+	auto physical = physicalAllocator->allocate(kHugePageSize, _addressBits);
+	if(physical == PhysicalAddr(-1))
+		return;
+	assert(!(physical & (kHugePageSize - 1)));
+
+	// Zeroing 2 MiB takes a while; do not do it with IRQs disabled.
+	for(size_t pg_progress = 0; pg_progress < kHugePageSize; pg_progress += kPageSize) {
+		PageAccessor accessor{physical + pg_progress};
+		zeroPage(accessor.get());
+	}
+
+	{
+		auto irq_lock = frigg::guard(&irqMutex());
+		auto lock = frigg::guard(&_mutex);
+
+		// Another fault might have populated (parts of) the region in the meantime.
+		if(isUnpopulated()) {
+			for(size_t i = 0; i < pagesPerHuge; i++)
+				_physicalChunks[first + i] = physical + i * kPageSize;
+			_hugeRegions[region] = true;
+			return;
+		}
+	}
+
+	physicalAllocator->free(physical, kHugePageSize);
+}
+
 bool AllocatedMemory::fetchRange(uintptr_t offset, FetchNode *node) {
+	if(_hugePages)
+		_populateHugeRegion(offset);
+
 	auto irq_lock = frigg::guard(&irqMutex());
 	auto lock = frigg::guard(&_mutex);
 
@@ -594,18 +906,38 @@ bool AllocatedMemory::fetchRange(uintptr_t offset, FetchNode *node) {
 	assert(index < _physicalChunks.size());
 
 	if(_physicalChunks[index] == PhysicalAddr(-1)) {
-		auto physical = physicalAllocator->allocate(_chunkSize, _addressBits);
-		assert(physical != PhysicalAddr(-1) && "OOM");
-		assert(!(physical & (_chunkAlign - 1)));
+		auto start = systemClockSource()->currentNanos();
 
-		for(size_t pg_progress = 0; pg_progress < _chunkSize; pg_progress += kPageSize) {
-			PageAccessor accessor{physical + pg_progress};
-			memset(accessor.get(), 0, kPageSize);
+		// Single pages can be taken from the pool of pre-zeroed pages.
+		auto physical = PhysicalAddr(-1);
+		if(_chunkSize == kPageSize && _addressBits >= 64)
+			physical = zeroedPagePool->allocate();
+		bool poolHit = physical != PhysicalAddr(-1);
+
+		if(!poolHit) {
+			physical = physicalAllocator->allocate(_chunkSize, _addressBits);
+			assert(physical != PhysicalAddr(-1) && "OOM");
+
+			for(size_t pg_progress = 0; pg_progress < _chunkSize; pg_progress += kPageSize) {
+				PageAccessor accessor{physical + pg_progress};
+				zeroPage(accessor.get());
+			}
 		}
+		assert(!(physical & (_chunkAlign - 1)));
 		_physicalChunks[index] = physical;
+
+		if(_chunkSize == kPageSize)
+			zeroedPagePool->accountLatency(poolHit,
+					systemClockSource()->currentNanos() - start);
 	}
 
 	assert(_physicalChunks[index] != PhysicalAddr(-1));
+	if(_hugePages && _hugeRegions[offset / kHugePageSize]) {
+		auto hugeDisp = offset & (kHugePageSize - 1);
+		completeFetch(node, kErrSuccess, _physicalChunks[index] + disp,
+				kHugePageSize - hugeDisp, CachingMode::null);
+		return true;
+	}
 	completeFetch(node, kErrSuccess,
 			_physicalChunks[index] + disp, _chunkSize - disp, CachingMode::null);
 	return true;
@@ -615,6 +947,10 @@ void AllocatedMemory::markDirty(uintptr_t offset, size_t size) {
 	// Do nothing for now.
 }
 
+bool AllocatedMemory::canMapHugePages() {
+	return _hugePages || _chunkSize >= kHugePageSize;
+}
+
 size_t AllocatedMemory::getLength() {
 	auto irq_lock = frigg::guard(&irqMutex());
 	auto lock = frigg::guard(&_mutex);
@@ -646,7 +982,12 @@ bool ManagedSpace::uncachePage(CachePage *page, ReclaimNode *continuation) {
 	size_t index = page->identity;
 	auto pit = pages.find(index);
 	assert(pit);
-	assert(pit->loadState == kStatePresent);
+	// The reclaimer evicts pages in batches; the page might have been locked
+	// or dirtied since it was selected for eviction.
+	if(pit->loadState != kStatePresent || pit->lockCount) {
+		globalReclaimer->restorePage(&pit->cachePage);
+		return true;
+	}
 	pit->loadState = kStateEvicting;
 	globalReclaimer->removePage(&pit->cachePage);
 
@@ -678,6 +1019,10 @@ void ManagedSpace::retirePage(CachePage *page) {
 	//       destructed until all CachePages are retired).
 }
 
+bool ManagedSpace::testAndClearAccessed(CachePage *page) {
+	return _evictQueue.testAccessed(page->identity << kPageShift, kPageSize);
+}
+
 // Note: Neither offset nor size are necessarily multiples of the page size.
 Error ManagedSpace::lockPages(uintptr_t offset, size_t size) {
 	auto irq_lock = frigg::guard(&irqMutex());
@@ -898,7 +1243,7 @@ bool BackingMemory::fetchRange(uintptr_t offset, FetchNode *node) {
 		assert(physical != PhysicalAddr(-1) && "OOM");
 
 		PageAccessor accessor{physical};
-		memset(accessor.get(), 0, kPageSize);
+		zeroPage(accessor.get());
 		pit->physical = physical;
 	}
 
@@ -1328,7 +1673,7 @@ void CopyOnWriteMemory::fork(execution::any_receiver<frg::tuple<Error, frigg::Sh
 			// As the page is locked anyway, we can just copy it synchronously.
 			PageAccessor lockedAccessor{osIt->physical};
 			PageAccessor copyAccessor{copyPhysical};
-			memcpy(copyAccessor.get(), lockedAccessor.get(), kPageSize);
+			copyPage(copyAccessor.get(), lockedAccessor.get());
 
 			// Update the chains.
 			auto fsIt = forked->_ownedPages.insert(pg >> kPageShift);
@@ -1418,7 +1763,7 @@ void CopyOnWriteMemory::asyncLockRange(uintptr_t offset, size_t size,
 					auto srcPhysical = it->load(std::memory_order_relaxed);
 					assert(srcPhysical != PhysicalAddr(-1));
 					auto srcAccessor = PageAccessor{srcPhysical};
-					memcpy(accessor.get(), srcAccessor.get(), kPageSize);
+					copyPage(accessor.get(), srcAccessor.get());
 					break;
 				}
 
@@ -1519,7 +1864,7 @@ bool CopyOnWriteMemory::fetchRange(uintptr_t offset, FetchNode *node) {
 				auto srcPhysical = it->load(std::memory_order_relaxed);
 				assert(srcPhysical != PhysicalAddr(-1));
 				auto srcAccessor = PageAccessor{srcPhysical};
-				memcpy(accessor.get(), srcAccessor.get(), kPageSize);
+				copyPage(accessor.get(), srcAccessor.get());
 				break;
 			}
 
@@ -43,6 +43,12 @@ struct CacheBundle {
 
 	// Called once the reference count of a CachePage reaches zero.
 	virtual void retirePage(CachePage *page) = 0;
+
+	// Returns true if the page was accessed through a mapping since the last call.
+	virtual bool testAndClearAccessed(CachePage *page) {
+		(void)page;
+		return false;
+	}
 };
 
 struct CachePage {
@@ -51,6 +57,13 @@ struct CachePage {
 	static constexpr uint32_t reclaimCached    = 0x01;
 	// Page is currently being evicted (not in LRU list).
 	static constexpr uint32_t reclaimUncaching  = 0x02;
+	// Page is temporarily taken off the LRU lists while the reclaimer scans it.
+	static constexpr uint32_t reclaimIsolated  = 0x03;
+
+	// Page is on the active (instead of the inactive) LRU list.
+	static constexpr uint32_t reclaimActive = 0x04;
+	// Page was accessed through fetchRange() since it was last scanned.
+	static constexpr uint32_t reclaimReferenced = 0x08;
 
 	// CacheBundle that owns this page.
 	CacheBundle *bundle = nullptr;
@@ -214,6 +227,14 @@ struct MemoryObserver {
 	//              Thus, observeEviction() should increment/decrement the RC itself.
 	virtual bool observeEviction(uintptr_t offset, size_t length, EvictNode *node) = 0;
 
+	// Called by the reclaimer to age pages. Returns true if any page in the range
+	// was accessed since the last call; clears the accessed state.
+	virtual bool observeAccess(uintptr_t offset, size_t length) {
+		(void)offset;
+		(void)length;
+		return false;
+	}
+
 	frg::default_list_hook<MemoryObserver> listHook;
 };
 
@@ -237,6 +258,18 @@ struct EvictionQueue {
 		observer.ctr()->decrement();
 	}
 
+	bool testAccessed(uintptr_t offset, size_t size) {
+		auto irqLock = frigg::guard(&irqMutex());
+		auto lock = frigg::guard(&mutex_);
+
+		// Ask all observers such that all accessed bits are cleared.
+		bool accessed = false;
+		for(auto observer : observers_)
+			if(observer->observeAccess(offset, size))
+				accessed = true;
+		return accessed;
+	}
+
 	// ----------------------------------------------------------------------------------
 	// Sender-based implementation of evictRange()
 	// ----------------------------------------------------------------------------------
@@ -328,6 +361,15 @@ private:
 
 // View on some pages of memory. This is the "frontend" part of a memory object.
 struct MemoryView {
+	MemoryView()
+	: _id{_nextId.fetch_add(1, std::memory_order_relaxed)} { }
+
+	// Unique ID of this view. IDs are never reused, even after the view is destroyed;
+	// hence, they (unlike the view's address) can key shared futexes.
+	uint64_t id() const {
+		return _id;
+	}
+
 protected:
 	static void completeFetch(FetchNode *node, Error error) {
 		node->_error = error;
@@ -376,6 +418,12 @@ public:
 	// Marks a range of pages as dirty.
 	virtual void markDirty(uintptr_t offset, size_t size) = 0;
 
+	// Returns true if fetchRange() can return physically contiguous ranges
+	// that are large enough to be mapped by huge pages.
+	virtual bool canMapHugePages() {
+		return false;
+	}
+
 	virtual void submitManage(ManageNode *handle);
 
 	// TODO: InitiateLoad does more or less the same as fetchRange(). Remove it.
@@ -487,6 +535,11 @@ public:
 	}
 
 	// ----------------------------------------------------------------------------------
+
+private:
+	static std::atomic<uint64_t> _nextId;
+
+	uint64_t _id;
 };
 
 struct SliceRange {
@@ -641,6 +694,7 @@ struct HardwareMemory final : MemoryView {
 	frg::tuple<PhysicalAddr, CachingMode> peekRange(uintptr_t offset) override;
 	bool fetchRange(uintptr_t offset, FetchNode *node) override;
 	void markDirty(uintptr_t offset, size_t size) override;
+	bool canMapHugePages() override;
 
 private:
 	PhysicalAddr _base;
@@ -649,8 +703,11 @@ private:
 };
 
 struct AllocatedMemory final : MemoryView {
+	// If hugePages is true, chunks must be 4 KiB; aligned 2 MiB regions of the view are then
+	// backed by single 2 MiB pages if such pages are available on the first fault.
 	AllocatedMemory(size_t length, int addressBits = 64,
-			size_t chunkSize = kPageSize, size_t chunkAlign = kPageSize);
+			size_t chunkSize = kPageSize, size_t chunkAlign = kPageSize,
+			bool hugePages = false);
 	AllocatedMemory(const AllocatedMemory &) = delete;
 	~AllocatedMemory();
 
@@ -667,13 +724,21 @@ struct AllocatedMemory final : MemoryView {
 	frg::tuple<PhysicalAddr, CachingMode> peekRange(uintptr_t offset) override;
 	bool fetchRange(uintptr_t offset, FetchNode *node) override;
 	void markDirty(uintptr_t offset, size_t size) override;
+	bool canMapHugePages() override;
 
 private:
+	// Tries to back the 2 MiB region that contains offset by a single 2 MiB page.
+	void _populateHugeRegion(uintptr_t offset);
+
 	frigg::TicketLock _mutex;
 
 	frg::vector<PhysicalAddr, KernelAlloc> _physicalChunks;
 	int _addressBits;
 	size_t _chunkSize, _chunkAlign;
+
+	bool _hugePages;
+	// Whether each 2 MiB region is backed by a 2 MiB page (only used if _hugePages is true).
+	frg::vector<bool, KernelAlloc> _hugeRegions;
 };
 
 struct ManagedSpace : CacheBundle {
@@ -711,6 +776,8 @@ struct ManagedSpace : CacheBundle {
 
 	void retirePage(CachePage *page) override;
 
+	bool testAndClearAccessed(CachePage *page) override;
+
 	Error lockPages(uintptr_t offset, size_t size);
 	void unlockPages(uintptr_t offset, size_t size);
 
@@ -1,7 +1,12 @@
 #include "kernel.hpp"
+#include "fiber.hpp"
+#include "work-queue.hpp"
+#include "../arch/x86/copy.hpp"
 
 namespace thor {
 
+extern frigg::LazyInitializer<frigg::Vector<KernelFiber *, KernelAlloc>> earlyFibers;
+
 static bool logPhysicalAllocs = false;
 
 // --------------------------------------------------------
@@ -32,16 +37,26 @@ PhysicalChunkAllocator::PhysicalChunkAllocator() {
 
 void PhysicalChunkAllocator::bootstrapRegion(PhysicalAddr address,
 		int order, size_t numRoots, int8_t *buddyTree) {
-	if(_numRegions >= 8) {
-		frigg::infoLogger() << "thor: Ignoring memory region (can only handle 8 regions)"
-				<< frigg::endLog;
-		return;
+	if(_lastTable->numRegions == RegionTable::capacity) {
+		// Allocate a new table from the regions that we already know about.
+		auto table_physical = _allocateFromRegions(0, 64);
+		if(table_physical == static_cast<PhysicalAddr>(-1)) {
+			frigg::infoLogger() << "thor: Ignoring memory region"
+					" (no memory for the region table)" << frigg::endLog;
+			return;
+		}
+		_freePages -= 1;
+		_usedPages += 1;
+
+		auto table = new (SkeletalRegion::global().access(table_physical)) RegionTable;
+		_lastTable->next = table;
+		_lastTable = table;
 	}
 
-	int n = _numRegions++;
-	_allRegions[n].physicalBase = address;
-	_allRegions[n].regionSize = numRoots << (order + kPageShift);
-	_allRegions[n].buddyAccessor = BuddyAccessor{address, kPageShift,
+	auto region = &_lastTable->regions[_lastTable->numRegions++];
+	region->physicalBase = address;
+	region->regionSize = numRoots << (order + kPageShift);
+	region->buddyAccessor = BuddyAccessor{address, kPageShift,
 			buddyTree, numRoots, order};
 
 	_freePages += numRoots << order;
@@ -49,11 +64,6 @@ void PhysicalChunkAllocator::bootstrapRegion(PhysicalAddr address,
 
 PhysicalAddr PhysicalChunkAllocator::allocate(size_t size, int addressBits) {
 	auto irq_lock = frigg::guard(&irqMutex());
-	auto lock = frigg::guard(&_mutex);
-
-	assert(_freePages > size / kPageSize);
-	_freePages -= size / kPageSize;
-	_usedPages += size / kPageSize;
 
 	// TODO: This could be solved better.
 	int target = 0;
@@ -64,57 +74,250 @@ PhysicalAddr PhysicalChunkAllocator::allocate(size_t size, int addressBits) {
 	if(logPhysicalAllocs)
 		frigg::infoLogger() << "thor: Allocating physical memory of order "
 					<< (target + kPageShift) << frigg::endLog;
-	for(int i = 0; i < _numRegions; i++) {
-		if(target > _allRegions[i].buddyAccessor.tableOrder())
-			continue;
-
-		auto physical = _allRegions[i].buddyAccessor.allocate(target, addressBits);
-		if(physical == BuddyAccessor::illegalAddress)
-			continue;
-	//	frigg::infoLogger() << "Allocate " << (void *)physical << frigg::endLog;
-		assert(!(physical % (size_t(kPageSize) << target)));
-		return physical;
+
+	PhysicalAddr physical;
+	if(!target && addressBits >= 64) {
+		// Serve single pages from the per-CPU cache.
+		auto cache = &getCpuData()->pageCache;
+		if(!cache->_numPages) {
+			cache->misses.fetch_add(1, std::memory_order_relaxed);
+			_lock();
+			while(cache->_numPages < PhysicalPageCache::batchSize) {
+				auto refill = _allocateFromRegions(0, 64);
+				if(refill == static_cast<PhysicalAddr>(-1))
+					break;
+				cache->_pages[cache->_numPages++] = refill;
+			}
+			_unlock();
+		}else{
+			cache->hits.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		if(!cache->_numPages)
+			return static_cast<PhysicalAddr>(-1);
+		physical = cache->_pages[--cache->_numPages];
+	}else{
+		_lock();
+		physical = _allocateFromRegions(target, addressBits);
+		_unlock();
+
+		if(physical == static_cast<PhysicalAddr>(-1))
+			return physical;
 	}
 
-	return static_cast<PhysicalAddr>(-1);
+	assert(_freePages.load(std::memory_order_relaxed) >= size / kPageSize);
+	auto freePages = _freePages.fetch_sub(size / kPageSize, std::memory_order_relaxed)
+			- size / kPageSize;
+	_usedPages.fetch_add(size / kPageSize, std::memory_order_relaxed);
+
+	if(_pressureWorklet.load(std::memory_order_relaxed)
+			&& freePages < _lowWatermark.load(std::memory_order_relaxed))
+		_postPressure();
+	return physical;
 }
 
 void PhysicalChunkAllocator::free(PhysicalAddr address, size_t size) {
 	auto irq_lock = frigg::guard(&irqMutex());
-	auto lock = frigg::guard(&_mutex);
 	
 	int target = 0;
 	while(size > (size_t(kPageSize) << target))
 		target++;
 
-	for(int i = 0; i < _numRegions; i++) {
-		if(address < _allRegions[i].physicalBase)
-			continue;
-		if(address + size - _allRegions[i].physicalBase > _allRegions[i].regionSize)
-			continue;
+	assert(_usedPages.load(std::memory_order_relaxed) >= size / kPageSize);
+	_freePages.fetch_add(size / kPageSize, std::memory_order_relaxed);
+	_usedPages.fetch_sub(size / kPageSize, std::memory_order_relaxed);
 
-		_allRegions[i].buddyAccessor.free(address, target);
-		assert(_usedPages > size / kPageSize);
-		_freePages += size / kPageSize;
-		_usedPages -= size / kPageSize;
+	if(!target) {
+		// Return single pages to the per-CPU cache.
+		// If the cache is full, drain a batch back to the global allocator.
+		auto cache = &getCpuData()->pageCache;
+		if(cache->_numPages == PhysicalPageCache::capacity) {
+			cache->misses.fetch_add(1, std::memory_order_relaxed);
+			_lock();
+			while(cache->_numPages > PhysicalPageCache::capacity - PhysicalPageCache::batchSize)
+				_freeToRegions(cache->_pages[--cache->_numPages], 0);
+			_unlock();
+		}else{
+			cache->hits.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		cache->_pages[cache->_numPages++] = address;
 		return;
 	}
 
-	assert(!"Physical page is not part of any region");
+	_lock();
+	_freeToRegions(address, target);
+	_unlock();
 }
 
 size_t PhysicalChunkAllocator::numUsedPages() {
-	auto irq_lock = frigg::guard(&irqMutex());
-	auto lock = frigg::guard(&_mutex);
-
-	return _usedPages;
+	return _usedPages.load(std::memory_order_relaxed);
 }
 size_t PhysicalChunkAllocator::numFreePages() {
+	return _freePages.load(std::memory_order_relaxed);
+}
+
+void PhysicalChunkAllocator::notifyOnPressure(Worklet *worklet, size_t lowWatermark) {
+	_lowWatermark.store(lowWatermark, std::memory_order_relaxed);
+	_pressureWorklet.store(worklet, std::memory_order_release);
+
+	// Memory might already be low; in this case, nobody else would post the worklet.
+	if(_freePages.load(std::memory_order_relaxed) < lowWatermark)
+		_postPressure();
+}
+
+void PhysicalChunkAllocator::_postPressure() {
+	// Only the CPU that takes the worklet out of the allocator posts it.
+	auto worklet = _pressureWorklet.exchange(nullptr, std::memory_order_acq_rel);
+	if(worklet)
+		WorkQueue::post(worklet);
+}
+
+PhysicalAddr PhysicalChunkAllocator::_allocateFromRegions(int target, int addressBits) {
+	for(auto table = &_firstTable; table; table = table->next) {
+		for(size_t i = 0; i < table->numRegions; i++) {
+			auto region = &table->regions[i];
+			if(target > region->buddyAccessor.tableOrder())
+				continue;
+
+			auto physical = region->buddyAccessor.allocate(target, addressBits);
+			if(physical == BuddyAccessor::illegalAddress)
+				continue;
+		//	frigg::infoLogger() << "Allocate " << (void *)physical << frigg::endLog;
+			assert(!(physical % (size_t(kPageSize) << target)));
+			return physical;
+		}
+	}
+
+	return static_cast<PhysicalAddr>(-1);
+}
+
+void PhysicalChunkAllocator::_freeToRegions(PhysicalAddr address, int target) {
+	size_t size = size_t(kPageSize) << target;
+	for(auto table = &_firstTable; table; table = table->next) {
+		for(size_t i = 0; i < table->numRegions; i++) {
+			auto region = &table->regions[i];
+			if(address < region->physicalBase)
+				continue;
+			if(address + size - region->physicalBase > region->regionSize)
+				continue;
+
+			region->buddyAccessor.free(address, target);
+			return;
+		}
+	}
+
+	assert(!"Physical page is not part of any region");
+}
+
+void PhysicalChunkAllocator::_lock() {
+	assert(!intsAreEnabled());
+	_stats.lockAcquisitions.fetch_add(1, std::memory_order_relaxed);
+	if(_lockUsers.fetch_add(1, std::memory_order_relaxed))
+		_stats.lockContentions.fetch_add(1, std::memory_order_relaxed);
+	_mutex.lock();
+}
+
+void PhysicalChunkAllocator::_unlock() {
+	_mutex.unlock();
+	_lockUsers.fetch_sub(1, std::memory_order_relaxed);
+}
+
+// --------------------------------------------------------
+// ZeroedPagePool
+// --------------------------------------------------------
+
+frigg::LazyInitializer<ZeroedPagePool> zeroedPagePool;
+
+PhysicalAddr ZeroedPagePool::allocate() {
+	PhysicalAddr physical = static_cast<PhysicalAddr>(-1);
+	size_t remaining;
+	{
+		auto irq_lock = frigg::guard(&irqMutex());
+		auto lock = frigg::guard(&_mutex);
+
+		if(_numPages)
+			physical = _pages[--_numPages];
+		remaining = _numPages;
+	}
+
+	if(physical != static_cast<PhysicalAddr>(-1)) {
+		_stats.hits.fetch_add(1, std::memory_order_relaxed);
+	}else{
+		_stats.misses.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	if(remaining < refillThreshold)
+		_postRefill();
+	return physical;
+}
+
+size_t ZeroedPagePool::numPages() {
 	auto irq_lock = frigg::guard(&irqMutex());
 	auto lock = frigg::guard(&_mutex);
+	return _numPages;
+}
 
-	return _freePages;
+void ZeroedPagePool::accountLatency(bool hit, uint64_t nanos) {
+	if(hit) {
+		_stats.hitNanos.fetch_add(nanos, std::memory_order_relaxed);
+	}else{
+		_stats.missNanos.fetch_add(nanos, std::memory_order_relaxed);
+	}
 }
 
-} // namespace thor
+KernelFiber *ZeroedPagePool::createRefillFiber() {
+	return KernelFiber::post([=] {
+		struct Closure {
+			FiberBlocker blocker;
+			Worklet worklet;
+		} closure;
+
+		closure.worklet.setup([] (Worklet *base) {
+			auto closure = frg::container_of(base, &Closure::worklet);
+			KernelFiber::unblockOther(&closure->blocker);
+		});
+
+		// Everything else (including user threads) takes precedence over zeroing.
+		Scheduler::setPriority(thisFiber(), -1);
+
+		while(true) {
+			// Wait until the pool drops below the refill threshold.
+			closure.blocker.setup();
+			_refillWorklet.store(&closure.worklet, std::memory_order_release);
+			if(numPages() < refillThreshold)
+				_postRefill();
+			KernelFiber::blockCurrent(&closure.blocker);
+
+			while(numPages() < capacity) {
+				auto physical = physicalAllocator->allocate(kPageSize);
+				if(physical == static_cast<PhysicalAddr>(-1))
+					break;
 
+				// The page is probably not accessed soon; do not pollute the cache.
+				PageAccessor accessor{physical};
+				zeroPageNonTemporal(accessor.get());
+				_stats.zeroedPages.fetch_add(1, std::memory_order_relaxed);
+
+				auto irq_lock = frigg::guard(&irqMutex());
+				auto lock = frigg::guard(&_mutex);
+				assert(_numPages < capacity);
+				_pages[_numPages++] = physical;
+			}
+		}
+	});
+}
+
+void ZeroedPagePool::_postRefill() {
+	// Only the CPU that takes the worklet out of the pool posts it.
+	auto worklet = _refillWorklet.exchange(nullptr, std::memory_order_acq_rel);
+	if(worklet)
+		WorkQueue::post(worklet);
+}
+
+void initializeZeroedPagePool() {
+	zeroedPagePool.initialize();
+	earlyFibers->push(zeroedPagePool->createRefillFiber());
+}
+
+} // namespace thor
@@ -1,10 +1,16 @@
 #pragma once
 
+#include <atomic>
+#include <frigg/atomic.hpp>
+#include <frigg/initializer.hpp>
 #include "types.hpp"
 #include <physical-buddy.hpp>
 
 namespace thor {
 
+struct Worklet;
+struct KernelFiber;
+
 struct SkeletalRegion {
 public:
 	static void initialize();
@@ -21,6 +27,40 @@ public:
 	void *access(PhysicalAddr physical);
 };
 
+// Per-CPU cache of single pages in front of the PhysicalChunkAllocator.
+// The cache is only accessed by its own CPU with IRQs disabled,
+// hence it does not require a lock.
+struct PhysicalPageCache {
+	friend class PhysicalChunkAllocator;
+
+	// Maximal number of pages in the cache.
+	static constexpr size_t capacity = 64;
+	// Number of pages that are moved from/to the global allocator at once.
+	static constexpr size_t batchSize = 32;
+
+	PhysicalPageCache() = default;
+
+	PhysicalPageCache(const PhysicalPageCache &) = delete;
+
+	PhysicalPageCache &operator= (const PhysicalPageCache &) = delete;
+
+	// Allocations and frees that were served from the cache.
+	std::atomic<uint64_t> hits{0};
+	// Allocations and frees that had to refill or drain the cache.
+	std::atomic<uint64_t> misses{0};
+
+private:
+	size_t _numPages = 0;
+	PhysicalAddr _pages[capacity];
+};
+
+struct PhysicalAllocatorStats {
+	// Number of times that the global lock was taken.
+	std::atomic<uint64_t> lockAcquisitions{0};
+	// Number of times that another CPU held or waited for the lock at that point.
+	std::atomic<uint64_t> lockContentions{0};
+};
+
 class PhysicalChunkAllocator {
 	typedef frigg::TicketLock Mutex;
 public:
@@ -35,22 +75,117 @@ public:
 	size_t numUsedPages();
 	size_t numFreePages();
 
-private:
-	Mutex _mutex;
+	// Posts the worklet once the number of free pages drops below lowWatermark.
+	// This is a one-shot notification; it has to be requested again after it fired.
+	void notifyOnPressure(Worklet *worklet, size_t lowWatermark);
 
+	const PhysicalAllocatorStats &stats() {
+		return _stats;
+	}
+
+private:
 	struct Region {
 		PhysicalAddr physicalBase;
 		PhysicalAddr regionSize;
 		BuddyAccessor buddyAccessor;
 	};
 
-	Region _allRegions[8];
-	int _numRegions = 0;
+	// Regions are stored in a linked list of page-sized tables.
+	// The first table is embedded into the allocator. Subsequent tables are
+	// allocated from the regions themselves as there is no kernel heap during bootstrap.
+	struct RegionTable {
+		static constexpr size_t tableSize = 0x1000;
+		static constexpr size_t capacity = (tableSize - sizeof(void *) - sizeof(size_t))
+				/ sizeof(Region);
+
+		RegionTable *next = nullptr;
+		size_t numRegions = 0;
+		Region regions[capacity];
+	};
+	static_assert(sizeof(RegionTable) <= RegionTable::tableSize);
+
+	// The following functions require _mutex to be held.
+	PhysicalAddr _allocateFromRegions(int target, int addressBits);
+	void _freeToRegions(PhysicalAddr address, int target);
+
+	void _lock();
+	void _unlock();
+
+	void _postPressure();
+
+	Mutex _mutex;
+	// Number of CPUs that currently hold or wait for _mutex.
+	std::atomic<unsigned int> _lockUsers{0};
+
+	RegionTable _firstTable;
+	RegionTable *_lastTable = &_firstTable;
+
+	std::atomic<size_t> _usedPages{0};
+	std::atomic<size_t> _freePages{0};
+
+	std::atomic<Worklet *> _pressureWorklet{nullptr};
+	std::atomic<size_t> _lowWatermark{0};
 
-	size_t _usedPages = 0;
-	size_t _freePages = 0;
+	PhysicalAllocatorStats _stats;
 };
 
 extern frigg::LazyInitializer<PhysicalChunkAllocator> physicalAllocator;
 
+struct ZeroedPagePoolStats {
+	// Allocations that were served from the pool and allocations that found it empty.
+	std::atomic<uint64_t> hits{0};
+	std::atomic<uint64_t> misses{0};
+	// Total time (in nanoseconds) that page faults spent to obtain a zeroed page,
+	// with and without a pool hit.
+	std::atomic<uint64_t> hitNanos{0};
+	std::atomic<uint64_t> missNanos{0};
+	// Number of pages that were zeroed by the refill fiber.
+	std::atomic<uint64_t> zeroedPages{0};
+};
+
+// Pool of pages that are zeroed in the background, such that faults on
+// anonymous memory do not need to zero pages while they hold locks.
+struct ZeroedPagePool {
+	// Maximal number of pages in the pool.
+	static constexpr size_t capacity = 512;
+	// The pool is refilled once it drops below this number of pages.
+	static constexpr size_t refillThreshold = capacity / 2;
+
+	ZeroedPagePool() = default;
+
+	ZeroedPagePool(const ZeroedPagePool &) = delete;
+
+	ZeroedPagePool &operator= (const ZeroedPagePool &) = delete;
+
+	// Returns a zeroed page or PhysicalAddr(-1) if the pool is empty.
+	PhysicalAddr allocate();
+
+	size_t numPages();
+
+	// Accounts the time that was needed to obtain a zeroed page.
+	void accountLatency(bool hit, uint64_t nanos);
+
+	// The returned fiber refills the pool when the CPU would otherwise be idle.
+	KernelFiber *createRefillFiber();
+
+	const ZeroedPagePoolStats &stats() {
+		return _stats;
+	}
+
+private:
+	void _postRefill();
+
+	frigg::TicketLock _mutex;
+	size_t _numPages = 0;
+	PhysicalAddr _pages[capacity];
+
+	std::atomic<Worklet *> _refillWorklet{nullptr};
+
+	ZeroedPagePoolStats _stats;
+};
+
+extern frigg::LazyInitializer<ZeroedPagePool> zeroedPagePool;
+
+void initializeZeroedPagePool();
+
 } // namespace thor
@@ -8,11 +8,22 @@ namespace {
 	constexpr bool logNextBest = false;
 	constexpr bool logUpdates = false;
 	constexpr bool logTimeSlice = false;
+	constexpr bool logMigrations = false;
 
 	constexpr bool disablePreemption = false;
+	constexpr bool disableLoadBalancing = false;
 
 	// Minimum length of a preemption time slice in ns.
 	constexpr int64_t sliceGranularity = 10'000'000;
+
+	// Minimal time between two periodic load balancing attempts in ns.
+	constexpr uint64_t balanceInterval = 50'000'000;
+
+	// Maximal number of pinned entities that we skip while looking for a floating one.
+	constexpr size_t maxStealScan = 4;
+
+	// Number of schedulers that currently halt their CPU.
+	std::atomic<int> globalIdleSchedulers{0};
 }
 
 int ScheduleEntity::orderPriority(const ScheduleEntity *a, const ScheduleEntity *b) {
@@ -24,8 +35,8 @@ bool ScheduleEntity::scheduleBefore(const ScheduleEntity *a, const ScheduleEntit
 			> b->baseUnfairness - b->refProgress; // Prefer greater unfairness.
 }
 
-ScheduleEntity::ScheduleEntity()
-: state{ScheduleState::null}, priority{0}, _refClock{0}, _runTime{0},
+ScheduleEntity::ScheduleEntity(ScheduleAffinity affinity)
+: state{ScheduleState::null}, affinity{affinity}, priority{0}, _refClock{0}, _runTime{0},
 		refProgress{0}, baseUnfairness{0} { }
 
 ScheduleEntity::~ScheduleEntity() {
@@ -97,6 +108,10 @@ void Scheduler::resume(ScheduleEntity *entity) {
 	}else{
 		sendPingIpi(self->_cpuContext->localApicId);
 	}
+
+	// If the entity has to wait anyway, let an idle CPU pick it up.
+	if(entity->affinity == ScheduleAffinity::floating && self->_current)
+		self->_kickIdle();
 }
 
 void Scheduler::suspendCurrent() {
@@ -151,7 +166,8 @@ void Scheduler::suspendWaiting(ScheduleEntity *entity) {
 
 Scheduler::Scheduler(CpuData *cpu_context)
 : _cpuContext{cpu_context}, _current{nullptr},
-		_numWaiting{0}, _refClock{0}, _systemProgress{0} { }
+		_numWaiting{0}, _refClock{0}, _systemProgress{0},
+		_balanceClock{0}, _idle{false}, _stealRequested{false} { }
 
 Progress Scheduler::_liveUnfairness(const ScheduleEntity *entity) {
 	assert(entity->state == ScheduleState::active);
@@ -178,11 +194,33 @@ bool Scheduler::wantSchedule() {
 	auto lock = frigg::guard(&_mutex);
 
 	_updateSystemProgress();
-	return _updatePreemption();
+	if(_updatePreemption())
+		return true;
+
+	// Another CPU asked us to steal some of its work.
+	if(!_current && _stealRequested.load(std::memory_order_relaxed))
+		return true;
+	return false;
 }
 
 void Scheduler::reschedule() {
 	assert(!intsAreEnabled());
+
+	if(_idle.load(std::memory_order_relaxed)) {
+		_idle.store(false, std::memory_order_relaxed);
+		globalIdleSchedulers.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+	if(_stealRequested.exchange(false, std::memory_order_acquire)) {
+		_trySteal(StealReason::idle);
+	}else if(!disableLoadBalancing) {
+		auto now = systemClockSource()->currentNanos();
+		if(now - _balanceClock >= balanceInterval) {
+			_balanceClock = now;
+			_trySteal(StealReason::balance);
+		}
+	}
+
 	auto lock = frigg::guard(&_mutex);
 
 	_updateSystemProgress();
@@ -193,11 +231,24 @@ void Scheduler::reschedule() {
 	_sliceClock = _refClock;
 	
 	if(_waitQueue.empty()) {
-		if(logScheduling)
-			frigg::infoLogger() << "System is idle" << frigg::endLog;
+		// Announce that we are idle before trying to steal.
+		// This ensures that we do not miss work that is offered after _trySteal() fails.
+		_idle.store(true, std::memory_order_relaxed);
+		globalIdleSchedulers.fetch_add(1, std::memory_order_relaxed);
+
 		lock.unlock();
-		suspendSelf();
-		frigg::panicLogger() << "Return from suspendSelf()" << frigg::endLog;
+		if(!_trySteal(StealReason::idle)) {
+			if(logScheduling)
+				frigg::infoLogger() << "System is idle" << frigg::endLog;
+			suspendSelf();
+			frigg::panicLogger() << "Return from suspendSelf()" << frigg::endLog;
+		}
+
+		_idle.store(false, std::memory_order_relaxed);
+		globalIdleSchedulers.fetch_sub(1, std::memory_order_relaxed);
+		lock.lock();
+		_updateSystemProgress();
+		assert(!_waitQueue.empty());
 	}
 
 	_schedule();
@@ -346,6 +397,143 @@ void Scheduler::_updateEntityStats(ScheduleEntity *entity) {
 	entity->_refClock = _refClock;
 }
 
+size_t Scheduler::_load() {
+	// This is only a hint; it is read without holding the scheduler's lock.
+	size_t n = __atomic_load_n(&_numWaiting, __ATOMIC_RELAXED);
+	if(__atomic_load_n(&_current, __ATOMIC_RELAXED))
+		n++;
+	return n;
+}
+
+// Tries to move one floating entity from the busiest scheduler to this one.
+// Must be called on the local scheduler without holding _mutex.
+bool Scheduler::_trySteal(StealReason reason) {
+	assert(!intsAreEnabled());
+	assert(this == localScheduler());
+
+	if(disableLoadBalancing)
+		return false;
+
+	Scheduler *victim = nullptr;
+	size_t victimLoad = 0;
+	for(int i = 0; i < getCpuCount(); i++) {
+		auto other = &getCpuData(i)->scheduler;
+		if(other == this)
+			continue;
+		auto load = other->_load();
+		if(load > victimLoad) {
+			victim = other;
+			victimLoad = load;
+		}
+	}
+
+	// Migrating an entity only helps if the imbalance is larger than one entity.
+	if(!victim || victimLoad < _load() + 2)
+		return false;
+
+	// Always take the scheduler locks in the same order to avoid deadlocks.
+	auto first = this;
+	auto second = victim;
+	if(uintptr_t(second) < uintptr_t(first))
+		std::swap(first, second);
+	auto first_lock = frigg::guard(&first->_mutex);
+	auto second_lock = frigg::guard(&second->_mutex);
+
+	if(!_pullFrom(victim))
+		return false;
+
+	if(reason == StealReason::idle) {
+		_stats.idleSteals.fetch_add(1, std::memory_order_relaxed);
+	}else{
+		assert(reason == StealReason::balance);
+		_stats.balanceSteals.fetch_add(1, std::memory_order_relaxed);
+	}
+	victim->_stats.migratedAway.fetch_add(1, std::memory_order_relaxed);
+
+	if(logMigrations)
+		frigg::infoLogger() << "thor: CPU " << _cpuContext->localApicId
+				<< " pulled an entity from CPU " << victim->_cpuContext->localApicId
+				<< (reason == StealReason::idle ? " (idle)" : " (balance)") << frigg::endLog;
+	return true;
+}
+
+// Both this scheduler's and the victim's lock must be held.
+bool Scheduler::_pullFrom(Scheduler *victim) {
+	if(victim->_waitQueue.empty())
+		return false;
+
+	// Pinned entities are temporarily removed from the queue and pushed back afterwards.
+	// This does not change their order as their keys are not modified.
+	ScheduleEntity *skipped[maxStealScan];
+	size_t numSkipped = 0;
+	ScheduleEntity *entity = nullptr;
+	while(!victim->_waitQueue.empty()) {
+		auto candidate = victim->_waitQueue.top();
+		if(candidate->affinity == ScheduleAffinity::floating) {
+			entity = candidate;
+			break;
+		}
+		if(numSkipped == maxStealScan)
+			break;
+		victim->_waitQueue.pop();
+		skipped[numSkipped++] = candidate;
+	}
+
+	if(!entity) {
+		for(size_t i = 0; i < numSkipped; i++)
+			victim->_waitQueue.push(skipped[i]);
+		_stats.pinnedRejects.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+	assert(entity->state == ScheduleState::active);
+	assert(entity->_scheduler == victim);
+	assert(entity == victim->_waitQueue.top());
+
+	// Accumulate the entity's unfairness relative to the victim's progress.
+	// Afterwards, its baseUnfairness is independent of the victim's progress counter.
+	victim->_updateSystemProgress();
+	if(victim->_current)
+		victim->_updateCurrentEntity();
+	victim->_updateWaitingEntity(entity);
+	victim->_waitQueue.pop();
+	victim->_numWaiting--;
+
+	for(size_t i = 0; i < numSkipped; i++)
+		victim->_waitQueue.push(skipped[i]);
+
+	// Rebase the entity onto our own progress counter, exactly as resume() does.
+	_updateSystemProgress();
+	if(_current)
+		_updateCurrentEntity();
+	entity->refProgress = _systemProgress;
+	entity->_refClock = _refClock;
+	entity->_scheduler = this;
+
+	_waitQueue.push(entity);
+	_numWaiting++;
+	return true;
+}
+
+// Asks an idle CPU to steal work from this scheduler.
+void Scheduler::_kickIdle() {
+	if(disableLoadBalancing)
+		return;
+	if(!globalIdleSchedulers.load(std::memory_order_relaxed))
+		return;
+
+	for(int i = 0; i < getCpuCount(); i++) {
+		auto other = &getCpuData(i)->scheduler;
+		if(other == this || !other->_idle.load(std::memory_order_relaxed))
+			continue;
+		// Skip CPUs that were already kicked but did not react yet.
+		if(other->_stealRequested.exchange(true, std::memory_order_release))
+			continue;
+		_stats.idleKicks.fetch_add(1, std::memory_order_relaxed);
+		sendPingIpi(other->_cpuContext->localApicId);
+		return;
+	}
+}
+
 Scheduler *localScheduler() {
 	return &getCpuData()->scheduler;
 }
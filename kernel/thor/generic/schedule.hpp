@@ -1,6 +1,7 @@
 #ifndef THOR_GENERIC_SCHEDULE_HPP
 #define THOR_GENERIC_SCHEDULE_HPP
 
+#include <atomic>
 #include <frg/list.hpp>
 #include <frg/pairing_heap.hpp>
 
@@ -14,6 +15,13 @@ enum class ScheduleState {
 	active
 };
 
+enum class ScheduleAffinity {
+	// The entity always runs on the scheduler that it was associated with.
+	pinned,
+	// The entity may be migrated to other schedulers by load balancing.
+	floating
+};
+
 // This needs to store a large timeframe.
 // For now, store it as 55.8 0 signed integer nanoseconds.
 using Progress = int64_t;
@@ -24,7 +32,7 @@ struct ScheduleEntity {
 	static int orderPriority(const ScheduleEntity *a, const ScheduleEntity *b);
 	static bool scheduleBefore(const ScheduleEntity *a, const ScheduleEntity *b);
 
-	ScheduleEntity();
+	explicit ScheduleEntity(ScheduleAffinity affinity = ScheduleAffinity::pinned);
 
 	ScheduleEntity(const ScheduleEntity &) = delete;
 
@@ -43,6 +51,7 @@ private:
 	Scheduler *_scheduler;
 
 	ScheduleState state;
+	ScheduleAffinity affinity;
 	int priority;
 	
 	frg::pairing_heap_hook<ScheduleEntity> hook;
@@ -66,6 +75,22 @@ struct ScheduleGreater {
 	}
 };
 
+// Per-CPU load balancing statistics.
+// These are only written by the owning scheduler (under its lock)
+// but they may be read concurrently by other CPUs.
+struct SchedulerStats {
+	// Entities that this scheduler pulled because it had nothing to run.
+	std::atomic<uint64_t> idleSteals{0};
+	// Entities that this scheduler pulled during periodic load balancing.
+	std::atomic<uint64_t> balanceSteals{0};
+	// Entities that other schedulers pulled away from this scheduler.
+	std::atomic<uint64_t> migratedAway{0};
+	// Steal attempts that found an overloaded scheduler with only pinned entities.
+	std::atomic<uint64_t> pinnedRejects{0};
+	// Ping IPIs that this scheduler sent to idle CPUs to trigger stealing.
+	std::atomic<uint64_t> idleKicks{0};
+};
+
 struct Scheduler {
 	static void associate(ScheduleEntity *entity, Scheduler *scheduler);
 	static void unassociate(ScheduleEntity *entity);
@@ -82,6 +107,10 @@ struct Scheduler {
 
 	Scheduler &operator= (const Scheduler &) = delete;
 
+	const SchedulerStats &stats() {
+		return _stats;
+	}
+
 private:
 	Progress _liveUnfairness(const ScheduleEntity *entity);
 	int64_t _liveRuntime(const ScheduleEntity *entity);
@@ -104,6 +133,18 @@ private:
 
 	void _updateEntityStats(ScheduleEntity *entity);
 
+private:
+	enum class StealReason {
+		idle,
+		balance
+	};
+
+	size_t _load();
+
+	bool _trySteal(StealReason reason);
+	bool _pullFrom(Scheduler *victim);
+	void _kickIdle();
+
 	CpuData *_cpuContext;
 
 	frigg::TicketLock _mutex;
@@ -132,6 +173,17 @@ private:
 	// This variables stores sum{t = 0, ... T} w(t)/n(t).
 	// This allows us to easily track u_p(T) for all waiting processes.
 	Progress _systemProgress;
+
+	// Time point of the last periodic load balancing attempt.
+	uint64_t _balanceClock;
+
+	// Set while this scheduler halts the CPU because it has nothing to run.
+	std::atomic<bool> _idle;
+
+	// Set by remote CPUs that have work that this (idle) scheduler could steal.
+	std::atomic<bool> _stealRequested;
+
+	SchedulerStats _stats;
 };
 
 Scheduler *localScheduler();
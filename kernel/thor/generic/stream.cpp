@@ -1,4 +1,5 @@
 
+#include "../arch/x86/copy.hpp"
 #include "kernel.hpp"
 
 namespace thor {
@@ -17,6 +18,34 @@ LaneHandle::~LaneHandle() {
 		_stream.control().decrement();
 }
 
+// SendFromBuffer items that are submitted from user space refer to the user's buffer
+// until they are transferred. This is only valid while we run in the context of the
+// submitting thread; hence, the buffer is copied to the kernel heap before the item
+// (or an item that it is ancillary to) is queued.
+static bool needsStaging(StreamNode *node) {
+	if(node->_inUserBuffer)
+		return true;
+	for(auto child : node->ancillaryChain)
+		if(needsStaging(child))
+			return true;
+	return false;
+}
+
+static void stageBuffers(StreamNode *node) {
+	if(node->_inUserBuffer) {
+		frigg::UniqueMemory<KernelAlloc> buffer(*kernelAlloc, node->_inUserLength);
+		enableUserAccess();
+		copyMemory(buffer.data(), node->_inUserBuffer, node->_inUserLength);
+		disableUserAccess();
+
+		node->_inBuffer = std::move(buffer);
+		node->_inUserBuffer = nullptr;
+		node->_inUserLength = 0;
+	}
+	for(auto child : node->ancillaryChain)
+		stageBuffers(child);
+}
+
 struct OfferAccept { };
 struct ImbueExtract { };
 struct SendRecvInline { };
@@ -44,6 +73,8 @@ static void transfer(ImbueExtract, StreamNode *from, StreamNode *to) {
 }
 
 static void transfer(SendRecvInline, StreamNode *from, StreamNode *to) {
+	// RecvInline needs a kernel buffer in any case.
+	stageBuffers(from);
 	auto buffer = std::move(from->_inBuffer);
 
 	if(buffer.size() <= to->_maxLength) {
@@ -63,6 +94,31 @@ static void transfer(SendRecvInline, StreamNode *from, StreamNode *to) {
 }
 
 static void transfer(SendRecvBuffer, StreamNode *from, StreamNode *to) {
+	if(from->_inUserBuffer) {
+		// Single-copy path: copy directly from the sender's address space
+		// (which is the current one) to the receiver's buffer.
+		auto length = from->_inUserLength;
+		if(length <= to->_inAccessor.length()) {
+			enableUserAccess();
+			auto error = to->_inAccessor.write(0, from->_inUserBuffer, length);
+			disableUserAccess();
+
+			from->_error = kErrSuccess;
+			from->complete();
+
+			to->_error = error;
+			to->_actualLength = error ? 0 : length;
+			to->complete();
+		}else{
+			from->_error = kErrBufferTooSmall;
+			from->complete();
+
+			to->_error = kErrBufferTooSmall;
+			to->complete();
+		}
+		return;
+	}
+
 	auto buffer = std::move(from->_inBuffer);
 
 	if(buffer.size() <= to->_inAccessor.length()) {
@@ -141,6 +197,16 @@ void Stream::Submitter::run() {
 			// If both lanes have items, we need to process them.
 			// Otherwise, we just queue the new node.
 			if(s->_processQueue[q].empty()) {
+				// Once it is queued, the item might be processed from another thread.
+				if(needsStaging(u)) {
+					lock.unlock();
+					irq_lock.unlock();
+
+					stageBuffers(u);
+					_pending.push_front(u);
+					continue;
+				}
+
 				s->_processQueue[p].push_back(u);
 				continue;
 			}
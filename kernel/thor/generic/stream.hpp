@@ -104,6 +104,11 @@ public:
 	frigg::Array<char, 16> _inCredentials;
 	size_t _maxLength;
 	frigg::UniqueMemory<KernelAlloc> _inBuffer;
+	// Alternatively to _inBuffer, SendFromBuffer can refer to a buffer in the address space
+	// of the submitting thread. This is only valid until the node is queued
+	// (see Stream::Submitter::run()); _inUserBuffer is null otherwise.
+	const void *_inUserBuffer = nullptr;
+	size_t _inUserLength = 0;
 	AnyBufferAccessor _inAccessor;
 	AnyDescriptor _inDescriptor;
 
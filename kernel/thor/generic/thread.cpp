@@ -310,7 +310,8 @@ Error Thread::resumeOther(frigg::UnsafePtr<Thread> thread) {
 
 Thread::Thread(frigg::SharedPtr<Universe> universe,
 		smarter::shared_ptr<AddressSpace, BindableHandle> address_space, AbiParameters abi)
-: flags{0}, _mainWorkQueue{this}, _pagingWorkQueue{this},
+: ScheduleEntity{ScheduleAffinity::floating},
+		flags{0}, _mainWorkQueue{this}, _pagingWorkQueue{this},
 		_runState{kRunInterrupted}, _lastInterrupt{kIntrNull}, _stateSeq{1},
 		_numTicks{0}, _activationTick{0},
 		_pendingKill{false}, _pendingSignal{kSigNone}, _runCount{1},
@@ -140,7 +140,7 @@ struct PciDevice : PciEntity {
 	: PciEntity{parentBus_, bus, slot, function}, mbusId(0),
 			vendor(vendor), deviceId(device_id), revision(revision),
 			classCode(class_code), subClass(sub_class), interface(interface), subsystemVendor(subsystem_vendor), subsystemDevice(subsystem_device),
-			interrupt(nullptr), caps(*kernelAlloc),
+			interrupt(nullptr), caps(*kernelAlloc), msixPins(*kernelAlloc),
 			associatedFrameBuffer(nullptr), associatedScreen(nullptr) { }
 	
 	// mbus object ID of the device
@@ -166,6 +166,13 @@ struct PciDevice : PciEntity {
 
 	frigg::Vector<Capability, KernelAlloc> caps;
 
+	// Index of the MSI-X capability in caps (or -1 if there is none).
+	int msixIndex = -1;
+	// Kernel mapping of the MSI-X table. Only valid once MSI-X is enabled.
+	void *msixMapping = nullptr;
+	// IrqPins of the MSI-X table entries; allocated on demand.
+	frigg::Vector<IrqPin *, KernelAlloc> msixPins;
+
 	// Device attachments.
 	FbInfo *associatedFrameBuffer;
 	BootScreen *associatedScreen;
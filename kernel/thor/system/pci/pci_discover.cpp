@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <arch/mem_space.hpp>
 #include <frigg/debug.hpp>
 #include <hw.frigg_pb.hpp>
 #include <mbus.frigg_pb.hpp>
@@ -25,6 +26,98 @@ namespace pci {
 frigg::LazyInitializer<frigg::Vector<frigg::SharedPtr<PciDevice>, KernelAlloc>> allDevices;
 
 namespace {
+	// IrqPin that corresponds to an entry of a device's MSI-X table.
+	struct MsixPin final : MsiPin {
+		MsixPin(frigg::String<KernelAlloc> name, arch::mem_space entry)
+		: MsiPin{std::move(name)}, _entry{entry} { }
+
+	protected:
+		IrqStrategy program(TriggerMode mode, Polarity polarity) override {
+			auto strategy = MsiPin::program(mode, polarity);
+
+			auto address = getMessageAddress();
+			_entry.store(msixMessageAddress[0], address);
+			_entry.store(msixMessageAddress[1], address >> 32);
+			_entry.store(msixMessageData, getMessageData());
+			_entry.store(msixVectorControl, 0);
+			return strategy;
+		}
+
+		void mask() override {
+			_entry.store(msixVectorControl, 1);
+		}
+
+		void unmask() override {
+			_entry.store(msixVectorControl, 0);
+		}
+
+	private:
+		static constexpr arch::scalar_register<uint32_t> msixMessageAddress[] = {
+			arch::scalar_register<uint32_t>{0},
+			arch::scalar_register<uint32_t>{4}
+		};
+		static constexpr arch::scalar_register<uint32_t> msixMessageData{8};
+		static constexpr arch::scalar_register<uint32_t> msixVectorControl{12};
+
+		arch::mem_space _entry;
+	};
+
+	// Returns the IrqPin of an MSI-X table entry (or null if there is no such entry).
+	// Enables MSI-X on the device on first use.
+	IrqPin *setupMsix(PciDevice *device, unsigned int index) {
+		if(device->msixIndex < 0)
+			return nullptr;
+		auto cap_offset = device->caps[device->msixIndex].offset;
+
+		auto control = readPciHalf(device->bus, device->slot, device->function, cap_offset + 2);
+		size_t num_entries = (control & 0x7FF) + 1;
+		if(index >= num_entries)
+			return nullptr;
+
+		if(!device->msixMapping) {
+			auto table_info = readPciWord(device->bus, device->slot, device->function,
+					cap_offset + 4);
+			auto bir = table_info & 7;
+			assert(device->bars[bir].type == PciDevice::kBarMemory);
+			auto physical = device->bars[bir].address + (table_info & ~uint32_t{7});
+
+			auto misalign = physical & (kPageSize - 1);
+			auto map_size = (misalign + num_entries * 16 + (kPageSize - 1)) & ~(kPageSize - 1);
+			auto window = reinterpret_cast<char *>(KernelVirtualMemory::global().allocate(map_size));
+			for(size_t pg = 0; pg < map_size; pg += kPageSize)
+				KernelPageSpace::global().mapSingle4k(VirtualAddr(window) + pg,
+						(physical & ~(kPageSize - 1)) + pg,
+						page_access::write, CachingMode::null);
+			device->msixMapping = window + misalign;
+
+			// Mask all entries before enabling MSI-X.
+			for(size_t i = 0; i < num_entries; i++) {
+				arch::mem_space entry{static_cast<char *>(device->msixMapping) + i * 16};
+				entry.store(arch::scalar_register<uint32_t>{12}, 1);
+				device->msixPins.push(nullptr);
+			}
+
+			writePciHalf(device->bus, device->slot, device->function, cap_offset + 2,
+					control | 0x8000);
+		}
+
+		if(!device->msixPins[index]) {
+			auto pin = frigg::construct<MsixPin>(*kernelAlloc,
+					frigg::String<KernelAlloc>{*kernelAlloc, "pci-msi."}
+					+ frigg::to_string(*kernelAlloc, device->bus)
+					+ frigg::String<KernelAlloc>{*kernelAlloc, "-"}
+					+ frigg::to_string(*kernelAlloc, device->slot)
+					+ frigg::String<KernelAlloc>{*kernelAlloc, "-"}
+					+ frigg::to_string(*kernelAlloc, device->function)
+					+ frigg::String<KernelAlloc>{*kernelAlloc, "."}
+					+ frigg::to_string(*kernelAlloc, index),
+					arch::mem_space{static_cast<char *>(device->msixMapping) + index * 16});
+			pin->configure(IrqConfiguration{TriggerMode::edge, Polarity::high});
+			device->msixPins[index] = pin;
+		}
+		return device->msixPins[index];
+	}
+
 	bool handleReq(LaneHandle lane, frigg::SharedPtr<PciDevice> device) {
 		auto branch = fiberAccept(lane);
 		if(!branch)
@@ -100,6 +193,37 @@ namespace {
 					+ frigg::to_string(*kernelAlloc, device->function));
 			IrqPin::attachSink(device->interrupt, object.get());
 
+			frg::string<KernelAlloc> ser(*kernelAlloc);
+			resp.SerializeToString(&ser);
+			fiberSend(branch, ser.data(), ser.size());
+			fiberPushDescriptor(branch, IrqDescriptor{object});
+		}else if(req.req_type() == managarm::hw::CntReqType::ACCESS_MSI) {
+			auto pin = setupMsix(device.get(), req.index());
+			if(!pin) {
+				// No descriptor is pushed; the client only pulls it on success.
+				managarm::hw::SvrResponse<KernelAlloc> resp(*kernelAlloc);
+				resp.set_error(managarm::hw::Errors::OUT_OF_BOUNDS);
+
+				frg::string<KernelAlloc> ser(*kernelAlloc);
+				resp.SerializeToString(&ser);
+				fiberSend(branch, ser.data(), ser.size());
+				return true;
+			}
+
+			auto object = frigg::makeShared<IrqObject>(*kernelAlloc,
+					frigg::String<KernelAlloc>{*kernelAlloc, "pci-msi."}
+					+ frigg::to_string(*kernelAlloc, device->bus)
+					+ frigg::String<KernelAlloc>{*kernelAlloc, "-"}
+					+ frigg::to_string(*kernelAlloc, device->slot)
+					+ frigg::String<KernelAlloc>{*kernelAlloc, "-"}
+					+ frigg::to_string(*kernelAlloc, device->function)
+					+ frigg::String<KernelAlloc>{*kernelAlloc, "."}
+					+ frigg::to_string(*kernelAlloc, req.index()));
+			IrqPin::attachSink(pin, object.get());
+
+			managarm::hw::SvrResponse<KernelAlloc> resp(*kernelAlloc);
+			resp.set_error(managarm::hw::Errors::SUCCESS);
+
 			frg::string<KernelAlloc> ser(*kernelAlloc);
 			resp.SerializeToString(&ser);
 			fiberSend(branch, ser.data(), ser.size());
@@ -550,6 +674,8 @@ void checkPciFunction(PciBus *bus, uint32_t slot, uint32_t function) {
 				if(type == 0x09)
 					size = readPciByte(bus->busId, slot, function, offset + 2);
 
+				if(type == 0x11)
+					device->msixIndex = device->caps.size();
 				device->caps.push({type, offset, size});
 
 				uint8_t successor = readPciByte(bus->busId, slot, function, offset + 1);
@@ -3,6 +3,7 @@
 
 #include <assert.h>
 #include <stddef.h>
+#include <stdint.h>
 
 namespace arch {
 
@@ -10,23 +11,50 @@ namespace arch {
 // DMA pool infrastructure.
 // ----------------------------------------------------------------------------
 
+// Physical address of DMA memory that is not known in advance.
+inline constexpr uintptr_t no_physical = static_cast<uintptr_t>(-1);
+
 struct dma_pool {
 	virtual ~dma_pool() = default;
 
 	virtual void *allocate(size_t size, size_t count, size_t align) = 0;
 	virtual void deallocate(void *pointer, size_t size, size_t count, size_t align) = 0;
+
+	// Returns the physical address of memory that was allocated from this pool
+	// (without asking the kernel). Pools that do not track physical addresses
+	// return no_physical. Allocations are assumed to be physically contiguous.
+	virtual uintptr_t physical_address(void *pointer) {
+		(void)pointer;
+		return no_physical;
+	}
 };
 
+inline uintptr_t physical_address_of(dma_pool *pool, void *pointer) {
+	if(!pool || !pointer)
+		return no_physical;
+	return pool->physical_address(pointer);
+}
+
+inline uintptr_t offset_physical(uintptr_t physical, size_t offset) {
+	if(physical == no_physical)
+		return no_physical;
+	return physical + offset;
+}
+
 // ----------------------------------------------------------------------------
 // View classes.
 // ----------------------------------------------------------------------------
 
 struct dma_buffer_view {
 	dma_buffer_view()
-	: _pool{nullptr}, _data{nullptr}, _size{0} { }
+	: _pool{nullptr}, _data{nullptr}, _size{0}, _physical{no_physical} { }
 
 	explicit dma_buffer_view(dma_pool *pool, void *data, size_t size)
-	: _pool{pool}, _data{data}, _size{size} { }
+	: _pool{pool}, _data{data}, _size{size},
+			_physical{physical_address_of(pool, data)} { }
+
+	explicit dma_buffer_view(dma_pool *pool, void *data, size_t size, uintptr_t physical)
+	: _pool{pool}, _data{data}, _size{size}, _physical{physical} { }
 
 	size_t size() const {
 		return _size;
@@ -36,21 +64,29 @@ struct dma_buffer_view {
 		return _data;
 	}
 
+	// Physical address of data() or no_physical if the pool does not know it.
+	uintptr_t physical() const {
+		return _physical;
+	}
+
 	dma_buffer_view subview(size_t offset, size_t chunk) const {
 		assert(offset <= _size);
 		assert(offset + chunk <= _size);
-		return dma_buffer_view{_pool, (char *)_data + offset, chunk};
+		return dma_buffer_view{_pool, (char *)_data + offset, chunk,
+				offset_physical(_physical, offset)};
 	}
 
 	dma_buffer_view subview(size_t offset) const {
 		assert(offset <= _size);
-		return dma_buffer_view{_pool, (char *)_data + offset, _size - offset};
+		return dma_buffer_view{_pool, (char *)_data + offset, _size - offset,
+				offset_physical(_physical, offset)};
 	}
 
 private:
 	dma_pool *_pool;
 	void *_data;
 	size_t _size;
+	uintptr_t _physical;
 };
 
 template<typename T>
@@ -114,10 +150,11 @@ struct dma_buffer {
 		swap(a._pool, b._pool);
 		swap(a._data, b._data);
 		swap(a._size, b._size);
+		swap(a._physical, b._physical);
 	}
 
 	dma_buffer()
-	: _pool{nullptr}, _data{nullptr}, _size{0} { }
+	: _pool{nullptr}, _data{nullptr}, _size{0}, _physical{no_physical} { }
 
 	dma_buffer(dma_buffer &&other)
 	: dma_buffer() {
@@ -131,6 +168,7 @@ struct dma_buffer {
 		}else{
 			_data = operator new(_size);
 		}
+		_physical = physical_address_of(_pool, _data);
 	}
 
 	~dma_buffer() {
@@ -147,7 +185,7 @@ struct dma_buffer {
 	}
 
 	operator dma_buffer_view () {
-		return dma_buffer_view{_pool, _data, _size};
+		return dma_buffer_view{_pool, _data, _size, _physical};
 	}
 
 	size_t size() {
@@ -158,14 +196,20 @@ struct dma_buffer {
 		return _data;
 	}
 
+	uintptr_t physical() {
+		return _physical;
+	}
+
 	dma_buffer_view subview(size_t offset, size_t chunk) {
-		return dma_buffer_view{_pool, (char *)_data + offset, chunk};
+		return dma_buffer_view{_pool, (char *)_data + offset, chunk,
+				offset_physical(_physical, offset)};
 	}
 
 private:
 	dma_pool *_pool;
 	void *_data;
 	size_t _size;
+	uintptr_t _physical;
 };
 
 template<typename T>
@@ -174,10 +218,11 @@ struct dma_object {
 		using std::swap;
 		swap(a._pool, b._pool);
 		swap(a._data, b._data);
+		swap(a._physical, b._physical);
 	}
 
 	dma_object()
-	: _pool{nullptr}, _data{nullptr} { }
+	: _pool{nullptr}, _data{nullptr}, _physical{no_physical} { }
 
 	dma_object(dma_object &&other)
 	: dma_object() {
@@ -195,6 +240,7 @@ struct dma_object {
 			p = operator new(sizeof(T));
 		}
 		_data = new (p) T{std::forward<Args>(args)...};
+		_physical = physical_address_of(_pool, p);
 	}
 
 	~dma_object() {
@@ -228,13 +274,18 @@ struct dma_object {
 		return _data;
 	}
 
+	uintptr_t physical() {
+		return _physical;
+	}
+
 	dma_buffer_view view_buffer() {
-		return dma_buffer_view{_pool, _data, sizeof(T)};
+		return dma_buffer_view{_pool, _data, sizeof(T), _physical};
 	}
 
 private:
 	dma_pool *_pool;
 	T *_data;
+	uintptr_t _physical;
 };
 
 // Like dma_object but stores the object on the stack if the class is initialized
@@ -242,7 +293,7 @@ private:
 template<typename T>
 struct dma_small_object {
 	dma_small_object()
-	: _pool{nullptr}, _data{nullptr} { }
+	: _pool{nullptr}, _data{nullptr}, _physical{no_physical} { }
 
 	template<typename... Args>
 	explicit dma_small_object(dma_pool *pool, Args &&... args)
@@ -254,6 +305,7 @@ struct dma_small_object {
 			p = &_embedded;
 		}
 		_data = new (p) T{std::forward<Args>(args)...};
+		_physical = physical_address_of(_pool, p);
 	}
 
 	dma_small_object(const dma_small_object &) = delete;
@@ -283,13 +335,18 @@ struct dma_small_object {
 		return _data;
 	}
 
+	uintptr_t physical() {
+		return _physical;
+	}
+
 	dma_buffer_view view_buffer() {
-		return dma_buffer_view{_pool, _data, sizeof(T)};
+		return dma_buffer_view{_pool, _data, sizeof(T), _physical};
 	}
 
 private:
 	dma_pool *_pool;
 	T *_data;
+	uintptr_t _physical;
 	std::aligned_storage_t<sizeof(T), alignof(T)> _embedded;
 };
 
@@ -300,10 +357,11 @@ struct dma_array {
 		swap(a._pool, b._pool);
 		swap(a._data, b._data);
 		swap(a._size, b._size);
+		swap(a._physical, b._physical);
 	}
 
 	dma_array()
-	: _pool{nullptr}, _data{nullptr}, _size(0) { }
+	: _pool{nullptr}, _data{nullptr}, _size(0), _physical{no_physical} { }
 
 	dma_array(dma_array &&other)
 	: dma_array() {
@@ -321,6 +379,7 @@ struct dma_array {
 			p = operator new(sizeof(T) * _size);
 		}
 		_data = new (p) T[_size];
+		_physical = physical_address_of(_pool, p);
 	}
 
 	~dma_array() {
@@ -356,15 +415,27 @@ struct dma_array {
 	T &operator[] (size_t n) {
 		return _data[n];
 	}
-	
+
+	uintptr_t physical() {
+		return _physical;
+	}
+
 	dma_buffer_view view_buffer() {
-		return dma_buffer_view{_pool, _data, sizeof(T) * _size};
+		return dma_buffer_view{_pool, _data, sizeof(T) * _size, _physical};
+	}
+
+	// Returns a view of a single element.
+	dma_buffer_view view_element(size_t n) {
+		assert(n < _size);
+		return dma_buffer_view{_pool, _data + n, sizeof(T),
+				offset_physical(_physical, sizeof(T) * n)};
 	}
 
 private:
 	dma_pool *_pool;
 	T *_data;
 	size_t _size;
+	uintptr_t _physical;
 };
 
 } // namespace arch
@@ -3,6 +3,7 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <map>
 #include <mutex>
 #include <utility>
 #include <arch/dma_structs.hpp>
@@ -15,6 +16,20 @@ struct contiguous_policy {
 public:
 	uintptr_t map(size_t length);
 	void unmap(uintptr_t address, size_t length);
+
+	// Translates addresses within memory returned by map().
+	uintptr_t physical(uintptr_t address);
+
+private:
+	struct area {
+		size_t length;
+		uintptr_t physical;
+	};
+
+	// Maps the virtual base address of each area to its physical address.
+	// The areas are physically contiguous, hence one entry suffices.
+	std::mutex _mutex;
+	std::map<uintptr_t, area> _areas;
 };
 
 struct contiguous_pool : dma_pool {
@@ -22,6 +37,7 @@ struct contiguous_pool : dma_pool {
 
 	void *allocate(size_t size, size_t count, size_t align) override;
 	void deallocate(void *pointer, size_t size, size_t count, size_t align) override;
+	uintptr_t physical_address(void *pointer) override;
 
 private:
 	contiguous_policy _policy;
@@ -28,6 +28,10 @@ struct basic_variable {
 		return static_cast<R>(_detail::mem_ops<B>::atomic_exchange(&_embedded, static_cast<B>(r)));
 	}
 
+	R atomic_fetch_and(R r) {
+		return static_cast<R>(_detail::mem_ops<B>::atomic_fetch_and(&_embedded, static_cast<B>(r)));
+	}
+
 private:
 	B _embedded;
 };
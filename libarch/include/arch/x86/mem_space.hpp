@@ -91,6 +91,10 @@ namespace _detail {
 			asm volatile ("xchgq %0, %1" : "+r"(v) : "m"(*p) : "memory");
 			return v;
 		}
+
+		static uint64_t atomic_fetch_and(uint64_t *p, uint64_t v) {
+			return __atomic_fetch_and(p, v, __ATOMIC_SEQ_CST);
+		}
 	};
 
 	struct mem_space {
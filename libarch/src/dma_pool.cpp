@@ -20,13 +20,39 @@ uintptr_t contiguous_policy::map(size_t length) {
 	HEL_CHECK(helMapMemory(memory, kHelNullHandle, nullptr, 0, length,
 			kHelMapProtRead | kHelMapProtWrite, &actual_ptr));
 	HEL_CHECK(helCloseDescriptor(memory));
+
+	// Resolve the physical address once; DMA users look it up in userspace afterwards.
+	uintptr_t physical;
+	HEL_CHECK(helPointerPhysical(actual_ptr, &physical));
+	{
+		std::lock_guard lock{_mutex};
+		_areas.emplace((uintptr_t)actual_ptr, area{length, physical});
+	}
 	return (uintptr_t)actual_ptr;
 }
 
 void contiguous_policy::unmap(uintptr_t address, size_t length) {
+	{
+		std::lock_guard lock{_mutex};
+		auto it = _areas.find(address);
+		assert(it != _areas.end());
+		assert(it->second.length == length);
+		_areas.erase(it);
+	}
 	HEL_CHECK(helUnmapMemory(kHelNullHandle, (void *)address, length));
 }
 
+uintptr_t contiguous_policy::physical(uintptr_t address) {
+	std::lock_guard lock{_mutex};
+	auto it = _areas.upper_bound(address);
+	if(it == _areas.begin())
+		return no_physical;
+	--it;
+	if(address - it->first >= it->second.length)
+		return no_physical;
+	return it->second.physical + (address - it->first);
+}
+
 contiguous_pool::contiguous_pool()
 : _slab{_policy} { }
 
@@ -45,5 +71,9 @@ void contiguous_pool::deallocate(void *pointer, size_t size, size_t count, size_
 	_slab.free(pointer);
 }
 
+uintptr_t contiguous_pool::physical_address(void *pointer) {
+	return _policy.physical(reinterpret_cast<uintptr_t>(pointer));
+}
+
 } } // namespace arch::os
 
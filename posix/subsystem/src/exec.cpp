@@ -34,7 +34,7 @@ expected<ImageInfo> load(SharedFilePtr file,
 
 	// read the elf file header and verify the signature.
 	Elf64_Ehdr ehdr;
-	co_await file->readExactly(nullptr, &ehdr, sizeof(Elf64_Ehdr));
+	co_await file->preadExactly(nullptr, 0, &ehdr, sizeof(Elf64_Ehdr));
 
 	if(!(ehdr.e_ident[0] == 0x7F
 			&& ehdr.e_ident[1] == 'E'
@@ -50,8 +50,8 @@ expected<ImageInfo> load(SharedFilePtr file,
 
 	// read the elf program headers and load them into the address space.
 	auto phdr_buffer = (char *)malloc(ehdr.e_phnum * ehdr.e_phentsize);
-	co_await file->seek(ehdr.e_phoff, VfsSeek::absolute);
-	co_await file->readExactly(nullptr, phdr_buffer, ehdr.e_phnum * size_t(ehdr.e_phentsize));
+	co_await file->preadExactly(nullptr, ehdr.e_phoff,
+			phdr_buffer, ehdr.e_phnum * size_t(ehdr.e_phentsize));
 
 	for(int i = 0; i < ehdr.e_phnum; i++) {
 		auto phdr = (Elf64_Phdr *)(phdr_buffer + i * ehdr.e_phentsize);
@@ -102,8 +102,8 @@ expected<ImageInfo> load(SharedFilePtr file,
 
 				// read the segment contents from the file.
 				memset(window, 0, map_length);
-				co_await file->seek(phdr->p_offset, VfsSeek::absolute);
-				co_await file->readExactly(nullptr, (char *)window + misalign, phdr->p_filesz);
+				co_await file->preadExactly(nullptr, phdr->p_offset,
+						(char *)window + misalign, phdr->p_filesz);
 				HEL_CHECK(helUnmapMemory(kHelNullHandle, window, map_length));
 			}
 		}else if(phdr->p_type == PT_PHDR) {
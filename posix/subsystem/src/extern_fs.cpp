@@ -14,7 +14,7 @@ struct DirectoryNode;
 struct Superblock final : FsSuperblock {
 	Superblock(helix::UniqueLane lane);
 
-	FutureMaybe<std::shared_ptr<FsNode>> createRegular() override;
+	FutureMaybe<std::shared_ptr<FsNode>> createRegular(FsNode *parent) override;
 	FutureMaybe<std::shared_ptr<FsNode>> createSocket() override;
 
 	async::result<std::shared_ptr<FsLink>> rename(FsLink *source,
@@ -119,6 +119,36 @@ private:
 		co_return length;
 	}
 
+	expected<size_t>
+	pread(Process *, int64_t offset, void *data, size_t max_length) override {
+		auto result = co_await _file.pread(offset, data, max_length);
+		if(auto error = std::get_if<protocols::fs::Error>(&result)) {
+			if(*error == protocols::fs::Error::seekOnPipe)
+				co_return Error::seekOnPipe;
+			if(*error == protocols::fs::Error::wouldBlock)
+				co_return Error::wouldBlock;
+			co_return Error::illegalArguments;
+		}
+		co_return std::get<size_t>(result);
+	}
+
+	async::result<Error>
+	pwrite(Process *, int64_t offset, const void *data, size_t length) override {
+		auto error = co_await _file.pwrite(offset, data, length);
+		switch(error) {
+		case protocols::fs::Error::none:
+			co_return Error::success;
+		case protocols::fs::Error::noSpaceLeft:
+			co_return Error::noSpaceLeft;
+		case protocols::fs::Error::fileTooBig:
+			co_return Error::fileTooBig;
+		case protocols::fs::Error::seekOnPipe:
+			co_return Error::seekOnPipe;
+		default:
+			co_return Error::illegalArguments;
+		}
+	}
+
 	// TODO: For extern_fs, we can simply return POLLIN | POLLOUT here.
 	// Move device code out of this file.
 	expected<PollResult> poll(Process *, uint64_t sequence,
@@ -347,8 +377,11 @@ private:
 
 			auto child = _sb->internalizeStructural(this, name,
 					resp.id(), pull_node.descriptor());
-			co_return child->treeLink();
+			auto link = child->treeLink();
+			_dentries.insert(name, link);
+			co_return link;
 		} else {
+			_dentries.invalidate(name);
 			co_return Error::illegalOperationTarget; // TODO
 		}
 	}
@@ -370,6 +403,10 @@ private:
 
 	FutureMaybe<std::shared_ptr<FsLink>>
 			getLink(std::string name) override {
+		if(auto cached = _dentries.lookup(name); cached)
+			co_return *cached;
+		auto sequence = _dentries.sequence();
+
 		helix::Offer offer;
 		helix::SendBuffer send_req;
 		helix::RecvInline recv_resp;
@@ -395,16 +432,22 @@ private:
 		if(resp.error() == managarm::fs::Errors::SUCCESS) {
 			HEL_CHECK(pull_node.error());
 
+			std::shared_ptr<FsLink> link;
 			if(resp.file_type() == managarm::fs::FileType::DIRECTORY) {
 				auto child = _sb->internalizeStructural(this, name,
 						resp.id(), pull_node.descriptor());
-				co_return child->treeLink();
+				link = child->treeLink();
 			}else{
 				auto child = _sb->internalizePeripheralNode(resp.file_type(), resp.id(),
 						pull_node.descriptor());
-				co_return _sb->internalizePeripheralLink(this, name, std::move(child));
+				link = _sb->internalizePeripheralLink(this, name, std::move(child));
 			}
+			if(_dentries.sequence() == sequence)
+				_dentries.insert(name, link);
+			co_return link;
 		}else{
+			if(_dentries.sequence() == sequence)
+				_dentries.insert(name, nullptr);
 			co_return nullptr;
 		}
 	}
@@ -437,16 +480,20 @@ private:
 		if(resp.error() == managarm::fs::Errors::SUCCESS) {
 			HEL_CHECK(pull_node.error());
 
+			std::shared_ptr<FsLink> link;
 			if(resp.file_type() == managarm::fs::FileType::DIRECTORY) {
 				auto child = _sb->internalizeStructural(this, name,
 						resp.id(), pull_node.descriptor());
-				co_return child->treeLink();
+				link = child->treeLink();
 			}else{
 				auto child = _sb->internalizePeripheralNode(resp.file_type(), resp.id(),
 						pull_node.descriptor());
-				co_return _sb->internalizePeripheralLink(this, name, std::move(child));
+				link = _sb->internalizePeripheralLink(this, name, std::move(child));
 			}
+			_dentries.insert(name, link);
+			co_return link;
 		}else{
+			_dentries.invalidate(name);
 			co_return nullptr;
 		}
 	}
@@ -472,6 +519,7 @@ private:
 
 		managarm::fs::SvrResponse resp;
 		resp.ParseFromArray(recv_resp.data(), recv_resp.length());
+		_dentries.invalidate(name);
 		assert(resp.error() == managarm::fs::Errors::SUCCESS);
 	}
 
@@ -525,6 +573,7 @@ public:
 private:
 	Superblock *_sb;
 	StructuralLink _treeLink;
+	DentryCache _dentries;
 };
 
 std::shared_ptr<FsNode> StructuralLink::getTarget() {
@@ -534,7 +583,7 @@ std::shared_ptr<FsNode> StructuralLink::getTarget() {
 Superblock::Superblock(helix::UniqueLane lane)
 : _lane{std::move(lane)} { }
 
-FutureMaybe<std::shared_ptr<FsNode>> Superblock::createRegular() {
+FutureMaybe<std::shared_ptr<FsNode>> Superblock::createRegular(FsNode *parent) {
 	helix::Offer offer;
 	helix::SendBuffer send_req;
 	helix::RecvInline recv_resp;
@@ -542,6 +591,7 @@ FutureMaybe<std::shared_ptr<FsNode>> Superblock::createRegular() {
 
 	managarm::fs::CntRequest req;
 	req.set_req_type(managarm::fs::CntReqType::SB_CREATE_REGULAR);
+	req.set_parent_id(static_cast<Node *>(parent)->getInode());
 
 	auto ser = req.SerializeAsString();
 	auto &&transmit = helix::submitAsync(_lane, helix::Dispatcher::global(),
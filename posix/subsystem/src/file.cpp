@@ -74,11 +74,51 @@ File::ptRead(void *object, const char *credentials,
 	}
 }
 
-async::result<void> File::ptWrite(void *object, const char *credentials,
+async::result<protocols::fs::Error> File::ptWrite(void *object, const char *credentials,
 		const void *buffer, size_t length) {
 	auto self = static_cast<File *>(object);
 	auto process = findProcessWithCredentials(credentials);
-	return self->writeAll(process.get(), buffer, length);
+	co_await self->writeAll(process.get(), buffer, length);
+	co_return protocols::fs::Error::none;
+}
+
+async::result<protocols::fs::ReadResult>
+File::ptPread(void *object, int64_t offset, const char *credentials,
+		void *buffer, size_t length) {
+	auto self = static_cast<File *>(object);
+	auto process = findProcessWithCredentials(credentials);
+	auto result = co_await self->pread(process.get(), offset, buffer, length);
+	auto error = std::get_if<Error>(&result);
+	if(error && *error == Error::seekOnPipe) {
+		co_return protocols::fs::Error::seekOnPipe;
+	}else if(error && *error == Error::wouldBlock) {
+		co_return protocols::fs::Error::wouldBlock;
+	}else if(error) {
+		assert(*error == Error::illegalOperationTarget || *error == Error::illegalArguments);
+		co_return protocols::fs::Error::illegalArguments;
+	}else{
+		co_return std::get<size_t>(result);
+	}
+}
+
+async::result<protocols::fs::Error> File::ptPwrite(void *object, int64_t offset,
+		const char *credentials, const void *buffer, size_t length) {
+	auto self = static_cast<File *>(object);
+	auto process = findProcessWithCredentials(credentials);
+	auto error = co_await self->pwrite(process.get(), offset, buffer, length);
+	switch(error) {
+	case Error::success:
+		co_return protocols::fs::Error::none;
+	case Error::seekOnPipe:
+		co_return protocols::fs::Error::seekOnPipe;
+	case Error::noSpaceLeft:
+		co_return protocols::fs::Error::noSpaceLeft;
+	case Error::fileTooBig:
+		co_return protocols::fs::Error::fileTooBig;
+	default:
+		assert(error == Error::illegalOperationTarget || error == Error::illegalArguments);
+		co_return protocols::fs::Error::illegalArguments;
+	}
 }
 
 async::result<ReadEntriesResult> File::ptReadEntries(void *object) {
@@ -86,6 +126,12 @@ async::result<ReadEntriesResult> File::ptReadEntries(void *object) {
 	return self->readEntries();
 }
 
+async::result<bool> File::ptReadEntryBatch(void *object,
+		protocols::fs::EntryBatch *batch) {
+	auto self = static_cast<File *>(object);
+	return self->readEntryBatch(batch);
+}
+
 async::result<void> File::ptTruncate(void *object, size_t size) {
 	auto self = static_cast<File *>(object);
 	return self->truncate(size);
@@ -97,6 +143,16 @@ async::result<void> File::ptAllocate(void *object,
 	return self->allocate(offset, size);
 }
 
+async::result<protocols::fs::Error> File::ptSync(void *object,
+		protocols::fs::SyncMode mode) {
+	auto self = static_cast<File *>(object);
+	auto error = co_await self->sync(mode);
+	if(error == Error::illegalArguments)
+		co_return protocols::fs::Error::illegalArguments;
+	assert(error == Error::success);
+	co_return protocols::fs::Error::none;
+}
+
 async::result<int> File::ptGetOption(void *object, int option) {
 	auto self = static_cast<File *>(object);
 	return self->getOption(option);
@@ -211,12 +267,39 @@ FutureMaybe<void> File::readExactly(Process *process,
 	}
 }
 
+FutureMaybe<void> File::preadExactly(Process *process, int64_t offset,
+		void *data, size_t length) {
+	size_t progress = 0;
+	while(progress < length) {
+		auto result = co_await pread(process, offset + progress,
+				(char *)data + progress, length - progress);
+		assert(std::get<size_t>(result) > 0);
+		progress += std::get<size_t>(result);
+	}
+}
+
 expected<size_t> File::readSome(Process *, void *, size_t) {
 	std::cout << "\e[35mposix \e[1;34m" << structName()
 			<< "\e[0m\e[35m: File does not support read()\e[39m" << std::endl;
 	co_return Error::illegalOperationTarget;
 }
 
+expected<size_t> File::pread(Process *, int64_t, void *, size_t) {
+	if(_defaultOps & defaultPipeLikeSeek)
+		co_return Error::seekOnPipe;
+	std::cout << "\e[35mposix \e[1;34m" << structName()
+			<< "\e[0m\e[35m: File does not support pread()\e[39m" << std::endl;
+	co_return Error::illegalOperationTarget;
+}
+
+async::result<Error> File::pwrite(Process *, int64_t, const void *, size_t) {
+	if(_defaultOps & defaultPipeLikeSeek)
+		co_return Error::seekOnPipe;
+	std::cout << "\e[35mposix \e[1;34m" << structName()
+			<< "\e[0m\e[35m: File does not support pwrite()\e[39m" << std::endl;
+	co_return Error::illegalOperationTarget;
+}
+
 void File::handleClose() {
 	std::cout << "posix \e[1;34m" << structName()
 			<< "\e[0m: Object does not implement handleClose()" << std::endl;
@@ -232,6 +315,10 @@ async::result<ReadEntriesResult> File::readEntries() {
 	throw std::runtime_error("posix: Object has no File::readEntries()");
 }
 
+async::result<bool> File::readEntryBatch(protocols::fs::EntryBatch *) {
+	co_return false;
+}
+
 async::result<protocols::fs::RecvResult>
 File::recvMsg(Process *, uint32_t, void *, size_t,
 		void *, size_t, size_t) {
@@ -256,6 +343,10 @@ async::result<void> File::allocate(int64_t, size_t) {
 	throw std::runtime_error("posix: Object has no File::allocate()");
 }
 
+async::result<Error> File::sync(protocols::fs::SyncMode) {
+	co_return Error::illegalArguments;
+}
+
 expected<off_t> File::seek(off_t, VfsSeek) {
 	if(_defaultOps & defaultPipeLikeSeek) {
 		async::promise<std::variant<Error, off_t>> promise;
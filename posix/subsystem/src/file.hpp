@@ -40,7 +40,11 @@ enum class Error {
 
 	brokenPipe,
 
-	illegalArguments
+	illegalArguments,
+
+	noSpaceLeft,
+
+	fileTooBig
 };
 
 // TODO: Rename this enum as is not part of the VFS.
@@ -92,18 +96,32 @@ public:
 	static async::result<protocols::fs::ReadResult>
 	ptRead(void *object, const char *credentials, void *buffer, size_t length);
 
-	static async::result<void>
+	static async::result<protocols::fs::Error>
 	ptWrite(void *object, const char *credentials, const void *buffer, size_t length);
 
+	static async::result<protocols::fs::ReadResult>
+	ptPread(void *object, int64_t offset, const char *credentials,
+			void *buffer, size_t length);
+
+	static async::result<protocols::fs::Error>
+	ptPwrite(void *object, int64_t offset, const char *credentials,
+			const void *buffer, size_t length);
+
 	static async::result<protocols::fs::ReadEntriesResult>
 	ptReadEntries(void *object);
 
+	static async::result<bool>
+	ptReadEntryBatch(void *object, protocols::fs::EntryBatch *batch);
+
 	static async::result<void>
 	ptTruncate(void *object, size_t size);
 
 	static async::result<void>
 	ptAllocate(void *object, int64_t offset, size_t size);
 
+	static async::result<protocols::fs::Error>
+	ptSync(void *object, protocols::fs::SyncMode mode);
+
 	static async::result<int>
 	ptGetOption(void *object, int option);
 
@@ -150,9 +168,13 @@ public:
 		.seekEof = &ptSeekEof,
 		.read = &ptRead,
 		.write = &ptWrite,
+		.pread = &ptPread,
+		.pwrite = &ptPwrite,
 		.readEntries = &ptReadEntries,
+		.readEntryBatch = &ptReadEntryBatch,
 		.truncate = &ptTruncate,
 		.fallocate = &ptAllocate,
+		.sync = &ptSync,
 		.getOption = &ptGetOption,
 		.setOption = &ptSetOption,
 		.bind = &ptBind,
@@ -235,8 +257,21 @@ public:
 
 	virtual FutureMaybe<void> writeAll(Process *process, const void *data, size_t length);
 
+	FutureMaybe<void> preadExactly(Process *process, int64_t offset, void *data, size_t length);
+
+	// Like readSome() and writeAll() but these do not use or modify the file offset.
+	virtual expected<size_t> pread(Process *process, int64_t offset, void *data,
+			size_t max_length);
+
+	virtual async::result<Error> pwrite(Process *process, int64_t offset, const void *data,
+			size_t length);
+
 	virtual FutureMaybe<ReadEntriesResult> readEntries();
 
+	// Fills the batch with as many entries as fit into it.
+	// Returns false if the file only supports readEntries().
+	virtual async::result<bool> readEntryBatch(protocols::fs::EntryBatch *batch);
+
 	virtual async::result<protocols::fs::RecvResult>
 		recvMsg(Process *process, uint32_t flags,
 			void *data, size_t max_length,
@@ -252,6 +287,10 @@ public:
 
 	virtual async::result<void> allocate(int64_t offset, size_t size);
 
+	// Returns once the file is on stable storage.
+	// Files that do not support synchronization return Error::illegalArguments.
+	virtual async::result<Error> sync(protocols::fs::SyncMode mode);
+
 	// poll() uses a sequence number mechansim for synchronization.
 	// Before returning, it waits until current-sequence > in-sequence.
 	// Returns (current-sequence, edges since in-sequence, current events).
@@ -86,3 +86,82 @@ void FsNode::notifyObservers() {
 	}
 }
 
+// --------------------------------------------------------
+// DentryCache implementation.
+// --------------------------------------------------------
+
+namespace {
+	DentryCache::Stats globalDentryStats;
+}
+
+const DentryCache::Stats &DentryCache::stats() {
+	globalDentryStats.numEntries = _lru().size();
+	return globalDentryStats;
+}
+
+DentryCache::LruList &DentryCache::_lru() {
+	static LruList lru;
+	return lru;
+}
+
+DentryCache::~DentryCache() {
+	// Positive entries keep the owner of their link alive, hence only negative
+	// entries can remain when a directory is destructed.
+	for(auto [name, it] : _entries) {
+		assert(!it->link);
+		_lru().erase(it);
+	}
+}
+
+std::optional<std::shared_ptr<FsLink>> DentryCache::lookup(const std::string &name) {
+	auto entry = _entries.find(name);
+	if(entry == _entries.end()) {
+		globalDentryStats.misses++;
+		return std::nullopt;
+	}
+
+	auto it = entry->second;
+	if(it->link) {
+		globalDentryStats.hits++;
+	}else{
+		globalDentryStats.negativeHits++;
+	}
+	_lru().splice(_lru().begin(), _lru(), it);
+	return it->link;
+}
+
+void DentryCache::insert(const std::string &name, std::shared_ptr<FsLink> link) {
+	_sequence++;
+
+	std::shared_ptr<FsLink> replaced;
+	if(auto entry = _entries.find(name); entry != _entries.end())
+		replaced = _remove(entry->second);
+
+	_lru().push_front(Entry{this, name, std::move(link)});
+	_entries.insert({name, _lru().begin()});
+
+	// Evicted links are released after the loop, as destructing a link can
+	// destruct its owner (and hence a DentryCache).
+	std::vector<std::shared_ptr<FsLink>> evicted;
+	while(_lru().size() > maxEntries) {
+		evicted.push_back(_remove(std::prev(_lru().end())));
+		globalDentryStats.evictions++;
+	}
+}
+
+void DentryCache::invalidate(const std::string &name) {
+	_sequence++;
+
+	auto entry = _entries.find(name);
+	if(entry == _entries.end())
+		return;
+	auto link = _remove(entry->second);
+	globalDentryStats.invalidations++;
+}
+
+std::shared_ptr<FsLink> DentryCache::_remove(LruList::iterator it) {
+	auto link = std::move(it->link);
+	it->cache->_entries.erase(it->name);
+	_lru().erase(it);
+	return link;
+}
@@ -2,6 +2,8 @@
 #define POSIX_SUBSYSTEM_FS_HPP
 
 #include <iostream>
+#include <list>
+#include <optional>
 #include <set>
 #include <deque>
 #include <unordered_map>
@@ -54,7 +56,8 @@ protected:
 	~FsSuperblock() = default;
 
 public:
-	virtual FutureMaybe<std::shared_ptr<FsNode>> createRegular() = 0;
+	// parent is the directory that the new node will be linked into.
+	virtual FutureMaybe<std::shared_ptr<FsNode>> createRegular(FsNode *parent) = 0;
 	virtual FutureMaybe<std::shared_ptr<FsNode>> createSocket() = 0;
 
 	virtual async::result<std::shared_ptr<FsLink>> rename(FsLink *source,
@@ -156,4 +159,69 @@ private:
 	std::unordered_map<FsObserver *, std::shared_ptr<FsObserver>> _observers;
 };
 
+// --------------------------------------------------------
+// DentryCache class.
+// --------------------------------------------------------
+
+// Caches the results of FsNode::getLink() for a single directory.
+// This includes negative entries, i.e., names that do not exist.
+// FsNodes that own a DentryCache need to invalidate entries on all operations
+// that change the directory. Entries of all caches share a global LRU list.
+struct DentryCache {
+	static constexpr size_t maxEntries = 4096;
+
+	struct Stats {
+		uint64_t hits = 0;
+		uint64_t negativeHits = 0;
+		uint64_t misses = 0;
+		uint64_t evictions = 0;
+		uint64_t invalidations = 0;
+		size_t numEntries = 0;
+	};
+
+	static const Stats &stats();
+
+	DentryCache() = default;
+
+	DentryCache(const DentryCache &) = delete;
+
+	~DentryCache();
+
+	DentryCache &operator= (const DentryCache &) = delete;
+
+	// Incremented on each modification of the cache. Callers that perform lookups
+	// asynchronously should only insert their result if the sequence did not change
+	// (otherwise, the result might already be outdated).
+	uint64_t sequence() {
+		return _sequence;
+	}
+
+	// Returns std::nullopt if the name is not cached.
+	// Otherwise, returns the cached link (which is null for negative entries).
+	std::optional<std::shared_ptr<FsLink>> lookup(const std::string &name);
+
+	// Inserts an entry. Pass a null link to insert a negative entry.
+	void insert(const std::string &name, std::shared_ptr<FsLink> link);
+
+	void invalidate(const std::string &name);
+
+private:
+	struct Entry {
+		DentryCache *cache;
+		std::string name;
+		std::shared_ptr<FsLink> link;
+	};
+
+	using LruList = std::list<Entry>;
+
+	static LruList &_lru();
+
+	// Unlinks an entry from the cache and returns the link that it held.
+	// The link is only released by the caller, as this can destruct other caches.
+	std::shared_ptr<FsLink> _remove(LruList::iterator it);
+
+	std::unordered_map<std::string, LruList::iterator> _entries;
+	uint64_t _sequence = 0;
+};
+
 #endif // POSIX_SUBSYSTEM_FS_HPP
@@ -10,8 +10,10 @@
 #include <sys/sysmacros.h>
 #include <sys/timerfd.h>
 #include <sys/wait.h>
+#include <algorithm>
 #include <iomanip>
 #include <iostream>
+#include <sstream>
 
 #include <async/jump.hpp>
 #include <protocols/mbus/client.hpp>
@@ -454,21 +456,178 @@ async::detached serveSignals(std::shared_ptr<Process> self,
 		std::cout << "\e[33mposix: Exiting serveSignals()\e[39m" << std::endl;
 }
 
+// --------------------------------------------------------
+// Request latency statistics.
+// --------------------------------------------------------
+
+struct RequestLatency {
+	// Bucket i counts requests that took less than 2^i microseconds.
+	static constexpr int numBuckets = 24;
+
+	uint64_t count = 0;
+	uint64_t totalNanos = 0;
+	uint64_t maxNanos = 0;
+	std::array<uint64_t, numBuckets> buckets{};
+};
+
+std::map<managarm::posix::CntReqType, RequestLatency> requestLatencies;
+
+void recordRequestLatency(managarm::posix::CntReqType type, uint64_t nanos) {
+	auto &latency = requestLatencies[type];
+	latency.count++;
+	latency.totalNanos += nanos;
+	latency.maxNanos = std::max(latency.maxNanos, nanos);
+
+	int bucket = 0;
+	auto micros = nanos / 1000;
+	while(micros && bucket < RequestLatency::numBuckets - 1) {
+		micros >>= 1;
+		bucket++;
+	}
+	latency.buckets[bucket]++;
+}
+
+// --------------------------------------------------------
+// Request ordering.
+// --------------------------------------------------------
+
+// Resources that are not file descriptors. File descriptors are non-negative.
+constexpr int vmResource = -1;
+constexpr int fsContextResource = -2;
+constexpr int signalResource = -3;
+
+// Returns the resources that a request modifies. Requests that only inspect the process
+// (or that may block for a long time) do not need to be ordered against other requests.
+std::vector<int> requestResources(const managarm::posix::CntRequest &req) {
+	std::vector<int> resources;
+	auto addFd = [&] (int fd) {
+		if(fd < 0 || std::find(resources.begin(), resources.end(), fd) != resources.end())
+			return;
+		resources.push_back(fd);
+	};
+
+	switch(req.request_type()) {
+	case managarm::posix::CntReqType::VM_MAP:
+		resources.push_back(vmResource);
+		addFd(req.fd());
+		break;
+	case managarm::posix::CntReqType::VM_REMAP:
+	case managarm::posix::CntReqType::VM_PROTECT:
+	case managarm::posix::CntReqType::VM_UNMAP:
+		resources.push_back(vmResource);
+		break;
+	case managarm::posix::CntReqType::MOUNT:
+	case managarm::posix::CntReqType::CHROOT:
+	case managarm::posix::CntReqType::CHDIR:
+		resources.push_back(fsContextResource);
+		break;
+	case managarm::posix::CntReqType::FCHDIR:
+		resources.push_back(fsContextResource);
+		addFd(req.fd());
+		break;
+	case managarm::posix::CntReqType::SIG_ACTION:
+		resources.push_back(signalResource);
+		break;
+	case managarm::posix::CntReqType::CLOSE:
+	case managarm::posix::CntReqType::DUP:
+	case managarm::posix::CntReqType::TIMERFD_SETTIME:
+	case managarm::posix::CntReqType::INOTIFY_ADD:
+		addFd(req.fd());
+		break;
+	case managarm::posix::CntReqType::DUP2:
+	case managarm::posix::CntReqType::EPOLL_ADD:
+	case managarm::posix::CntReqType::EPOLL_MODIFY:
+	case managarm::posix::CntReqType::EPOLL_DELETE:
+		addFd(req.fd());
+		addFd(req.newfd());
+		break;
+	default:
+		break;
+	}
+	return resources;
+}
+
+// Tracks a request from the time it is received until its response is sent.
+// Requests that modify the same resource are handled in the order in which they arrive.
+struct RequestScope {
+	RequestScope(std::shared_ptr<Generation> generation, const managarm::posix::CntRequest &req)
+	: _generation{std::move(generation)}, _type{req.request_type()} {
+		HEL_CHECK(helGetClock(&_start));
+
+		// Take the tickets before the next request is accepted.
+		for(int resource : requestResources(req)) {
+			auto &queue = _generation->requestQueues[resource];
+			_tickets.push_back({resource, queue.received++});
+		}
+	}
+
+	RequestScope(const RequestScope &) = delete;
+
+	RequestScope &operator= (const RequestScope &) = delete;
+
+	~RequestScope() {
+		for(auto [resource, ticket] : _tickets) {
+			auto it = _generation->requestQueues.find(resource);
+			assert(it != _generation->requestQueues.end());
+			assert(it->second.completed == ticket);
+			if(++it->second.completed == it->second.received)
+				_generation->requestQueues.erase(it);
+		}
+		if(!_tickets.empty())
+			_generation->requestBell.ring();
+
+		uint64_t now;
+		HEL_CHECK(helGetClock(&now));
+		recordRequestLatency(_type, now - _start);
+	}
+
+	// Waits until all earlier requests that modify the same resources are completed.
+	async::result<void> waitForTurn() {
+		while(!_isTurn())
+			co_await _generation->requestBell.async_wait();
+	}
+
+private:
+	bool _isTurn() {
+		for(auto [resource, ticket] : _tickets) {
+			if(_generation->requestQueues.at(resource).completed != ticket)
+				return false;
+		}
+		return true;
+	}
+
+	std::shared_ptr<Generation> _generation;
+	managarm::posix::CntReqType _type;
+	uint64_t _start;
+	std::vector<std::pair<int, uint64_t>> _tickets;
+};
+
 async::result<void> serveRequests(std::shared_ptr<Process> self,
 		std::shared_ptr<Generation> generation) {
 	async::cancellation_token cancellation = generation->cancelServe;
 
 	async::cancellation_callback cancel_callback{cancellation, [&] {
+		// Other serveRequests() coroutines of this generation might have done this already.
+		if(generation->posixLaneShutdown)
+			return;
+		generation->posixLaneShutdown = true;
 		HEL_CHECK(helShutdownLane(generation->posixLane.getHandle()));
 	}};
 
 	while(true) {
+		// Each coroutine handles one request at a time. We only need one coroutine
+		// that waits for the next request.
+		if(generation->idleRequestServers)
+			co_return;
+
 		helix::Accept accept;
 		helix::RecvInline recv_req;
 
 		auto &&header = helix::submitAsync(generation->posixLane, helix::Dispatcher::global(),
 				helix::action(&accept));
+		generation->idleRequestServers++;
 		co_await header.async_wait();
+		generation->idleRequestServers--;
 
 		if(accept.error() == kHelErrLaneShutdown)
 			break;
@@ -494,6 +653,12 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 
 		managarm::posix::CntRequest req;
 		req.ParseFromArray(recv_req.data(), recv_req.length());
+
+		// Let another coroutine accept the next request while this one is handled.
+		RequestScope scope{generation, req};
+		async::detach(serveRequests(self, generation));
+		co_await scope.waitForTurn();
+
 		if(req.request_type() == managarm::posix::CntReqType::GET_PID) {
 			if(logRequests)
 				std::cout << "posix: GET_PID" << std::endl;
@@ -1182,7 +1347,7 @@ async::result<void> serveRequests(std::shared_ptr<Process> self,
 					}
 				}else{
 					assert(directory->superblock());
-					auto node = co_await directory->superblock()->createRegular();
+					auto node = co_await directory->superblock()->createRegular(directory.get());
 					// Due to races, link() can fail here.
 					// TODO: Implement a version of link() that eithers links the new node
 					// or returns the current node without failing.
@@ -2067,6 +2232,95 @@ struct CmdlineNode final : public procfs::RegularNode {
 	}
 };
 
+struct KernelCountersNode final : public procfs::RegularNode {
+	async::result<std::string> show() override {
+		helix::Offer offer;
+		helix::SendBuffer send_req;
+		helix::RecvInline recv_resp;
+		helix::RecvInline recv_list;
+
+		managarm::kerncfg::CntRequest req;
+		req.set_req_type(managarm::kerncfg::CntReqType::GET_COUNTERS);
+
+		// The list grows with the number of CPUs; receive it inline (like the cmdline)
+		// instead of into a fixed-size buffer.
+		auto ser = req.SerializeAsString();
+		auto &&transmit = helix::submitAsync(kerncfgLane, helix::Dispatcher::global(),
+				helix::action(&offer, kHelItemAncillary),
+				helix::action(&send_req, ser.data(), ser.size(), kHelItemChain),
+				helix::action(&recv_resp, kHelItemChain),
+				helix::action(&recv_list));
+		co_await transmit.async_wait();
+		HEL_CHECK(offer.error());
+		HEL_CHECK(send_req.error());
+		HEL_CHECK(recv_resp.error());
+		HEL_CHECK(recv_list.error());
+
+		managarm::kerncfg::SvrResponse resp;
+		resp.ParseFromArray(recv_resp.data(), recv_resp.length());
+		assert(resp.error() == managarm::kerncfg::Error::SUCCESS);
+		assert(recv_list.length() == resp.size());
+
+		managarm::kerncfg::CounterList list;
+		list.ParseFromArray(recv_list.data(), recv_list.length());
+
+		std::stringstream ss;
+		for(const auto &counter : list.counters()) {
+			ss << counter.name();
+			if(counter.cpu() >= 0)
+				ss << ":cpu" << counter.cpu();
+			ss << " " << counter.value() << "\n";
+		}
+		co_return ss.str();
+	}
+
+	async::result<void> store(std::string buffer) override {
+		throw std::runtime_error("Cannot store to /proc/kcounters");
+	}
+};
+
+struct RequestLatencyNode final : public procfs::RegularNode {
+	async::result<std::string> show() override {
+		std::stringstream ss;
+		for(const auto &[type, latency] : requestLatencies) {
+			ss << managarm::posix::CntReqType_Name(type)
+					<< " count " << latency.count
+					<< " mean " << (latency.totalNanos / latency.count / 1000) << "us"
+					<< " max " << (latency.maxNanos / 1000) << "us"
+					<< " buckets";
+			for(int i = 0; i < RequestLatency::numBuckets; i++) {
+				if(!latency.buckets[i])
+					continue;
+				ss << " <" << (uint64_t{1} << i) << "us:" << latency.buckets[i];
+			}
+			ss << "\n";
+		}
+		co_return ss.str();
+	}
+
+	async::result<void> store(std::string buffer) override {
+		throw std::runtime_error("Cannot store to /proc/posix-latency");
+	}
+};
+
+struct DentryCacheNode final : public procfs::RegularNode {
+	async::result<std::string> show() override {
+		auto &stats = DentryCache::stats();
+		std::stringstream ss;
+		ss << "entries " << stats.numEntries << "\n";
+		ss << "hits " << stats.hits << "\n";
+		ss << "negative-hits " << stats.negativeHits << "\n";
+		ss << "misses " << stats.misses << "\n";
+		ss << "evictions " << stats.evictions << "\n";
+		ss << "invalidations " << stats.invalidations << "\n";
+		co_return ss.str();
+	}
+
+	async::result<void> store(std::string buffer) override {
+		throw std::runtime_error("Cannot store to /proc/dentry-cache");
+	}
+};
+
 async::result<void> enumerateKerncfg() {
 	auto root = co_await mbus::Instance::global().getRoot();
 
@@ -2087,6 +2341,9 @@ async::result<void> enumerateKerncfg() {
 
 	auto procfs_root = std::static_pointer_cast<procfs::DirectoryNode>(getProcfs()->getTarget());
 	procfs_root->directMkregular("cmdline", std::make_shared<CmdlineNode>());
+	procfs_root->directMkregular("kcounters", std::make_shared<KernelCountersNode>());
+	procfs_root->directMkregular("posix-latency", std::make_shared<RequestLatencyNode>());
+	procfs_root->directMkregular("dentry-cache", std::make_shared<DentryCacheNode>());
 }
 
 // --------------------------------------------------------
@@ -287,6 +287,25 @@ struct Generation {
 	helix::UniqueLane posixLane;
 	helix::UniqueDescriptor threadDescriptor;
 	async::cancellation_event cancelServe;
+
+	// Set once posixLane is shut down by cancelServe.
+	bool posixLaneShutdown = false;
+
+	// Number of serveRequests() coroutines that wait for the next request on posixLane.
+	int idleRequestServers = 0;
+
+	// Requests on posixLane that modify the same resource (a file descriptor,
+	// the mappings, the fs context or the signal handlers) are handled in order.
+	// For each resource, we count the received and the completed requests.
+	struct RequestQueue {
+		uint64_t received = 0;
+		uint64_t completed = 0;
+	};
+
+	std::unordered_map<int, RequestQueue> requestQueues;
+
+	// Rung whenever a request completes that was tracked in requestQueues.
+	async::doorbell requestBell;
 };
 
 struct ThreadPage {
@@ -1,4 +1,5 @@
 
+#include <dirent.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <set>
@@ -35,6 +36,10 @@ public:
 		co_return stats;
 	}
 
+	int64_t inodeNumber() {
+		return _inodeNumber;
+	}
+
 private:
 	int64_t _inodeNumber;
 };
@@ -144,6 +149,11 @@ public:
 	void handleClose() override;
 
 	FutureMaybe<ReadEntriesResult> readEntries() override;
+	async::result<bool> readEntryBatch(protocols::fs::EntryBatch *batch) override;
+	async::result<Error> sync(protocols::fs::SyncMode) override {
+		// There is no backing storage.
+		co_return Error::success;
+	}
 	helix::BorrowedDescriptor getPassthroughLane() override;
 
 private:
@@ -270,10 +280,21 @@ public:
 
 	async::result<void> writeAll(Process *, const void *buffer, size_t length) override;
 
+	expected<size_t> pread(Process *, int64_t offset, void *buffer,
+			size_t max_length) override;
+
+	async::result<Error> pwrite(Process *, int64_t offset, const void *buffer,
+			size_t length) override;
+
 	FutureMaybe<void> truncate(size_t size) override;
 
 	FutureMaybe<void> allocate(int64_t offset, size_t size) override;
 
+	async::result<Error> sync(protocols::fs::SyncMode) override {
+		// There is no backing storage.
+		co_return Error::success;
+	}
+
 	FutureMaybe<helix::UniqueDescriptor> accessMemory() override;
 
 	helix::BorrowedDescriptor getPassthroughLane() override {
@@ -333,7 +354,7 @@ private:
 };
 
 struct Superblock final : FsSuperblock {
-	FutureMaybe<std::shared_ptr<FsNode>> createRegular() override {
+	FutureMaybe<std::shared_ptr<FsNode>> createRegular(FsNode *) override {
 		auto node = std::make_shared<MemoryNode>(this);
 		co_return std::move(node);
 	}
@@ -423,6 +444,33 @@ MemoryFile::writeAll(Process *, const void *buffer, size_t length) {
 	co_return;
 }
 
+expected<size_t>
+MemoryFile::pread(Process *, int64_t offset, void *buffer, size_t max_length) {
+	auto node = static_cast<MemoryNode *>(associatedLink()->getTarget().get());
+
+	if(offset < 0)
+		co_return Error::illegalArguments;
+	if(static_cast<size_t>(offset) >= node->_fileSize)
+		co_return size_t{0};
+	auto chunk = std::min(node->_fileSize - offset, max_length);
+
+	memcpy(buffer, reinterpret_cast<char *>(node->_mapping.get()) + offset, chunk);
+	co_return chunk;
+}
+
+async::result<Error>
+MemoryFile::pwrite(Process *, int64_t offset, const void *buffer, size_t length) {
+	auto node = static_cast<MemoryNode *>(associatedLink()->getTarget().get());
+
+	if(offset < 0)
+		co_return Error::illegalArguments;
+	if(offset + length > node->_fileSize)
+		node->_resizeFile(offset + length);
+
+	memcpy(reinterpret_cast<char *>(node->_mapping.get()) + offset, buffer, length);
+	co_return Error::success;
+}
+
 async::result<void>
 MemoryFile::truncate(size_t size) {
 	auto node = static_cast<MemoryNode *>(associatedLink()->getTarget().get());
@@ -488,6 +536,38 @@ DirectoryFile::readEntries() {
 	}
 }
 
+async::result<bool>
+DirectoryFile::readEntryBatch(protocols::fs::EntryBatch *batch) {
+	while(_iter != _node->_entries.end()) {
+		auto target = (*_iter)->getTarget();
+
+		uint64_t inode;
+		if(auto node = dynamic_cast<Node *>(target.get()); node) {
+			inode = node->inodeNumber();
+		}else{
+			auto stats = co_await target->getStats();
+			inode = stats.inodeNumber;
+		}
+
+		uint8_t type;
+		switch(target->getType()) {
+		case VfsType::directory: type = DT_DIR; break;
+		case VfsType::regular: type = DT_REG; break;
+		case VfsType::symlink: type = DT_LNK; break;
+		case VfsType::charDevice: type = DT_CHR; break;
+		case VfsType::blockDevice: type = DT_BLK; break;
+		case VfsType::socket: type = DT_SOCK; break;
+		case VfsType::fifo: type = DT_FIFO; break;
+		default: type = DT_UNKNOWN;
+		}
+
+		if(!batch->append(inode, type, (*_iter)->getName()))
+			break;
+		_iter++;
+	}
+	co_return true;
+}
+
 helix::BorrowedDescriptor DirectoryFile::getPassthroughLane() {
 	return _passthrough;
 }
@@ -4,6 +4,8 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
+#include <sys/uio.h>
+#include <optional>
 #include <unordered_map>
 
 #include <async/result.hpp>
@@ -30,6 +32,18 @@ struct File {
 
 	async::result<size_t> readSome(void *data, size_t max_length);
 
+	// Positional I/O; these do not change the file offset.
+	async::result<ReadResult> pread(int64_t offset, void *data, size_t max_length);
+	async::result<Error> pwrite(int64_t offset, const void *data, size_t length);
+
+	// Vectored I/O. Without an offset, these use (and advance) the file offset.
+	// Transfers that exceed maxTransferSize or maxTransferSegments are split
+	// into multiple requests; they are not atomic in that case.
+	async::result<ReadResult> readv(std::optional<int64_t> offset,
+			const iovec *segments, size_t count);
+	async::result<Error> writev(std::optional<int64_t> offset,
+			const iovec *segments, size_t count);
+
 	async::result<PollResult> poll(uint64_t sequence, async::cancellation_token cancellation);
 
 	async::result<helix::UniqueDescriptor> accessMemory();
@@ -1,7 +1,12 @@
 #ifndef LIBFS_COMMON_HPP
 #define LIBFS_COMMON_HPP
 
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 #include <optional>
+#include <string>
 #include <variant>
 #include <vector>
 
@@ -13,13 +18,96 @@ enum class Error {
 	wouldBlock,
 	illegalArguments,
 	seekOnPipe,
-	brokenPipe
+	brokenPipe,
+	noSpaceLeft,
+	fileTooBig
 };
 
 using ReadResult = std::variant<Error, size_t>;
 
+// Upper bounds on the data of a single PT_PREAD, PT_PWRITE, PT_READV or PT_WRITEV request.
+// Servers reject larger requests; the client helpers split transfers accordingly.
+// Servers also clamp the buffer size of PT_READ_ENTRIES_BATCH to maxTransferSize.
+constexpr size_t maxTransferSize = size_t{64} << 20;
+constexpr size_t maxTransferSegments = 1024;
+
+// Determines what PT_FSYNC, PT_FDATASYNC and PT_SYNCFS write back.
+enum class SyncMode {
+	// Data and metadata of the file (fsync()).
+	file,
+	// Data of the file and the metadata that is needed to read it back (fdatasync()).
+	data,
+	// All files of the file system (syncfs()).
+	fileSystem
+};
+
 using ReadEntriesResult = std::optional<std::string>;
 
+// Layout of the entries that PT_READ_ENTRIES_BATCH returns.
+// Entries are 8-byte aligned; recordLength is the offset of the next entry.
+struct PackedEntry {
+	uint64_t inode;
+	uint16_t recordLength;
+	uint8_t type; // DT_* constant from <dirent.h> (DT_UNKNOWN if unknown).
+	uint8_t nameLength;
+	char name[];
+};
+
+// Fills a buffer with PackedEntry structs.
+struct EntryBatch {
+	EntryBatch(void *buffer, size_t size)
+	: _buffer{static_cast<char *>(buffer)}, _size{size} { }
+
+	// Returns false (and leaves the buffer unchanged) if the entry does not fit.
+	// Once this happens, the batch does not accept further entries.
+	bool append(uint64_t inode, uint8_t type, const char *name, size_t name_length) {
+		assert(name_length <= 255);
+		auto record_length = (sizeof(PackedEntry) + name_length + 7) & ~size_t(7);
+		if(_full || _size - _length < record_length) {
+			_full = true;
+			return false;
+		}
+
+		auto entry = reinterpret_cast<PackedEntry *>(_buffer + _length);
+		entry->inode = inode;
+		entry->recordLength = record_length;
+		entry->type = type;
+		entry->nameLength = name_length;
+		memcpy(entry->name, name, name_length);
+		memset(entry->name + name_length, 0,
+				record_length - sizeof(PackedEntry) - name_length);
+		_length += record_length;
+		return true;
+	}
+
+	bool append(uint64_t inode, uint8_t type, const std::string &name) {
+		return append(inode, type, name.data(), name.size());
+	}
+
+	bool empty() {
+		return !_length;
+	}
+
+	// True if an entry was rejected because the buffer is full.
+	bool full() {
+		return _full;
+	}
+
+	void *data() {
+		return _buffer;
+	}
+
+	size_t length() {
+		return _length;
+	}
+
+private:
+	char *_buffer;
+	size_t _size;
+	size_t _length = 0;
+	bool _full = false;
+};
+
 using PollResult = std::tuple<uint64_t, int, int>;
 
 struct RecvData {
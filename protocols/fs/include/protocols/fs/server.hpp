@@ -67,15 +67,30 @@ struct FileOperations {
 		read = f;
 		return *this;
 	}
-	constexpr FileOperations &withWrite(async::result<void> (*f)(void *object,
+	constexpr FileOperations &withWrite(async::result<Error> (*f)(void *object,
 			const char *, const void *buffer, size_t length)) {
 		write = f;
 		return *this;
 	}
+	constexpr FileOperations &withPread(async::result<ReadResult> (*f)(void *object,
+			int64_t offset, const char *, void *buffer, size_t length)) {
+		pread = f;
+		return *this;
+	}
+	constexpr FileOperations &withPwrite(async::result<Error> (*f)(void *object,
+			int64_t offset, const char *, const void *buffer, size_t length)) {
+		pwrite = f;
+		return *this;
+	}
 	constexpr FileOperations &withReadEntries(async::result<ReadEntriesResult> (*f)(void *object)) {
 		readEntries = f;
 		return *this;
 	}
+	constexpr FileOperations &withReadEntryBatch(async::result<bool> (*f)(void *object,
+			EntryBatch *batch)) {
+		readEntryBatch = f;
+		return *this;
+	}
 	constexpr FileOperations &withAccessMemory(async::result<helix::BorrowedDescriptor>(*f)(void *object)) {
 		accessMemory = f;
 		return *this;
@@ -90,6 +105,11 @@ struct FileOperations {
 		fallocate = f;
 		return *this;
 	}
+	constexpr FileOperations &withSync(async::result<Error> (*f)(void *object,
+			SyncMode mode)) {
+		sync = f;
+		return *this;
+	}
 	constexpr FileOperations &withIoctl(async::result<void> (*f)(void *object,
 			managarm::fs::CntRequest req, helix::UniqueLane conversation)) {
 		ioctl = f;
@@ -136,12 +156,22 @@ struct FileOperations {
 	async::result<SeekResult> (*seekEof)(void *object, int64_t offset);
 	async::result<ReadResult> (*read)(void *object, const char *credentials,
 			void *buffer, size_t length);
-	async::result<void> (*write)(void *object, const char *credentials,
+	async::result<Error> (*write)(void *object, const char *credentials,
+			const void *buffer, size_t length);
+	// Like read() and write() but these do not use or modify the file offset.
+	async::result<ReadResult> (*pread)(void *object, int64_t offset, const char *credentials,
+			void *buffer, size_t length);
+	async::result<Error> (*pwrite)(void *object, int64_t offset, const char *credentials,
 			const void *buffer, size_t length);
 	async::result<ReadEntriesResult> (*readEntries)(void *object);
+	// Appends as many directory entries as fit into the batch.
+	// Returns false if the file does not support batched enumeration.
+	async::result<bool> (*readEntryBatch)(void *object, EntryBatch *batch);
 	async::result<helix::BorrowedDescriptor>(*accessMemory)(void *object);
 	async::result<void> (*truncate)(void *object, size_t size);
 	async::result<void> (*fallocate)(void *object, int64_t offset, size_t size);
+	// Returns once the data selected by mode is on the disk.
+	async::result<Error> (*sync)(void *object, SyncMode mode);
 	async::result<void> (*ioctl)(void *object, managarm::fs::CntRequest req,
 			helix::UniqueLane conversation);
 	async::result<protocols::fs::Error> (*flock)(void *object, int flags);
@@ -1,4 +1,5 @@
 
+#include <algorithm>
 #include <iostream>
 
 #include "fs.pb.h"
@@ -7,6 +8,155 @@
 namespace protocols {
 namespace fs {
 
+namespace {
+
+Error translateError(managarm::fs::Errors error) {
+	switch(error) {
+	case managarm::fs::Errors::WOULD_BLOCK:
+		return Error::wouldBlock;
+	case managarm::fs::Errors::SEEK_ON_PIPE:
+		return Error::seekOnPipe;
+	case managarm::fs::Errors::BROKEN_PIPE:
+		return Error::brokenPipe;
+	case managarm::fs::Errors::NO_SPACE_LEFT:
+		return Error::noSpaceLeft;
+	case managarm::fs::Errors::FILE_TOO_BIG:
+		return Error::fileTooBig;
+	default:
+		// ILLEGAL_ARGUMENT, or ILLEGAL_REQUEST if the server does not support the request.
+		return Error::illegalArguments;
+	}
+}
+
+size_t transferLength(const std::vector<iovec> &batch) {
+	size_t length = 0;
+	for(auto &segment : batch)
+		length += segment.iov_len;
+	return length;
+}
+
+// Splits the segments into batches that do not exceed the limits of a single request.
+std::vector<std::vector<iovec>> splitTransfer(const iovec *segments, size_t count) {
+	std::vector<std::vector<iovec>> batches;
+	std::vector<iovec> batch;
+	size_t length = 0;
+	for(size_t i = 0; i < count; i++) {
+		auto base = static_cast<char *>(segments[i].iov_base);
+		size_t progress = 0;
+		do {
+			if(batch.size() == maxTransferSegments || length == maxTransferSize) {
+				batches.push_back(std::move(batch));
+				batch.clear();
+				length = 0;
+			}
+			auto chunk = std::min(segments[i].iov_len - progress, maxTransferSize - length);
+			batch.push_back(iovec{base + progress, chunk});
+			length += chunk;
+			progress += chunk;
+		} while(progress < segments[i].iov_len);
+	}
+	if(!batch.empty())
+		batches.push_back(std::move(batch));
+	return batches;
+}
+
+// Issues a single PT_READV request. The server sends one buffer per segment.
+async::result<ReadResult> readBatch(helix::BorrowedDescriptor lane,
+		std::optional<int64_t> offset, const std::vector<iovec> &batch) {
+	helix::Offer offer;
+	helix::SendBuffer send_req;
+	helix::ImbueCredentials imbue_creds;
+	helix::RecvBuffer recv_resp;
+	std::vector<helix::RecvBuffer> recv_data(batch.size());
+
+	managarm::fs::CntRequest req;
+	req.set_req_type(managarm::fs::CntReqType::PT_READV);
+	if(offset)
+		req.set_offset(*offset);
+	for(auto &segment : batch)
+		req.add_segment_sizes(segment.iov_len);
+
+	auto ser = req.SerializeAsString();
+	uint8_t buffer[128];
+	std::vector<helix::AnyItem> items{
+		helix::action(&offer, kHelItemAncillary),
+		helix::action(&send_req, ser.data(), ser.size(), kHelItemChain),
+		helix::action(&imbue_creds, kHelItemChain),
+		helix::action(&recv_resp, buffer, 128, batch.size() ? kHelItemChain : 0)
+	};
+	for(size_t i = 0; i < batch.size(); i++)
+		items.push_back(helix::action(&recv_data[i], batch[i].iov_base, batch[i].iov_len,
+				(i + 1 < batch.size()) ? kHelItemChain : 0));
+	auto &&transmit = helix::submitAsync(lane, helix::Dispatcher::global(), items);
+	co_await transmit.async_wait();
+	HEL_CHECK(offer.error());
+	HEL_CHECK(send_req.error());
+	HEL_CHECK(imbue_creds.error());
+	HEL_CHECK(recv_resp.error());
+
+	managarm::fs::SvrResponse resp;
+	resp.ParseFromArray(buffer, recv_resp.actualLength());
+	if(resp.error() == managarm::fs::Errors::END_OF_FILE)
+		co_return size_t{0};
+	// The server does not send any data if the request fails.
+	if(resp.error() != managarm::fs::Errors::SUCCESS)
+		co_return translateError(resp.error());
+
+	size_t length = 0;
+	for(auto &recv : recv_data) {
+		HEL_CHECK(recv.error());
+		length += recv.actualLength();
+	}
+	assert(length == static_cast<size_t>(resp.size()));
+	co_return length;
+}
+
+// Issues a single PT_WRITEV request.
+async::result<Error> writeBatch(helix::BorrowedDescriptor lane,
+		std::optional<int64_t> offset, const std::vector<iovec> &batch) {
+	helix::Offer offer;
+	helix::SendBuffer send_req;
+	helix::ImbueCredentials imbue_creds;
+	std::vector<helix::SendBuffer> send_data(batch.size());
+	helix::RecvBuffer recv_resp;
+
+	managarm::fs::CntRequest req;
+	req.set_req_type(managarm::fs::CntReqType::PT_WRITEV);
+	if(offset)
+		req.set_offset(*offset);
+	for(auto &segment : batch)
+		req.add_segment_sizes(segment.iov_len);
+
+	auto ser = req.SerializeAsString();
+	uint8_t buffer[128];
+	std::vector<helix::AnyItem> items{
+		helix::action(&offer, kHelItemAncillary),
+		helix::action(&send_req, ser.data(), ser.size(), kHelItemChain),
+		helix::action(&imbue_creds, kHelItemChain)
+	};
+	for(size_t i = 0; i < batch.size(); i++)
+		items.push_back(helix::action(&send_data[i], batch[i].iov_base, batch[i].iov_len,
+				kHelItemChain));
+	items.push_back(helix::action(&recv_resp, buffer, 128));
+	auto &&transmit = helix::submitAsync(lane, helix::Dispatcher::global(), items);
+	co_await transmit.async_wait();
+	HEL_CHECK(offer.error());
+	HEL_CHECK(send_req.error());
+	HEL_CHECK(imbue_creds.error());
+	HEL_CHECK(recv_resp.error());
+
+	managarm::fs::SvrResponse resp;
+	resp.ParseFromArray(buffer, recv_resp.actualLength());
+	if(resp.error() != managarm::fs::Errors::SUCCESS)
+		co_return translateError(resp.error());
+	for(auto &send : send_data)
+		HEL_CHECK(send.error());
+	assert(static_cast<size_t>(resp.size()) == transferLength(batch));
+	co_return Error::none;
+}
+
+} // anonymous namespace
+
 File::File(helix::UniqueDescriptor lane)
 : _lane(std::move(lane)) { }
 
@@ -70,6 +220,49 @@ async::result<size_t> File::readSome(void *data, size_t max_length) {
 	co_return recv_data.actualLength();
 }
 
+async::result<ReadResult> File::pread(int64_t offset, void *data, size_t max_length) {
+	iovec segment{data, max_length};
+	co_return co_await readv(offset, &segment, 1);
+}
+
+async::result<Error> File::pwrite(int64_t offset, const void *data, size_t length) {
+	iovec segment{const_cast<void *>(data), length};
+	co_return co_await writev(offset, &segment, 1);
+}
+
+async::result<ReadResult> File::readv(std::optional<int64_t> offset,
+		const iovec *segments, size_t count) {
+	size_t progress = 0;
+	for(auto &batch : splitTransfer(segments, count)) {
+		auto result = co_await readBatch(_lane, offset, batch);
+		if(auto error = std::get_if<Error>(&result)) {
+			if(progress)
+				break;
+			co_return *error;
+		}
+
+		auto length = std::get<size_t>(result);
+		progress += length;
+		if(offset)
+			*offset += length;
+		if(length < transferLength(batch))
+			break;
+	}
+	co_return progress;
+}
+
+async::result<Error> File::writev(std::optional<int64_t> offset,
+		const iovec *segments, size_t count) {
+	for(auto &batch : splitTransfer(segments, count)) {
+		auto error = co_await writeBatch(_lane, offset, batch);
+		if(error != Error::none)
+			co_return error;
+		if(offset)
+			*offset += transferLength(batch);
+	}
+	co_return Error::none;
+}
+
 async::result<PollResult> File::poll(uint64_t sequence,
 		async::cancellation_token cancellation) {
 	helix::Offer offer;
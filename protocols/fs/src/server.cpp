@@ -2,7 +2,10 @@
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <algorithm>
 #include <iostream>
+#include <memory>
+#include <optional>
 #include <vector>
 
 #include <helix/ipc.hpp>
@@ -15,6 +18,63 @@ namespace fs {
 
 namespace {
 
+async::result<void> sendResponse(helix::UniqueLane &conversation,
+		managarm::fs::SvrResponse &resp) {
+	helix::SendBuffer send_resp;
+
+	auto ser = resp.SerializeAsString();
+	auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
+			helix::action(&send_resp, ser.data(), ser.size()));
+	co_await transmit.async_wait();
+	HEL_CHECK(send_resp.error());
+}
+
+// The sizes are chosen by the client but we allocate a buffer for the whole request.
+// Returns the total size of the segments or std::nullopt if the request is too large.
+std::optional<size_t> transferSize(const std::vector<size_t> &segments) {
+	if(segments.size() > maxTransferSegments)
+		return std::nullopt;
+	size_t total = 0;
+	for(auto segment : segments) {
+		if(segment > maxTransferSize - total)
+			return std::nullopt;
+		total += segment;
+	}
+	return total;
+}
+
+// Translates errors of read() and pread(). Returns false if there was no error.
+bool translateReadError(ReadResult &res, managarm::fs::SvrResponse &resp) {
+	auto error = std::get_if<Error>(&res);
+	if(!error)
+		return false;
+	if(*error == Error::wouldBlock) {
+		resp.set_error(managarm::fs::Errors::WOULD_BLOCK);
+	}else{
+		assert(*error == Error::illegalArguments);
+		resp.set_error(managarm::fs::Errors::ILLEGAL_ARGUMENT);
+	}
+	return true;
+}
+
+// Translates errors of write() and pwrite(). Returns false if there was no error.
+bool translateWriteError(Error error, managarm::fs::SvrResponse &resp) {
+	switch(error) {
+	case Error::none:
+		return false;
+	case Error::noSpaceLeft:
+		resp.set_error(managarm::fs::Errors::NO_SPACE_LEFT);
+		break;
+	case Error::fileTooBig:
+		resp.set_error(managarm::fs::Errors::FILE_TOO_BIG);
+		break;
+	default:
+		assert(error == Error::illegalArguments);
+		resp.set_error(managarm::fs::Errors::ILLEGAL_ARGUMENT);
+	}
+	return true;
+}
+
 async::detached handlePassthrough(smarter::shared_ptr<void> file,
 		const FileOperations *file_ops,
 		managarm::fs::CntRequest req, helix::UniqueLane conversation) {
@@ -79,11 +139,11 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 		co_await buff.async_wait();
 		HEL_CHECK(extract_creds.error());
 
-		std::string data;
-		data.resize(req.size());
+		// Do not zero-fill the buffer; read() overwrites the part that we send.
+		std::unique_ptr<char[]> data{new char[req.size()]};
 		assert(file_ops->read);
 		auto res = co_await file_ops->read(file.get(), extract_creds.credentials(),
-				data.data(), req.size());
+				data.get(), req.size());
 
 		managarm::fs::SvrResponse resp;
 		auto error = std::get_if<Error>(&res);
@@ -110,7 +170,7 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 			auto ser = resp.SerializeAsString();
 			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 					helix::action(&send_resp, ser.data(), ser.size(), kHelItemChain),
-					helix::action(&send_data, data.data(), std::get<size_t>(res)));
+					helix::action(&send_data, data.get(), std::get<size_t>(res)));
 			co_await transmit.async_wait();
 			HEL_CHECK(send_resp.error());
 			HEL_CHECK(send_data.error());
@@ -129,18 +189,152 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 		HEL_CHECK(recv_buffer.error());
 
 		assert(file_ops->write);
-		co_await file_ops->write(file.get(), extract_creds.credentials(),
+		auto error = co_await file_ops->write(file.get(), extract_creds.credentials(),
 				buffer.data(), recv_buffer.actualLength());
 
 		helix::SendBuffer send_resp;
 		managarm::fs::SvrResponse resp;
-		resp.set_error(managarm::fs::Errors::SUCCESS);
+		if(!translateWriteError(error, resp))
+			resp.set_error(managarm::fs::Errors::SUCCESS);
 
 		auto ser = resp.SerializeAsString();
 		auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
 				helix::action(&send_resp, ser.data(), ser.size()));
 		co_await transmit.async_wait();
 		HEL_CHECK(send_resp.error());
+	}else if(req.req_type() == managarm::fs::CntReqType::PT_PREAD
+			|| req.req_type() == managarm::fs::CntReqType::PT_READV) {
+		helix::ExtractCredentials extract_creds;
+		auto &&buff = helix::submitAsync(conversation, helix::Dispatcher::global(),
+				helix::action(&extract_creds));
+		co_await buff.async_wait();
+		HEL_CHECK(extract_creds.error());
+
+		bool positional = req.req_type() == managarm::fs::CntReqType::PT_PREAD
+				|| req.has_offset();
+		std::vector<size_t> segments;
+		if(req.req_type() == managarm::fs::CntReqType::PT_PREAD) {
+			segments.push_back(req.size());
+		}else{
+			segments.assign(req.segment_sizes().begin(), req.segment_sizes().end());
+		}
+
+		managarm::fs::SvrResponse resp;
+		if(positional ? !file_ops->pread : !file_ops->read) {
+			resp.set_error(managarm::fs::Errors::ILLEGAL_REQUEST);
+			co_await sendResponse(conversation, resp);
+			co_return;
+		}
+
+		auto total = transferSize(segments);
+		if(!total) {
+			resp.set_error(managarm::fs::Errors::ILLEGAL_ARGUMENT);
+			co_await sendResponse(conversation, resp);
+			co_return;
+		}
+		auto length = *total;
+
+		// Read all segments at once; the data is sent directly from this buffer.
+		std::unique_ptr<char[]> data{new char[length]};
+		ReadResult res = size_t{0};
+		if(length) {
+			if(positional) {
+				res = co_await file_ops->pread(file.get(), req.offset(),
+						extract_creds.credentials(), data.get(), length);
+			}else{
+				res = co_await file_ops->read(file.get(),
+						extract_creds.credentials(), data.get(), length);
+			}
+		}
+
+		if(translateReadError(res, resp)) {
+			co_await sendResponse(conversation, resp);
+			co_return;
+		}
+		auto size = std::get<size_t>(res);
+		resp.set_error(managarm::fs::Errors::SUCCESS);
+		resp.set_size(size);
+		co_await sendResponse(conversation, resp);
+
+		// Send one buffer per segment, such that the client can receive
+		// each segment directly into its own buffer.
+		size_t progress = 0;
+		for(auto segment : segments) {
+			auto chunk = std::min(segment, size - progress);
+
+			helix::SendBuffer send_data;
+			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
+					helix::action(&send_data, data.get() + progress, chunk));
+			co_await transmit.async_wait();
+			HEL_CHECK(send_data.error());
+			progress += chunk;
+		}
+	}else if(req.req_type() == managarm::fs::CntReqType::PT_PWRITE
+			|| req.req_type() == managarm::fs::CntReqType::PT_WRITEV) {
+		helix::ExtractCredentials extract_creds;
+		auto &&buff = helix::submitAsync(conversation, helix::Dispatcher::global(),
+				helix::action(&extract_creds));
+		co_await buff.async_wait();
+		HEL_CHECK(extract_creds.error());
+
+		bool positional = req.req_type() == managarm::fs::CntReqType::PT_PWRITE
+				|| req.has_offset();
+		std::vector<size_t> segments;
+		if(req.req_type() == managarm::fs::CntReqType::PT_PWRITE) {
+			segments.push_back(req.size());
+		}else{
+			segments.assign(req.segment_sizes().begin(), req.segment_sizes().end());
+		}
+
+		// Reject oversized requests before receiving any data.
+		// The client then fails to send the data as we drop the conversation.
+		auto total = transferSize(segments);
+		if(!total) {
+			managarm::fs::SvrResponse resp;
+			resp.set_error(managarm::fs::Errors::ILLEGAL_ARGUMENT);
+			co_await sendResponse(conversation, resp);
+			co_return;
+		}
+		auto length = *total;
+
+		// Receive all segments into a single buffer.
+		std::unique_ptr<char[]> data{new char[length]};
+		size_t progress = 0;
+		for(auto segment : segments) {
+			helix::RecvBuffer recv_data;
+			auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
+					helix::action(&recv_data, data.get() + progress, segment));
+			co_await transmit.async_wait();
+			HEL_CHECK(recv_data.error());
+			assert(recv_data.actualLength() == segment);
+			progress += segment;
+		}
+
+		managarm::fs::SvrResponse resp;
+		if(positional ? !file_ops->pwrite : !file_ops->write) {
+			resp.set_error(managarm::fs::Errors::ILLEGAL_REQUEST);
+			co_await sendResponse(conversation, resp);
+			co_return;
+		}
+
+		if(length) {
+			Error error;
+			if(positional) {
+				error = co_await file_ops->pwrite(file.get(), req.offset(),
+						extract_creds.credentials(), data.get(), length);
+			}else{
+				error = co_await file_ops->write(file.get(),
+						extract_creds.credentials(), data.get(), length);
+			}
+			if(translateWriteError(error, resp)) {
+				co_await sendResponse(conversation, resp);
+				co_return;
+			}
+		}
+
+		resp.set_error(managarm::fs::Errors::SUCCESS);
+		resp.set_size(length);
+		co_await sendResponse(conversation, resp);
 	}else if(req.req_type() == managarm::fs::CntReqType::FLOCK) {
 		helix::SendBuffer send_resp;
 
@@ -180,6 +374,38 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 				helix::action(&send_resp, ser.data(), ser.size()));
 		co_await transmit.async_wait();
 		HEL_CHECK(send_resp.error());
+	}else if(req.req_type() == managarm::fs::CntReqType::PT_READ_ENTRIES_BATCH) {
+		helix::SendBuffer send_resp;
+		helix::SendBuffer send_data;
+
+		// The client chooses the size; a batch may return fewer entries than fit into it,
+		// so clamp the size like that of other transfers.
+		auto size = std::min(static_cast<size_t>(std::max(req.size(), 0)), maxTransferSize);
+		std::unique_ptr<char[]> data{new char[size]};
+		EntryBatch batch{data.get(), size};
+
+		managarm::fs::SvrResponse resp;
+		if(!file_ops->readEntryBatch || !(co_await file_ops->readEntryBatch(file.get(), &batch))) {
+			// Clients fall back to PT_READ_ENTRIES.
+			resp.set_error(managarm::fs::Errors::ILLEGAL_REQUEST);
+		}else if(!batch.empty()) {
+			resp.set_error(managarm::fs::Errors::SUCCESS);
+			resp.set_size(batch.length());
+		}else if(batch.full()) {
+			// The buffer cannot hold the next entry.
+			resp.set_error(managarm::fs::Errors::ILLEGAL_ARGUMENT);
+		}else{
+			resp.set_error(managarm::fs::Errors::END_OF_FILE);
+		}
+
+		// The data buffer is always sent (but it is empty unless the request succeeded).
+		auto ser = resp.SerializeAsString();
+		auto &&transmit = helix::submitAsync(conversation, helix::Dispatcher::global(),
+				helix::action(&send_resp, ser.data(), ser.size(), kHelItemChain),
+				helix::action(&send_data, data.get(), batch.length()));
+		co_await transmit.async_wait();
+		HEL_CHECK(send_resp.error());
+		HEL_CHECK(send_data.error());
 	}else if(req.req_type() == managarm::fs::CntReqType::MMAP) {
 		helix::SendBuffer send_resp;
 		helix::PushDescriptor push_memory;
@@ -211,6 +437,28 @@ async::detached handlePassthrough(smarter::shared_ptr<void> file,
 				helix::action(&send_resp, ser.data(), ser.size()));
 		co_await transmit.async_wait();
 		HEL_CHECK(send_resp.error());
+	}else if(req.req_type() == managarm::fs::CntReqType::PT_FSYNC
+			|| req.req_type() == managarm::fs::CntReqType::PT_FDATASYNC
+			|| req.req_type() == managarm::fs::CntReqType::PT_SYNCFS) {
+		SyncMode mode = SyncMode::file;
+		if(req.req_type() == managarm::fs::CntReqType::PT_FDATASYNC)
+			mode = SyncMode::data;
+		else if(req.req_type() == managarm::fs::CntReqType::PT_SYNCFS)
+			mode = SyncMode::fileSystem;
+
+		managarm::fs::SvrResponse resp;
+		if(!file_ops->sync) {
+			resp.set_error(managarm::fs::Errors::ILLEGAL_REQUEST);
+		}else{
+			auto error = co_await file_ops->sync(file.get(), mode);
+			if(error == Error::illegalArguments) {
+				resp.set_error(managarm::fs::Errors::ILLEGAL_ARGUMENT);
+			}else{
+				assert(error == Error::none);
+				resp.set_error(managarm::fs::Errors::SUCCESS);
+			}
+		}
+		co_await sendResponse(conversation, resp);
 	}else if(req.req_type() == managarm::fs::CntReqType::PT_FALLOCATE) {
 		helix::SendBuffer send_resp;
 
@@ -46,6 +46,9 @@ struct Device {
 	async::result<PciInfo> getPciInfo();
 	async::result<helix::UniqueDescriptor> accessBar(int index);
 	async::result<helix::UniqueDescriptor> accessIrq();
+	// Returns the IRQ of an MSI-X table entry. Enables MSI-X on first use.
+	// Returns a null descriptor if the device does not support MSI-X or has no such entry.
+	async::result<helix::UniqueDescriptor> accessMsi(unsigned int index);
 
 	async::result<void> claimDevice();
 	async::result<void> enableBusIrq();
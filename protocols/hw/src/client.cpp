@@ -115,6 +115,38 @@ async::result<helix::UniqueDescriptor> Device::accessIrq() {
 	co_return pull_irq.descriptor();
 }
 
+async::result<helix::UniqueDescriptor> Device::accessMsi(unsigned int index) {
+	helix::Offer offer;
+	helix::SendBuffer send_req;
+	helix::RecvInline recv_resp;
+	helix::PullDescriptor pull_irq;
+
+	managarm::hw::CntRequest req;
+	req.set_req_type(managarm::hw::CntReqType::ACCESS_MSI);
+	req.set_index(index);
+
+	auto ser = req.SerializeAsString();
+	auto &&transmit = helix::submitAsync(_lane, helix::Dispatcher::global(),
+			helix::action(&offer, kHelItemAncillary),
+			helix::action(&send_req, ser.data(), ser.size(), kHelItemChain),
+			helix::action(&recv_resp, kHelItemChain),
+			helix::action(&pull_irq));
+	co_await transmit.async_wait();
+	HEL_CHECK(offer.error());
+	HEL_CHECK(send_req.error());
+	HEL_CHECK(recv_resp.error());
+
+	// The server only pushes the IRQ on success; otherwise, pull_irq fails.
+	managarm::hw::SvrResponse resp;
+	resp.ParseFromArray(recv_resp.data(), recv_resp.length());
+	if(resp.error() == managarm::hw::Errors::OUT_OF_BOUNDS)
+		co_return helix::UniqueDescriptor{};
+	assert(resp.error() == managarm::hw::Errors::SUCCESS);
+	HEL_CHECK(pull_irq.error());
+
+	co_return pull_irq.descriptor();
+}
+
 async::result<void> Device::claimDevice() {
 	helix::Offer offer;
 	helix::SendBuffer send_req;